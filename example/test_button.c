@@ -1,4 +1,5 @@
 #include "libnxtusb.h"
+#include "nxt_wait.h"
 #include <stdio.h>
 
 int main(void) {
@@ -17,13 +18,13 @@ int main(void) {
     te = nxt_set_input_mode(handle, NXT_IN_2, NXT_SENSOR_SWITCH, NXT_SENSOR_MODE_BOOLEAN);
     if (te != NXT_STATUS_OK)
       printf("%d %s\n", te, libnxtusb_errstr());
-    libnxtusb_inputstate_t st;
-    while (st.scaled_value!=1) {
-      te = nxt_get_input_values(handle, NXT_IN_2, &st);
-      if (te != NXT_STATUS_OK)
-        printf("%d %s\n", te, libnxtusb_errstr());
-      printf("%u\n", st.scaled_value);
-    }
+    libnxtusb_wait_cond_t pressed = {NXT_WAIT_SCALED, NXT_IN_2, NXT_WAIT_EQUAL, 1};
+    int32_t value;
+    te = nxt_wait_for(handle, &pressed, 0, &value);
+    if (te != 0)
+      printf("%d %s\n", te, libnxtusb_errstr());
+    else
+      printf("%d\n", value);
 
     libnxtusb_closenxt(handle);
   }
@@ -1,4 +1,5 @@
 #include "libnxtusb.h"
+#include "nxt_wait.h"
 #include <stdio.h>
 
 int main(void) {
@@ -15,13 +16,13 @@ int main(void) {
     if (te != NXT_STATUS_OK)
       printf("%d %s\n", te, libnxtusb_errstr());
     nxt_reset_input_scaled_value(handle,NXT_IN_3);
-    libnxtusb_inputstate_t st;
-    while (st.scaled_value < 500) {
-      te = nxt_get_input_values(handle, NXT_IN_3, &st);
-      if (te != NXT_STATUS_OK)
-        printf("%d %s\n", te, libnxtusb_errstr());
-      printf("%u\n", st.scaled_value);
-    }
+    libnxtusb_wait_cond_t bright = {NXT_WAIT_SCALED, NXT_IN_3, NXT_WAIT_ABOVE, 499};
+    int32_t value;
+    te = nxt_wait_for(handle, &bright, 0, &value);
+    if (te != 0)
+      printf("%d %s\n", te, libnxtusb_errstr());
+    else
+      printf("%d\n", value);
    nxt_set_input_mode(handle, NXT_IN_3, NXT_SENSOR_NONE, NXT_SENSOR_MODE_RAW);
     libnxtusb_closenxt(handle);
   }
@@ -1,4 +1,5 @@
 #include "libnxtusb.h"
+#include "nxt_wait.h"
 #include <stdio.h>
 
 int main(void) {
@@ -14,14 +15,14 @@ int main(void) {
     te = nxt_set_input_mode(handle, NXT_IN_4, NXT_SENSOR_SOUND_DBA, NXT_SENSOR_MODE_RAW);
     if (te != NXT_STATUS_OK)
       printf("%d %s\n", te, libnxtusb_errstr());
-    nxt_reset_input_scaled_value(handle,NXT_IN_3);
-    libnxtusb_inputstate_t st;
-    while (st.scaled_value<200) {
-      te = nxt_get_input_values(handle, NXT_IN_4, &st);
-      if (te != NXT_STATUS_OK)
-        printf("%d %s\n", te, libnxtusb_errstr());
-      printf("%u\n", st.scaled_value);
-    }
+    nxt_reset_input_scaled_value(handle,NXT_IN_4);
+    libnxtusb_wait_cond_t loud = {NXT_WAIT_SCALED, NXT_IN_4, NXT_WAIT_ABOVE, 199};
+    int32_t value;
+    te = nxt_wait_for(handle, &loud, 0, &value);
+    if (te != 0)
+      printf("%d %s\n", te, libnxtusb_errstr());
+    else
+      printf("%d\n", value);
 
     libnxtusb_closenxt(handle);
   }
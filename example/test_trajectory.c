@@ -0,0 +1,35 @@
+#include "libnxtusb.h"
+#include "nxt_trajectory.h"
+#include <stdio.h>
+
+int main(void) {
+  libnxtusb_device_handle *handle = NULL;
+  handle = libnxtusb_getnxt();
+  if (handle == NULL) {
+    printf("No NXT devices found\n");
+  } else {
+    printf("Found NXT device\n");
+    // drive base on B and C: ramp up, curve left, straighten, stop
+    libnxtusb_out_t ports[2] = {NXT_OUT_B, NXT_OUT_C};
+    libnxtusb_traj_keyframe_t kf[] = {
+      {0, {0, 0}, 0, {0, 0}},
+      {1000, {75, 75}, 0, {0, 0}},
+      {2000, {75, 75}, -40, {0, 0}},
+      {3000, {75, 75}, 0, {0, 0}},
+      {4000, {0, 0}, 0, {0, 0}}
+    };
+    libnxtusb_trajectory_t *traj = nxt_trajectory_compile(ports, 2, NXT_MOTOR_REGULATION_SYNC, 20, kf, 5);
+    if (traj == NULL) {
+      printf("Bad trajectory\n");
+    } else {
+      libnxtusb_traj_stats_t st;
+      if (nxt_trajectory_run(handle, traj, &st) != 0)
+        printf("Streaming failed\n");
+      printf("ticks %u, sent %u, skipped %u, max late %uus\n", st.ticks, st.sent, st.skipped, st.max_late_us);
+      nxt_trajectory_free(traj);
+    }
+    nxt_set_output_state(handle, NXT_OUT_ALL, 0, NXT_MOTOR_MODE_BRAKE, NXT_MOTOR_REGULATION_IDLE, 0, NXT_MOTOR_RUNSTATE_IDLE, 0);
+    libnxtusb_closenxt(handle);
+  }
+  return 0;
+}
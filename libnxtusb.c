@@ -27,73 +27,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "libnxtusb.h"
+#include "nxt_private.h"
+
+uint8_t libnxtusb_error;
 
 // for libusb
 const int NXT_USB_ID_VENDOR_LEGO = 0x0694;
 const int NXT_USB_ID_PRODUCT_NXT = 0x0002;
 const int NXT_USB_ENDPOINT_OUT = 0x01; //1
 const int NXT_USB_ENDPOINT_IN = 0x82; //130
-const int NXT_USB_TIMEOUT = 1000;
 const int NXT_USB_READSIZE = 64;
 const int NXT_USB_INTERFACE = 0;
 
 
-// packet type
-
-enum {
-  NXT_DIRECT_COMMAND_DOREPLY = 0x00,
-  NXT_SYSTEM_COMMAND_DOREPLY = 0x01,
-  NXT_COMMAND_REPLY = 0x02,
-  NXT_DIRECT_COMMAND_NOREPLY = 0x80,
-  NXT_SYSTEM_COMMAND_NOREPLY = 0x81,
-};
-
-//packet opcodes
-
-enum {
-  NXT_OPCODE_STARTPROGRAM = 0x00,
-  NXT_OPCODE_STOPPROGRAM = 0x01,
-  NXT_OPCODE_PLAYSOUND = 0x02,
-  NXT_OPCODE_PLAYTONE = 0x03,
-  NXT_OPCODE_SET_OUTPUTSTATE = 0x04,
-  NXT_OPCODE_SET_INPUTMODE = 0x05,
-  NXT_OPCODE_GET_OUTPUTSTATE = 0x06,
-  NXT_OPCODE_GET_INPUTVALUES = 0x07,
-  NXT_OPCODE_RESET_INPUT_SCALEDVALUES = 0x08,
-  NXT_OPCODE_MESSAGE_WRITE = 0x09,
-  NXT_OPCODE_MESSAGE_READ = 0x13,
-  NXT_OPCODE_RESET_MOTOR_POSITION = 0x0A,
-  NXT_OPCODE_BATTERYLEVEL = 0x0B,
-  NXT_OPCODE_STOP_SOUND = 0x0C,
-  NXT_OPCODE_KEEPALIVE = 0x0D,
-  NXT_OPCODE_LS_GET_STATUS = 0x0E,
-  NXT_OPCODE_LS_WRITE = 0x0F,
-  NXT_OPCODE_LS_READ = 0x10,
-  NXT_OPCODE_GET_CURRENTPROGRAM_NAME = 0x11,
-  /** \todo system commands */
-  NXT_OPCODE_SYS_OPENREAD = 0x80,
-  NXT_OPCODE_SYS_OPENWRITE = 0x81,
-  NXT_OPCODE_SYS_READ = 0x82,
-  NXT_OPCODE_SYS_WRITE = 0x83,
-  NXT_OPCODE_SYS_CLOSE = 0x84,
-  NXT_OPCODE_SYS_DELETE = 0x85,
-  NXT_OPCODE_SYS_FINDFIRST = 0x86,
-  NXT_OPCODE_SYS_FINDNEXT = 0x87,
-  NXT_OPCODE_SYS_GET_FIRMVAREVERSION = 0x88,
-  NXT_OPCODE_SYS_OPENLINEARWRITE = 0x89,
-  NXT_OPCODE_SYS_OPENLINEARREAD = 0x8A,
-  NXT_OPCODE_SYS_OPENWRITEDATA = 0x8B,
-  NXT_OPCODE_SYS_OPENAPPENDDATA = 0x8C,
-  NXT_OPCODE_SYS_BOOT = 0x97,
-  NXT_OPCODE_SYS_SETBRICKNAME = 0x98,
-  NXT_OPCODE_SYS_GET_DEVICEINFO = 0x9B,
-  NXT_OPCODE_SYS_DELETE_USERFLASH = 0xA0,
-  NXT_OPCODE_SYS_POLLCOMMAND_LENGTH = 0xA1,
-  NXT_OPCODE_SYS_POLLCOMMAND = 0xA2,
-  NXT_OPCODE_SYS_RESET_BLUETOOTH = 0xA4
-};
-
 //error messages
 static const char const *err_str[] = {
   "Pending communication transaction in progress",
@@ -115,149 +61,6 @@ static const char const *err_str[] = {
   "Bad arguments"
 };
 
-
-// packet return types
-#pragma pack(push,1)
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t status;
-} ret_status_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t status;
-  uint16_t mv;
-} ret_battery_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t status;
-  uint32_t msec;
-} ret_keepalive_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t status;
-  char filename[20];
-} ret_currentprogram_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t status;
-  uint8_t bytes_ready;
-} ret_lsstatus_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t status;
-  uint8_t bytes_read;
-  char data[16];
-} ret_lsread_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t status;
-  uint8_t local_inbox;
-  uint8_t msg_size;
-  char data[58];
-} ret_msgread_t;
-
-// command packet types
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-} cmd_simple_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t port;
-} cmd_port_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t port;
-  uint8_t relative;
-} cmd_resetport_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  char filename[20];
-} cmd_startprogram_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t loop;
-  char filename[20];
-} cmd_playsound_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint16_t freq;
-  uint16_t duration;
-} cmd_playtone_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t port;
-  int8_t power;
-  uint8_t mode;
-  uint8_t regulation;
-  int8_t turn_ratio;
-  uint8_t run_state;
-  uint32_t tacho_limit;
-} cmd_setoutput_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t port;
-  uint8_t stype;
-  uint8_t smode;
-} cmd_setinput_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t port;
-  uint8_t tx_size;
-  uint8_t rx_size;
-  char data[20];
-} cmd_lswrite_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t remote_inbox;
-  uint8_t local_inbox;
-  uint8_t remove;
-} cmd_msgread_t;
-
-typedef struct {
-  uint8_t type;
-  uint8_t opcode;
-  uint8_t inbox;
-  uint8_t message_size;
-  char message[59];
-} cmd_msgwrite_t;
-
-
-#pragma pack(pop)
-
 const char *libnxtusb_errstr() {
   switch (libnxtusb_error) {
     case 0x00:
@@ -320,65 +123,420 @@ const char *libnxtusb_errstr() {
   }
 }
 
-libnxtusb_device_handle *libnxtusb_getnxt() {
-  libnxtusb_device_handle *nxtdev = NULL;
+typedef struct nxt_usb_pool nxt_usb_pool_t;
+static nxt_usb_pool_t *nxt_usb_pool_new();
+static void nxt_usb_pool_attach(const libnxtusb_device_handle *handle);
+static void nxt_usb_pool_free(nxt_usb_pool_t *pool);
+
+//internal. find brick with given serial (any if NULL), open it and claim interface.
+//Returns 0 on success, libusb error code on failure
+
+static int nxt_usb_open(libnxtusb_device_handle *nxtdev, const char *serial, const int verbose) {
   ssize_t dev_count;
   int ret;
   struct libusb_device **list;
   struct libusb_device_descriptor desc;
-
-  nxtdev = malloc(sizeof (libnxtusb_device_handle));
-  libusb_init(&nxtdev->ctx);
-  libusb_set_debug(nxtdev->ctx, 3);
+  char dev_serial[NXT_SERIAL_SIZE];
 
   dev_count = libusb_get_device_list(nxtdev->ctx, &list);
   if (dev_count < 0) {
-    printf("Get device list error\n");
-    return NULL;
+    if (verbose) {
+      printf("Get device list error\n");
+    }
+    return dev_count;
+  }
+  if (verbose) {
+    printf("Total usb devices: %ld\n", dev_count);
   }
-  printf("Total usb devices: %ld\n", dev_count);
 
   int i;
   for (i = 0; i < dev_count; i++) {
     ret = libusb_get_device_descriptor(list[i], &desc);
     if (ret < 0) {
-      printf("Failed to get device descriptor\n");
-      free(nxtdev);
-      return NULL;
+      if (verbose) {
+        printf("Failed to get device descriptor\n");
+      }
+      libusb_free_device_list(list, 1);
+      return ret;
     }
     if (desc.idVendor == NXT_USB_ID_VENDOR_LEGO && desc.idProduct == NXT_USB_ID_PRODUCT_NXT) {
-      struct libusb_device_handle *handle;
       ret = libusb_open(list[i], &nxtdev->handle);
       if (ret < 0) {
-        printf("Failed to open device\n");
-        free(nxtdev);
-        return NULL;
+        if (verbose) {
+          printf("Failed to open device\n");
+        }
+        libusb_free_device_list(list, 1);
+        return ret;
+      }
+      dev_serial[0] = '\0';
+      if (desc.iSerialNumber != 0 &&
+          libusb_get_string_descriptor_ascii(nxtdev->handle, desc.iSerialNumber,
+                                             (unsigned char*) dev_serial, sizeof (dev_serial)) < 0) {
+        dev_serial[0] = '\0';
+      }
+      if (serial != NULL && strcmp(serial, dev_serial) != 0) {
+        libusb_close(nxtdev->handle);
+        nxtdev->handle = NULL;
+        continue;
       }
       ret = libusb_claim_interface(nxtdev->handle, NXT_USB_INTERFACE);
       if (ret < 0) {
-        printf("Cannot claim interface\n");
+        if (verbose) {
+          printf("Cannot claim interface\n");
+        }
         libusb_close(nxtdev->handle);
+        nxtdev->handle = NULL;
         libusb_free_device_list(list, 1);
-        free(nxtdev);
-        return NULL;
+        return ret;
       }
+      memcpy(nxtdev->priv->serial, dev_serial, NXT_SERIAL_SIZE);
       libusb_free_device_list(list, 1);
-      return nxtdev;
+      return 0;
     }
   }
   libusb_free_device_list(list, 1);
-  free(nxtdev);
-  return NULL;
+  return LIBUSB_ERROR_NO_DEVICE;
+}
+
+libnxtusb_device_handle *libnxtusb_getnxt() {
+  return libnxtusb_getnxt_serial(NULL);
+}
+
+libnxtusb_device_handle *libnxtusb_getnxt_serial(const char *serial) {
+  libnxtusb_device_handle *nxtdev = NULL;
+
+  nxtdev = nxt_handle_new(&nxt_usb_transport, NULL);
+  if (nxtdev == NULL) {
+    return NULL;
+  }
+  libusb_init(&nxtdev->ctx);
+  libusb_set_debug(nxtdev->ctx, 3);
+
+  nxtdev->priv->transport_ctx = nxt_usb_pool_new();
+  if (nxtdev->priv->transport_ctx == NULL || nxt_usb_open(nxtdev, serial, 1) != 0) {
+    nxt_usb_pool_free(nxtdev->priv->transport_ctx);
+    libusb_exit(nxtdev->ctx);
+    nxt_channel_destroy(&nxtdev->priv->channel);
+    free(nxtdev->priv);
+    free(nxtdev);
+    return NULL;
+  }
+  nxt_usb_pool_attach(nxtdev);
+  return nxtdev;
 }
 
 int libnxtusb_closenxt(libnxtusb_device_handle *nxtdev) {
-  libusb_release_interface(nxtdev->handle, NXT_USB_INTERFACE);
-  libusb_close(nxtdev->handle);
-  libusb_exit(nxtdev->ctx);
+  nxt_capture_stop(nxtdev);
+  nxt_telemetry_unpublish(nxtdev);
+  nxt_waits_destroy(&nxtdev->priv->waits);
+  nxtdev->priv->transport->close(nxtdev);
+  nxt_channel_destroy(&nxtdev->priv->channel);
+  free(nxtdev->priv);
   free(nxtdev);
   return 0;
 }
 
+//internal. usb transport. Transfers and packet buffers are allocated once
+//per handle, so commands don't touch the heap. Buffers live in usbfs memory
+//(zero-copy) where libusb and kernel support it
+
+enum {
+  NXT_USB_OUT = 0,
+  NXT_USB_IN = 1
+};
+
+struct nxt_usb_pool {
+  struct libusb_transfer *transfer[2];
+  unsigned char *buf[2];
+  // buf points into memory from libusb_dev_mem_alloc
+  unsigned char *dev_mem;
+  unsigned char fallback[2][NXT_PACKET_SIZE];
+};
+
+static nxt_usb_pool_t *nxt_usb_pool_new() {
+  nxt_usb_pool_t *pool = calloc(1, sizeof (nxt_usb_pool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->transfer[NXT_USB_OUT] = libusb_alloc_transfer(0);
+  pool->transfer[NXT_USB_IN] = libusb_alloc_transfer(0);
+  if (pool->transfer[NXT_USB_OUT] == NULL || pool->transfer[NXT_USB_IN] == NULL) {
+    libusb_free_transfer(pool->transfer[NXT_USB_OUT]);
+    libusb_free_transfer(pool->transfer[NXT_USB_IN]);
+    free(pool);
+    return NULL;
+  }
+  pool->buf[NXT_USB_OUT] = pool->fallback[NXT_USB_OUT];
+  pool->buf[NXT_USB_IN] = pool->fallback[NXT_USB_IN];
+  return pool;
+}
+
+// device memory belongs to opened device, so it follows open/close
+static void nxt_usb_pool_attach(const libnxtusb_device_handle *handle) {
+  nxt_usb_pool_t *pool = handle->priv->transport_ctx;
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+  pool->dev_mem = libusb_dev_mem_alloc(handle->handle, 2 * NXT_PACKET_SIZE);
+  if (pool->dev_mem != NULL) {
+    pool->buf[NXT_USB_OUT] = pool->dev_mem;
+    pool->buf[NXT_USB_IN] = pool->dev_mem + NXT_PACKET_SIZE;
+  }
+#endif
+}
+
+static void nxt_usb_pool_detach(const libnxtusb_device_handle *handle) {
+  nxt_usb_pool_t *pool = handle->priv->transport_ctx;
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+  if (pool->dev_mem != NULL) {
+    libusb_dev_mem_free(handle->handle, pool->dev_mem, 2 * NXT_PACKET_SIZE);
+  }
+#endif
+  pool->dev_mem = NULL;
+  pool->buf[NXT_USB_OUT] = pool->fallback[NXT_USB_OUT];
+  pool->buf[NXT_USB_IN] = pool->fallback[NXT_USB_IN];
+}
+
+static void nxt_usb_pool_free(nxt_usb_pool_t *pool) {
+  if (pool == NULL) {
+    return;
+  }
+  libusb_free_transfer(pool->transfer[NXT_USB_OUT]);
+  libusb_free_transfer(pool->transfer[NXT_USB_IN]);
+  free(pool);
+}
+
+static void LIBUSB_CALL nxt_usb_transfer_done(struct libusb_transfer *transfer) {
+  *(int*) transfer->user_data = 1;
+}
+
+// fill and submit pooled transfer, done is set on completion
+static int nxt_usb_submit(
+                          const libnxtusb_device_handle *handle, const int dir,
+                          const unsigned int length, const unsigned int timeout, int *done
+                          ) {
+  nxt_usb_pool_t *pool = handle->priv->transport_ctx;
+  unsigned char endpoint = (dir == NXT_USB_OUT) ?
+    (NXT_USB_ENDPOINT_OUT | LIBUSB_ENDPOINT_OUT) : (NXT_USB_ENDPOINT_IN | LIBUSB_ENDPOINT_IN);
+
+  if (handle->handle == NULL) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  *done = 0;
+  libusb_fill_bulk_transfer(pool->transfer[dir], handle->handle, endpoint, pool->buf[dir], length,
+                            nxt_usb_transfer_done, done, timeout);
+  return libusb_submit_transfer(pool->transfer[dir]);
+}
+
+// bytes transferred by completed transfer or libusb error code
+static int nxt_usb_status(const libnxtusb_device_handle *handle, const int dir) {
+  nxt_usb_pool_t *pool = handle->priv->transport_ctx;
+  struct libusb_transfer *t = pool->transfer[dir];
+
+  switch (t->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      return t->actual_length;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:
+      libusb_clear_halt(handle->handle, t->endpoint);
+      return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      return LIBUSB_ERROR_OVERFLOW;
+    default:
+      return LIBUSB_ERROR_IO;
+  }
+}
+
+// wait for submitted transfer. Returns bytes transferred or libusb error code
+static int nxt_usb_wait(const libnxtusb_device_handle *handle, const int dir, int *done) {
+  nxt_usb_pool_t *pool = handle->priv->transport_ctx;
+  int res;
+
+  while (!*done) {
+    res = libusb_handle_events_completed(handle->ctx, done);
+    if (res < 0 && res != LIBUSB_ERROR_INTERRUPTED) {
+      libusb_cancel_transfer(pool->transfer[dir]);
+      while (!*done) {
+        if (libusb_handle_events_completed(handle->ctx, done) < 0) {
+          break;
+        }
+      }
+      return res;
+    }
+  }
+  return nxt_usb_status(handle, dir);
+}
+
+// run pooled transfer to completion, like libusb_bulk_transfer does
+static int nxt_usb_run(
+                       const libnxtusb_device_handle *handle, const int dir,
+                       const unsigned int length, const unsigned int timeout
+                       ) {
+  int done;
+  int res = nxt_usb_submit(handle, dir, length, timeout, &done);
+
+  if (res < 0) {
+    return res;
+  }
+  return nxt_usb_wait(handle, dir, &done);
+}
+
+//internal. start send without waiting, for broadcasts. Returns 0 or libusb error code,
+//LIBUSB_ERROR_NOT_SUPPORTED if handle isn't usb
+
+int nxt_usb_send_async(
+                       const libnxtusb_device_handle *handle, const unsigned char *request,
+                       const unsigned int length, const unsigned int timeout, int *done
+                       ) {
+  nxt_usb_pool_t *pool = handle->priv->transport_ctx;
+
+  if (handle->priv->transport != &nxt_usb_transport) {
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+  }
+  if (length > NXT_PACKET_SIZE) {
+    return LIBUSB_ERROR_INVALID_PARAM;
+  }
+  memcpy(pool->buf[NXT_USB_OUT], request, length);
+  return nxt_usb_submit(handle, NXT_USB_OUT, length, timeout, done);
+}
+
+//internal. handle pending events, waiting at most wait_us. Returns 0 or libusb error code
+
+int nxt_usb_send_poll(const libnxtusb_device_handle *handle, int *done, const unsigned int wait_us) {
+  struct timeval tv = {0, wait_us};
+
+  if (*done) {
+    return 0;
+  }
+  int res = libusb_handle_events_timeout_completed(handle->ctx, &tv, done);
+  return (res == LIBUSB_ERROR_INTERRUPTED) ? 0 : res;
+}
+
+//internal. finish async send. Returns bytes sent or libusb error code
+
+int nxt_usb_send_finish(const libnxtusb_device_handle *handle, int *done) {
+  return nxt_usb_wait(handle, NXT_USB_OUT, done);
+}
+
+static int nxt_usb_send(
+                        const libnxtusb_device_handle *handle, const unsigned char *request,
+                        const unsigned int length, const unsigned int timeout
+                        ) {
+  nxt_usb_pool_t *pool = handle->priv->transport_ctx;
+
+  if (length > NXT_PACKET_SIZE) {
+    return LIBUSB_ERROR_INVALID_PARAM;
+  }
+  memcpy(pool->buf[NXT_USB_OUT], request, length);
+  return nxt_usb_run(handle, NXT_USB_OUT, length, timeout);
+}
+
+static int nxt_usb_recv(
+                        const libnxtusb_device_handle *handle,
+                        unsigned char *result, const unsigned int timeout
+                        ) {
+  nxt_usb_pool_t *pool = handle->priv->transport_ctx;
+  int res = nxt_usb_run(handle, NXT_USB_IN, NXT_USB_READSIZE, timeout);
+
+  if (res > 0) {
+    memcpy(result, pool->buf[NXT_USB_IN], res);
+  }
+  return res;
+}
+
+static void nxt_usb_close(libnxtusb_device_handle *handle) {
+  if (handle->handle != NULL) {
+    nxt_usb_pool_detach(handle);
+    libusb_release_interface(handle->handle, NXT_USB_INTERFACE);
+    libusb_close(handle->handle);
+  }
+  nxt_usb_pool_free(handle->priv->transport_ctx);
+  libusb_exit(handle->ctx);
+}
+
+// drop dead device and open the same brick again
+static int nxt_usb_reopen(libnxtusb_device_handle *handle) {
+  if (handle->handle != NULL) {
+    nxt_usb_pool_detach(handle);
+    libusb_release_interface(handle->handle, NXT_USB_INTERFACE);
+    libusb_close(handle->handle);
+    handle->handle = NULL;
+  }
+  int ret = nxt_usb_open(handle, handle->priv->serial[0] ? handle->priv->serial : NULL, 0);
+  if (ret == 0) {
+    nxt_usb_pool_attach(handle);
+  }
+  return ret;
+}
+
+int libnxtusb_zero_copy(const libnxtusb_device_handle *handle) {
+  if (handle->priv->transport != &nxt_usb_transport) {
+    return 0;
+  }
+  return ((nxt_usb_pool_t*) handle->priv->transport_ctx)->dev_mem != NULL;
+}
+
+const nxt_transport_t nxt_usb_transport = {
+  nxt_usb_send, nxt_usb_recv, nxt_usb_close, nxt_usb_reopen
+};
+
+//internal. handle for non-usb transport
+
+libnxtusb_device_handle *nxt_handle_new(const nxt_transport_t *transport, void *transport_ctx) {
+  libnxtusb_device_handle *nxtdev = malloc(sizeof (libnxtusb_device_handle));
+  if (nxtdev == NULL) {
+    return NULL;
+  }
+  nxtdev->handle = NULL;
+  nxtdev->ctx = NULL;
+  nxtdev->priv = calloc(1, sizeof (struct libnxtusb_private));
+  if (nxtdev->priv == NULL) {
+    free(nxtdev);
+    return NULL;
+  }
+  nxtdev->priv->transport = transport;
+  nxtdev->priv->transport_ctx = transport_ctx;
+  nxt_timeouts_init(&nxtdev->priv->timeouts);
+  nxt_channel_init(&nxtdev->priv->channel);
+  nxt_waits_init(&nxtdev->priv->waits);
+  return nxtdev;
+}
+
+//internal. account finished send: metrics, capture, timing, shadow state
+
+int nxt_send_done(
+                  const libnxtusb_device_handle *handle, const unsigned char *request,
+                  const int res, const uint64_t start
+                  ) {
+  nxt_timeouts_t *to = &handle->priv->timeouts;
+  to->recv_class = nxt_opcode_class(request[1]);
+  nxt_opcode_metrics_t *m = &handle->priv->metrics.op[request[1]];
+  atomic_fetch_add_explicit(&m->requests, 1, memory_order_relaxed);
+  if (res < 0) {
+    to->last_io_error = res;
+    if (res == LIBUSB_ERROR_TIMEOUT) {
+      atomic_fetch_add_explicit(&m->timeouts, 1, memory_order_relaxed);
+    } else {
+      atomic_fetch_add_explicit(&m->send_errors, 1, memory_order_relaxed);
+    }
+    return res;
+  }
+  uint64_t done = nxt_time_ns();
+  nxt_shadow_update(&handle->priv->shadow, request, res);
+  if (request[0] & 0x80) {
+    // nobody will tell if brick took it
+    nxt_write_done(&handle->priv->writes, request, res, 0);
+  }
+  atomic_fetch_add_explicit(&m->bytes_out, res, memory_order_relaxed);
+  if (handle->priv->capture != NULL) {
+    nxt_capture_record(handle->priv->capture, done, NXT_CAPTURE_OUT, request, res);
+  }
+  if (!(request[0] & 0x80)) {
+    nxt_timing_sent(&handle->priv->timing, start, done);
+  }
+  return res;
+}
 
 //internal. send packet
 
@@ -387,16 +545,41 @@ int nxt_send(
              const unsigned int length
              ) {
   int res;
-  int transferred;
-  res = libusb_bulk_transfer(
-    handle->handle,
-    (NXT_USB_ENDPOINT_OUT | LIBUSB_ENDPOINT_OUT),
-    (unsigned char*) request, length, &transferred, NXT_USB_TIMEOUT
-    );
+  nxt_timeouts_t *to = &handle->priv->timeouts;
+  int timeout = nxt_io_timeout(to, to->policy[nxt_opcode_class(request[1])].send_ms);
+  uint64_t start = nxt_time_ns();
+  if (timeout < 0) {
+    res = LIBUSB_ERROR_TIMEOUT;
+  } else {
+    res = handle->priv->transport->send(handle, request, length, timeout);
+  }
+  return nxt_send_done(handle, request, res, start);
+}
+
+//internal. receive packet with explicit timeout
+
+int nxt_recv_timeout(
+                     const libnxtusb_device_handle *handle,
+                     unsigned char *result, const int timeout
+                     ) {
+  int res;
+  if (timeout < 0) {
+    res = LIBUSB_ERROR_TIMEOUT;
+  } else {
+    res = handle->priv->transport->recv(handle, result, timeout);
+  }
+  if (handle->priv->capture != NULL) {
+    if (res < 0) {
+      unsigned char err = -res;
+      nxt_capture_record(handle->priv->capture, nxt_time_ns(), NXT_CAPTURE_ERROR, &err, 1);
+    } else {
+      nxt_capture_record(handle->priv->capture, nxt_time_ns(), NXT_CAPTURE_IN, result, res);
+    }
+  }
   if (res < 0) {
-    return -1;
+    handle->priv->timeouts.last_io_error = res;
   }
-  return transferred;
+  return res;
 }
 
 //internal. receive packet
@@ -405,94 +588,328 @@ int nxt_recv(
              const libnxtusb_device_handle *handle,
              unsigned char *result
              ) {
-  int res;
-  int transferred;
-  res = libusb_bulk_transfer(
-    handle->handle,
-    (NXT_USB_ENDPOINT_IN | LIBUSB_ENDPOINT_IN),
-    result, NXT_USB_READSIZE, &transferred, NXT_USB_TIMEOUT
-    );
-  if (res < 0) {
-    return -1;
+  nxt_timeouts_t *to = &handle->priv->timeouts;
+  return nxt_recv_timeout(handle, result, nxt_io_timeout(to, to->policy[to->recv_class].recv_ms));
+}
+
+// outcome of one request/reply exchange
+enum {
+  NXT_TX_OK,
+  NXT_TX_FAIL,
+  // timeout or garbled reply, worth another attempt if command is idempotent
+  NXT_TX_RETRY,
+  // device vanished, request never reached brick
+  NXT_TX_LOST
+};
+
+// receive and check reply to request sent at start. With got, reply of any
+// length is copied to NXT_PACKET_SIZE buffer, even if status isn't OK
+static int nxt_transact_reply(
+                              const libnxtusb_device_handle *handle, const uint8_t opcode,
+                              void *reply, const unsigned int reply_len, const uint64_t start,
+                              int *got
+                              ) {
+  nxt_opcode_metrics_t *m = &handle->priv->metrics.op[opcode];
+  unsigned char buf[NXT_PACKET_SIZE];
+  ret_status_t *st = (ret_status_t*) buf;
+  nxt_timeouts_t *to = &handle->priv->timeouts;
+  int ret;
+  // one budget for whole receive phase, late replies eat into it
+  int timeout = nxt_io_timeout(to, to->policy[to->recv_class].recv_ms);
+  uint64_t phase_end = nxt_time_ns() + (uint64_t) (timeout > 0 ? timeout : 0) * 1000000ULL;
+  for (;;) {
+    ret = nxt_recv_timeout(handle, buf, timeout);
+    if (ret < 0) {
+      if (ret == LIBUSB_ERROR_TIMEOUT) {
+        atomic_fetch_add_explicit(&m->timeouts, 1, memory_order_relaxed);
+        nxt_owed_push(&handle->priv->owed, opcode);
+        return NXT_TX_RETRY;
+      }
+      atomic_fetch_add_explicit(&m->recv_errors, 1, memory_order_relaxed);
+      return NXT_TX_FAIL;
+    }
+    // reply to some earlier timed out request, drop it and keep waiting for ours
+    if (ret >= (int) sizeof (ret_status_t) && st->type == NXT_COMMAND_REPLY &&
+        nxt_owed_late(&handle->priv->owed, st->opcode)) {
+      atomic_fetch_add_explicit(&handle->priv->metrics.op[st->opcode].late_replies, 1, memory_order_relaxed);
+      if (timeout > 0) {
+        uint64_t now = nxt_time_ns();
+        timeout = now >= phase_end ? -1 : (int) ((phase_end - now + 999999) / 1000000);
+      }
+      continue;
+    }
+    break;
+  }
+  nxt_timing_received(&handle->priv->timing, nxt_time_ns());
+  atomic_fetch_add_explicit(&m->replies, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&m->bytes_in, ret, memory_order_relaxed);
+  nxt_metrics_latency(m, nxt_time_ns() - start);
+
+  if (ret < (int) sizeof (ret_status_t)) {
+    atomic_fetch_add_explicit(&m->short_reads, 1, memory_order_relaxed);
+    return NXT_TX_RETRY;
+  }
+  if (st->type != NXT_COMMAND_REPLY || st->opcode != opcode) {
+    atomic_fetch_add_explicit(&m->mismatches, 1, memory_order_relaxed);
+    return NXT_TX_RETRY;
+  }
+  if (got != NULL) {
+    memcpy(reply, buf, ret);
+    *got = ret;
+  }
+  atomic_fetch_add_explicit(&handle->priv->metrics.status[st->status], 1, memory_order_relaxed);
+  if (st->status != NXT_STATUS_OK) {
+    atomic_fetch_add_explicit(&m->status_errors, 1, memory_order_relaxed);
+    libnxtusb_error = st->status;
+    return NXT_TX_FAIL;
+  }
+  if (handle->priv->telemetry != NULL) {
+    nxt_telemetry_record(handle->priv->telemetry, nxt_time_ns(), buf, ret);
+  }
+  if (got != NULL) {
+    return NXT_TX_OK;
+  }
+  if (ret != (int) reply_len) {
+    atomic_fetch_add_explicit(&m->short_reads, 1, memory_order_relaxed);
+    return NXT_TX_RETRY;
+  }
+  memcpy(reply, buf, reply_len);
+  return NXT_TX_OK;
+}
+
+static int nxt_transact_once(
+                             const libnxtusb_device_handle *handle, const void *request,
+                             const unsigned int length, void *reply, const unsigned int reply_len
+                             ) {
+  const uint8_t opcode = ((const uint8_t*) request)[1];
+  uint64_t start = nxt_time_ns();
+
+  int sent = nxt_send(handle, (const unsigned char*) request, length);
+  if (sent != (int) length) {
+    if (nxt_device_lost(sent)) {
+      return NXT_TX_LOST;
+    }
+    return sent == LIBUSB_ERROR_TIMEOUT ? NXT_TX_RETRY : NXT_TX_FAIL;
+  }
+  return nxt_transact_reply(handle, opcode, reply, reply_len, start, NULL);
+}
+
+//internal. receive reply of request already sent at start, caller holds channel.
+//Returns 0 on success, -1 on failure
+
+int nxt_reply_locked(
+                     const libnxtusb_device_handle *handle, const uint8_t opcode,
+                     void *reply, const unsigned int reply_len, const uint64_t start
+                     ) {
+  return nxt_transact_reply(handle, opcode, reply, reply_len, start, NULL) == NXT_TX_OK ? 0 : -1;
+}
+
+//internal. one exchange, caller holds channel. Returns 0 on success, -1 on failure
+
+int nxt_transact_locked(
+                        const libnxtusb_device_handle *handle, const void *request,
+                        const unsigned int length, void *reply, const unsigned int reply_len
+                        ) {
+  return nxt_transact_once(handle, request, length, reply, reply_len) == NXT_TX_OK ? 0 : -1;
+}
+
+//internal. send request, receive and check reply of exactly reply_len bytes.
+//Channel is taken per attempt with priority of opcode. Writes brick already
+//has are answered from cache when elision is on. Idempotent reads are retried
+//according to timeout policy, vanished device is reconnected if enabled
+
+int nxt_transact(
+                 const libnxtusb_device_handle *handle, const void *request,
+                 const unsigned int length, void *reply, const unsigned int reply_len
+                 ) {
+  return nxt_transact_ts(handle, request, length, reply, reply_len, NULL);
+}
+
+int nxt_transact_ts(
+                    const libnxtusb_device_handle *handle, const void *request,
+                    const unsigned int length, void *reply, const unsigned int reply_len,
+                    libnxtusb_timestamp_t *ts
+                    ) {
+  const uint8_t opcode = ((const uint8_t*) request)[1];
+  nxt_channel_t *c = &handle->priv->channel;
+  nxt_writes_t *w = &handle->priv->writes;
+  nxt_timeouts_t *to = &handle->priv->timeouts;
+  const libnxtusb_timeout_policy_t *policy = &to->policy[nxt_opcode_class(opcode)];
+  const libnxtusb_priority_t prio = nxt_opcode_priority(opcode);
+  unsigned int attempt = 0;
+  int reconnected = 0;
+
+  for (;;) {
+    nxt_channel_acquire(c, prio);
+    to->last_io_error = 0;
+    if (attempt == 0 && !reconnected) {
+      if (nxt_write_redundant(w, request, length)) {
+        nxt_channel_release(c);
+        ret_status_t ok = {NXT_COMMAND_REPLY, opcode, NXT_STATUS_OK};
+        memcpy(reply, &ok, reply_len < sizeof (ok) ? reply_len : sizeof (ok));
+        return 0;
+      }
+    }
+    uint64_t start = nxt_time_ns();
+    int res = nxt_transact_once(handle, request, length, reply, reply_len);
+    nxt_write_done(w, request, length, res == NXT_TX_OK);
+    if (res == NXT_TX_OK && ts != NULL) {
+      // stamp of this exchange, before another thread replaces it
+      *ts = handle->priv->timing.last;
+    }
+    // other threads overwrite it once channel is released
+    int io_error = to->last_io_error;
+    nxt_channel_release(c);
+    if (res == NXT_TX_OK) {
+      return 0;
+    }
+    if (!reconnected && handle->priv->reconnect.timeout_ms != 0 &&
+        nxt_device_lost(io_error)) {
+      reconnected = 1;
+      if (nxt_reconnect_io(handle, start) != 0) {
+        return -1;
+      }
+      // repeat unless brick might have executed it already
+      if (res == NXT_TX_LOST || nxt_opcode_idempotent(opcode)) {
+        continue;
+      }
+      return -1;
+    }
+    if (res == NXT_TX_LOST) {
+      return -1;
+    }
+    if (res == NXT_TX_FAIL || attempt >= policy->retries || !nxt_opcode_idempotent(opcode)) {
+      return -1;
+    }
+    if (nxt_retry_pause(to, policy) != 0) {
+      return -1;
+    }
+    atomic_fetch_add_explicit(&handle->priv->metrics.op[opcode].retries, 1, memory_order_relaxed);
+    attempt++;
   }
-  return transferred;
 }
 
 /*
  *  PUBLIC COMMANDS
  */
 
-int nxt_start_program(const libnxtusb_device_handle *handle, const char *filename) {
-
-  cmd_startprogram_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_STARTPROGRAM, ""};
-  strncat(cmd.filename, filename, 19);
+//internal. nxt_raw_command without bookkeeping of file changes, for nxt_files.c
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
+int nxt_raw_exchange(
+                     const libnxtusb_device_handle *handle, const uint8_t *request,
+                     const unsigned int length, uint8_t *reply, const unsigned int reply_size
+                     ) {
+  unsigned char buf[NXT_PACKET_SIZE];
+  int got = -1;
 
-  if (sent != sizeof (cmd)) {
+  if (length < 2 || length > NXT_PACKET_SIZE) {
     return -1;
   }
-
-  ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
+  const uint8_t opcode = request[1];
+  nxt_channel_t *c = &handle->priv->channel;
+  nxt_channel_acquire(c, nxt_opcode_priority(opcode));
+  handle->priv->timeouts.last_io_error = 0;
+  uint64_t start = nxt_time_ns();
+  int acked = 0;
+  int sent = nxt_send(handle, request, length);
+  if (sent == (int) length && (request[0] & 0x80)) {
+    got = 0;
+  } else if (sent == (int) length) {
+    acked = nxt_transact_reply(handle, opcode, buf, 0, start, &got) == NXT_TX_OK;
   }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_STARTPROGRAM) {
-    return -1;
+  if (!(request[0] & 0x80)) {
+    nxt_write_done(&handle->priv->writes, request, length, acked);
   }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-    return -1;
+  nxt_channel_release(c);
+  if (got > 0) {
+    memcpy(reply, buf, (unsigned int) got < reply_size ? (unsigned int) got : reply_size);
   }
-  return 0;
+  return got;
 }
 
-int nxt_stop_program(const libnxtusb_device_handle *handle) {
-
-  cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_STOPPROGRAM};
+int nxt_raw_command(
+                    const libnxtusb_device_handle *handle, const uint8_t *request,
+                    const unsigned int length, uint8_t *reply, const unsigned int reply_size
+                    ) {
+  int got = nxt_raw_exchange(handle, request, length, reply, reply_size);
+  if (length >= 2) {
+    nxt_manifest_touched(handle, request[1]);
+  }
+  return got;
+}
 
-  int sent = nxt_send(handle, (unsigned char*) &cmd, sizeof (cmd));
+int nxt_pipeline(const libnxtusb_device_handle *handle, libnxtusb_raw_cmd_t *cmds, const unsigned int n) {
+  libnxtusb_priority_t prio = NXT_PRIO_BULK;
+  nxt_timeouts_t *to = &handle->priv->timeouts;
+  unsigned int sent, i;
+  int ret = 0;
 
-  if (sent != 2) {
-    return -1;
+  for (i = 0; i < n; i++) {
+    if (cmds[i].length < 2 || cmds[i].length > NXT_PACKET_SIZE) {
+      return -1;
+    }
+    cmds[i].reply_length = -1;
+    if (nxt_opcode_priority(cmds[i].request[1]) > prio) {
+      prio = nxt_opcode_priority(cmds[i].request[1]);
+    }
   }
-
-  ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
+  nxt_channel_t *c = &handle->priv->channel;
+  nxt_channel_acquire(c, prio);
+  to->last_io_error = 0;
+  uint64_t start = nxt_time_ns();
+  for (sent = 0; sent < n; sent++) {
+    if (nxt_send(handle, cmds[sent].request, cmds[sent].length) != (int) cmds[sent].length) {
+      break;
+    }
+    if (cmds[sent].request[0] & 0x80) {
+      cmds[sent].reply_length = 0;
+    }
   }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_STOPPROGRAM) {
-    return -1;
+  for (i = 0; i < n; i++) {
+    const uint8_t *req = cmds[i].request;
+    if (req[0] & 0x80) {
+      continue;
+    }
+    int acked = 0;
+    // replies come in order, timed out one may still be followed by the rest
+    if (i < sent && (to->last_io_error == 0 || to->last_io_error == LIBUSB_ERROR_TIMEOUT)) {
+      acked = nxt_transact_reply(handle, req[1], cmds[i].reply, 0, start, &cmds[i].reply_length) == NXT_TX_OK;
+    }
+    nxt_write_done(&handle->priv->writes, req, cmds[i].length, acked);
+    if (cmds[i].reply_length < 0) {
+      ret = -1;
+    }
   }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-    return -1;
+  nxt_channel_release(c);
+  for (i = 0; i < sent; i++) {
+    nxt_manifest_touched(handle, cmds[i].request[1]);
   }
-  return 0;
+  return sent == n ? ret : -1;
 }
 
-int nxt_get_current_program_name(const libnxtusb_device_handle *handle, char* filename) {
+int nxt_start_program(const libnxtusb_device_handle *handle, const char *filename) {
 
-  cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_CURRENTPROGRAM_NAME};
+  cmd_startprogram_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_STARTPROGRAM, ""};
+  strncat(cmd.filename, filename, 19);
 
-  int sent = nxt_send(handle, (unsigned char*) &cmd, sizeof (cmd));
+  ret_status_t st;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
+}
 
-  if (sent != sizeof (cmd)) {
-    return -1;
-  }
+int nxt_stop_program(const libnxtusb_device_handle *handle) {
+
+  cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_STOPPROGRAM};
+
+  ret_status_t st;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
+}
+
+int nxt_get_current_program_name(const libnxtusb_device_handle *handle, char* filename) {
+
+  cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_CURRENTPROGRAM_NAME};
 
   ret_currentprogram_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_currentprogram_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_GET_CURRENTPROGRAM_NAME) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
+  if (nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st)) != 0) {
     return -1;
   }
   strncpy(filename, st.filename, 20);
@@ -507,22 +924,8 @@ int nxt_play_soundfile(
   cmd_playsound_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_PLAYSOUND, loop, ""};
   strncat(cmd.filename, filename, 19);
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
-  if (sent != sizeof (cmd)) {
-    return -1;
-  }
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_PLAYSOUND) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
+  if (nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st)) != 0) {
     return -1;
   }
   return loop;
@@ -535,42 +938,16 @@ int nxt_play_tone(
 
   cmd_playtone_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_PLAYTONE, freq, duration};
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_PLAYTONE) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
 }
 
 int nxt_stop_sound(const libnxtusb_device_handle *handle) {
 
   cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_STOP_SOUND};
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_STOP_SOUND) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
 }
 
 int nxt_set_output_state(
@@ -584,21 +961,8 @@ int nxt_set_output_state(
     mode, regulation, turn_ratio, run_state, tacho_limit
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_SET_OUTPUTSTATE) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
 }
 
 int nxt_set_input_mode(
@@ -610,22 +974,8 @@ int nxt_set_input_mode(
     NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_SET_INPUTMODE, port, stype, smode
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_SET_INPUTMODE) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
 }
 
 int nxt_get_output_state(
@@ -636,20 +986,7 @@ int nxt_get_output_state(
     NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_OUTPUTSTATE, port
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
-  int ret = nxt_recv(handle, (unsigned char*) out);
-  if (ret != sizeof (libnxtusb_outputstate_t)) {
-    return -1;
-  }
-  if (out->type != NXT_COMMAND_REPLY || out->opcode != NXT_OPCODE_GET_OUTPUTSTATE) {
-    return -1;
-  }
-  if (out->status != NXT_STATUS_OK) {
-    libnxtusb_error = out->status;
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), out, sizeof (libnxtusb_outputstate_t));
 }
 
 int nxt_get_input_values(
@@ -660,22 +997,7 @@ int nxt_get_input_values(
     NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_INPUTVALUES, port
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
-  int ret = nxt_recv(handle, (unsigned char*) out);
-
-  if (ret != sizeof (libnxtusb_inputstate_t)) {
-    return -1;
-  }
-  if (out->type != NXT_COMMAND_REPLY || out->opcode != NXT_OPCODE_GET_INPUTVALUES) {
-    return -1;
-  }
-  if (out->status != NXT_STATUS_OK) {
-    libnxtusb_error = out->status;
-
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), out, sizeof (libnxtusb_inputstate_t));
 }
 
 int nxt_reset_input_scaled_value(
@@ -686,22 +1008,8 @@ int nxt_reset_input_scaled_value(
     NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_RESET_INPUT_SCALEDVALUES, port
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_RESET_INPUT_SCALEDVALUES) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
 }
 
 int nxt_reset_motor_position(
@@ -713,22 +1021,8 @@ int nxt_reset_motor_position(
     NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_RESET_MOTOR_POSITION, port, (relative > 0) ? 1 : 0
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_RESET_MOTOR_POSITION) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
 }
 
 int nxt_ls_get_status(
@@ -740,18 +1034,8 @@ int nxt_ls_get_status(
     NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_LS_GET_STATUS, port
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_lsstatus_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_lsstatus_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_LS_GET_STATUS) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
+  if (nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st)) != 0) {
     return -1;
   }
   *bytes_ready = st.bytes_ready;
@@ -769,22 +1053,8 @@ int nxt_ls_write(
   };
   strncat(cmd.data, data, 20);
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_LS_WRITE) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
 }
 
 int nxt_ls_read(
@@ -796,18 +1066,8 @@ int nxt_ls_read(
     NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_LS_READ, port
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_lsread_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_lsread_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_LS_READ) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
+  if (nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st)) != 0) {
     return -1;
   }
   strncpy(data, st.data, 16);
@@ -825,22 +1085,8 @@ int nxt_message_write(
   };
   strncat(cmd.message, message, strlen(message) + 3);
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_status_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_status_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_MESSAGE_WRITE) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
-
-    return -1;
-  }
-  return 0;
+  return nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st));
 }
 
 int nxt_message_read(
@@ -853,18 +1099,8 @@ int nxt_message_read(
     remote_inbox, local_inbox, remove
   };
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-
   ret_msgread_t st;
-  int ret = nxt_recv(handle, (unsigned char*) &st);
-  if (ret != sizeof (ret_msgread_t)) {
-    return -1;
-  }
-  if (st.type != NXT_COMMAND_REPLY || st.opcode != NXT_OPCODE_MESSAGE_READ) {
-    return -1;
-  }
-  if (st.status != NXT_STATUS_OK) {
-    libnxtusb_error = st.status;
+  if (nxt_transact(handle, &cmd, sizeof (cmd), &st, sizeof (st)) != 0) {
     return -1;
   }
   strncpy(message, st.data, st.msg_size);
@@ -876,21 +1112,8 @@ int nxt_get_battery_level_mv(const libnxtusb_device_handle *handle, unsigned int
 
   cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_BATTERYLEVEL};
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-  if (sent != 2) {
-    return -1;
-  }
-
   ret_battery_t bt;
-  int ret = nxt_recv(handle, (unsigned char*) &bt);
-  if (ret != sizeof (ret_battery_t)) {
-    return -1;
-  }
-  if (bt.type != NXT_COMMAND_REPLY || bt.opcode != NXT_OPCODE_BATTERYLEVEL) {
-    return -1;
-  }
-  if (bt.status != NXT_STATUS_OK) {
-    libnxtusb_error = bt.status;
+  if (nxt_transact(handle, &cmd, sizeof (cmd), &bt, sizeof (bt)) != 0) {
     return -1;
   }
   *mv = bt.mv;
@@ -902,21 +1125,8 @@ int nxt_keepalive(const libnxtusb_device_handle *handle, unsigned int* msec) {
 
   cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_KEEPALIVE};
 
-  int sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
-  if (sent != sizeof (cmd_simple_t)) {
-    return -1;
-  }
-
   ret_keepalive_t kt;
-  int ret = nxt_recv(handle, (unsigned char*) &kt);
-  if (ret != sizeof (ret_keepalive_t)) {
-    return -1;
-  }
-  if (kt.type != NXT_COMMAND_REPLY || kt.opcode != NXT_OPCODE_BATTERYLEVEL) {
-    return -1;
-  }
-  if (kt.status != NXT_STATUS_OK) {
-    libnxtusb_error = kt.status;
+  if (nxt_transact(handle, &cmd, sizeof (cmd), &kt, sizeof (kt)) != 0) {
     return -1;
   }
   *msec = kt.msec;
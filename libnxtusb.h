@@ -37,6 +37,78 @@
  *
  * \section serror Error handling
  * Refer to \ref error
+ *
+ * \section straj Trajectory streaming
+ * Refer to \ref traj (nxt_trajectory.h)
+ *
+ * \section stiming Timing and timestamps
+ * Refer to \ref timing (nxt_timing.h)
+ *
+ * \section smetrics Metrics
+ * Refer to \ref metrics (nxt_metrics.h)
+ *
+ * \section scapture Capture and replay
+ * Refer to \ref capture (nxt_capture.h)
+ *
+ * \section srecorder Columnar recording
+ * Refer to \ref recorder (nxt_recorder.h)
+ *
+ * \section stimeout Timeouts and deadlines
+ * Refer to \ref timeout (nxt_timeout.h)
+ *
+ * \section sresync Reply resynchronisation
+ * Refer to \ref resync (nxt_resync.h)
+ *
+ * \section sreconnect Reconnect
+ * Refer to \ref reconnect (nxt_reconnect.h)
+ *
+ * \section swrites Write elision and coalescing
+ * Refer to \ref writes (nxt_writes.h)
+ *
+ * \section spriority Priorities and emergency stop
+ * Refer to \ref priority (nxt_priority.h)
+ *
+ * \section sbroadcast Multi-brick broadcast
+ * Refer to \ref broadcast (nxt_broadcast.h)
+ *
+ * \section sdaemon Multiplexing daemon
+ * Refer to \ref daemon (nxt_daemon.h), nxtd/nxtd.c
+ *
+ * \section stelemetry Shared-memory telemetry
+ * Refer to \ref telemetry (nxt_telemetry.h)
+ *
+ * \section stcp TCP transport
+ * Refer to \ref tcp (nxt_tcp.h), nxtproxy/nxtproxy.c
+ *
+ * \section sbluetooth Bluetooth transport
+ * Refer to \ref bluetooth (nxt_bluetooth.h)
+ *
+ * \section swait Waiting for conditions
+ * Refer to \ref wait (nxt_wait.h)
+ *
+ * \section sfilter Sample filtering
+ * Refer to \ref filter (nxt_filter.h)
+ *
+ * \section sodometry Odometry
+ * Refer to \ref odometry (nxt_odometry.h)
+ *
+ * \section ssim Simulated brick
+ * Refer to \ref sim (nxt_sim.h)
+ *
+ * \section sfiles Filesystem and sync
+ * Refer to \ref files (nxt_files.h)
+ *
+ * \section ssound WAV to RSO conversion
+ * Refer to \ref sound (nxt_sound.h)
+ *
+ * \section smelody Tone sequences and melodies
+ * Refer to \ref melody (nxt_melody.h)
+ *
+ * \section sdatalog Datalog retrieval
+ * Refer to \ref datalog (nxt_datalog.h)
+ *
+ * \section sdeploy Program deployment
+ * Refer to \ref deploy (nxt_deploy.h)
  */
 
 
@@ -45,7 +117,10 @@
 #include <stdint.h>
 #include <libusb-1.0/libusb.h>
 
-static uint8_t libnxtusb_error;
+/** \ingroup error
+ * Status of last failed command, see libnxtusb_errstr
+ */
+extern uint8_t libnxtusb_error;
 
 /** \ingroup dc
  * Output ports
@@ -275,12 +350,28 @@ typedef struct {
 } libnxtusb_inputstate_t;
 #pragma pack(pop)
 
+/**
+ *  Prebuilt command for nxt_pipeline
+ */
+typedef struct {
+  /** Command packet, type byte first */
+  const uint8_t *request;
+  /** Packet length (2 to 64) */
+  unsigned int length;
+  /** Result: reply packet */
+  uint8_t reply[64];
+  /** Result: reply length, 0 for no-reply commands, -1 on failure */
+  int reply_length;
+} libnxtusb_raw_cmd_t;
+
 /**
  * Nxt brick handle
  */
 typedef struct {
   libusb_device_handle *handle;
   libusb_context *ctx;
+  /** Library state, not for direct use */
+  struct libnxtusb_private *priv;
 } libnxtusb_device_handle;
 
 /**
@@ -293,12 +384,27 @@ typedef struct {
  */
 libnxtusb_device_handle *libnxtusb_getnxt();
 
+/** \ingroup device
+ * Find and open nxt device with given usb serial
+ * @param serial usb serial (brick bluetooth address), NULL = any brick
+ * @return libnxtusb_device_handle handle to nxt brick
+ */
+libnxtusb_device_handle *libnxtusb_getnxt_serial(const char *serial);
+
 /** \ingroup device
  * Close nxt device
  * @param nxtdev libnxtusb_device_handle handle to nxt brick
  */
 int libnxtusb_closenxt(libnxtusb_device_handle *nxtdev);
 
+/** \ingroup device
+ * Check if packet buffers are in kernel usb memory (zero-copy I/O).
+ * Needs libusb 1.0.21 and linux usbfs with mmap support.
+ * @param handle nxt brick handle
+ * @return 1 if zero-copy, 0 otherwise
+ */
+int libnxtusb_zero_copy(const libnxtusb_device_handle *handle);
+
 
 /**
  * \defgroup error Error handling.
@@ -329,6 +435,14 @@ int nxt_start_program(const libnxtusb_device_handle *handle, const char *filenam
  */
 int nxt_stop_program(const libnxtusb_device_handle *handle);
 
+/** \ingroup dc
+ *  Get name of currently running program
+ * @param handle nxt brick handle
+ * @param filename file name of program (preallocated, 20 bytes)
+ * @return 0 on success, -1 on failure (also when no program is running)
+ */
+int nxt_get_current_program_name(const libnxtusb_device_handle *handle, char* filename);
+
 /** \ingroup dc
  *  Play sound file stored on NXT brick
  * @param handle nxt brick handle
@@ -421,5 +535,40 @@ int nxt_reset_input_scaled_value(
  */
 int nxt_get_battery_level_mv(const libnxtusb_device_handle *handle, unsigned int* mv);
 
+/** \ingroup dc
+ *  Keep brick alive
+ * @param handle nxt brick handle
+ * @param msec current sleep time limit in ms (this is not a clock)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_keepalive(const libnxtusb_device_handle *handle, unsigned int* msec);
+
+/** \ingroup dc
+ *  Send prebuilt command packet and receive reply as is.
+ *  Reply with error status is returned too (status also goes to libnxtusb_error).
+ *  No retries, no write elision.
+ * @param handle nxt brick handle
+ * @param request command packet, type byte first
+ * @param length packet length (2 to 64)
+ * @param reply reply buffer (64 bytes is always enough)
+ * @param reply_size reply buffer size, longer replies are truncated
+ * @return reply length, 0 for no-reply commands, -1 on failure
+ */
+int nxt_raw_command(
+        const libnxtusb_device_handle *handle, const uint8_t *request,
+        const unsigned int length, uint8_t *reply, const unsigned int reply_size
+        );
+
+/** \ingroup dc
+ *  Send prebuilt command packets back to back, then collect replies in order.
+ *  Transports which batch (see nxt_tcp.h) carry whole pipeline in one round trip.
+ *  Channel is held for the whole pipeline, at priority of most urgent command.
+ * @param handle nxt brick handle
+ * @param cmds libnxtusb_raw_cmd_t* commands, replies are filled in
+ * @param n number of commands
+ * @return 0 if every command got its reply (any status), -1 otherwise
+ */
+int nxt_pipeline(const libnxtusb_device_handle *handle, libnxtusb_raw_cmd_t *cmds, const unsigned int n);
+
 #endif
 
@@ -0,0 +1,140 @@
+/**
+ * @file nxt_bluetooth.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Bluetooth serial transport.
+ */
+
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "nxt_private.h"
+
+typedef struct {
+  nxt_stream_t stream;
+  // NULL for plain fd
+  char *path;
+} fd_t;
+
+static int fd_open_path(fd_t *f) {
+  struct termios tio;
+
+  int fd = open(f->path, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  if (isatty(fd)) {
+    // 8 bit clean, no echo, no line discipline
+    if (tcgetattr(fd, &tio) != 0) {
+      close(fd);
+      return LIBUSB_ERROR_IO;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+      close(fd);
+      return LIBUSB_ERROR_IO;
+    }
+    tcflush(fd, TCIOFLUSH);
+  }
+  nxt_stream_attach(&f->stream, fd);
+  return 0;
+}
+
+static int fd_send(
+                   const libnxtusb_device_handle *handle, const unsigned char *request,
+                   const unsigned int length, const unsigned int timeout
+                   ) {
+  fd_t *f = handle->priv->transport_ctx;
+  return nxt_stream_send(&f->stream, request, length, timeout);
+}
+
+static int fd_recv(
+                   const libnxtusb_device_handle *handle, unsigned char *result,
+                   const unsigned int timeout
+                   ) {
+  fd_t *f = handle->priv->transport_ctx;
+  return nxt_stream_recv(&f->stream, result, timeout);
+}
+
+static void fd_close(libnxtusb_device_handle *handle) {
+  fd_t *f = handle->priv->transport_ctx;
+
+  nxt_stream_close(&f->stream);
+  free(f->path);
+  free(f);
+}
+
+static int fd_reopen(libnxtusb_device_handle *handle) {
+  fd_t *f = handle->priv->transport_ctx;
+
+  nxt_stream_close(&f->stream);
+  return fd_open_path(f);
+}
+
+const nxt_transport_t nxt_fd_transport = {
+  fd_send, fd_recv, fd_close, fd_reopen
+};
+
+// fd given by caller has no path to reopen it by
+const nxt_transport_t nxt_plain_fd_transport = {
+  fd_send, fd_recv, fd_close, NULL
+};
+
+static libnxtusb_device_handle *fd_handle(const nxt_transport_t *transport, fd_t *f) {
+  libnxtusb_device_handle *nxtdev = nxt_handle_new(transport, f);
+  if (nxtdev == NULL) {
+    nxt_stream_close(&f->stream);
+    free(f->path);
+    free(f);
+  }
+  return nxtdev;
+}
+
+libnxtusb_device_handle *libnxtusb_open_bluetooth(const char *path) {
+  fd_t *f = calloc(1, sizeof (fd_t));
+  if (f == NULL) {
+    return NULL;
+  }
+  f->path = strdup(path);
+  if (f->path == NULL || fd_open_path(f) != 0) {
+    free(f->path);
+    free(f);
+    return NULL;
+  }
+  return fd_handle(&nxt_fd_transport, f);
+}
+
+libnxtusb_device_handle *libnxtusb_open_fd(const int fd) {
+  if (fd < 0) {
+    return NULL;
+  }
+  fd_t *f = calloc(1, sizeof (fd_t));
+  if (f == NULL) {
+    return NULL;
+  }
+  nxt_stream_attach(&f->stream, fd);
+  return fd_handle(&nxt_plain_fd_transport, f);
+}
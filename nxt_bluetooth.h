@@ -0,0 +1,58 @@
+/**
+ * @file nxt_bluetooth.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Bluetooth serial transport. Public header
+ *
+ * Brick's Bluetooth serial port carries the same command packets as USB,
+ * each prefixed with 2 bytes of length (little-endian). Transport works
+ * over any stream file descriptor: rfcomm tty, pty, socketpair or socket.
+ * Several replies arriving in one read are split from a buffer. Batching, flushing and statistics of nxt_tcp.h
+ * work on these handles as well.
+ */
+
+#ifndef NXT_BLUETOOTH_H
+#define NXT_BLUETOOTH_H
+#include "libnxtusb.h"
+
+/**
+ * \defgroup bluetooth Bluetooth serial transport.
+ */
+
+/** \ingroup bluetooth
+ *  Open brick on serial device, e.g. /dev/rfcomm0. Tty is put in raw mode.
+ *  Device is reopened by path after it vanished (see nxt_set_reconnect)
+ * @param path device path
+ * @return libnxtusb_device_handle handle, NULL on failure
+ */
+libnxtusb_device_handle *libnxtusb_open_bluetooth(const char *path);
+
+/** \ingroup bluetooth
+ *  Talk to brick over already open stream.
+ *  Handle owns fd and closes it in libnxtusb_closenxt. No reconnect,
+ *  nxt_set_reconnect fails on such handle
+ * @param fd stream file descriptor
+ * @return libnxtusb_device_handle handle, NULL on failure
+ */
+libnxtusb_device_handle *libnxtusb_open_fd(const int fd);
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * @file nxt_broadcast.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Output commands to several bricks at once.
+ */
+
+#include <stdint.h>
+#include "nxt_private.h"
+
+// longest wait for send completion between sweeps, us
+#define NXT_BCAST_POLL_US 100
+
+// channels are always taken in address order, so concurrent broadcasts can't deadlock
+static int bcast_order(const libnxtusb_bcast_cmd_t *cmds, const unsigned int n, unsigned int *order) {
+  unsigned int i, k;
+
+  for (i = 0; i < n; i++) {
+    k = i;
+    while (k > 0 && (uintptr_t) cmds[order[k - 1]].handle > (uintptr_t) cmds[i].handle) {
+      order[k] = order[k - 1];
+      k--;
+    }
+    order[k] = i;
+  }
+  for (i = 1; i < n; i++) {
+    if (cmds[order[i]].handle == cmds[order[i - 1]].handle) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int nxt_broadcast_output_state(libnxtusb_bcast_cmd_t *cmds, const unsigned int n, libnxtusb_bcast_stats_t *stats) {
+  cmd_setoutput_t pkt[NXT_BCAST_MAX_BRICKS];
+  unsigned int order[NXT_BCAST_MAX_BRICKS];
+  int res[NXT_BCAST_MAX_BRICKS];
+  int done[NXT_BCAST_MAX_BRICKS];
+  uint8_t pending[NXT_BCAST_MAX_BRICKS];
+  unsigned int i, remaining = 0;
+  int ret = 0;
+
+  if (n == 0 || n > NXT_BCAST_MAX_BRICKS || bcast_order(cmds, n, order) != 0) {
+    return -1;
+  }
+  uint64_t start = nxt_time_ns();
+  for (i = 0; i < n; i++) {
+    nxt_channel_acquire(&cmds[order[i]].handle->priv->channel, NXT_PRIO_RT);
+  }
+  for (i = 0; i < n; i++) {
+    cmd_setoutput_t cmd = {
+      NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_SET_OUTPUTSTATE, cmds[i].port, cmds[i].power,
+      cmds[i].mode, cmds[i].regulation, cmds[i].turn_ratio, cmds[i].run_state, cmds[i].tacho_limit
+    };
+    pkt[i] = cmd;
+    cmds[i].result = -1;
+    cmds[i].handle->priv->timeouts.last_io_error = 0;
+  }
+  uint64_t prepared = nxt_time_ns();
+
+  // nothing but submissions in this loop
+  for (i = 0; i < n; i++) {
+    const libnxtusb_device_handle *h = cmds[i].handle;
+    nxt_timeouts_t *to = &h->priv->timeouts;
+    int timeout = nxt_io_timeout(to, to->policy[NXT_CLASS_ACTUATOR].send_ms);
+
+    pending[i] = 0;
+    cmds[i].submitted_ns = nxt_time_ns();
+    cmds[i].sent_ns = cmds[i].submitted_ns;
+    if (timeout < 0) {
+      res[i] = LIBUSB_ERROR_TIMEOUT;
+      continue;
+    }
+    res[i] = nxt_usb_send_async(h, (const unsigned char*) &pkt[i], sizeof (cmd_setoutput_t), timeout, &done[i]);
+    if (res[i] == LIBUSB_ERROR_NOT_SUPPORTED) {
+      res[i] = h->priv->transport->send(h, (const unsigned char*) &pkt[i], sizeof (cmd_setoutput_t), timeout);
+      // stream transports hold reply packets until receive, push it out now
+      nxt_stream_t *stream = nxt_stream_of(h);
+      int err;
+      if (stream != NULL && res[i] >= 0 && (err = nxt_stream_flush(stream, timeout)) < 0) {
+        res[i] = err;
+      }
+      cmds[i].sent_ns = nxt_time_ns();
+    } else if (res[i] == 0) {
+      pending[i] = 1;
+      remaining++;
+    }
+  }
+
+  // sweep without blocking; after a sweep that completed nothing, first
+  // pending brick waits briefly in libusb instead of spinning
+  unsigned int wait_us = 0;
+  while (remaining > 0) {
+    unsigned int before = remaining;
+    for (i = 0; i < n; i++) {
+      if (!pending[i]) {
+        continue;
+      }
+      int err = nxt_usb_send_poll(cmds[i].handle, &done[i], wait_us);
+      wait_us = 0;
+      if (done[i] || err < 0) {
+        cmds[i].sent_ns = nxt_time_ns();
+        res[i] = nxt_usb_send_finish(cmds[i].handle, &done[i]);
+        pending[i] = 0;
+        remaining--;
+      }
+    }
+    wait_us = remaining == before ? NXT_BCAST_POLL_US : 0;
+  }
+
+  // every packet is out, replies may take their time now
+  for (i = 0; i < n; i++) {
+    const libnxtusb_device_handle *h = cmds[i].handle;
+    ret_status_t st;
+
+    nxt_send_done(h, (const unsigned char*) &pkt[i], res[i], cmds[i].submitted_ns);
+    if (res[i] == sizeof (cmd_setoutput_t)) {
+      cmds[i].result = nxt_reply_locked(h, NXT_OPCODE_SET_OUTPUTSTATE, &st, sizeof (st), cmds[i].submitted_ns);
+    }
+    nxt_write_done(&h->priv->writes, (const unsigned char*) &pkt[i], sizeof (cmd_setoutput_t), cmds[i].result == 0);
+    if (cmds[i].result != 0) {
+      ret = -1;
+    }
+  }
+  for (i = 0; i < n; i++) {
+    nxt_channel_release(&cmds[order[i]].handle->priv->channel);
+  }
+
+  if (stats != NULL) {
+    uint64_t sub_min = UINT64_MAX, sub_max = 0, sent_min = UINT64_MAX, sent_max = 0;
+    for (i = 0; i < n; i++) {
+      sub_min = cmds[i].submitted_ns < sub_min ? cmds[i].submitted_ns : sub_min;
+      sub_max = cmds[i].submitted_ns > sub_max ? cmds[i].submitted_ns : sub_max;
+      // bricks whose packet never left don't count for send skew
+      if (res[i] != sizeof (cmd_setoutput_t)) {
+        continue;
+      }
+      sent_min = cmds[i].sent_ns < sent_min ? cmds[i].sent_ns : sent_min;
+      sent_max = cmds[i].sent_ns > sent_max ? cmds[i].sent_ns : sent_max;
+    }
+    stats->prepare_ns = prepared - start;
+    stats->submit_skew_ns = sub_max - sub_min;
+    stats->sent_skew_ns = sent_max > sent_min ? sent_max - sent_min : 0;
+    stats->total_ns = nxt_time_ns() - start;
+  }
+  return ret;
+}
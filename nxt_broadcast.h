@@ -0,0 +1,91 @@
+/**
+ * @file nxt_broadcast.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Output commands to several bricks at once. Public header
+ *
+ * Broadcast takes channels of all bricks, copies every packet into its
+ * brick's preallocated transfer and then submits all of them back to back.
+ * Replies are collected after every packet is on the bus, so round trips
+ * don't add to skew. Bricks on other transports are sent synchronously
+ * in the same submission loop.
+ */
+
+#ifndef NXT_BROADCAST_H
+#define NXT_BROADCAST_H
+#include "libnxtusb.h"
+
+/** \ingroup broadcast
+ * Maximum number of bricks in one broadcast
+ */
+#define NXT_BCAST_MAX_BRICKS 16
+
+/** \ingroup broadcast
+ * Output state command for one brick
+ */
+typedef struct {
+  /** Brick, every brick at most once per broadcast */
+  const libnxtusb_device_handle *handle;
+  /** Arguments as in nxt_set_output_state */
+  libnxtusb_out_t port;
+  int8_t power;
+  libnxtusb_motor_mode_t mode;
+  libnxtusb_motor_regulation_t regulation;
+  int8_t turn_ratio;
+  libnxtusb_motor_runstate_t run_state;
+  uint32_t tacho_limit;
+  /** Result: 0 on success, -1 on failure */
+  int result;
+  /** Result: submission time, nxt_time_ns clock */
+  uint64_t submitted_ns;
+  /** Result: time packet was seen leaving host, nxt_time_ns clock (submitted_ns if send failed) */
+  uint64_t sent_ns;
+} libnxtusb_bcast_cmd_t;
+
+/** \ingroup broadcast
+ * Broadcast timing
+ */
+typedef struct {
+  /** Time to take channels and prepare packets, ns */
+  uint64_t prepare_ns;
+  /** First to last submission, ns */
+  uint64_t submit_skew_ns;
+  /** First to last observed send completion, bricks whose send failed left out, ns */
+  uint64_t sent_skew_ns;
+  /** Whole broadcast including replies, ns */
+  uint64_t total_ns;
+} libnxtusb_bcast_stats_t;
+
+/**
+ * \defgroup broadcast Multi-brick broadcast.
+ */
+
+/** \ingroup broadcast
+ *  Send output state commands to several bricks with minimal skew
+ * @param cmds commands, one per brick. Results are filled in
+ * @param n number of commands (1 to NXT_BCAST_MAX_BRICKS)
+ * @param stats libnxtusb_bcast_stats_t* timing (may be NULL)
+ * @return 0 if every brick acknowledged, -1 otherwise
+ */
+int nxt_broadcast_output_state(libnxtusb_bcast_cmd_t *cmds, const unsigned int n, libnxtusb_bcast_stats_t *stats);
+
+#endif
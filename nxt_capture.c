@@ -0,0 +1,315 @@
+/**
+ * @file nxt_capture.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Packet capture and replay.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nxt_private.h"
+
+static const unsigned char capture_magic[8] = {'N', 'X', 'T', 'C', 'A', 'P', 1, 0};
+
+#define CAPTURE_HEADER_SIZE 10
+
+struct nxt_capture {
+  FILE *f;
+  unsigned char *ring;
+  size_t mask;
+  // written by command thread
+  atomic_uint_fast64_t head;
+  // written by flushing thread
+  atomic_uint_fast64_t tail;
+  atomic_uint_fast64_t records;
+  atomic_uint_fast64_t dropped;
+  atomic_uint_fast64_t bytes_written;
+};
+
+//internal. put record into ring. Never blocks or allocates
+
+void nxt_capture_record(
+                        nxt_capture_t *cap, const uint64_t ts_ns, const uint8_t dir,
+                        const unsigned char *data, const unsigned int length
+                        ) {
+  unsigned char hdr[CAPTURE_HEADER_SIZE];
+  uint64_t head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&cap->tail, memory_order_acquire);
+  size_t need = CAPTURE_HEADER_SIZE + length;
+  size_t i;
+
+  if (cap->mask + 1 - (head - tail) < need) {
+    atomic_fetch_add_explicit(&cap->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  for (i = 0; i < 8; i++) {
+    hdr[i] = ts_ns >> (8 * i);
+  }
+  hdr[8] = dir;
+  hdr[9] = length;
+  for (i = 0; i < CAPTURE_HEADER_SIZE; i++) {
+    cap->ring[(head + i) & cap->mask] = hdr[i];
+  }
+  for (i = 0; i < length; i++) {
+    cap->ring[(head + CAPTURE_HEADER_SIZE + i) & cap->mask] = data[i];
+  }
+  atomic_fetch_add_explicit(&cap->records, 1, memory_order_relaxed);
+  atomic_store_explicit(&cap->head, head + need, memory_order_release);
+}
+
+int nxt_capture_start(const libnxtusb_device_handle *handle, const char *path, const size_t ring_size) {
+  size_t size = 256;
+
+  if (handle->priv->capture != NULL) {
+    return -1;
+  }
+  while (size < ring_size) {
+    size <<= 1;
+  }
+  nxt_capture_t *cap = calloc(1, sizeof (nxt_capture_t));
+  if (cap == NULL) {
+    return -1;
+  }
+  cap->ring = malloc(size);
+  cap->mask = size - 1;
+  cap->f = fopen(path, "wb");
+  if (cap->ring == NULL || cap->f == NULL || fwrite(capture_magic, sizeof (capture_magic), 1, cap->f) != 1) {
+    if (cap->f != NULL) {
+      fclose(cap->f);
+    }
+    free(cap->ring);
+    free(cap);
+    return -1;
+  }
+  atomic_store_explicit(&cap->bytes_written, sizeof (capture_magic), memory_order_relaxed);
+  handle->priv->capture = cap;
+  return 0;
+}
+
+int nxt_capture_flush(const libnxtusb_device_handle *handle) {
+  nxt_capture_t *cap = handle->priv->capture;
+
+  if (cap == NULL) {
+    return -1;
+  }
+  uint64_t tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&cap->head, memory_order_acquire);
+  size_t len = head - tail;
+  size_t start = tail & cap->mask;
+  size_t first = (start + len > cap->mask + 1) ? cap->mask + 1 - start : len;
+
+  if (fwrite(cap->ring + start, 1, first, cap->f) != first ||
+      fwrite(cap->ring, 1, len - first, cap->f) != len - first) {
+    return -1;
+  }
+  fflush(cap->f);
+  atomic_store_explicit(&cap->tail, head, memory_order_release);
+  atomic_fetch_add_explicit(&cap->bytes_written, len, memory_order_relaxed);
+  return len;
+}
+
+int nxt_capture_stop(const libnxtusb_device_handle *handle) {
+  nxt_capture_t *cap = handle->priv->capture;
+
+  if (cap == NULL) {
+    return -1;
+  }
+  int ret = nxt_capture_flush(handle);
+  handle->priv->capture = NULL;
+  if (fclose(cap->f) != 0) {
+    ret = -1;
+  }
+  free(cap->ring);
+  free(cap);
+  return ret < 0 ? -1 : 0;
+}
+
+int nxt_capture_stats(const libnxtusb_device_handle *handle, libnxtusb_capture_stats_t *stats) {
+  nxt_capture_t *cap = handle->priv->capture;
+
+  if (cap == NULL) {
+    return -1;
+  }
+  stats->records = atomic_load_explicit(&cap->records, memory_order_relaxed);
+  stats->dropped = atomic_load_explicit(&cap->dropped, memory_order_relaxed);
+  stats->bytes_written = atomic_load_explicit(&cap->bytes_written, memory_order_relaxed);
+  return 0;
+}
+
+/*
+ *  REPLAY TRANSPORT
+ */
+
+typedef struct {
+  uint64_t ts_ns;
+  uint8_t dir;
+  uint8_t length;
+  const unsigned char *data;
+} replay_record_t;
+
+typedef struct {
+  unsigned char *file;
+  replay_record_t *records;
+  size_t count;
+  size_t pos;
+  int realtime;
+  uint64_t host_start_ns;
+  libnxtusb_replay_stats_t stats;
+} replay_t;
+
+static int replay_send(
+                       const libnxtusb_device_handle *handle, const unsigned char *request,
+                       const unsigned int length, const unsigned int timeout
+                       ) {
+  replay_t *r = handle->priv->transport_ctx;
+
+  (void) timeout;
+  while (r->pos < r->count && r->records[r->pos].dir != NXT_CAPTURE_OUT) {
+    r->stats.mismatches++;
+    r->pos++;
+  }
+  if (r->pos == r->count) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  const replay_record_t *rec = &r->records[r->pos++];
+  if (rec->length != length || memcmp(rec->data, request, length) != 0) {
+    r->stats.mismatches++;
+  }
+  r->stats.sent++;
+  return length;
+}
+
+static int replay_recv(
+                       const libnxtusb_device_handle *handle, unsigned char *result,
+                       const unsigned int timeout
+                       ) {
+  replay_t *r = handle->priv->transport_ctx;
+
+  (void) timeout;
+  if (r->pos == r->count) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  const replay_record_t *rec = &r->records[r->pos];
+  if (rec->dir == NXT_CAPTURE_OUT) {
+    return LIBUSB_ERROR_TIMEOUT;
+  }
+  r->pos++;
+  if (r->realtime) {
+    uint64_t due = r->host_start_ns + (rec->ts_ns - r->records[0].ts_ns);
+    struct timespec ts = {due / 1000000000ULL, due % 1000000000ULL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+  }
+  if (rec->dir == NXT_CAPTURE_ERROR) {
+    return rec->length > 0 ? -(int) rec->data[0] : LIBUSB_ERROR_IO;
+  }
+  memcpy(result, rec->data, rec->length);
+  r->stats.received++;
+  return rec->length;
+}
+
+static void replay_close(libnxtusb_device_handle *handle) {
+  replay_t *r = handle->priv->transport_ctx;
+
+  free(r->records);
+  free(r->file);
+  free(r);
+}
+
+static const nxt_transport_t replay_transport = {
+  replay_send, replay_recv, replay_close, NULL
+};
+
+libnxtusb_device_handle *libnxtusb_open_replay(const char *path, const int realtime) {
+  FILE *f = fopen(path, "rb");
+  long size;
+  size_t pos, n;
+
+  if (f == NULL) {
+    return NULL;
+  }
+  replay_t *r = calloc(1, sizeof (replay_t));
+  if (r == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < (long) sizeof (capture_magic)) {
+    goto fail;
+  }
+  rewind(f);
+  r->file = malloc(size);
+  if (r->file == NULL || fread(r->file, 1, size, f) != (size_t) size ||
+      memcmp(r->file, capture_magic, sizeof (capture_magic)) != 0) {
+    goto fail;
+  }
+
+  // two passes: count, then index
+  for (n = 0, pos = sizeof (capture_magic); pos + CAPTURE_HEADER_SIZE <= (size_t) size; n++) {
+    pos += CAPTURE_HEADER_SIZE + r->file[pos + 9];
+  }
+  r->records = malloc(sizeof (replay_record_t) * (n ? n : 1));
+  if (r->records == NULL) {
+    goto fail;
+  }
+  for (r->count = 0, pos = sizeof (capture_magic); pos + CAPTURE_HEADER_SIZE <= (size_t) size; r->count++) {
+    replay_record_t *rec = &r->records[r->count];
+    int i;
+    rec->ts_ns = 0;
+    for (i = 0; i < 8; i++) {
+      rec->ts_ns |= (uint64_t) r->file[pos + i] << (8 * i);
+    }
+    rec->dir = r->file[pos + 8];
+    rec->length = r->file[pos + 9];
+    rec->data = r->file + pos + CAPTURE_HEADER_SIZE;
+    if (pos + CAPTURE_HEADER_SIZE + rec->length > (size_t) size || rec->length > NXT_PACKET_SIZE) {
+      // truncated tail, keep what we have
+      break;
+    }
+    pos += CAPTURE_HEADER_SIZE + rec->length;
+  }
+  fclose(f);
+  r->realtime = realtime;
+  r->host_start_ns = nxt_time_ns();
+
+  libnxtusb_device_handle *nxtdev = nxt_handle_new(&replay_transport, r);
+  if (nxtdev == NULL) {
+    free(r->records);
+    free(r->file);
+    free(r);
+  }
+  return nxtdev;
+
+fail:
+  fclose(f);
+  if (r != NULL) {
+    free(r->file);
+    free(r);
+  }
+  return NULL;
+}
+
+int nxt_replay_stats(const libnxtusb_device_handle *handle, libnxtusb_replay_stats_t *stats) {
+  if (handle->priv->transport != &replay_transport) {
+    return -1;
+  }
+  *stats = ((replay_t*) handle->priv->transport_ctx)->stats;
+  return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file nxt_capture.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Packet capture and replay. Public header
+ *
+ * Capture file is "NXTCAP" followed by two bytes of format version (1, 0),
+ * then records: 8 bytes timestamp (ns, little-endian), 1 byte direction
+ * (0 = to brick, 1 = from brick, 2 = receive error), 1 byte length,
+ * then packet data. Receive error data is negated libusb error code.
+ */
+
+#ifndef NXT_CAPTURE_H
+#define NXT_CAPTURE_H
+#include <stddef.h>
+#include "libnxtusb.h"
+
+/** \ingroup capture
+ * Capture statistics
+ */
+typedef struct {
+  /** Records put into ring */
+  uint64_t records;
+  /** Records dropped because ring was full */
+  uint64_t dropped;
+  /** Bytes written to file */
+  uint64_t bytes_written;
+} libnxtusb_capture_stats_t;
+
+/** \ingroup capture
+ * Replay statistics
+ */
+typedef struct {
+  /** Packets sent by library */
+  uint64_t sent;
+  /** Packets returned to library */
+  uint64_t received;
+  /** Sent packets which differ from recorded ones, or recorded replies never read */
+  uint64_t mismatches;
+} libnxtusb_replay_stats_t;
+
+/**
+ * \defgroup capture Capture and replay.
+ */
+
+/** \ingroup capture
+ *  Start capturing packets. Packets are put into preallocated ring,
+ *  nothing is written until nxt_capture_flush. Records which don't fit
+ *  into ring are dropped.
+ *  Must not be called concurrently with commands on the same handle.
+ * @param handle nxt brick handle
+ * @param path capture file
+ * @param ring_size ring size in bytes (rounded up to power of two)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_capture_start(const libnxtusb_device_handle *handle, const char *path, const size_t ring_size);
+
+/** \ingroup capture
+ *  Write captured records to file. May be called from another thread
+ *  (only one flushing thread at a time).
+ * @param handle nxt brick handle
+ * @return bytes written, -1 on failure
+ */
+int nxt_capture_flush(const libnxtusb_device_handle *handle);
+
+/** \ingroup capture
+ *  Flush and stop capture.
+ *  Must not be called concurrently with commands on the same handle.
+ * @param handle nxt brick handle
+ * @return 0 on success, -1 on failure
+ */
+int nxt_capture_stop(const libnxtusb_device_handle *handle);
+
+/** \ingroup capture
+ *  Get capture statistics
+ * @param handle nxt brick handle
+ * @param stats libnxtusb_capture_stats_t* statistics (preallocated)
+ * @return 0 on success, -1 if not capturing
+ */
+int nxt_capture_stats(const libnxtusb_device_handle *handle, libnxtusb_capture_stats_t *stats);
+
+/** \ingroup capture
+ *  Open captured session as a brick. Each send consumes next recorded
+ *  packet to brick, each receive returns next recorded reply (or error).
+ *  A receive with no recorded reply pending times out.
+ * @param path capture file
+ * @param realtime 1 = deliver replies at recorded timing, 0 = as fast as possible
+ * @return libnxtusb_device_handle handle, NULL on failure
+ */
+libnxtusb_device_handle *libnxtusb_open_replay(const char *path, const int realtime);
+
+/** \ingroup capture
+ *  Get replay statistics
+ * @param handle handle returned by libnxtusb_open_replay
+ * @param stats libnxtusb_replay_stats_t* statistics (preallocated)
+ * @return 0 on success, -1 if handle is not a replay
+ */
+int nxt_replay_stats(const libnxtusb_device_handle *handle, libnxtusb_replay_stats_t *stats);
+
+#endif
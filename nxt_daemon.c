@@ -0,0 +1,162 @@
+/**
+ * @file nxt_daemon.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Client side of nxtd multiplexing daemon.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "nxt_private.h"
+
+typedef struct {
+  int fd;
+  struct sockaddr_un addr;
+} daemon_t;
+
+static int daemon_connect(daemon_t *d) {
+  d->fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (d->fd < 0) {
+    return LIBUSB_ERROR_OTHER;
+  }
+  if (connect(d->fd, (struct sockaddr*) &d->addr, sizeof (d->addr)) != 0) {
+    close(d->fd);
+    d->fd = -1;
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  return 0;
+}
+
+// wait for socket readiness, returns libusb error code on failure
+static int daemon_wait(const daemon_t *d, const short events, const unsigned int timeout) {
+  struct pollfd p = {d->fd, events, 0};
+  int ret;
+
+  if (d->fd < 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  do {
+    ret = poll(&p, 1, timeout);
+  } while (ret < 0 && errno == EINTR);
+  if (ret == 0) {
+    return LIBUSB_ERROR_TIMEOUT;
+  }
+  if (ret < 0 || (p.revents & (POLLERR | POLLNVAL))) {
+    return LIBUSB_ERROR_IO;
+  }
+  if ((p.revents & POLLHUP) && !(p.revents & POLLIN)) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  return 0;
+}
+
+static int daemon_send(
+                       const libnxtusb_device_handle *handle, const unsigned char *request,
+                       const unsigned int length, const unsigned int timeout
+                       ) {
+  daemon_t *d = handle->priv->transport_ctx;
+  int ret = daemon_wait(d, POLLOUT, timeout);
+
+  if (ret < 0) {
+    return ret;
+  }
+  ssize_t n = send(d->fd, request, length, MSG_NOSIGNAL);
+  if (n < 0) {
+    return errno == EPIPE ? LIBUSB_ERROR_NO_DEVICE : LIBUSB_ERROR_IO;
+  }
+  return n;
+}
+
+static int daemon_recv(
+                       const libnxtusb_device_handle *handle, unsigned char *result,
+                       const unsigned int timeout
+                       ) {
+  daemon_t *d = handle->priv->transport_ctx;
+  int ret = daemon_wait(d, POLLIN, timeout);
+
+  if (ret < 0) {
+    return ret;
+  }
+  ssize_t n = recv(d->fd, result, NXT_PACKET_SIZE, 0);
+  if (n == 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  if (n < 0) {
+    return LIBUSB_ERROR_IO;
+  }
+  return n;
+}
+
+static void daemon_close(libnxtusb_device_handle *handle) {
+  daemon_t *d = handle->priv->transport_ctx;
+
+  if (d->fd >= 0) {
+    close(d->fd);
+  }
+  free(d);
+}
+
+// daemon restarted
+static int daemon_reopen(libnxtusb_device_handle *handle) {
+  daemon_t *d = handle->priv->transport_ctx;
+
+  if (d->fd >= 0) {
+    close(d->fd);
+  }
+  return daemon_connect(d);
+}
+
+static const nxt_transport_t daemon_transport = {
+  daemon_send, daemon_recv, daemon_close, daemon_reopen
+};
+
+libnxtusb_device_handle *libnxtusb_open_daemon(const char *path) {
+  if (path == NULL) {
+    path = NXTD_SOCKET;
+  }
+  daemon_t *d = calloc(1, sizeof (daemon_t));
+  if (d == NULL) {
+    return NULL;
+  }
+  d->addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof (d->addr.sun_path)) {
+    free(d);
+    return NULL;
+  }
+  strcpy(d->addr.sun_path, path);
+  if (daemon_connect(d) != 0) {
+    free(d);
+    return NULL;
+  }
+  libnxtusb_device_handle *nxtdev = nxt_handle_new(&daemon_transport, d);
+  if (nxtdev == NULL) {
+    close(d->fd);
+    free(d);
+  }
+  return nxtdev;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file nxt_daemon.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Client side of nxtd multiplexing daemon. Public header
+ *
+ * nxtd owns the brick and serves any number of client processes over a
+ * SOCK_SEQPACKET unix socket, one command packet or reply per message.
+ * Handle opened with libnxtusb_open_daemon works with every command.
+ * Daemon answers identical sensor polls of several clients with a single
+ * brick poll, and gives every output and input port to the first client
+ * that writes it. Writes to a port owned by other client are rejected
+ * with NXT_STATUS_CHANNEL_BUSY.
+ */
+
+#ifndef NXT_DAEMON_H
+#define NXT_DAEMON_H
+#include "libnxtusb.h"
+
+/** \ingroup daemon
+ * Default socket of nxtd
+ */
+#define NXTD_SOCKET "/tmp/nxtd.sock"
+
+/**
+ * \defgroup daemon Multiplexing daemon.
+ */
+
+/** \ingroup daemon
+ *  Connect to nxtd
+ * @param path daemon socket, NULL = NXTD_SOCKET
+ * @return libnxtusb_device_handle handle, NULL on failure
+ */
+libnxtusb_device_handle *libnxtusb_open_daemon(const char *path);
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * @file nxt_datalog.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Datalog retrieval.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nxt_private.h"
+
+#define DATALOG_SEPARATORS " \t,;"
+
+typedef struct {
+  const libnxtusb_datalog_opts_t *opts;
+  libnxtusb_datalog_stats_t stats;
+  uint64_t base_ns;
+  char line[NXT_DATALOG_MAX_LINE + 1];
+  unsigned int len;
+  int overflow;
+  // values per record, set by first one
+  int cols;
+  // callback asked to stop
+  int stopped;
+  // recorder refused row
+  int failed;
+} datalog_parser_t;
+
+// split line into numbers, returns count or -1 if line is text
+static int datalog_fields(char *line, double *values) {
+  char *save, *tok;
+  int n = 0;
+
+  for (tok = strtok_r(line, DATALOG_SEPARATORS, &save); tok != NULL; tok = strtok_r(NULL, DATALOG_SEPARATORS, &save)) {
+    char *end;
+    double v = strtod(tok, &end);
+    if (end == tok || *end != 0) {
+      return -1;
+    }
+    if (n == NXT_DATALOG_MAX_COLS) {
+      return NXT_DATALOG_MAX_COLS + 1;
+    }
+    values[n++] = v;
+  }
+  return n;
+}
+
+static void datalog_line(datalog_parser_t *p) {
+  const libnxtusb_datalog_opts_t *o = p->opts;
+  double values[NXT_DATALOG_MAX_COLS];
+  int64_t row[NXT_DATALOG_MAX_COLS];
+  int i;
+
+  if (p->len > 0 && p->line[p->len - 1] == '\r') {
+    p->len--;
+  }
+  p->line[p->len] = 0;
+  int n = p->overflow ? NXT_DATALOG_MAX_COLS + 1 : datalog_fields(p->line, values);
+  p->len = 0;
+  p->overflow = 0;
+  if (n == 0) {
+    return;
+  }
+  if (n < 0) {
+    p->stats.text_lines++;
+    return;
+  }
+  if (p->cols == 0 && n <= NXT_DATALOG_MAX_COLS) {
+    p->cols = n;
+  }
+  // torn or misformatted record, recorder rows have fixed width
+  if (n > NXT_DATALOG_MAX_COLS || n != p->cols) {
+    p->stats.bad_lines++;
+    return;
+  }
+  unsigned long index = p->stats.rows++;
+  if (o->row != NULL && o->row(o->arg, index, values, n) != 0) {
+    p->stopped = 1;
+    return;
+  }
+  if (o->rec != NULL) {
+    double t = o->time_column >= 0 && o->time_column < n ? values[o->time_column] : (double) index;
+    double unit = o->time_unit_ns > 0 ? o->time_unit_ns : 1e6;
+    double scale = o->scale != 0 ? o->scale : 1;
+    for (i = 0; i < n; i++) {
+      row[i] = llround(values[i] * scale);
+    }
+    uint64_t ts = p->base_ns + (t > 0 ? (uint64_t) llround(t * unit) : 0);
+    if (nxt_recorder_add_row(o->rec, o->brick, o->channel, ts, row, n) != 0) {
+      p->failed = 1;
+    }
+  }
+}
+
+// file sink: lines are parsed as soon as they are complete
+static int datalog_feed(const uint8_t *data, const unsigned int n, void *arg) {
+  datalog_parser_t *p = arg;
+  unsigned int i;
+
+  p->stats.bytes += n;
+  for (i = 0; i < n && !p->stopped && !p->failed; i++) {
+    if (data[i] == '\n') {
+      datalog_line(p);
+    } else if (p->len < NXT_DATALOG_MAX_LINE) {
+      p->line[p->len++] = data[i];
+    } else {
+      p->overflow = 1;
+    }
+  }
+  return p->stopped || p->failed ? -1 : 0;
+}
+
+int nxt_datalog_download(
+                         const libnxtusb_device_handle *handle, const char *name,
+                         const libnxtusb_datalog_opts_t *opts, libnxtusb_datalog_stats_t *stats
+                         ) {
+  datalog_parser_t *p = calloc(1, sizeof (datalog_parser_t));
+  int ret = 0;
+
+  if (p == NULL) {
+    return -1;
+  }
+  uint64_t start = nxt_time_ns();
+  p->opts = opts;
+  p->base_ns = opts->time_base_ns ? opts->time_base_ns : start;
+  if (nxt_file_download(handle, name, datalog_feed, p) != 0 && !p->stopped) {
+    ret = -1;
+  }
+  // last line may lack newline
+  if (ret == 0 && !p->stopped && (p->len > 0 || p->overflow)) {
+    datalog_line(p);
+  }
+  if (p->failed) {
+    ret = -1;
+  }
+  if (ret == 0 && !p->stopped && opts->delete_after && nxt_file_delete(handle, name) != 0) {
+    ret = -1;
+  }
+  p->stats.elapsed_ns = nxt_time_ns() - start;
+  if (stats != NULL) {
+    *stats = p->stats;
+  }
+  free(p);
+  return ret;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file nxt_datalog.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Datalog retrieval. Public header
+ *
+ * Datalog files written by brick programs are text, one record per line,
+ * values separated by tabs, commas, semicolons or spaces. Download keeps
+ * NXT_FILE_PIPELINE read requests in flight and parses records as chunks
+ * arrive. Lines which aren't all numbers (titles, column names) are
+ * counted and skipped. Records go to callback and/or as generic rows to
+ * columnar recorder (see nxt_recorder_add_row), file can be deleted from
+ * brick once it is fully retrieved.
+ */
+
+#ifndef NXT_DATALOG_H
+#define NXT_DATALOG_H
+#include "libnxtusb.h"
+#include "nxt_recorder.h"
+
+/** \ingroup datalog
+ * Most values in record
+ */
+#define NXT_DATALOG_MAX_COLS 16
+
+/** \ingroup datalog
+ * Longest line, longer lines are counted as bad
+ */
+#define NXT_DATALOG_MAX_LINE 255
+
+/** \ingroup datalog
+ * Record callback. Return non-zero to stop download.
+ */
+typedef int (*libnxtusb_datalog_row_cb)(void *arg, const unsigned long row, const double *values, const unsigned int n);
+
+/** \ingroup datalog
+ * Download options, zero fields take defaults
+ */
+typedef struct {
+  /** Record callback (may be NULL) */
+  libnxtusb_datalog_row_cb row;
+  /** Callback argument */
+  void *arg;
+  /** Recorder getting records as rows (may be NULL) */
+  libnxtusb_recorder_t *rec;
+  /** Recorder brick number */
+  unsigned int brick;
+  /** Recorder row channel (0 to 15) */
+  unsigned int channel;
+  /** Values are recorded as round(value * scale) (1) */
+  double scale;
+  /** Column holding record time, -1 = use record number */
+  int time_column;
+  /** Length of time unit of that column, ns (1000000) */
+  double time_unit_ns;
+  /** Recorded time of record at time 0, ns (download start, see nxt_time_ns) */
+  uint64_t time_base_ns;
+  /** Delete file after successful download */
+  int delete_after;
+} libnxtusb_datalog_opts_t;
+
+/** \ingroup datalog
+ * Download result
+ */
+typedef struct {
+  /** File bytes received */
+  uint32_t bytes;
+  /** Records parsed */
+  unsigned long rows;
+  /** Text lines skipped */
+  unsigned long text_lines;
+  /** Lines too long, with too many values or other count than first record */
+  unsigned long bad_lines;
+  /** Download time, ns */
+  uint64_t elapsed_ns;
+} libnxtusb_datalog_stats_t;
+
+/**
+ * \defgroup datalog Datalog retrieval.
+ */
+
+/** \ingroup datalog
+ *  Download and parse datalog file
+ * @param handle nxt brick handle
+ * @param name file name
+ * @param opts libnxtusb_datalog_opts_t* options
+ * @param stats libnxtusb_datalog_stats_t* result (may be NULL)
+ * @return 0 on success (also if callback stopped it, file is not deleted then), -1 on failure
+ */
+int nxt_datalog_download(
+        const libnxtusb_device_handle *handle, const char *name,
+        const libnxtusb_datalog_opts_t *opts, libnxtusb_datalog_stats_t *stats
+        );
+
+#endif
@@ -0,0 +1,289 @@
+/**
+ * @file nxt_deploy.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Program deployment to many bricks.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nxt_private.h"
+
+#define NXT_DEPLOY_CONFIRM_MS 2000
+#define NXT_DEPLOY_POLL_MS 10
+
+typedef struct {
+  const char *name;
+  const void *data;
+  uint32_t size;
+  libnxtusb_deploy_opts_t opts;
+  unsigned int n;
+  unsigned int finished;
+  pthread_mutex_t lock;
+} deploy_t;
+
+typedef struct {
+  deploy_t *d;
+  libnxtusb_deploy_target_t *t;
+  pthread_t thread;
+  int started;
+} deploy_worker_t;
+
+// direct command, returns brick status or -1 if there was no usable reply.
+// Status isn't taken from libnxtusb_error, other workers write it too
+static int deploy_exchange(
+                           const libnxtusb_device_handle *handle, const void *request,
+                           const unsigned int length, void *reply, const unsigned int reply_len
+                           ) {
+  uint8_t buf[NXT_PACKET_SIZE];
+
+  int got = nxt_raw_exchange(handle, request, length, buf, sizeof (buf));
+  if (got < (int) sizeof (ret_status_t)) {
+    return -1;
+  }
+  if (buf[2] == NXT_STATUS_OK && got < (int) reply_len) {
+    return -1;
+  }
+  memcpy(reply, buf, (unsigned int) got < reply_len ? (unsigned int) got : reply_len);
+  return buf[2];
+}
+
+// poll until name is running (NULL: until nothing runs). Returns 0,
+// brick status or -1 on timeout
+static int deploy_poll(const libnxtusb_device_handle *handle, const char *name, const unsigned int ms) {
+  cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_CURRENTPROGRAM_NAME};
+  ret_currentprogram_t ret;
+  uint64_t give_up = nxt_time_ns() + (uint64_t) ms * 1000000ULL;
+
+  for (;;) {
+    int status = deploy_exchange(handle, &cmd, sizeof (cmd), &ret, sizeof (ret));
+    if (name == NULL && status == NXT_STATUS_NO_ACTIVE_PROGRAM) {
+      return 0;
+    }
+    if (name != NULL && status == NXT_STATUS_OK && strncmp(ret.filename, name, sizeof (ret.filename)) == 0) {
+      return 0;
+    }
+    if (status != NXT_STATUS_OK && status != NXT_STATUS_NO_ACTIVE_PROGRAM) {
+      return status;
+    }
+    if (nxt_time_ns() + NXT_DEPLOY_POLL_MS * 1000000ULL >= give_up) {
+      return -1;
+    }
+    struct timespec ts = {0, NXT_DEPLOY_POLL_MS * 1000000L};
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+  }
+}
+
+// run one stage, returns 0, brick status or -1
+static int deploy_stage(deploy_t *d, const libnxtusb_device_handle *handle, const libnxtusb_deploy_stage_t stage) {
+  switch (stage) {
+    case NXT_DEPLOY_STOP:
+    {
+      cmd_simple_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_STOPPROGRAM};
+      ret_status_t ret;
+      int status = deploy_exchange(handle, &cmd, sizeof (cmd), &ret, sizeof (ret));
+      if (status == NXT_STATUS_NO_ACTIVE_PROGRAM) {
+        return 0;
+      }
+      if (status != NXT_STATUS_OK) {
+        return status;
+      }
+      // program ends asynchronously and its file stays busy until then
+      return deploy_poll(handle, NULL, d->opts.confirm_ms);
+    }
+    case NXT_DEPLOY_UPLOAD:
+      return nxt_file_upload_linear(handle, d->name, d->data, d->size);
+    case NXT_DEPLOY_VERIFY:
+    {
+      uint32_t size = 0;
+      int status = nxt_file_find(handle, d->name, &size);
+      if (status == NXT_STATUS_OK && size != d->size) {
+        return -1;
+      }
+      return status;
+    }
+    case NXT_DEPLOY_START:
+    {
+      cmd_startprogram_t cmd = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_STARTPROGRAM, ""};
+      ret_status_t ret;
+      strcpy(cmd.filename, d->name);
+      return deploy_exchange(handle, &cmd, sizeof (cmd), &ret, sizeof (ret));
+    }
+    case NXT_DEPLOY_CONFIRM:
+      return deploy_poll(handle, d->name, d->opts.confirm_ms);
+    default:
+      return -1;
+  }
+}
+
+static void deploy_report(deploy_t *d, const libnxtusb_deploy_target_t *t, const int finished) {
+  pthread_mutex_lock(&d->lock);
+  if (finished) {
+    d->finished++;
+  }
+  if (d->opts.progress != NULL) {
+    d->opts.progress(t, d->finished, d->n, d->opts.arg);
+  }
+  pthread_mutex_unlock(&d->lock);
+}
+
+static void *deploy_worker(void *arg) {
+  deploy_worker_t *w = arg;
+  deploy_t *d = w->d;
+  libnxtusb_deploy_target_t *t = w->t;
+  libnxtusb_deploy_stage_t last = d->opts.no_start ? NXT_DEPLOY_START : NXT_DEPLOY_STAGES;
+  uint64_t start = nxt_time_ns();
+  int status = 0;
+
+  while (t->stage < last) {
+    deploy_report(d, t, 0);
+    uint64_t stage_start = nxt_time_ns();
+    status = deploy_stage(d, t->handle, t->stage);
+    t->stage_ns[t->stage] = nxt_time_ns() - stage_start;
+    if (status != 0) {
+      break;
+    }
+    t->stage++;
+  }
+  t->total_ns = nxt_time_ns() - start;
+  if (status == 0) {
+    t->stage = NXT_DEPLOY_STAGES;
+  } else {
+    t->result = -1;
+    t->status = status > 0 ? status : 0;
+  }
+  deploy_report(d, t, 1);
+  return NULL;
+}
+
+int nxt_deploy(
+               libnxtusb_deploy_target_t *targets, const unsigned int n, const char *name,
+               const void *data, const uint32_t size,
+               const libnxtusb_deploy_opts_t *opts, libnxtusb_deploy_stats_t *stats
+               ) {
+  deploy_worker_t workers[NXT_DEPLOY_MAX_BRICKS];
+  deploy_t d;
+  unsigned int i, k;
+  int ret = 0;
+
+  if (n == 0 || n > NXT_DEPLOY_MAX_BRICKS || size == 0 ||
+      strlen(name) == 0 || strlen(name) > NXT_FILENAME_MAX) {
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    for (k = 0; k < i; k++) {
+      if (targets[k].handle == targets[i].handle) {
+        return -1;
+      }
+    }
+  }
+  memset(&d, 0, sizeof (d));
+  if (opts != NULL) {
+    d.opts = *opts;
+  }
+  if (d.opts.confirm_ms == 0) {
+    d.opts.confirm_ms = NXT_DEPLOY_CONFIRM_MS;
+  }
+  d.name = name;
+  d.data = data;
+  d.size = size;
+  d.n = n;
+  pthread_mutex_init(&d.lock, NULL);
+
+  uint64_t start = nxt_time_ns();
+  for (i = 0; i < n; i++) {
+    libnxtusb_deploy_target_t *t = &targets[i];
+    t->result = 0;
+    t->stage = NXT_DEPLOY_STOP;
+    t->status = 0;
+    memset(t->stage_ns, 0, sizeof (t->stage_ns));
+    t->total_ns = 0;
+    workers[i].d = &d;
+    workers[i].t = t;
+    workers[i].started = pthread_create(&workers[i].thread, NULL, deploy_worker, &workers[i]) == 0;
+  }
+  // bricks without thread are done here, meanwhile others run
+  for (i = 0; i < n; i++) {
+    if (!workers[i].started) {
+      deploy_worker(&workers[i]);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    if (workers[i].started) {
+      pthread_join(workers[i].thread, NULL);
+    }
+  }
+  uint64_t elapsed = nxt_time_ns() - start;
+  pthread_mutex_destroy(&d.lock);
+
+  if (stats != NULL) {
+    memset(stats, 0, sizeof (*stats));
+    stats->elapsed_ns = elapsed;
+  }
+  for (i = 0; i < n; i++) {
+    const libnxtusb_deploy_target_t *t = &targets[i];
+    if (t->result != 0) {
+      ret = -1;
+    }
+    if (stats == NULL) {
+      continue;
+    }
+    if (t->result == 0) {
+      stats->ok++;
+    } else {
+      stats->failed++;
+    }
+    if (t->stage > NXT_DEPLOY_UPLOAD) {
+      stats->bytes += size;
+    }
+    if (t->total_ns > stats->slowest_ns) {
+      stats->slowest_ns = t->total_ns;
+    }
+    stats->sum_ns += t->total_ns;
+    for (k = 0; k < NXT_DEPLOY_STAGES; k++) {
+      if (t->stage_ns[k] > stats->stage_max_ns[k]) {
+        stats->stage_max_ns[k] = t->stage_ns[k];
+      }
+    }
+  }
+  return ret;
+}
+
+int nxt_deploy_file(
+                    libnxtusb_deploy_target_t *targets, const unsigned int n, const char *path,
+                    const libnxtusb_deploy_opts_t *opts, libnxtusb_deploy_stats_t *stats
+                    ) {
+  const char *name = strrchr(path, '/');
+  uint32_t size;
+
+  name = name != NULL ? name + 1 : path;
+  uint8_t *data = nxt_read_file(path, &size);
+  if (data == NULL) {
+    return -1;
+  }
+  int ret = nxt_deploy(targets, n, name, data, size, opts, stats);
+  free(data);
+  return ret;
+}
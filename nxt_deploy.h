@@ -0,0 +1,158 @@
+/**
+ * @file nxt_deploy.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Program deployment to many bricks. Public header
+ *
+ * Deploy runs one worker thread per brick. Worker stops running program,
+ * uploads program with linear write (brick executes it in place from
+ * flash), asks brick for size of written file, starts program and polls
+ * until brick reports it running. Bricks share nothing but progress
+ * reporting, so rollout to a rig takes about as long as its slowest brick.
+ */
+
+#ifndef NXT_DEPLOY_H
+#define NXT_DEPLOY_H
+#include "libnxtusb.h"
+
+/** \ingroup deploy
+ * Maximum number of bricks in one deploy
+ */
+#define NXT_DEPLOY_MAX_BRICKS 64
+
+/** \ingroup deploy
+ * Deploy stages, in order
+ */
+typedef enum {
+  /** Stop running program */
+  NXT_DEPLOY_STOP = 0,
+  /** Upload program */
+  NXT_DEPLOY_UPLOAD,
+  /** Check size of uploaded file */
+  NXT_DEPLOY_VERIFY,
+  /** Start program */
+  NXT_DEPLOY_START,
+  /** Wait until program runs */
+  NXT_DEPLOY_CONFIRM,
+
+  /** Finished */
+  NXT_DEPLOY_STAGES
+} libnxtusb_deploy_stage_t;
+
+/** \ingroup deploy
+ * Deploy to one brick
+ */
+typedef struct {
+  /** Brick, every brick at most once per deploy */
+  const libnxtusb_device_handle *handle;
+  /** Result: 0 on success, -1 on failure */
+  int result;
+  /** Result: stage running, failed stage, or NXT_DEPLOY_STAGES when done */
+  libnxtusb_deploy_stage_t stage;
+  /** Result: brick status of failure, 0 if there is none (transport failure, timeout, size mismatch) */
+  uint8_t status;
+  /** Result: time spent in every stage, ns */
+  uint64_t stage_ns[NXT_DEPLOY_STAGES];
+  /** Result: whole deploy of this brick, ns */
+  uint64_t total_ns;
+} libnxtusb_deploy_target_t;
+
+/** \ingroup deploy
+ * Progress callback, called when brick enters stage and when it is finished
+ * (then stage is NXT_DEPLOY_STAGES, or result is -1). Calls are serialised.
+ */
+typedef void (*libnxtusb_deploy_cb)(
+        const libnxtusb_deploy_target_t *target, const unsigned int finished,
+        const unsigned int n, void *arg
+        );
+
+/** \ingroup deploy
+ * Deploy options, zero fields take defaults
+ */
+typedef struct {
+  /** Progress callback (may be NULL) */
+  libnxtusb_deploy_cb progress;
+  /** Callback argument */
+  void *arg;
+  /** How long to wait for program to stop and to start, ms (2000) */
+  unsigned int confirm_ms;
+  /** Don't start program, only install it */
+  int no_start;
+} libnxtusb_deploy_opts_t;
+
+/** \ingroup deploy
+ * Deploy summary
+ */
+typedef struct {
+  /** Bricks running new program (installed, with no_start) */
+  unsigned int ok;
+  /** Bricks failed */
+  unsigned int failed;
+  /** Program bytes uploaded, all bricks */
+  uint64_t bytes;
+  /** Whole deploy, ns */
+  uint64_t elapsed_ns;
+  /** Slowest brick, ns */
+  uint64_t slowest_ns;
+  /** Sum of brick times, what one by one rollout would take, ns */
+  uint64_t sum_ns;
+  /** Longest time of every stage over bricks, ns */
+  uint64_t stage_max_ns[NXT_DEPLOY_STAGES];
+} libnxtusb_deploy_stats_t;
+
+/**
+ * \defgroup deploy Program deployment.
+ */
+
+/** \ingroup deploy
+ *  Install and start program on several bricks at once
+ * @param targets bricks, results are filled in
+ * @param n number of bricks (1 to NXT_DEPLOY_MAX_BRICKS)
+ * @param name program file name in 15.3 format
+ * @param data program
+ * @param size program size
+ * @param opts libnxtusb_deploy_opts_t* options (may be NULL)
+ * @param stats libnxtusb_deploy_stats_t* summary (may be NULL)
+ * @return 0 if every brick succeeded, -1 otherwise
+ */
+int nxt_deploy(
+        libnxtusb_deploy_target_t *targets, const unsigned int n, const char *name,
+        const void *data, const uint32_t size,
+        const libnxtusb_deploy_opts_t *opts, libnxtusb_deploy_stats_t *stats
+        );
+
+/** \ingroup deploy
+ *  Install and start program file on several bricks at once.
+ *  Brick file name is last component of path.
+ * @param targets bricks, results are filled in
+ * @param n number of bricks (1 to NXT_DEPLOY_MAX_BRICKS)
+ * @param path local .rxe file
+ * @param opts libnxtusb_deploy_opts_t* options (may be NULL)
+ * @param stats libnxtusb_deploy_stats_t* summary (may be NULL)
+ * @return 0 if every brick succeeded, -1 otherwise
+ */
+int nxt_deploy_file(
+        libnxtusb_deploy_target_t *targets, const unsigned int n, const char *path,
+        const libnxtusb_deploy_opts_t *opts, libnxtusb_deploy_stats_t *stats
+        );
+
+#endif
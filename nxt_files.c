@@ -0,0 +1,703 @@
+/**
+ * @file nxt_files.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Brick filesystem and delta sync.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "nxt_private.h"
+
+// write packets in flight per pipeline
+#define NXT_FILE_PIPELINE 8
+#define NXT_FILE_CHUNK (NXT_PACKET_SIZE - 3)
+#define NXT_FILE_READ_CHUNK (NXT_PACKET_SIZE - 6)
+#define NXT_MANIFEST_MAGIC "nxtmanifest 1"
+
+// FNV-1a
+static uint32_t file_hash(const uint8_t *data, const uint32_t size) {
+  uint32_t h = 2166136261u;
+  uint32_t i;
+
+  for (i = 0; i < size; i++) {
+    h = (h ^ data[i]) * 16777619u;
+  }
+  return h;
+}
+
+static int file_name_ok(const char *name) {
+  size_t len = strlen(name);
+  return len > 0 && len <= NXT_FILENAME_MAX;
+}
+
+static int file_matches(const char *pattern, const char *name) {
+  return pattern == NULL || fnmatch(pattern, name, 0) == 0;
+}
+
+// system command, returns brick status or -1 if there was no usable reply
+static int file_exchange(
+                         const libnxtusb_device_handle *handle, const void *request,
+                         const unsigned int length, void *reply, const unsigned int reply_len
+                         ) {
+  uint8_t buf[NXT_PACKET_SIZE];
+
+  int got = nxt_raw_exchange(handle, request, length, buf, sizeof (buf));
+  if (got < (int) sizeof (ret_status_t)) {
+    return -1;
+  }
+  if (buf[2] == NXT_STATUS_OK && got < (int) reply_len) {
+    return -1;
+  }
+  memcpy(reply, buf, (unsigned int) got < reply_len ? (unsigned int) got : reply_len);
+  return buf[2];
+}
+
+static int file_close(const libnxtusb_device_handle *handle, const uint8_t fh) {
+  cmd_handle_t cmd = {NXT_SYSTEM_COMMAND_DOREPLY, NXT_OPCODE_SYS_CLOSE, fh};
+  ret_handle_t ret;
+
+  return file_exchange(handle, &cmd, sizeof (cmd), &ret, sizeof (ret)) == NXT_STATUS_OK ? 0 : -1;
+}
+
+// entry of name, caller holds channel lock
+static nxt_manifest_entry_t *manifest_find(nxt_manifest_t *m, const char *name) {
+  unsigned int i;
+
+  for (i = 0; i < m->count; i++) {
+    if (strcmp(m->entry[i].file.name, name) == 0) {
+      return &m->entry[i];
+    }
+  }
+  return NULL;
+}
+
+static void manifest_remove(nxt_manifest_t *m, const char *name) {
+  nxt_manifest_entry_t *e = manifest_find(m, name);
+
+  if (e != NULL) {
+    *e = m->entry[--m->count];
+  }
+}
+
+static void manifest_put(nxt_manifest_t *m, const char *name, const uint32_t size, const uint32_t hash) {
+  nxt_manifest_entry_t *e = manifest_find(m, name);
+
+  if (e == NULL) {
+    if (m->count == NXT_FILES_MAX) {
+      // brick is fuller than manifest can tell, next listing will fail anyway
+      m->valid = 0;
+      return;
+    }
+    e = &m->entry[m->count++];
+    memset(e, 0, sizeof (*e));
+    strcpy(e->file.name, name);
+  }
+  e->file.size = size;
+  e->hash = hash;
+  e->hashed = 1;
+}
+
+// one FINDFIRST/FINDNEXT walk of whole brick into manifest. Hashes of files
+// whose size didn't change are kept
+static int manifest_fetch(const libnxtusb_device_handle *handle) {
+  nxt_manifest_t *m = &handle->priv->manifest;
+  libnxtusb_file_t *found = malloc(NXT_FILES_MAX * sizeof (libnxtusb_file_t));
+  cmd_filename_t first = {NXT_SYSTEM_COMMAND_DOREPLY, NXT_OPCODE_SYS_FINDFIRST, "*.*"};
+  cmd_handle_t next = {NXT_SYSTEM_COMMAND_DOREPLY, NXT_OPCODE_SYS_FINDNEXT, 0};
+  ret_find_t ret;
+  unsigned int n = 0;
+  unsigned int i;
+
+  if (found == NULL) {
+    return -1;
+  }
+  int status = file_exchange(handle, &first, sizeof (first), &ret, sizeof (ret));
+  int open = status == NXT_STATUS_OK;
+  while (status == NXT_STATUS_OK) {
+    if (n == NXT_FILES_MAX) {
+      status = -1;
+      break;
+    }
+    memcpy(found[n].name, ret.filename, NXT_FILENAME_MAX);
+    found[n].name[NXT_FILENAME_MAX] = 0;
+    found[n].size = ret.size;
+    n++;
+    next.handle = ret.handle;
+    status = file_exchange(handle, &next, sizeof (next), &ret, sizeof (ret));
+  }
+  // search handle stays open on brick until closed
+  if (open) {
+    file_close(handle, next.handle);
+  }
+  if (status != NXT_STATUS_SYS_FILE_NOT_FOUND) {
+    free(found);
+    return -1;
+  }
+
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  nxt_manifest_t old = *m;
+  m->count = n;
+  for (i = 0; i < n; i++) {
+    nxt_manifest_entry_t *e = &m->entry[i];
+    nxt_manifest_entry_t *was = manifest_find(&old, found[i].name);
+    memset(e, 0, sizeof (*e));
+    e->file = found[i];
+    if (was != NULL && was->hashed && was->file.size == found[i].size) {
+      e->hash = was->hash;
+      e->hashed = 1;
+    }
+  }
+  m->valid = 1;
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  free(found);
+  return 0;
+}
+
+// consistent copy of manifest, listing brick if needed
+static int manifest_snapshot(const libnxtusb_device_handle *handle, const int relist, nxt_manifest_t *copy) {
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  int valid = handle->priv->manifest.valid;
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  if ((!valid || relist) && manifest_fetch(handle) != 0) {
+    return -1;
+  }
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  *copy = handle->priv->manifest;
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  return 0;
+}
+
+//internal. command sent around this API may have changed files
+
+void nxt_manifest_touched(const libnxtusb_device_handle *handle, const uint8_t opcode) {
+  switch (opcode) {
+    case NXT_OPCODE_SYS_OPENWRITE:
+    case NXT_OPCODE_SYS_DELETE:
+    case NXT_OPCODE_SYS_OPENLINEARWRITE:
+    case NXT_OPCODE_SYS_OPENWRITEDATA:
+    case NXT_OPCODE_SYS_OPENAPPENDDATA:
+    case NXT_OPCODE_SYS_DELETE_USERFLASH:
+      nxt_manifest_invalidate(handle);
+      break;
+  }
+}
+
+void nxt_manifest_invalidate(const libnxtusb_device_handle *handle) {
+  nxt_manifest_t *m = &handle->priv->manifest;
+  unsigned int i;
+
+  // files may have been rewritten behind our back at same size
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  m->valid = 0;
+  for (i = 0; i < m->count; i++) {
+    m->entry[i].hashed = 0;
+  }
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+}
+
+int nxt_file_list(
+                  const libnxtusb_device_handle *handle, const char *pattern,
+                  libnxtusb_file_t *files, const unsigned int max
+                  ) {
+  nxt_manifest_t *m = malloc(sizeof (nxt_manifest_t));
+  unsigned int i;
+  int n = 0;
+
+  if (m == NULL || manifest_snapshot(handle, 0, m) != 0) {
+    free(m);
+    return -1;
+  }
+  for (i = 0; i < m->count; i++) {
+    if (!file_matches(pattern, m->entry[i].file.name)) {
+      continue;
+    }
+    if ((unsigned int) n < max) {
+      files[n] = m->entry[i].file;
+    }
+    n++;
+  }
+  free(m);
+  return n;
+}
+
+// delete and account in manifest, returns brick status or -1
+static int file_remove(const libnxtusb_device_handle *handle, const char *name) {
+  cmd_filename_t cmd = {NXT_SYSTEM_COMMAND_DOREPLY, NXT_OPCODE_SYS_DELETE, ""};
+  ret_status_t ret;
+
+  strcpy(cmd.filename, name);
+  int status = file_exchange(handle, &cmd, sizeof (cmd), &ret, sizeof (ret));
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  if (status == NXT_STATUS_OK || status == NXT_STATUS_SYS_FILE_NOT_FOUND) {
+    manifest_remove(&handle->priv->manifest, name);
+  } else {
+    handle->priv->manifest.valid = 0;
+  }
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  if (status > 0) {
+    libnxtusb_error = status;
+  }
+  return status;
+}
+
+int nxt_file_delete(const libnxtusb_device_handle *handle, const char *name) {
+  if (!file_name_ok(name)) {
+    return -1;
+  }
+  return file_remove(handle, name) == NXT_STATUS_OK ? 0 : -1;
+}
+
+// write packets of open file, NXT_FILE_PIPELINE in flight. Hashes what is written
+static int file_write(
+                      const libnxtusb_device_handle *handle, const uint8_t fh, const uint32_t size,
+                      libnxtusb_file_source_cb src, void *arg, uint32_t *hash
+                      ) {
+  cmd_write_t pkt[NXT_FILE_PIPELINE];
+  libnxtusb_raw_cmd_t cmds[NXT_FILE_PIPELINE];
+  uint32_t off = 0;
+  unsigned int i, k;
+
+  *hash = file_hash(NULL, 0);
+  while (off < size) {
+    unsigned int n = 0;
+    while (n < NXT_FILE_PIPELINE && off < size) {
+      unsigned int chunk = size - off < NXT_FILE_CHUNK ? size - off : NXT_FILE_CHUNK;
+      pkt[n].type = NXT_SYSTEM_COMMAND_DOREPLY;
+      pkt[n].opcode = NXT_OPCODE_SYS_WRITE;
+      pkt[n].handle = fh;
+      if (src(pkt[n].data, chunk, arg) != 0) {
+        return -1;
+      }
+      for (k = 0; k < chunk; k++) {
+        *hash = (*hash ^ pkt[n].data[k]) * 16777619u;
+      }
+      cmds[n].request = (const uint8_t*) &pkt[n];
+      cmds[n].length = 3 + chunk;
+      off += chunk;
+      n++;
+    }
+    if (nxt_pipeline(handle, cmds, n) != 0) {
+      return -1;
+    }
+    for (i = 0; i < n; i++) {
+      const ret_write_t *ret = (const ret_write_t*) cmds[i].reply;
+      if (cmds[i].reply_length < (int) sizeof (ret_status_t)) {
+        return -1;
+      }
+      if (ret->status != NXT_STATUS_OK) {
+        libnxtusb_error = ret->status;
+        return -1;
+      }
+      if (cmds[i].reply_length < (int) sizeof (ret_write_t) || ret->written != cmds[i].length - 3) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// replace file, opened with OPENWRITE or OPENLINEARWRITE
+static int file_upload(
+                       const libnxtusb_device_handle *handle, const char *name, const uint8_t opcode,
+                       const uint32_t size, libnxtusb_file_source_cb src, void *arg
+                       ) {
+  cmd_openwrite_t cmd = {NXT_SYSTEM_COMMAND_DOREPLY, opcode, "", size};
+  ret_handle_t ret;
+  uint32_t hash;
+
+  if (!file_name_ok(name)) {
+    return -1;
+  }
+  // brick won't open existing file for writing
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  int absent = handle->priv->manifest.valid && manifest_find(&handle->priv->manifest, name) == NULL;
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  if (!absent) {
+    int status = file_remove(handle, name);
+    if (status != NXT_STATUS_OK && status != NXT_STATUS_SYS_FILE_NOT_FOUND) {
+      return -1;
+    }
+  }
+  strcpy(cmd.filename, name);
+  int status = file_exchange(handle, &cmd, sizeof (cmd), &ret, sizeof (ret));
+  if (status != NXT_STATUS_OK) {
+    if (status > 0) {
+      libnxtusb_error = status;
+    }
+    // nothing was written, hashes of other files still hold
+    pthread_mutex_lock(&handle->priv->channel.lock);
+    handle->priv->manifest.valid = 0;
+    pthread_mutex_unlock(&handle->priv->channel.lock);
+    return -1;
+  }
+  int written = file_write(handle, ret.handle, size, src, arg, &hash);
+  int closed = file_close(handle, ret.handle);
+  if (written != 0 || closed != 0) {
+    // partial file would look complete by size
+    file_remove(handle, name);
+    return -1;
+  }
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  manifest_put(&handle->priv->manifest, name, size, hash);
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  return 0;
+}
+
+int nxt_file_upload_from(
+                         const libnxtusb_device_handle *handle, const char *name, const uint32_t size,
+                         libnxtusb_file_source_cb src, void *arg
+                         ) {
+  return file_upload(handle, name, NXT_OPCODE_SYS_OPENWRITE, size, src, arg);
+}
+
+static int file_from_memory(uint8_t *buf, const unsigned int n, void *arg) {
+  const uint8_t **p = arg;
+
+  memcpy(buf, *p, n);
+  *p += n;
+  return 0;
+}
+
+int nxt_file_upload(
+                    const libnxtusb_device_handle *handle, const char *name,
+                    const void *data, const uint32_t size
+                    ) {
+  const uint8_t *p = data;
+
+  return nxt_file_upload_from(handle, name, size, file_from_memory, &p);
+}
+
+//internal. upload to contiguous flash, executables run in place
+
+int nxt_file_upload_linear(
+                           const libnxtusb_device_handle *handle, const char *name,
+                           const void *data, const uint32_t size
+                           ) {
+  const uint8_t *p = data;
+
+  return file_upload(handle, name, NXT_OPCODE_SYS_OPENLINEARWRITE, size, file_from_memory, &p);
+}
+
+//internal. size of file as brick reports it, bypassing manifest.
+//Returns brick status or -1
+
+int nxt_file_find(const libnxtusb_device_handle *handle, const char *name, uint32_t *size) {
+  cmd_filename_t cmd = {NXT_SYSTEM_COMMAND_DOREPLY, NXT_OPCODE_SYS_FINDFIRST, ""};
+  ret_find_t ret;
+
+  if (!file_name_ok(name)) {
+    return -1;
+  }
+  strcpy(cmd.filename, name);
+  int status = file_exchange(handle, &cmd, sizeof (cmd), &ret, sizeof (ret));
+  if (status == NXT_STATUS_OK) {
+    *size = ret.size;
+    file_close(handle, ret.handle);
+  }
+  return status;
+}
+
+// read packets of open file, NXT_FILE_PIPELINE in flight
+static int file_read(
+                     const libnxtusb_device_handle *handle, const uint8_t fh, const uint32_t size,
+                     libnxtusb_file_sink_cb sink, void *arg
+                     ) {
+  cmd_read_t pkt[NXT_FILE_PIPELINE];
+  libnxtusb_raw_cmd_t cmds[NXT_FILE_PIPELINE];
+  uint32_t off = 0;
+  unsigned int i;
+
+  while (off < size) {
+    unsigned int n = 0;
+    uint32_t requested = off;
+    // never ask past end, brick answers that with error
+    while (n < NXT_FILE_PIPELINE && requested < size) {
+      pkt[n].type = NXT_SYSTEM_COMMAND_DOREPLY;
+      pkt[n].opcode = NXT_OPCODE_SYS_READ;
+      pkt[n].handle = fh;
+      pkt[n].length = size - requested < NXT_FILE_READ_CHUNK ? size - requested : NXT_FILE_READ_CHUNK;
+      cmds[n].request = (const uint8_t*) &pkt[n];
+      cmds[n].length = sizeof (cmd_read_t);
+      requested += pkt[n].length;
+      n++;
+    }
+    if (nxt_pipeline(handle, cmds, n) != 0) {
+      return -1;
+    }
+    for (i = 0; i < n; i++) {
+      const ret_read_t *ret = (const ret_read_t*) cmds[i].reply;
+      if (cmds[i].reply_length < (int) sizeof (ret_status_t)) {
+        return -1;
+      }
+      if (ret->status != NXT_STATUS_OK) {
+        libnxtusb_error = ret->status;
+        return -1;
+      }
+      if (ret->length != pkt[i].length || cmds[i].reply_length < 6 + (int) ret->length) {
+        return -1;
+      }
+      if (sink(ret->data, ret->length, arg) != 0) {
+        return -1;
+      }
+      off += ret->length;
+    }
+  }
+  return 0;
+}
+
+int nxt_file_download(
+                      const libnxtusb_device_handle *handle, const char *name,
+                      libnxtusb_file_sink_cb sink, void *arg
+                      ) {
+  cmd_filename_t cmd = {NXT_SYSTEM_COMMAND_DOREPLY, NXT_OPCODE_SYS_OPENREAD, ""};
+  ret_openread_t ret;
+
+  if (!file_name_ok(name)) {
+    return -1;
+  }
+  strcpy(cmd.filename, name);
+  int status = file_exchange(handle, &cmd, sizeof (cmd), &ret, sizeof (ret));
+  if (status != NXT_STATUS_OK) {
+    if (status > 0) {
+      libnxtusb_error = status;
+    }
+    return -1;
+  }
+  int read = file_read(handle, ret.handle, ret.size, sink, arg);
+  int closed = file_close(handle, ret.handle);
+  return read == 0 && closed == 0 ? 0 : -1;
+}
+
+typedef struct {
+  char name[NXT_FILENAME_MAX + 1];
+  char path[PATH_MAX];
+} sync_local_t;
+
+// regular files of dir matching pattern
+static sync_local_t *sync_scan(const char *dir, const char *pattern, unsigned int *count, libnxtusb_sync_stats_t *st) {
+  DIR *d = opendir(dir);
+  sync_local_t *local = NULL;
+  unsigned int n = 0, cap = 0;
+  struct dirent *de;
+  struct stat sb;
+
+  if (d == NULL) {
+    return NULL;
+  }
+  while ((de = readdir(d)) != NULL) {
+    if (de->d_name[0] == '.' || !file_matches(pattern, de->d_name)) {
+      continue;
+    }
+    if (n == cap) {
+      cap = cap ? cap * 2 : 32;
+      sync_local_t *grown = realloc(local, cap * sizeof (sync_local_t));
+      if (grown == NULL) {
+        free(local);
+        closedir(d);
+        return NULL;
+      }
+      local = grown;
+    }
+    if (snprintf(local[n].path, PATH_MAX, "%s/%s", dir, de->d_name) >= PATH_MAX ||
+        stat(local[n].path, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+      continue;
+    }
+    if (!file_name_ok(de->d_name)) {
+      st->skipped++;
+      continue;
+    }
+    strcpy(local[n].name, de->d_name);
+    n++;
+  }
+  closedir(d);
+  *count = n;
+  // empty directory is fine, caller tells it from failure by count
+  return local != NULL ? local : malloc(sizeof (sync_local_t));
+}
+
+//internal. whole file into malloc()ed buffer, NULL on failure
+
+uint8_t *nxt_read_file(const char *path, uint32_t *size) {
+  FILE *f = fopen(path, "rb");
+  uint8_t *data = NULL;
+
+  if (f == NULL) {
+    return NULL;
+  }
+  if (fseek(f, 0, SEEK_END) == 0) {
+    long len = ftell(f);
+    if (len >= 0 && len <= (long) UINT32_MAX && fseek(f, 0, SEEK_SET) == 0) {
+      data = malloc(len ? len : 1);
+      if (data != NULL && fread(data, 1, len, f) != (size_t) len) {
+        free(data);
+        data = NULL;
+      }
+      *size = len;
+    }
+  }
+  fclose(f);
+  return data;
+}
+
+int nxt_sync(
+             const libnxtusb_device_handle *handle, const char *dir, const char *pattern,
+             const unsigned int flags, libnxtusb_sync_stats_t *stats
+             ) {
+  libnxtusb_sync_stats_t st = {0, 0, 0, 0, 0};
+  nxt_manifest_t *m = malloc(sizeof (nxt_manifest_t));
+  unsigned int nlocal = 0;
+  unsigned int i, k;
+  int ret = 0;
+
+  sync_local_t *local = m != NULL ? sync_scan(dir, pattern, &nlocal, &st) : NULL;
+  if (local == NULL || manifest_snapshot(handle, flags & NXT_SYNC_RELIST, m) != 0) {
+    free(local);
+    free(m);
+    return -1;
+  }
+  // stale files first, they may hold flash space uploads need
+  for (i = 0; (flags & NXT_SYNC_DELETE) && i < m->count; i++) {
+    const char *name = m->entry[i].file.name;
+    if (!file_matches(pattern, name)) {
+      continue;
+    }
+    for (k = 0; k < nlocal && strcmp(local[k].name, name) != 0; k++) {
+    }
+    if (k < nlocal) {
+      continue;
+    }
+    if (!(flags & NXT_SYNC_DRY_RUN) && nxt_file_delete(handle, name) != 0) {
+      ret = -1;
+      continue;
+    }
+    st.deleted++;
+  }
+  for (k = 0; k < nlocal; k++) {
+    uint32_t size;
+    uint8_t *data = nxt_read_file(local[k].path, &size);
+    if (data == NULL) {
+      st.skipped++;
+      continue;
+    }
+    const nxt_manifest_entry_t *e = manifest_find(m, local[k].name);
+    if (e != NULL && e->hashed && e->file.size == size && e->hash == file_hash(data, size)) {
+      st.unchanged++;
+    } else if (!(flags & NXT_SYNC_DRY_RUN) && nxt_file_upload(handle, local[k].name, data, size) != 0) {
+      ret = -1;
+    } else {
+      st.uploaded++;
+      st.bytes += size;
+    }
+    free(data);
+  }
+  free(local);
+  free(m);
+  if (stats != NULL) {
+    *stats = st;
+  }
+  return ret;
+}
+
+int nxt_manifest_save(const libnxtusb_device_handle *handle, const char *path) {
+  nxt_manifest_t *m = malloc(sizeof (nxt_manifest_t));
+  char tmp[PATH_MAX];
+  unsigned int i;
+
+  if (m == NULL || snprintf(tmp, sizeof (tmp), "%s.tmp", path) >= (int) sizeof (tmp)) {
+    free(m);
+    return -1;
+  }
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  *m = handle->priv->manifest;
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  FILE *f = m->valid ? fopen(tmp, "w") : NULL;
+  if (f == NULL) {
+    free(m);
+    return -1;
+  }
+  fprintf(f, NXT_MANIFEST_MAGIC " %s\n", handle->priv->serial[0] ? handle->priv->serial : "-");
+  for (i = 0; i < m->count; i++) {
+    const nxt_manifest_entry_t *e = &m->entry[i];
+    if (e->hashed) {
+      fprintf(f, "%u %08x %s\n", e->file.size, e->hash, e->file.name);
+    } else {
+      fprintf(f, "%u - %s\n", e->file.size, e->file.name);
+    }
+  }
+  free(m);
+  int ok = fflush(f) == 0 && !ferror(f);
+  if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+    remove(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+int nxt_manifest_load(const libnxtusb_device_handle *handle, const char *path) {
+  nxt_manifest_t *m = calloc(1, sizeof (nxt_manifest_t));
+  char line[128];
+  char serial[NXT_SERIAL_SIZE + 1];
+  char hash[16];
+  int ret = -1;
+
+  FILE *f = m != NULL ? fopen(path, "r") : NULL;
+  if (f == NULL) {
+    free(m);
+    return -1;
+  }
+  const char *own = handle->priv->serial[0] ? handle->priv->serial : "-";
+  if (fgets(line, sizeof (line), f) == NULL ||
+      strncmp(line, NXT_MANIFEST_MAGIC " ", strlen(NXT_MANIFEST_MAGIC) + 1) != 0 ||
+      sscanf(line + strlen(NXT_MANIFEST_MAGIC) + 1, "%32s", serial) != 1 || strcmp(serial, own) != 0) {
+    goto out;
+  }
+  while (fgets(line, sizeof (line), f) != NULL) {
+    nxt_manifest_entry_t *e = &m->entry[m->count];
+    if (m->count == NXT_FILES_MAX ||
+        sscanf(line, "%u %15s %19[^\n]", &e->file.size, hash, e->file.name) != 3) {
+      goto out;
+    }
+    if (strcmp(hash, "-") != 0) {
+      e->hash = strtoul(hash, NULL, 16);
+      e->hashed = 1;
+    }
+    m->count++;
+  }
+  // brick may have changed since save, next listing keeps hashes of
+  // files whose size still matches
+  m->valid = 0;
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  handle->priv->manifest = *m;
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  ret = 0;
+out:
+  fclose(f);
+  free(m);
+  return ret;
+}
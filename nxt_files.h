@@ -0,0 +1,207 @@
+/**
+ * @file nxt_files.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Brick filesystem and delta sync. Public header
+ *
+ * Listing of brick takes one exchange per file, so it is done once and
+ * kept as manifest of names and sizes in the handle. Uploads and deletes
+ * through this API keep manifest current, raw file commands (also those
+ * forwarded by nxtd/nxtproxy) and reconnects invalidate it.
+ *
+ * Brick keeps no checksums, so manifest also remembers content hash of
+ * every file uploaded through this handle. Sync uploads local file when
+ * brick has no file of that name, size differs or hash is unknown or
+ * different, so first sync of brick uploads everything. Manifest can be
+ * saved to and loaded from file, so later syncs from other processes
+ * upload only what changed.
+ */
+
+#ifndef NXT_FILES_H
+#define NXT_FILES_H
+#include "libnxtusb.h"
+
+/** \ingroup files
+ * Maximum number of files in manifest
+ */
+#define NXT_FILES_MAX 128
+
+/** \ingroup files
+ * Maximum file name length, 15.3
+ */
+#define NXT_FILENAME_MAX 19
+
+/** \ingroup files
+ * Sync flags
+ */
+enum {
+  /** Delete brick files matching pattern which are not in directory */
+  NXT_SYNC_DELETE = 0x01,
+  /** List brick even if manifest is cached */
+  NXT_SYNC_RELIST = 0x02,
+  /** Only count what would be done */
+  NXT_SYNC_DRY_RUN = 0x04
+};
+
+/** \ingroup files
+ * Brick file
+ */
+typedef struct {
+  /** File name */
+  char name[NXT_FILENAME_MAX + 1];
+  /** File size, bytes */
+  uint32_t size;
+} libnxtusb_file_t;
+
+/** \ingroup files
+ * Sync result
+ */
+typedef struct {
+  /** Files uploaded */
+  unsigned int uploaded;
+  /** Files deleted from brick */
+  unsigned int deleted;
+  /** Files already on brick */
+  unsigned int unchanged;
+  /** Local files not usable on brick (name too long, unreadable) */
+  unsigned int skipped;
+  /** Bytes uploaded */
+  uint64_t bytes;
+} libnxtusb_sync_stats_t;
+
+/** \ingroup files
+ * Upload data source, fills buf with next n bytes of file
+ * @return 0 on success, -1 to abort upload
+ */
+typedef int(*libnxtusb_file_source_cb)(uint8_t *buf, const unsigned int n, void *arg);
+
+/** \ingroup files
+ * Download data sink, takes next n bytes of file
+ * @return 0 on success, -1 to abort download
+ */
+typedef int(*libnxtusb_file_sink_cb)(const uint8_t *data, const unsigned int n, void *arg);
+
+/**
+ * \defgroup files Filesystem and sync.
+ */
+
+/** \ingroup files
+ *  List brick files, from manifest when cached
+ * @param handle nxt brick handle
+ * @param pattern shell wildcard pattern, fnmatch(3) (NULL = all)
+ * @param files libnxtusb_file_t* files (preallocated, may be NULL if max is 0)
+ * @param max size of files
+ * @return number of matching files (may be more than max), -1 on failure
+ */
+int nxt_file_list(
+        const libnxtusb_device_handle *handle, const char *pattern,
+        libnxtusb_file_t *files, const unsigned int max
+        );
+
+/** \ingroup files
+ *  Delete brick file
+ * @param handle nxt brick handle
+ * @param name file name
+ * @return 0 on success, -1 on failure
+ */
+int nxt_file_delete(const libnxtusb_device_handle *handle, const char *name);
+
+/** \ingroup files
+ *  Upload file, replacing brick file of same name. Write packets are pipelined
+ * @param handle nxt brick handle
+ * @param name file name
+ * @param data file contents
+ * @param size file size
+ * @return 0 on success, -1 on failure
+ */
+int nxt_file_upload(
+        const libnxtusb_device_handle *handle, const char *name,
+        const void *data, const uint32_t size
+        );
+
+/** \ingroup files
+ *  Upload file produced while it is written, replacing brick file of same name
+ * @param handle nxt brick handle
+ * @param name file name
+ * @param size file size, source is asked for exactly this many bytes
+ * @param src libnxtusb_file_source_cb data source, called in pieces of up to 61 bytes
+ * @param arg source argument
+ * @return 0 on success, -1 on failure
+ */
+int nxt_file_upload_from(
+        const libnxtusb_device_handle *handle, const char *name, const uint32_t size,
+        libnxtusb_file_source_cb src, void *arg
+        );
+
+/** \ingroup files
+ *  Download file, handing data to sink as it arrives. Read packets are pipelined
+ * @param handle nxt brick handle
+ * @param name file name
+ * @param sink libnxtusb_file_sink_cb data sink, called in pieces of up to 58 bytes
+ * @param arg sink argument
+ * @return 0 on success, -1 on failure
+ */
+int nxt_file_download(
+        const libnxtusb_device_handle *handle, const char *name,
+        libnxtusb_file_sink_cb sink, void *arg
+        );
+
+/** \ingroup files
+ *  Make brick files matching pattern same as regular files of directory
+ * @param handle nxt brick handle
+ * @param dir local directory
+ * @param pattern shell wildcard pattern for both sides (NULL = all)
+ * @param flags NXT_SYNC_* flags
+ * @param stats libnxtusb_sync_stats_t* result (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_sync(
+        const libnxtusb_device_handle *handle, const char *dir, const char *pattern,
+        const unsigned int flags, libnxtusb_sync_stats_t *stats
+        );
+
+/** \ingroup files
+ *  Forget cached listing, next list or sync asks brick. Content hashes are
+ *  dropped too, files may have been rewritten at same size
+ * @param handle nxt brick handle
+ */
+void nxt_manifest_invalidate(const libnxtusb_device_handle *handle);
+
+/** \ingroup files
+ *  Save manifest with content hashes
+ * @param handle nxt brick handle
+ * @param path manifest file, replaced atomically
+ * @return 0 on success, -1 on failure (or no manifest cached)
+ */
+int nxt_manifest_save(const libnxtusb_device_handle *handle, const char *path);
+
+/** \ingroup files
+ *  Load content hashes saved for this brick. Fails if they were saved for
+ *  other brick. Brick is listed again on next list or sync, and loaded hashes
+ *  are kept for files whose size still matches
+ * @param handle nxt brick handle
+ * @param path manifest file
+ * @return 0 on success, -1 on failure
+ */
+int nxt_manifest_load(const libnxtusb_device_handle *handle, const char *path);
+
+#endif
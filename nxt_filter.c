@@ -0,0 +1,292 @@
+/**
+ * @file nxt_filter.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Sensor sample filtering and calibration.
+ */
+
+#include <string.h>
+#include "nxt_private.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// sound sensor full scale, dB(A)
+#define SOUND_FULL_SCALE_DB 90.0f
+
+int nxt_filter_init(libnxtusb_filter_t *f, const unsigned int median, const unsigned int mean, const float alpha) {
+  if (median > NXT_FILTER_MAX_WINDOW || (median > 1 && median % 2 == 0) ||
+      mean > NXT_FILTER_MAX_WINDOW || alpha < 0 || alpha > 1) {
+    return -1;
+  }
+  memset(f, 0, sizeof (libnxtusb_filter_t));
+  f->scale = 1;
+  f->median = median > 1 ? median : 0;
+  f->mean = mean > 1 ? mean : 0;
+  f->alpha = alpha;
+  return 0;
+}
+
+void nxt_filter_reset(libnxtusb_filter_t *f) {
+  f->med_count = 0;
+  f->mean_sum = 0;
+  f->mean_pos = 0;
+  f->mean_count = 0;
+  f->ema_primed = 0;
+}
+
+int nxt_filter_calibrate(
+                         libnxtusb_filter_t *f, const float in_lo, const float in_hi,
+                         const float out_lo, const float out_hi, const int clamp
+                         ) {
+  if (in_lo == in_hi) {
+    return -1;
+  }
+  f->scale = (out_hi - out_lo) / (in_hi - in_lo);
+  f->offset = out_lo - in_lo * f->scale;
+  f->lo = out_lo < out_hi ? out_lo : out_hi;
+  f->hi = out_lo < out_hi ? out_hi : out_lo;
+  f->clamp = clamp;
+  return 0;
+}
+
+int nxt_filter_calibrate_light(libnxtusb_filter_t *f, const uint16_t dark, const uint16_t bright) {
+  return nxt_filter_calibrate(f, dark, bright, 0, 100, 1);
+}
+
+int nxt_filter_calibrate_sound(libnxtusb_filter_t *f, const float offset_db) {
+  return nxt_filter_calibrate(f, 0, 1023, offset_db, SOUND_FULL_SCALE_DB + offset_db, 0);
+}
+
+// samples to calibrated floats
+static void filter_calibrate(const libnxtusb_filter_t *f, const int16_t *in, float *out, const unsigned int n) {
+  unsigned int i = 0;
+  const float lo = f->clamp ? f->lo : -3.4e38f;
+  const float hi = f->clamp ? f->hi : 3.4e38f;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(f->scale);
+  const __m128 offset = _mm_set1_ps(f->offset);
+  const __m128 vlo = _mm_set1_ps(lo);
+  const __m128 vhi = _mm_set1_ps(hi);
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (in + i));
+    // sign extend to 32 bit
+    __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    __m128 fa = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(a), scale), offset);
+    __m128 fb = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(b), scale), offset);
+    _mm_storeu_ps(out + i, _mm_min_ps(_mm_max_ps(fa, vlo), vhi));
+    _mm_storeu_ps(out + i + 4, _mm_min_ps(_mm_max_ps(fb, vlo), vhi));
+  }
+#elif defined(__ARM_NEON)
+  const float32x4_t scale = vdupq_n_f32(f->scale);
+  const float32x4_t offset = vdupq_n_f32(f->offset);
+  const float32x4_t vlo = vdupq_n_f32(lo);
+  const float32x4_t vhi = vdupq_n_f32(hi);
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t x = vld1q_s16(in + i);
+    float32x4_t fa = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+    float32x4_t fb = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+    fa = vmlaq_f32(offset, fa, scale);
+    fb = vmlaq_f32(offset, fb, scale);
+    vst1q_f32(out + i, vminq_f32(vmaxq_f32(fa, vlo), vhi));
+    vst1q_f32(out + i + 4, vminq_f32(vmaxq_f32(fb, vlo), vhi));
+  }
+#endif
+  for (; i < n; i++) {
+    float v = in[i] * f->scale + f->offset;
+    out[i] = v < lo ? lo : (v > hi ? hi : v);
+  }
+}
+
+static float median3(const float a, const float b, const float c) {
+  float lo = a < b ? a : b;
+  float hi = a < b ? b : a;
+  float m = hi < c ? hi : c;
+  return lo > m ? lo : m;
+}
+
+static float median5(const float a, const float b, const float c, const float d, const float e) {
+  float f1 = (a < b ? a : b) > (c < d ? c : d) ? (a < b ? a : b) : (c < d ? c : d);
+  float g1 = (a > b ? a : b) < (c > d ? c : d) ? (a > b ? a : b) : (c > d ? c : d);
+  return median3(e, f1, g1);
+}
+
+// median of w values by partial insertion sort, w is small
+static float median_n(const float *x, const unsigned int w) {
+  float s[NXT_FILTER_MAX_WINDOW];
+  unsigned int i, j;
+
+  for (i = 0; i < w; i++) {
+    float v = x[i];
+    for (j = i; j > 0 && s[j - 1] > v; j--) {
+      s[j] = s[j - 1];
+    }
+    s[j] = v;
+  }
+  return s[w / 2];
+}
+
+// median over window ending at each sample, in place. x[-k] for k < w are
+// taken from history
+static void filter_median(libnxtusb_filter_t *f, float *x, const unsigned int n) {
+  const unsigned int w = f->median;
+  const unsigned int keep = w - 1;
+  float buf[2 * NXT_FILTER_MAX_WINDOW];
+  float tail[NXT_FILTER_MAX_WINDOW];
+  unsigned int i, lead;
+
+  // inputs of next batch's first outputs, saved before they are overwritten
+  unsigned int h = f->med_count;
+  unsigned int tn = n < keep ? n : keep;
+  memcpy(tail, x + n - tn, tn * sizeof (float));
+
+  // head: outputs whose window reaches into history
+  lead = n < keep ? n : keep;
+  memcpy(buf, f->med_hist, h * sizeof (float));
+  memcpy(buf + h, x, lead * sizeof (float));
+  float head[NXT_FILTER_MAX_WINDOW];
+  for (i = 0; i < lead; i++) {
+    // until window fills up, median of what there is (odd count)
+    unsigned int have = h + i + 1;
+    unsigned int m = have < w ? have : w;
+    if (m % 2 == 0) {
+      m--;
+    }
+    head[i] = median_n(buf + have - m, m);
+  }
+
+  // body: all of window inside batch, backwards so inputs are read before overwritten
+  i = n;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  if (w == 3 || w == 5) {
+    while (i >= keep + 4) {
+      i -= 4;
+#if defined(__SSE2__)
+      __m128 a = _mm_loadu_ps(x + i - keep);
+      __m128 b = _mm_loadu_ps(x + i - keep + 1);
+      __m128 c = _mm_loadu_ps(x + i - keep + 2);
+      __m128 m;
+      if (w == 3) {
+        m = _mm_max_ps(_mm_min_ps(a, b), _mm_min_ps(_mm_max_ps(a, b), c));
+      } else {
+        __m128 d = _mm_loadu_ps(x + i - 1);
+        __m128 e = _mm_loadu_ps(x + i);
+        __m128 f1 = _mm_max_ps(_mm_min_ps(a, b), _mm_min_ps(c, d));
+        __m128 g1 = _mm_min_ps(_mm_max_ps(a, b), _mm_max_ps(c, d));
+        m = _mm_max_ps(_mm_min_ps(f1, g1), _mm_min_ps(_mm_max_ps(f1, g1), e));
+      }
+      _mm_storeu_ps(x + i, m);
+#else
+      float32x4_t a = vld1q_f32(x + i - keep);
+      float32x4_t b = vld1q_f32(x + i - keep + 1);
+      float32x4_t c = vld1q_f32(x + i - keep + 2);
+      float32x4_t m;
+      if (w == 3) {
+        m = vmaxq_f32(vminq_f32(a, b), vminq_f32(vmaxq_f32(a, b), c));
+      } else {
+        float32x4_t d = vld1q_f32(x + i - 1);
+        float32x4_t e = vld1q_f32(x + i);
+        float32x4_t f1 = vmaxq_f32(vminq_f32(a, b), vminq_f32(c, d));
+        float32x4_t g1 = vminq_f32(vmaxq_f32(a, b), vmaxq_f32(c, d));
+        m = vmaxq_f32(vminq_f32(f1, g1), vminq_f32(vmaxq_f32(f1, g1), e));
+      }
+      vst1q_f32(x + i, m);
+#endif
+    }
+  }
+#endif
+  while (i > lead) {
+    i--;
+    if (w == 3) {
+      x[i] = median3(x[i - 2], x[i - 1], x[i]);
+    } else if (w == 5) {
+      x[i] = median5(x[i - 4], x[i - 3], x[i - 2], x[i - 1], x[i]);
+    } else {
+      x[i] = median_n(x + i - keep, w);
+    }
+  }
+  memcpy(x, head, lead * sizeof (float));
+
+  // history: last keep inputs
+  if (tn < keep) {
+    unsigned int from = h + tn > keep ? h + tn - keep : 0;
+    memmove(f->med_hist, f->med_hist + from, (h - from) * sizeof (float));
+    h -= from;
+  } else {
+    h = 0;
+  }
+  memcpy(f->med_hist + h, tail, tn * sizeof (float));
+  f->med_count = h + tn;
+}
+
+static void filter_mean(libnxtusb_filter_t *f, float *x, const unsigned int n) {
+  unsigned int i;
+
+  for (i = 0; i < n; i++) {
+    if (f->mean_count == f->mean) {
+      f->mean_sum -= f->mean_ring[f->mean_pos];
+    } else {
+      f->mean_count++;
+    }
+    f->mean_ring[f->mean_pos] = x[i];
+    f->mean_sum += x[i];
+    f->mean_pos = (f->mean_pos + 1) % f->mean;
+    x[i] = f->mean_sum / f->mean_count;
+  }
+}
+
+// recurrence, one sample depends on previous: no lanes to fill
+static void filter_ema(libnxtusb_filter_t *f, float *x, const unsigned int n) {
+  float y = f->ema;
+  unsigned int i = 0;
+
+  if (!f->ema_primed && n > 0) {
+    y = x[0];
+    f->ema_primed = 1;
+    i = 1;
+  }
+  for (; i < n; i++) {
+    y += f->alpha * (x[i] - y);
+    x[i] = y;
+  }
+  f->ema = y;
+}
+
+void nxt_filter_run(libnxtusb_filter_t *f, const int16_t *in, float *out, const unsigned int n) {
+  if (n == 0) {
+    return;
+  }
+  filter_calibrate(f, in, out, n);
+  if (f->median) {
+    filter_median(f, out, n);
+  }
+  if (f->mean) {
+    filter_mean(f, out, n);
+  }
+  if (f->alpha > 0) {
+    filter_ema(f, out, n);
+  }
+}
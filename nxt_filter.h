@@ -0,0 +1,124 @@
+/**
+ * @file nxt_filter.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Sensor sample filtering and calibration. Public header
+ *
+ * Filter takes a batch of samples of one channel (raw, normalized or
+ * scaled values) and runs them through: linear calibration to units
+ * (with optional clamp), median, moving average, exponential moving
+ * average. Stages not configured are skipped. State carries over between
+ * batches, so a stream may be fed in pieces of any size. Calibration and
+ * medians of 3 and 5 use SSE2 or NEON when available.
+ */
+
+#ifndef NXT_FILTER_H
+#define NXT_FILTER_H
+#include "libnxtusb.h"
+
+/** \ingroup filter
+ * Largest median or moving average window
+ */
+#define NXT_FILTER_MAX_WINDOW 31
+
+/** \ingroup filter
+ * Filter state. Fill with nxt_filter_init, don't touch fields
+ */
+typedef struct {
+  float scale;
+  float offset;
+  float lo;
+  float hi;
+  int clamp;
+  unsigned int median;
+  unsigned int mean;
+  float alpha;
+  float med_hist[NXT_FILTER_MAX_WINDOW];
+  unsigned int med_count;
+  float mean_ring[NXT_FILTER_MAX_WINDOW];
+  double mean_sum;
+  unsigned int mean_pos;
+  unsigned int mean_count;
+  float ema;
+  int ema_primed;
+} libnxtusb_filter_t;
+
+/**
+ * \defgroup filter Sample filtering.
+ */
+
+/** \ingroup filter
+ *  Initialize filter. Calibration is identity
+ * @param f libnxtusb_filter_t* filter
+ * @param median median window, odd, 0 or 1 = off
+ * @param mean moving average window, 0 or 1 = off
+ * @param alpha EMA weight of new sample (0 to 1], 0 = off
+ * @return 0 on success, -1 on bad arguments
+ */
+int nxt_filter_init(libnxtusb_filter_t *f, const unsigned int median, const unsigned int mean, const float alpha);
+
+/** \ingroup filter
+ *  Forget history, keep configuration
+ * @param f libnxtusb_filter_t* filter
+ */
+void nxt_filter_reset(libnxtusb_filter_t *f);
+
+/** \ingroup filter
+ *  Set linear calibration: in_lo maps to out_lo, in_hi to out_hi
+ * @param f libnxtusb_filter_t* filter
+ * @param in_lo, in_hi sample values
+ * @param out_lo, out_hi calibrated values
+ * @param clamp 1 = limit result to [out_lo, out_hi]
+ * @return 0 on success, -1 if in_lo == in_hi
+ */
+int nxt_filter_calibrate(
+        libnxtusb_filter_t *f, const float in_lo, const float in_hi,
+        const float out_lo, const float out_hi, const int clamp
+        );
+
+/** \ingroup filter
+ *  Light sensor calibration: normalized value to percent, 0 = dark, 100 = bright
+ * @param f libnxtusb_filter_t* filter
+ * @param dark normalized value on dark surface
+ * @param bright normalized value on bright surface
+ * @return 0 on success, -1 if dark == bright
+ */
+int nxt_filter_calibrate_light(libnxtusb_filter_t *f, const uint16_t dark, const uint16_t bright);
+
+/** \ingroup filter
+ *  Sound sensor calibration: normalized value to dB(A), full scale is about 90 dB
+ * @param f libnxtusb_filter_t* filter
+ * @param offset_db sensor offset, added to result
+ * @return 0 on success
+ */
+int nxt_filter_calibrate_sound(libnxtusb_filter_t *f, const float offset_db);
+
+/** \ingroup filter
+ *  Filter batch of samples
+ * @param f libnxtusb_filter_t* filter
+ * @param in samples
+ * @param out filtered samples (n, may not overlap in)
+ * @param n number of samples
+ */
+void nxt_filter_run(libnxtusb_filter_t *f, const int16_t *in, float *out, const unsigned int n);
+
+#endif
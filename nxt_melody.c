@@ -0,0 +1,163 @@
+/**
+ * @file nxt_melody.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Tone sequences and melody files.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <time.h>
+#include "nxt_private.h"
+
+#define RMD_FORMAT 0x0200
+#define RMD_HEADER 8
+#define RMD_NOTE 4
+// round trips measured when there is no estimate yet
+#define MELODY_PROBES 4
+
+static void be16(uint8_t *p, const uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+int nxt_melody_play(
+                    const libnxtusb_device_handle *handle, const libnxtusb_note_t *notes,
+                    const unsigned int n, libnxtusb_melody_stats_t *stats
+                    ) {
+  libnxtusb_melody_stats_t st = {n, 0, 0, 0, 0, 0};
+  libnxtusb_timing_stats_t timing;
+  cmd_playtone_t cmd = {NXT_DIRECT_COMMAND_NOREPLY, NXT_OPCODE_PLAYTONE, 0, 0};
+  const libnxtusb_priority_t prio = nxt_opcode_priority(NXT_OPCODE_PLAYTONE);
+  unsigned int estop_gen = atomic_load_explicit(&handle->priv->channel.estop_gen, memory_order_relaxed);
+  uint64_t offset_ns = 0;
+  unsigned int i;
+  int ret = 0;
+
+  nxt_timing_get(handle, &timing);
+  if (timing.samples == 0) {
+    nxt_timing_probe(handle, MELODY_PROBES);
+  }
+  uint64_t start = nxt_time_ns();
+
+  for (i = 0; i < n; i++) {
+    const uint64_t duration_ns = notes[i].duration_ms * 1000000ULL;
+    uint64_t due = start + offset_ns;
+    offset_ns += duration_ns + notes[i].gap_ms * 1000000ULL;
+    if (notes[i].freq == 0 || duration_ns == 0) {
+      continue;
+    }
+    // estimate may move under other traffic, take it per note
+    nxt_timing_get(handle, &timing);
+    uint64_t lead = timing.samples ? timing.latency_ns : 0;
+    st.lead_us = lead / 1000;
+    uint64_t send_at = due > lead ? due - lead : 0;
+    struct timespec deadline = {send_at / 1000000000ULL, send_at % 1000000000ULL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+    }
+
+    uint64_t now = nxt_time_ns();
+    uint64_t late = now > send_at ? now - send_at : 0;
+    if (late / 1000 > st.max_late_us) {
+      st.max_late_us = late / 1000;
+    }
+    // late note ends when it should, following notes keep their time
+    uint16_t duration_ms = late < duration_ns ? (duration_ns - late + 500000ULL) / 1000000ULL : 0;
+    if (duration_ms == 0) {
+      st.skipped++;
+      continue;
+    }
+    if (duration_ms != notes[i].duration_ms) {
+      st.shortened++;
+    }
+    cmd.freq = notes[i].freq;
+    cmd.duration = duration_ms;
+
+    nxt_channel_acquire(&handle->priv->channel, prio);
+    int sent = -1;
+    if (atomic_load_explicit(&handle->priv->channel.estop_gen, memory_order_relaxed) == estop_gen) {
+      sent = nxt_send(handle, (const unsigned char*) &cmd, sizeof (cmd));
+    }
+    nxt_channel_release(&handle->priv->channel);
+    if (sent != sizeof (cmd)) {
+      ret = -1;
+      break;
+    }
+    st.sent++;
+  }
+
+  if (stats != NULL) {
+    *stats = st;
+  }
+  return ret;
+}
+
+int nxt_melody_compile(const libnxtusb_note_t *notes, const unsigned int n, uint8_t **rmd, uint32_t *size) {
+  unsigned int i, count = 0;
+
+  for (i = 0; i < n; i++) {
+    count += (notes[i].duration_ms != 0) + (notes[i].gap_ms != 0);
+  }
+  // length field is 16 bit
+  if (count * RMD_NOTE > 0xffff) {
+    return -1;
+  }
+  *size = RMD_HEADER + count * RMD_NOTE;
+  *rmd = calloc(1, *size);
+  if (*rmd == NULL) {
+    return -1;
+  }
+  uint8_t *p = *rmd;
+  // format, data length, two unused words
+  be16(p, RMD_FORMAT);
+  be16(p + 2, count * RMD_NOTE);
+  p += RMD_HEADER;
+  for (i = 0; i < n; i++) {
+    if (notes[i].duration_ms != 0) {
+      be16(p, notes[i].freq);
+      be16(p + 2, notes[i].duration_ms);
+      p += RMD_NOTE;
+    }
+    // rest is note of frequency 0
+    if (notes[i].gap_ms != 0) {
+      be16(p, 0);
+      be16(p + 2, notes[i].gap_ms);
+      p += RMD_NOTE;
+    }
+  }
+  return 0;
+}
+
+int nxt_melody_upload(
+                      const libnxtusb_device_handle *handle, const char *name,
+                      const libnxtusb_note_t *notes, const unsigned int n
+                      ) {
+  uint8_t *rmd;
+  uint32_t size;
+
+  if (nxt_melody_compile(notes, n, &rmd, &size) != 0) {
+    return -1;
+  }
+  int ret = nxt_file_upload(handle, name, rmd, size);
+  free(rmd);
+  return ret;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file nxt_melody.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Tone sequences and melody files. Public header
+ *
+ * Brick plays one tone at a time and new tone replaces playing one, so
+ * sequence played from host needs each tone command sent at its time.
+ * nxt_melody_play schedules notes against monotonic clock, sends them as
+ * no-reply commands and starts every send earlier by estimated one-way
+ * latency (see nxt_timing_get). Note which is due while host is late is
+ * shortened so the rest keeps time, note which is already over is
+ * skipped.
+ *
+ * For playback without any host timing, sequence compiles into RMD
+ * melody file which firmware plays itself (see nxt_play_soundfile).
+ */
+
+#ifndef NXT_MELODY_H
+#define NXT_MELODY_H
+#include "libnxtusb.h"
+
+/** \ingroup melody
+ * Melody note
+ */
+typedef struct {
+  /** Frequency, Hz (200 to 14000, 0 = rest) */
+  uint16_t freq;
+  /** Duration, ms */
+  uint16_t duration_ms;
+  /** Silence after note, ms */
+  uint16_t gap_ms;
+} libnxtusb_note_t;
+
+/** \ingroup melody
+ * Playback statistics
+ */
+typedef struct {
+  /** Notes in sequence */
+  unsigned int notes;
+  /** Tone commands sent */
+  unsigned int sent;
+  /** Notes shortened because host was late */
+  unsigned int shortened;
+  /** Notes skipped because host was late */
+  unsigned int skipped;
+  /** Worst lateness against note start, us */
+  unsigned int max_late_us;
+  /** Latency compensation used, us */
+  unsigned int lead_us;
+} libnxtusb_melody_stats_t;
+
+/**
+ * \defgroup melody Tone sequences and melodies.
+ */
+
+/** \ingroup melody
+ *  Play notes from host. Blocks until last note is sent.
+ *  Stops early on nxt_emergency_stop.
+ * @param handle nxt brick handle
+ * @param notes notes
+ * @param n number of notes
+ * @param stats libnxtusb_melody_stats_t* playback statistics (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_melody_play(
+        const libnxtusb_device_handle *handle, const libnxtusb_note_t *notes,
+        const unsigned int n, libnxtusb_melody_stats_t *stats
+        );
+
+/** \ingroup melody
+ *  Compile notes into RMD melody file
+ * @param notes notes
+ * @param n number of notes
+ * @param rmd RMD file contents, free with free()
+ * @param size RMD size
+ * @return 0 on success, -1 on failure
+ */
+int nxt_melody_compile(const libnxtusb_note_t *notes, const unsigned int n, uint8_t **rmd, uint32_t *size);
+
+/** \ingroup melody
+ *  Compile notes and upload them as RMD file, replacing brick file of same name
+ * @param handle nxt brick handle
+ * @param name brick file name (.rmd)
+ * @param notes notes
+ * @param n number of notes
+ * @return 0 on success, -1 on failure
+ */
+int nxt_melody_upload(
+        const libnxtusb_device_handle *handle, const char *name,
+        const libnxtusb_note_t *notes, const unsigned int n
+        );
+
+#endif
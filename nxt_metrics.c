@@ -0,0 +1,266 @@
+/**
+ * @file nxt_metrics.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Per-opcode counters and latency histograms.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nxt_private.h"
+
+const uint32_t nxt_metrics_bucket_us[NXT_METRICS_BUCKETS - 1] = {
+  250, 500, 1000, 2000, 4000, 8000, 16000, 32000, 64000, 128000, 256000, 512000, 1024000
+};
+
+//internal. account one round trip
+
+void nxt_metrics_latency(nxt_opcode_metrics_t *m, const uint64_t ns) {
+  int b = 0;
+  while (b < NXT_METRICS_BUCKETS - 1 && ns > (uint64_t) nxt_metrics_bucket_us[b] * 1000) {
+    b++;
+  }
+  atomic_fetch_add_explicit(&m->latency[b], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&m->latency_sum_ns, ns, memory_order_relaxed);
+}
+
+#define LOAD(x) atomic_load_explicit(&(x), memory_order_relaxed)
+
+int nxt_metrics_snapshot(const libnxtusb_device_handle *handle, libnxtusb_metrics_t *m) {
+  nxt_metrics_t *src = &handle->priv->metrics;
+  int i, b;
+
+  for (i = 0; i < 256; i++) {
+    nxt_opcode_metrics_t *s = &src->op[i];
+    libnxtusb_opcode_metrics_t *d = &m->opcode[i];
+    d->requests = LOAD(s->requests);
+    d->replies = LOAD(s->replies);
+    d->timeouts = LOAD(s->timeouts);
+    d->short_reads = LOAD(s->short_reads);
+    d->mismatches = LOAD(s->mismatches);
+    d->status_errors = LOAD(s->status_errors);
+    d->send_errors = LOAD(s->send_errors);
+    d->recv_errors = LOAD(s->recv_errors);
+    d->retries = LOAD(s->retries);
+    d->late_replies = LOAD(s->late_replies);
+    d->bytes_out = LOAD(s->bytes_out);
+    d->bytes_in = LOAD(s->bytes_in);
+    d->latency_sum_ns = LOAD(s->latency_sum_ns);
+    for (b = 0; b < NXT_METRICS_BUCKETS; b++) {
+      d->latency[b] = LOAD(s->latency[b]);
+    }
+    m->status[i] = LOAD(src->status[i]);
+  }
+  return 0;
+}
+
+void nxt_metrics_reset(const libnxtusb_device_handle *handle) {
+  nxt_metrics_t *m = &handle->priv->metrics;
+  int i, b;
+
+  for (i = 0; i < 256; i++) {
+    nxt_opcode_metrics_t *s = &m->op[i];
+    atomic_store_explicit(&s->requests, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->replies, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->timeouts, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->short_reads, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->mismatches, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->status_errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->send_errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->recv_errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->retries, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->late_replies, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->bytes_out, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->bytes_in, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->latency_sum_ns, 0, memory_order_relaxed);
+    for (b = 0; b < NXT_METRICS_BUCKETS; b++) {
+      atomic_store_explicit(&s->latency[b], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&m->status[i], 0, memory_order_relaxed);
+  }
+}
+
+const char *nxt_opcode_name(const uint8_t opcode) {
+  switch (opcode) {
+    case NXT_OPCODE_STARTPROGRAM: return "start_program";
+    case NXT_OPCODE_STOPPROGRAM: return "stop_program";
+    case NXT_OPCODE_PLAYSOUND: return "play_soundfile";
+    case NXT_OPCODE_PLAYTONE: return "play_tone";
+    case NXT_OPCODE_SET_OUTPUTSTATE: return "set_output_state";
+    case NXT_OPCODE_SET_INPUTMODE: return "set_input_mode";
+    case NXT_OPCODE_GET_OUTPUTSTATE: return "get_output_state";
+    case NXT_OPCODE_GET_INPUTVALUES: return "get_input_values";
+    case NXT_OPCODE_RESET_INPUT_SCALEDVALUES: return "reset_input_scaled_value";
+    case NXT_OPCODE_MESSAGE_WRITE: return "message_write";
+    case NXT_OPCODE_MESSAGE_READ: return "message_read";
+    case NXT_OPCODE_RESET_MOTOR_POSITION: return "reset_motor_position";
+    case NXT_OPCODE_BATTERYLEVEL: return "battery_level";
+    case NXT_OPCODE_STOP_SOUND: return "stop_sound";
+    case NXT_OPCODE_KEEPALIVE: return "keepalive";
+    case NXT_OPCODE_LS_GET_STATUS: return "ls_get_status";
+    case NXT_OPCODE_LS_WRITE: return "ls_write";
+    case NXT_OPCODE_LS_READ: return "ls_read";
+    case NXT_OPCODE_GET_CURRENTPROGRAM_NAME: return "get_current_program_name";
+    case NXT_OPCODE_SYS_OPENREAD: return "sys_openread";
+    case NXT_OPCODE_SYS_OPENWRITE: return "sys_openwrite";
+    case NXT_OPCODE_SYS_READ: return "sys_read";
+    case NXT_OPCODE_SYS_WRITE: return "sys_write";
+    case NXT_OPCODE_SYS_CLOSE: return "sys_close";
+    case NXT_OPCODE_SYS_DELETE: return "sys_delete";
+    case NXT_OPCODE_SYS_FINDFIRST: return "sys_findfirst";
+    case NXT_OPCODE_SYS_FINDNEXT: return "sys_findnext";
+    case NXT_OPCODE_SYS_GET_FIRMVAREVERSION: return "sys_get_firmware_version";
+    case NXT_OPCODE_SYS_OPENLINEARWRITE: return "sys_openlinearwrite";
+    case NXT_OPCODE_SYS_OPENLINEARREAD: return "sys_openlinearread";
+    case NXT_OPCODE_SYS_OPENWRITEDATA: return "sys_openwritedata";
+    case NXT_OPCODE_SYS_OPENAPPENDDATA: return "sys_openappenddata";
+    case NXT_OPCODE_SYS_BOOT: return "sys_boot";
+    case NXT_OPCODE_SYS_SETBRICKNAME: return "sys_setbrickname";
+    case NXT_OPCODE_SYS_GET_DEVICEINFO: return "sys_get_deviceinfo";
+    case NXT_OPCODE_SYS_DELETE_USERFLASH: return "sys_delete_userflash";
+    case NXT_OPCODE_SYS_POLLCOMMAND_LENGTH: return "sys_pollcommand_length";
+    case NXT_OPCODE_SYS_POLLCOMMAND: return "sys_pollcommand";
+    case NXT_OPCODE_SYS_RESET_BLUETOOTH: return "sys_reset_bluetooth";
+    default: return NULL;
+  }
+}
+
+// snprintf-like appender, keeps counting past end of buffer
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t pos;
+} prom_out_t;
+
+static void prom_printf(prom_out_t *o, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(o->pos < o->len ? o->buf + o->pos : NULL, o->pos < o->len ? o->len - o->pos : 0, fmt, ap);
+  va_end(ap);
+  if (n > 0) {
+    o->pos += n;
+  }
+}
+
+static void prom_labels(char *dst, const size_t len, const char *brick, const uint8_t opcode) {
+  char esc[64];
+  size_t i = 0;
+  const char *name = nxt_opcode_name(opcode);
+
+  for (; brick != NULL && *brick && i + 2 < sizeof (esc); brick++) {
+    if (*brick == '"' || *brick == '\\') {
+      esc[i++] = '\\';
+    }
+    esc[i++] = (*brick == '\n') ? ' ' : *brick;
+  }
+  esc[i] = 0;
+  if (name != NULL) {
+    snprintf(dst, len, "brick=\"%s\",opcode=\"%s\"", esc, name);
+  } else {
+    snprintf(dst, len, "brick=\"%s\",opcode=\"0x%02x\"", esc, opcode);
+  }
+}
+
+int nxt_metrics_prometheus(
+                           const libnxtusb_device_handle *handle, const char *brick,
+                           char *buf, const size_t len
+                           ) {
+  static const struct {
+    const char *name;
+    const char *help;
+    size_t offset;
+  } counters[] = {
+    {"nxt_requests_total", "Requests sent to brick.", offsetof(libnxtusb_opcode_metrics_t, requests)},
+    {"nxt_replies_total", "Replies received from brick.", offsetof(libnxtusb_opcode_metrics_t, replies)},
+    {"nxt_timeouts_total", "USB send or receive timeouts.", offsetof(libnxtusb_opcode_metrics_t, timeouts)},
+    {"nxt_short_reads_total", "Replies of unexpected length.", offsetof(libnxtusb_opcode_metrics_t, short_reads)},
+    {"nxt_opcode_mismatches_total", "Replies of unexpected type or opcode.", offsetof(libnxtusb_opcode_metrics_t, mismatches)},
+    {"nxt_status_errors_total", "Replies with error status.", offsetof(libnxtusb_opcode_metrics_t, status_errors)},
+    {"nxt_send_errors_total", "USB send failures other than timeouts.", offsetof(libnxtusb_opcode_metrics_t, send_errors)},
+    {"nxt_recv_errors_total", "USB receive failures other than timeouts.", offsetof(libnxtusb_opcode_metrics_t, recv_errors)},
+    {"nxt_retries_total", "Repeated attempts of idempotent reads.", offsetof(libnxtusb_opcode_metrics_t, retries)},
+    {"nxt_late_replies_total", "Late replies to timed out requests, discarded.", offsetof(libnxtusb_opcode_metrics_t, late_replies)},
+    {"nxt_sent_bytes_total", "Bytes sent to brick.", offsetof(libnxtusb_opcode_metrics_t, bytes_out)},
+    {"nxt_received_bytes_total", "Bytes received from brick.", offsetof(libnxtusb_opcode_metrics_t, bytes_in)}
+  };
+  prom_out_t o = {buf, len, 0};
+  char labels[128];
+  unsigned int c;
+  int i, b;
+
+  libnxtusb_metrics_t *m = malloc(sizeof (libnxtusb_metrics_t));
+  if (m == NULL) {
+    return -1;
+  }
+  nxt_metrics_snapshot(handle, m);
+
+  for (c = 0; c < sizeof (counters) / sizeof (counters[0]); c++) {
+    prom_printf(&o, "# HELP %s %s\n# TYPE %s counter\n", counters[c].name, counters[c].help, counters[c].name);
+    for (i = 0; i < 256; i++) {
+      const libnxtusb_opcode_metrics_t *op = &m->opcode[i];
+      if (op->requests == 0 && op->replies == 0) {
+        continue;
+      }
+      prom_labels(labels, sizeof (labels), brick, i);
+      prom_printf(&o, "%s{%s} %llu\n", counters[c].name, labels,
+                  (unsigned long long) *(const uint64_t*) ((const char*) op + counters[c].offset));
+    }
+  }
+
+  prom_printf(&o, "# HELP nxt_request_duration_seconds Round trip from request to reply.\n"
+              "# TYPE nxt_request_duration_seconds histogram\n");
+  for (i = 0; i < 256; i++) {
+    const libnxtusb_opcode_metrics_t *op = &m->opcode[i];
+    if (op->replies == 0) {
+      continue;
+    }
+    uint64_t cum = 0;
+    prom_labels(labels, sizeof (labels), brick, i);
+    for (b = 0; b < NXT_METRICS_BUCKETS - 1; b++) {
+      cum += op->latency[b];
+      prom_printf(&o, "nxt_request_duration_seconds_bucket{%s,le=\"%g\"} %llu\n", labels,
+                  nxt_metrics_bucket_us[b] / 1e6, (unsigned long long) cum);
+    }
+    cum += op->latency[b];
+    prom_printf(&o, "nxt_request_duration_seconds_bucket{%s,le=\"+Inf\"} %llu\n", labels, (unsigned long long) cum);
+    prom_printf(&o, "nxt_request_duration_seconds_sum{%s} %.9f\n", labels, op->latency_sum_ns / 1e9);
+    prom_printf(&o, "nxt_request_duration_seconds_count{%s} %llu\n", labels, (unsigned long long) cum);
+  }
+
+  prom_printf(&o, "# HELP nxt_reply_status_total Replies by brick status code.\n"
+              "# TYPE nxt_reply_status_total counter\n");
+  prom_labels(labels, sizeof (labels), brick, 0);
+  *strstr(labels, ",opcode=") = 0;
+  for (i = 0; i < 256; i++) {
+    if (m->status[i] == 0) {
+      continue;
+    }
+    prom_printf(&o, "nxt_reply_status_total{%s,status=\"0x%02x\"} %llu\n", labels, i,
+                (unsigned long long) m->status[i]);
+  }
+
+  free(m);
+  return (int) o.pos;
+}
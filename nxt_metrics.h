@@ -0,0 +1,126 @@
+/**
+ * @file nxt_metrics.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Per-opcode counters and latency histograms. Public header
+ */
+
+#ifndef NXT_METRICS_H
+#define NXT_METRICS_H
+#include <stddef.h>
+#include "libnxtusb.h"
+
+/** \ingroup metrics
+ * Number of latency histogram buckets, last one is +Inf
+ */
+#define NXT_METRICS_BUCKETS 14
+
+/** \ingroup metrics
+ * Upper bounds of latency buckets in us (last one is unbounded)
+ */
+extern const uint32_t nxt_metrics_bucket_us[NXT_METRICS_BUCKETS - 1];
+
+/** \ingroup metrics
+ * Counters of one opcode
+ */
+typedef struct {
+  /** Requests sent (or attempted) */
+  uint64_t requests;
+  /** Replies received */
+  uint64_t replies;
+  /** Send or receive timeouts */
+  uint64_t timeouts;
+  /** Replies shorter or longer than expected */
+  uint64_t short_reads;
+  /** Replies of wrong type or opcode */
+  uint64_t mismatches;
+  /** Replies with status other than NXT_STATUS_OK */
+  uint64_t status_errors;
+  /** Send failures other than timeout */
+  uint64_t send_errors;
+  /** Receive failures other than timeout */
+  uint64_t recv_errors;
+  /** Repeated attempts of idempotent reads */
+  uint64_t retries;
+  /** Late replies to timed out requests, discarded */
+  uint64_t late_replies;
+  /** Bytes sent */
+  uint64_t bytes_out;
+  /** Bytes received */
+  uint64_t bytes_in;
+  /** Sum of round-trip latencies, ns */
+  uint64_t latency_sum_ns;
+  /** Round-trip latency histogram (not cumulative) */
+  uint64_t latency[NXT_METRICS_BUCKETS];
+} libnxtusb_opcode_metrics_t;
+
+/** \ingroup metrics
+ * Snapshot of handle metrics
+ */
+typedef struct {
+  /** Per-opcode counters, indexed by opcode */
+  libnxtusb_opcode_metrics_t opcode[256];
+  /** Replies per status, indexed by libnxtusb_status_t */
+  uint64_t status[256];
+} libnxtusb_metrics_t;
+
+/**
+ * \defgroup metrics Metrics.
+ */
+
+/** \ingroup metrics
+ *  Copy counters. Counters are updated lock-free, so snapshot
+ *  may be taken from any thread.
+ * @param handle nxt brick handle
+ * @param m libnxtusb_metrics_t* snapshot (preallocated)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_metrics_snapshot(const libnxtusb_device_handle *handle, libnxtusb_metrics_t *m);
+
+/** \ingroup metrics
+ *  Zero all counters
+ * @param handle nxt brick handle
+ */
+void nxt_metrics_reset(const libnxtusb_device_handle *handle);
+
+/** \ingroup metrics
+ *  Get opcode name as used in metric labels
+ * @param opcode command opcode
+ * @return name or NULL if opcode is unknown
+ */
+const char *nxt_opcode_name(const uint8_t opcode);
+
+/** \ingroup metrics
+ *  Write metrics in Prometheus text exposition format
+ * @param handle nxt brick handle
+ * @param brick value of brick label (may be NULL)
+ * @param buf output buffer
+ * @param len buffer size
+ * @return length of full output (like snprintf), -1 on failure.
+ *         Output is truncated if return value >= len
+ */
+int nxt_metrics_prometheus(
+        const libnxtusb_device_handle *handle, const char *brick,
+        char *buf, const size_t len
+        );
+
+#endif
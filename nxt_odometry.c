@@ -0,0 +1,240 @@
+/**
+ * @file nxt_odometry.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Odometry of differential-drive robots.
+ */
+
+#include <string.h>
+#include "nxt_private.h"
+
+// pi as Q29, 2^31 / pi
+#define PI_Q29 1686629713LL
+#define INV_PI_Q31 683565276LL
+// CORDIC gain as Q30
+#define CORDIC_K 652032874
+#define CORDIC_STEPS 30
+// longest gap integrated in sub-steps
+#define MAX_SUBSTEPS 64
+
+// atan(2^-i) as binary angle
+static const int32_t cordic_atan[CORDIC_STEPS] = {
+  536870912, 316933406, 167458907, 85004756, 42667331, 21354465, 10679838, 5340245,
+  2670163, 1335087, 667544, 333772, 166886, 83443, 41722, 20861,
+  10430, 5215, 2608, 1304, 652, 326, 163, 81,
+  41, 20, 10, 5, 3, 1
+};
+
+// cos and sin of binary angle as Q30, same result on every host
+static void odo_sincos(const uint32_t angle, int32_t *c, int32_t *s) {
+  int32_t z = (int32_t) angle;
+  int flip = 0;
+  int i;
+
+  // CORDIC converges within +-pi/2
+  if (z > 0x40000000 || z < -0x40000000) {
+    z = (int32_t) (angle + 0x80000000U);
+    flip = 1;
+  }
+  int64_t x = CORDIC_K, y = 0;
+  for (i = 0; i < CORDIC_STEPS; i++) {
+    int64_t nx, ny;
+    if (z >= 0) {
+      nx = x - (y >> i);
+      ny = y + (x >> i);
+      z -= cordic_atan[i];
+    } else {
+      nx = x + (y >> i);
+      ny = y - (x >> i);
+      z += cordic_atan[i];
+    }
+    x = nx;
+    y = ny;
+  }
+  *c = flip ? -x : x;
+  *s = flip ? -y : y;
+}
+
+static int32_t odo_count(const libnxtusb_odometry_t *o, const libnxtusb_outputstate_t *st, const int reversed) {
+  int32_t v;
+
+  switch (o->cfg.counter) {
+    case NXT_ODO_TACHO:
+      v = st->tacho_count;
+      break;
+    case NXT_ODO_BLOCK:
+      v = st->block_tacho_count;
+      break;
+    default:
+      v = st->rotation_count;
+      break;
+  }
+  return reversed ? (int32_t) (0U - (uint32_t) v) : v;
+}
+
+int nxt_odometry_init(libnxtusb_odometry_t *o, const libnxtusb_odometry_config_t *cfg) {
+  if (cfg->wheel_diameter_um == 0 || cfg->track_um == 0 || cfg->counts_per_rev == 0 ||
+      cfg->left >= 3 || cfg->right >= 3 || cfg->left == cfg->right || cfg->counter > NXT_ODO_BLOCK) {
+    return -1;
+  }
+  memset(o, 0, sizeof (libnxtusb_odometry_t));
+  o->cfg = *cfg;
+  // pi * d / counts, um to mm, Q29 to Q32
+  o->mm_per_count = ((int64_t) cfg->wheel_diameter_um * PI_Q29 * 8) / (1000LL * cfg->counts_per_rev);
+  o->track = ((int64_t) cfg->track_um << 16) / 1000;
+  return 0;
+}
+
+void nxt_odometry_set_pose(libnxtusb_odometry_t *o, const int64_t x, const int64_t y, const uint32_t heading) {
+  o->pose.x = x;
+  o->pose.y = y;
+  o->pose.heading = heading;
+  memset(o->pose.cov, 0, sizeof (o->pose.cov));
+}
+
+void nxt_odometry_rebase(libnxtusb_odometry_t *o) {
+  o->based = 0;
+}
+
+// one step with wheel travels sl, sr (mm Q16.16), midpoint rule
+static void odo_step(libnxtusb_odometry_t *o, const int64_t sl, const int64_t sr) {
+  libnxtusb_pose_t *p = &o->pose;
+  int64_t ds = (sl + sr) / 2;
+  int32_t dth = (int32_t) (((sr - sl) * INV_PI_Q31) / o->track);
+  int32_t c, s;
+  int i, j, k;
+
+  odo_sincos(p->heading + (uint32_t) (dth / 2), &c, &s);
+  p->x += (ds * c) >> 30;
+  p->y += (ds * s) >> 30;
+  p->heading += (uint32_t) dth;
+
+  // P = F P F' + G Q G'
+  const float fc = c / 1073741824.0f;
+  const float fs = s / 1073741824.0f;
+  const float fds = ds / 65536.0f;
+  const float b = o->track / 65536.0f;
+  const float F[3][3] = {
+    {1, 0, -fds * fs},
+    {0, 1, fds * fc},
+    {0, 0, 1}
+  };
+  const float G[3][2] = {
+    {fc / 2 + fds * fs / (2 * b), fc / 2 - fds * fs / (2 * b)},
+    {fs / 2 - fds * fc / (2 * b), fs / 2 + fds * fc / (2 * b)},
+    {-1 / b, 1 / b}
+  };
+  const float k2 = o->cfg.slip * o->cfg.slip;
+  const float ql = k2 * (sl < 0 ? -sl : sl) / 65536.0f;
+  const float qr = k2 * (sr < 0 ? -sr : sr) / 65536.0f;
+  float FP[3][3], P[3][3];
+  for (i = 0; i < 3; i++) {
+    for (j = 0; j < 3; j++) {
+      FP[i][j] = 0;
+      for (k = 0; k < 3; k++) {
+        FP[i][j] += F[i][k] * p->cov[k][j];
+      }
+    }
+  }
+  for (i = 0; i < 3; i++) {
+    for (j = 0; j < 3; j++) {
+      P[i][j] = G[i][0] * ql * G[j][0] + G[i][1] * qr * G[j][1];
+      for (k = 0; k < 3; k++) {
+        P[i][j] += FP[i][k] * F[j][k];
+      }
+    }
+  }
+  memcpy(p->cov, P, sizeof (P));
+}
+
+int nxt_odometry_update(
+                        libnxtusb_odometry_t *o, const libnxtusb_outputstate_t *left,
+                        const libnxtusb_outputstate_t *right, const uint64_t t_ns
+                        ) {
+  if (left->port != o->cfg.left || right->port != o->cfg.right) {
+    return -1;
+  }
+  int32_t cl = odo_count(o, left, o->cfg.left_reversed);
+  int32_t cr = odo_count(o, right, o->cfg.right_reversed);
+  if (!o->based) {
+    o->prev_left = cl;
+    o->prev_right = cr;
+    o->pose.t_ns = t_ns;
+    o->based = 1;
+    return 0;
+  }
+  // modulo 2^32, wrap is just another step
+  int32_t dl = (int32_t) ((uint32_t) cl - (uint32_t) o->prev_left);
+  int32_t dr = (int32_t) ((uint32_t) cr - (uint32_t) o->prev_right);
+  o->prev_left = cl;
+  o->prev_right = cr;
+
+  int64_t steps = 1;
+  const uint64_t interval = o->cfg.sample_interval_us * 1000ULL;
+  if (interval != 0 && t_ns > o->pose.t_ns && t_ns - o->pose.t_ns > interval * 3 / 2) {
+    steps = (t_ns - o->pose.t_ns + interval / 2) / interval;
+    o->pose.missed += steps - 1;
+    if (steps > MAX_SUBSTEPS) {
+      steps = MAX_SUBSTEPS;
+    }
+  }
+  // Q32 to Q16.16
+  const int64_t sl = ((int64_t) dl * o->mm_per_count) >> 16;
+  const int64_t sr = ((int64_t) dr * o->mm_per_count) >> 16;
+  int64_t i;
+  for (i = 0; i < steps; i++) {
+    // remainder goes to last step, sum is exact
+    int64_t pl = sl / steps + (i == steps - 1 ? sl % steps : 0);
+    int64_t pr = sr / steps + (i == steps - 1 ? sr % steps : 0);
+    odo_step(o, pl, pr);
+  }
+  o->pose.t_ns = t_ns;
+  o->pose.samples++;
+  return 0;
+}
+
+int nxt_odometry_poll(const libnxtusb_device_handle *handle, libnxtusb_odometry_t *o) {
+  cmd_port_t cl = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_OUTPUTSTATE, o->cfg.left};
+  cmd_port_t cr = {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_OUTPUTSTATE, o->cfg.right};
+  libnxtusb_raw_cmd_t cmds[2];
+  libnxtusb_outputstate_t left, right;
+
+  memset(cmds, 0, sizeof (cmds));
+  cmds[0].request = (const uint8_t*) &cl;
+  cmds[0].length = sizeof (cl);
+  cmds[1].request = (const uint8_t*) &cr;
+  cmds[1].length = sizeof (cr);
+  if (nxt_pipeline(handle, cmds, 2) != 0 ||
+      cmds[0].reply_length != sizeof (libnxtusb_outputstate_t) ||
+      cmds[1].reply_length != sizeof (libnxtusb_outputstate_t) ||
+      cmds[0].reply[2] != NXT_STATUS_OK || cmds[1].reply[2] != NXT_STATUS_OK) {
+    return -1;
+  }
+  uint64_t now = nxt_time_ns();
+  memcpy(&left, cmds[0].reply, sizeof (left));
+  memcpy(&right, cmds[1].reply, sizeof (right));
+  return nxt_odometry_update(o, &left, &right, now);
+}
+
+void nxt_odometry_pose(const libnxtusb_odometry_t *o, libnxtusb_pose_t *pose) {
+  *pose = o->pose;
+}
@@ -0,0 +1,178 @@
+/**
+ * @file nxt_odometry.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Odometry of differential-drive robots. Public header
+ *
+ * Pose is integrated from output state samples of the two wheel motors
+ * in fixed point: position in mm as Q16.16, heading as binary angle
+ * (2^32 = full turn, 0 = +x axis, counter-clockwise positive). Same
+ * samples give bit-identical pose on every host. Counter deltas are taken
+ * modulo 2^32, so counter wrap is harmless. When sampling interval is
+ * configured, gaps longer than 1.5 intervals count as missed samples and
+ * the step is integrated in as many sub-steps.
+ *
+ * Covariance (x, y in mm^2, heading in rad^2) follows usual wheel-slip
+ * model: each wheel's travel error has variance slip^2 * |travel in mm|.
+ * Covariance is float and is an estimate, pose is exact.
+ */
+
+#ifndef NXT_ODOMETRY_H
+#define NXT_ODOMETRY_H
+#include "libnxtusb.h"
+
+/** \ingroup odometry
+ * Q16.16 mm to mm
+ */
+#define NXT_ODO_MM(q16) ((double) (q16) / 65536.0)
+
+/** \ingroup odometry
+ * Binary angle to radians, -pi to pi
+ */
+#define NXT_ODO_RAD(bam) ((double) (int32_t) (bam) * 3.14159265358979323846 / 2147483648.0)
+
+/** \ingroup odometry
+ * Counter used for odometry
+ */
+typedef enum {
+  /** rotation_count, survives block resets (default) */
+  NXT_ODO_ROTATION = 0,
+  /** tacho_count */
+  NXT_ODO_TACHO,
+  /** block_tacho_count */
+  NXT_ODO_BLOCK
+} libnxtusb_odo_counter_t;
+
+/** \ingroup odometry
+ * Robot geometry
+ */
+typedef struct {
+  /** Left wheel motor */
+  libnxtusb_out_t left;
+  /** Right wheel motor */
+  libnxtusb_out_t right;
+  /** Wheel diameter, um */
+  uint32_t wheel_diameter_um;
+  /** Distance between wheel contact points, um */
+  uint32_t track_um;
+  /** Counts per wheel turn, 360 for direct drive. Geared: multiply */
+  uint32_t counts_per_rev;
+  /** 1 if motor counts backwards when robot goes forward */
+  uint8_t left_reversed;
+  uint8_t right_reversed;
+  /** libnxtusb_odo_counter_t counter */
+  uint8_t counter;
+  /** Nominal sampling interval, us. 0 = don't detect missed samples */
+  uint32_t sample_interval_us;
+  /** Wheel slip coefficient, mm^0.5 */
+  float slip;
+} libnxtusb_odometry_config_t;
+
+/** \ingroup odometry
+ * Pose estimate
+ */
+typedef struct {
+  /** Position, mm Q16.16 */
+  int64_t x;
+  int64_t y;
+  /** Heading, binary angle */
+  uint32_t heading;
+  /** Time of last sample, ns */
+  uint64_t t_ns;
+  /** Covariance of x, y, heading */
+  float cov[3][3];
+  /** Samples integrated */
+  uint64_t samples;
+  /** Samples detected missing */
+  uint64_t missed;
+} libnxtusb_pose_t;
+
+/** \ingroup odometry
+ * Odometry state. Fill with nxt_odometry_init, don't touch fields
+ */
+typedef struct {
+  libnxtusb_odometry_config_t cfg;
+  // mm per count, Q32
+  int64_t mm_per_count;
+  // track, mm Q16.16
+  int64_t track;
+  int32_t prev_left;
+  int32_t prev_right;
+  int based;
+  libnxtusb_pose_t pose;
+} libnxtusb_odometry_t;
+
+/**
+ * \defgroup odometry Odometry.
+ */
+
+/** \ingroup odometry
+ *  Initialize odometry at origin, heading 0
+ * @param o libnxtusb_odometry_t* state
+ * @param cfg libnxtusb_odometry_config_t* geometry
+ * @return 0 on success, -1 on bad geometry
+ */
+int nxt_odometry_init(libnxtusb_odometry_t *o, const libnxtusb_odometry_config_t *cfg);
+
+/** \ingroup odometry
+ *  Set pose, covariance is cleared
+ * @param o libnxtusb_odometry_t* state
+ * @param x, y position, mm Q16.16
+ * @param heading binary angle
+ */
+void nxt_odometry_set_pose(libnxtusb_odometry_t *o, const int64_t x, const int64_t y, const uint32_t heading);
+
+/** \ingroup odometry
+ *  Take next sample as new reference, e.g. after nxt_reset_motor_position
+ * @param o libnxtusb_odometry_t* state
+ */
+void nxt_odometry_rebase(libnxtusb_odometry_t *o);
+
+/** \ingroup odometry
+ *  Integrate one sample. First sample only sets reference
+ * @param o libnxtusb_odometry_t* state
+ * @param left libnxtusb_outputstate_t* left motor state
+ * @param right libnxtusb_outputstate_t* right motor state
+ * @param t_ns sample time, nxt_time_ns clock
+ * @return 0 on success, -1 if states are not of configured ports
+ */
+int nxt_odometry_update(
+        libnxtusb_odometry_t *o, const libnxtusb_outputstate_t *left,
+        const libnxtusb_outputstate_t *right, const uint64_t t_ns
+        );
+
+/** \ingroup odometry
+ *  Read both motors in one round trip and integrate
+ * @param handle nxt brick handle
+ * @param o libnxtusb_odometry_t* state
+ * @return 0 on success, -1 on failure
+ */
+int nxt_odometry_poll(const libnxtusb_device_handle *handle, libnxtusb_odometry_t *o);
+
+/** \ingroup odometry
+ *  Get pose
+ * @param o libnxtusb_odometry_t* state
+ * @param pose libnxtusb_pose_t* pose (preallocated)
+ */
+void nxt_odometry_pose(const libnxtusb_odometry_t *o, libnxtusb_pose_t *pose);
+
+#endif
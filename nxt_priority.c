@@ -0,0 +1,137 @@
+/**
+ * @file nxt_priority.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Command priorities and emergency stop.
+ */
+
+#include "nxt_private.h"
+
+//internal. init channel of new handle
+
+void nxt_channel_init(nxt_channel_t *c) {
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->cond, NULL);
+}
+
+void nxt_channel_destroy(nxt_channel_t *c) {
+  pthread_cond_destroy(&c->cond);
+  pthread_mutex_destroy(&c->lock);
+}
+
+// someone more urgent is waiting
+static int channel_outranked(const nxt_channel_t *c, const libnxtusb_priority_t prio) {
+  int p;
+
+  for (p = prio + 1; p < NXT_PRIO_COUNT; p++) {
+    if (c->waiting[p] > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+//internal. wait until channel is free and no more urgent command waits
+
+void nxt_channel_acquire(nxt_channel_t *c, const libnxtusb_priority_t prio) {
+  uint64_t start = nxt_time_ns();
+
+  pthread_mutex_lock(&c->lock);
+  c->waiting[prio]++;
+  while (c->busy || channel_outranked(c, prio)) {
+    pthread_cond_wait(&c->cond, &c->lock);
+  }
+  c->waiting[prio]--;
+  c->busy = 1;
+
+  uint64_t wait = nxt_time_ns() - start;
+  c->stats.acquired[prio]++;
+  c->stats.wait_sum_ns[prio] += wait;
+  if (wait > c->stats.wait_max_ns[prio]) {
+    c->stats.wait_max_ns[prio] = wait;
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+void nxt_channel_release(nxt_channel_t *c) {
+  pthread_mutex_lock(&c->lock);
+  c->busy = 0;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+}
+
+libnxtusb_priority_t nxt_opcode_priority(const uint8_t opcode) {
+  switch (nxt_opcode_class(opcode)) {
+    case NXT_CLASS_ACTUATOR:
+      return NXT_PRIO_RT;
+    case NXT_CLASS_READ:
+      return NXT_PRIO_NORMAL;
+    default:
+      return NXT_PRIO_BULK;
+  }
+}
+
+int nxt_emergency_stop(const libnxtusb_device_handle *handle) {
+  nxt_channel_t *c = &handle->priv->channel;
+  uint64_t start = nxt_time_ns();
+
+  // announced before waiting, so trajectories stop feeding the channel
+  atomic_fetch_add_explicit(&c->estop_gen, 1, memory_order_relaxed);
+  cmd_setoutput_t cmd = {
+    NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_SET_OUTPUTSTATE, NXT_OUT_ALL, 0,
+    NXT_MOTOR_MODE_ON | NXT_MOTOR_MODE_BRAKE, NXT_MOTOR_REGULATION_IDLE, 0,
+    NXT_MOTOR_RUNSTATE_RUNNING, 0
+  };
+  ret_status_t st;
+
+  nxt_channel_acquire(c, NXT_PRIO_ESTOP);
+  pthread_mutex_lock(&c->lock);
+  handle->priv->writes.queued_outputs = 0;
+  pthread_mutex_unlock(&c->lock);
+  // no retries, no reconnect: brick which is gone is stopped anyway
+  handle->priv->timeouts.last_io_error = 0;
+  // brake goes out even past caller's deadline, with plain phase timeouts
+  uint64_t deadline_ns = nxt_deadline_get(&handle->priv->timeouts);
+  nxt_deadline_set(&handle->priv->timeouts, 0);
+  int ret = nxt_transact_locked(handle, &cmd, sizeof (cmd), &st, sizeof (st));
+  nxt_deadline_set(&handle->priv->timeouts, deadline_ns);
+  nxt_write_done(&handle->priv->writes, (const unsigned char*) &cmd, sizeof (cmd), ret == 0);
+
+  uint64_t latency = nxt_time_ns() - start;
+  pthread_mutex_lock(&c->lock);
+  c->stats.estops++;
+  c->stats.estop_last_ns = latency;
+  if (latency > c->stats.estop_max_ns) {
+    c->stats.estop_max_ns = latency;
+  }
+  pthread_mutex_unlock(&c->lock);
+  nxt_channel_release(c);
+  return ret;
+}
+
+void nxt_channel_stats(const libnxtusb_device_handle *handle, libnxtusb_channel_stats_t *stats) {
+  nxt_channel_t *c = &handle->priv->channel;
+
+  pthread_mutex_lock(&c->lock);
+  *stats = c->stats;
+  pthread_mutex_unlock(&c->lock);
+}
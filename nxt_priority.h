@@ -0,0 +1,101 @@
+/**
+ * @file nxt_priority.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Command priorities and emergency stop. Public header
+ *
+ * Handle may be shared between threads. Every request/reply exchange
+ * takes the channel, and when channel is released it goes to the waiting
+ * command of highest priority: actuator commands first, then reads, then
+ * system commands. Multi-packet work gives up the channel between
+ * packets (and between retries), so urgent command waits for at most
+ * one exchange already on the bus.
+ */
+
+#ifndef NXT_PRIORITY_H
+#define NXT_PRIORITY_H
+#include "libnxtusb.h"
+
+/** \ingroup priority
+ * Channel priorities, higher is more urgent
+ */
+typedef enum {
+  /** System commands (files, firmware) */
+  NXT_PRIO_BULK = 0,
+  /** Reads */
+  NXT_PRIO_NORMAL,
+  /** Actuator commands */
+  NXT_PRIO_RT,
+  /** Emergency stop */
+  NXT_PRIO_ESTOP,
+
+  NXT_PRIO_COUNT
+} libnxtusb_priority_t;
+
+/** \ingroup priority
+ * Channel statistics
+ */
+typedef struct {
+  /** Channel acquisitions per priority */
+  uint64_t acquired[NXT_PRIO_COUNT];
+  /** Sum of waits for channel per priority, ns */
+  uint64_t wait_sum_ns[NXT_PRIO_COUNT];
+  /** Longest wait for channel per priority, ns */
+  uint64_t wait_max_ns[NXT_PRIO_COUNT];
+  /** Emergency stops */
+  uint64_t estops;
+  /** Last emergency stop latency, call to brick acknowledge, ns */
+  uint64_t estop_last_ns;
+  /** Worst emergency stop latency, ns */
+  uint64_t estop_max_ns;
+} libnxtusb_channel_stats_t;
+
+/**
+ * \defgroup priority Priorities and emergency stop.
+ */
+
+/** \ingroup priority
+ *  Brake all motors ahead of any queued command.
+ *  Queued output writes (see nxt_queue_output_state) are dropped and
+ *  running trajectories stop. Deadline of calling thread (see
+ *  nxt_set_deadline) is ignored, so the brake goes out late rather
+ *  than not at all.
+ * @param handle nxt brick handle
+ * @return 0 on success, -1 on failure
+ */
+int nxt_emergency_stop(const libnxtusb_device_handle *handle);
+
+/** \ingroup priority
+ *  Get channel statistics
+ * @param handle nxt brick handle
+ * @param stats libnxtusb_channel_stats_t* statistics (preallocated)
+ */
+void nxt_channel_stats(const libnxtusb_device_handle *handle, libnxtusb_channel_stats_t *stats);
+
+/** \ingroup priority
+ *  Get priority of command opcode
+ * @param opcode command opcode
+ * @return libnxtusb_priority_t priority
+ */
+libnxtusb_priority_t nxt_opcode_priority(const uint8_t opcode);
+
+#endif
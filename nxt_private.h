@@ -0,0 +1,642 @@
+/**
+ * @file nxt_private.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *    
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *    
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *    
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *    
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of Lego NXT direct-command protocol. Internal header,
+ * shared between library modules. Not part of public api.
+ */
+
+#ifndef NXT_PRIVATE_H
+#define NXT_PRIVATE_H
+#include "libnxtusb.h"
+#include <stdatomic.h>
+#include <pthread.h>
+#include "nxt_timing.h"
+#include "nxt_metrics.h"
+#include "nxt_capture.h"
+#include "nxt_timeout.h"
+#include "nxt_resync.h"
+#include "nxt_reconnect.h"
+#include "nxt_writes.h"
+#include "nxt_priority.h"
+#include "nxt_broadcast.h"
+#include "nxt_daemon.h"
+#include "nxt_telemetry.h"
+#include "nxt_tcp.h"
+#include "nxt_bluetooth.h"
+#include "nxt_wait.h"
+#include "nxt_filter.h"
+#include "nxt_odometry.h"
+#include "nxt_sim.h"
+#include "nxt_files.h"
+#include "nxt_sound.h"
+#include "nxt_melody.h"
+#include "nxt_datalog.h"
+#include "nxt_deploy.h"
+
+// largest packet on the wire
+#define NXT_PACKET_SIZE 64
+
+// usb serial buffer, nxt serial is 12 hex digits
+#define NXT_SERIAL_SIZE 32
+
+// packet type
+
+enum {
+  NXT_DIRECT_COMMAND_DOREPLY = 0x00,
+  NXT_SYSTEM_COMMAND_DOREPLY = 0x01,
+  NXT_COMMAND_REPLY = 0x02,
+  NXT_DIRECT_COMMAND_NOREPLY = 0x80,
+  NXT_SYSTEM_COMMAND_NOREPLY = 0x81,
+};
+
+//packet opcodes
+
+enum {
+  NXT_OPCODE_STARTPROGRAM = 0x00,
+  NXT_OPCODE_STOPPROGRAM = 0x01,
+  NXT_OPCODE_PLAYSOUND = 0x02,
+  NXT_OPCODE_PLAYTONE = 0x03,
+  NXT_OPCODE_SET_OUTPUTSTATE = 0x04,
+  NXT_OPCODE_SET_INPUTMODE = 0x05,
+  NXT_OPCODE_GET_OUTPUTSTATE = 0x06,
+  NXT_OPCODE_GET_INPUTVALUES = 0x07,
+  NXT_OPCODE_RESET_INPUT_SCALEDVALUES = 0x08,
+  NXT_OPCODE_MESSAGE_WRITE = 0x09,
+  NXT_OPCODE_MESSAGE_READ = 0x13,
+  NXT_OPCODE_RESET_MOTOR_POSITION = 0x0A,
+  NXT_OPCODE_BATTERYLEVEL = 0x0B,
+  NXT_OPCODE_STOP_SOUND = 0x0C,
+  NXT_OPCODE_KEEPALIVE = 0x0D,
+  NXT_OPCODE_LS_GET_STATUS = 0x0E,
+  NXT_OPCODE_LS_WRITE = 0x0F,
+  NXT_OPCODE_LS_READ = 0x10,
+  NXT_OPCODE_GET_CURRENTPROGRAM_NAME = 0x11,
+  /** \todo system commands */
+  NXT_OPCODE_SYS_OPENREAD = 0x80,
+  NXT_OPCODE_SYS_OPENWRITE = 0x81,
+  NXT_OPCODE_SYS_READ = 0x82,
+  NXT_OPCODE_SYS_WRITE = 0x83,
+  NXT_OPCODE_SYS_CLOSE = 0x84,
+  NXT_OPCODE_SYS_DELETE = 0x85,
+  NXT_OPCODE_SYS_FINDFIRST = 0x86,
+  NXT_OPCODE_SYS_FINDNEXT = 0x87,
+  NXT_OPCODE_SYS_GET_FIRMVAREVERSION = 0x88,
+  NXT_OPCODE_SYS_OPENLINEARWRITE = 0x89,
+  NXT_OPCODE_SYS_OPENLINEARREAD = 0x8A,
+  NXT_OPCODE_SYS_OPENWRITEDATA = 0x8B,
+  NXT_OPCODE_SYS_OPENAPPENDDATA = 0x8C,
+  NXT_OPCODE_SYS_BOOT = 0x97,
+  NXT_OPCODE_SYS_SETBRICKNAME = 0x98,
+  NXT_OPCODE_SYS_GET_DEVICEINFO = 0x9B,
+  NXT_OPCODE_SYS_DELETE_USERFLASH = 0xA0,
+  NXT_OPCODE_SYS_POLLCOMMAND_LENGTH = 0xA1,
+  NXT_OPCODE_SYS_POLLCOMMAND = 0xA2,
+  NXT_OPCODE_SYS_RESET_BLUETOOTH = 0xA4
+};
+
+// packet return types
+#pragma pack(push,1)
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+} ret_status_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint16_t mv;
+} ret_battery_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint32_t msec;
+} ret_keepalive_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  char filename[20];
+} ret_currentprogram_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint8_t bytes_ready;
+} ret_lsstatus_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint8_t bytes_read;
+  char data[16];
+} ret_lsread_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint8_t local_inbox;
+  uint8_t msg_size;
+  char data[58];
+} ret_msgread_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint8_t handle;
+} ret_handle_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint8_t handle;
+  char filename[20];
+  uint32_t size;
+} ret_find_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint8_t handle;
+  uint16_t written;
+} ret_write_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint8_t handle;
+  uint32_t size;
+} ret_openread_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t status;
+  uint8_t handle;
+  uint16_t length;
+  uint8_t data[NXT_PACKET_SIZE - 6];
+} ret_read_t;
+
+// command packet types
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+} cmd_simple_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t port;
+} cmd_port_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t port;
+  uint8_t relative;
+} cmd_resetport_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  char filename[20];
+} cmd_startprogram_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t loop;
+  char filename[20];
+} cmd_playsound_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint16_t freq;
+  uint16_t duration;
+} cmd_playtone_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t port;
+  int8_t power;
+  uint8_t mode;
+  uint8_t regulation;
+  int8_t turn_ratio;
+  uint8_t run_state;
+  uint32_t tacho_limit;
+} cmd_setoutput_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t port;
+  uint8_t stype;
+  uint8_t smode;
+} cmd_setinput_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t port;
+  uint8_t tx_size;
+  uint8_t rx_size;
+  char data[20];
+} cmd_lswrite_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t remote_inbox;
+  uint8_t local_inbox;
+  uint8_t remove;
+} cmd_msgread_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t inbox;
+  uint8_t message_size;
+  char message[59];
+} cmd_msgwrite_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  char filename[20];
+} cmd_filename_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  char filename[20];
+  uint32_t size;
+} cmd_openwrite_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t handle;
+} cmd_handle_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t handle;
+  uint8_t data[NXT_PACKET_SIZE - 3];
+} cmd_write_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t opcode;
+  uint8_t handle;
+  uint16_t length;
+} cmd_read_t;
+
+
+#pragma pack(pop)
+
+// round-trip estimator state, see nxt_timing.c
+typedef struct {
+  uint64_t send_start_ns;
+  uint64_t send_done_ns;
+  uint64_t samples;
+  int64_t rtt_last_ns;
+  int64_t rtt_min_ns;
+  int64_t srtt_ns;
+  int64_t rttvar_ns;
+  libnxtusb_timestamp_t last;
+} nxt_timing_t;
+
+// per-opcode counters, see nxt_metrics.c
+typedef struct {
+  atomic_uint_fast64_t requests;
+  atomic_uint_fast64_t replies;
+  atomic_uint_fast64_t timeouts;
+  atomic_uint_fast64_t short_reads;
+  atomic_uint_fast64_t mismatches;
+  atomic_uint_fast64_t status_errors;
+  atomic_uint_fast64_t send_errors;
+  atomic_uint_fast64_t recv_errors;
+  atomic_uint_fast64_t retries;
+  atomic_uint_fast64_t late_replies;
+  atomic_uint_fast64_t bytes_out;
+  atomic_uint_fast64_t bytes_in;
+  atomic_uint_fast64_t latency_sum_ns;
+  atomic_uint_fast64_t latency[NXT_METRICS_BUCKETS];
+} nxt_opcode_metrics_t;
+
+typedef struct {
+  nxt_opcode_metrics_t op[256];
+  atomic_uint_fast64_t status[256];
+} nxt_metrics_t;
+
+// packet transport. send/recv return bytes transferred or libusb error code
+typedef struct {
+  int (*send)(const libnxtusb_device_handle *handle, const unsigned char *request,
+              const unsigned int length, const unsigned int timeout);
+  int (*recv)(const libnxtusb_device_handle *handle, unsigned char *result,
+              const unsigned int timeout);
+  void (*close)(libnxtusb_device_handle *handle);
+  // reopen same device after it vanished, 0 on success. NULL if transport can't
+  int (*reopen)(libnxtusb_device_handle *handle);
+} nxt_transport_t;
+
+extern const nxt_transport_t nxt_usb_transport;
+extern const nxt_transport_t nxt_tcp_transport;
+extern const nxt_transport_t nxt_fd_transport;
+extern const nxt_transport_t nxt_plain_fd_transport;
+
+// length-prefixed packets over fd, see nxt_stream.c
+typedef struct {
+  int fd;
+  int is_socket;
+  // hold no-reply packets until next receive
+  int batching;
+  unsigned char out[NXT_TCP_BUFFER];
+  unsigned int out_len;
+  unsigned char in[NXT_TCP_BUFFER];
+  unsigned int in_start;
+  unsigned int in_end;
+  libnxtusb_tcp_stats_t stats;
+} nxt_stream_t;
+
+void nxt_stream_attach(nxt_stream_t *s, const int fd);
+int nxt_stream_flush(nxt_stream_t *s, const int timeout);
+int nxt_stream_send(
+                    nxt_stream_t *s, const unsigned char *request,
+                    const unsigned int length, const unsigned int timeout
+                    );
+int nxt_stream_recv(nxt_stream_t *s, unsigned char *result, const unsigned int timeout);
+void nxt_stream_close(nxt_stream_t *s);
+nxt_stream_t *nxt_stream_of(const libnxtusb_device_handle *handle);
+
+// capture record directions
+enum {
+  NXT_CAPTURE_OUT = 0x00,
+  NXT_CAPTURE_IN = 0x01,
+  // receive failed, data is negated libusb error code
+  NXT_CAPTURE_ERROR = 0x02
+};
+
+typedef struct nxt_capture nxt_capture_t;
+
+// shared memory segment of publishing handle, see nxt_telemetry.c
+typedef struct nxt_telemetry nxt_telemetry_t;
+
+// timeout policies and deadline, see nxt_timeout.c
+typedef struct {
+  libnxtusb_timeout_policy_t policy[NXT_CLASS_COUNT];
+  // key of handle in per-thread deadline table
+  uint64_t id;
+  // class of last request, selects receive timeout
+  libnxtusb_cmd_class_t recv_class;
+  int last_io_error;
+} nxt_timeouts_t;
+
+// requests whose reply timed out, oldest first. See nxt_resync.c
+typedef struct {
+  uint8_t opcode[NXT_RESYNC_MAX_OUTSTANDING];
+  uint64_t since_ns[NXT_RESYNC_MAX_OUTSTANDING];
+  unsigned int head;
+  unsigned int count;
+} nxt_owed_t;
+
+// last commanded configuration, see nxt_reconnect.c
+typedef struct {
+  cmd_setinput_t input[4];
+  uint8_t input_set;
+  cmd_setoutput_t output[3];
+  uint8_t output_set;
+  cmd_lswrite_t ls[4][NXT_SHADOW_LS_WRITES];
+  uint8_t ls_count[4];
+} nxt_shadow_t;
+
+typedef struct {
+  unsigned int timeout_ms;
+  unsigned int restore;
+  libnxtusb_reconnect_cb cb;
+  void *arg;
+  // reconnect in progress and end of last successful one, under channel lock
+  int active;
+  uint64_t up_ns;
+  libnxtusb_reconnect_stats_t stats;
+} nxt_reconnect_t;
+
+// acknowledged and queued actuator writes, see nxt_writes.c
+typedef struct {
+  int elide;
+  cmd_setinput_t input[4];
+  uint8_t input_acked;
+  cmd_setoutput_t output[3];
+  uint8_t output_acked;
+  cmd_setinput_t q_input[4];
+  uint8_t queued_inputs;
+  cmd_setoutput_t q_output[3];
+  uint8_t queued_outputs;
+  libnxtusb_write_stats_t stats;
+} nxt_writes_t;
+
+// request/reply channel shared by threads, see nxt_priority.c
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int busy;
+  unsigned int waiting[NXT_PRIO_COUNT];
+  // bumped by every emergency stop
+  atomic_uint estop_gen;
+  libnxtusb_channel_stats_t stats;
+} nxt_channel_t;
+
+// condition waiters and their shared poller, see nxt_wait.c
+typedef struct nxt_waiter nxt_waiter_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  // waiters sleep here, poller broadcasts after every tick
+  pthread_cond_t cond;
+  // poller sleeps here between ticks
+  pthread_cond_t wake;
+  int kick;
+  nxt_waiter_t *waiters;
+  pthread_t thread;
+  int started;
+  int running;
+  unsigned int min_ms;
+  unsigned int max_ms;
+  libnxtusb_wait_stats_t stats;
+} nxt_waits_t;
+
+// cached brick listing with hashes of uploaded contents, see nxt_files.c
+typedef struct {
+  libnxtusb_file_t file;
+  uint32_t hash;
+  int hashed;
+} nxt_manifest_entry_t;
+
+typedef struct {
+  // listing is current, entries are kept for their hashes when it is not
+  int valid;
+  unsigned int count;
+  nxt_manifest_entry_t entry[NXT_FILES_MAX];
+} nxt_manifest_t;
+
+// per-handle library state
+struct libnxtusb_private {
+  const nxt_transport_t *transport;
+  void *transport_ctx;
+  nxt_capture_t *capture;
+  nxt_telemetry_t *telemetry;
+  nxt_timeouts_t timeouts;
+  nxt_owed_t owed;
+  char serial[NXT_SERIAL_SIZE];
+  nxt_shadow_t shadow;
+  nxt_reconnect_t reconnect;
+  nxt_writes_t writes;
+  nxt_channel_t channel;
+  nxt_waits_t waits;
+  nxt_manifest_t manifest;
+  nxt_timing_t timing;
+  nxt_metrics_t metrics;
+};
+
+//internal. allocate handle for given transport
+libnxtusb_device_handle *nxt_handle_new(const nxt_transport_t *transport, void *transport_ctx);
+
+void nxt_capture_record(
+                        nxt_capture_t *cap, const uint64_t ts_ns, const uint8_t dir,
+                        const unsigned char *data, const unsigned int length
+                        );
+
+void nxt_telemetry_record(nxt_telemetry_t *tel, const uint64_t ts_ns, const unsigned char *reply, const unsigned int length);
+
+void nxt_timing_sent(nxt_timing_t *t, const uint64_t start_ns, const uint64_t done_ns);
+void nxt_timing_received(nxt_timing_t *t, const uint64_t done_ns);
+void nxt_metrics_latency(nxt_opcode_metrics_t *m, const uint64_t ns);
+void nxt_timeouts_init(nxt_timeouts_t *t);
+int nxt_io_timeout(const nxt_timeouts_t *t, const unsigned int phase_ms);
+int nxt_retry_pause(const nxt_timeouts_t *t, const libnxtusb_timeout_policy_t *policy);
+uint64_t nxt_deadline_get(const nxt_timeouts_t *t);
+void nxt_deadline_set(const nxt_timeouts_t *t, const uint64_t deadline_ns);
+void nxt_owed_push(nxt_owed_t *o, const uint8_t opcode);
+int nxt_owed_late(nxt_owed_t *o, const uint8_t opcode);
+void nxt_shadow_update(nxt_shadow_t *s, const unsigned char *request, const unsigned int length);
+int nxt_device_lost(const int io_error);
+int nxt_reconnect_io(const libnxtusb_device_handle *handle, const uint64_t down_ns);
+int nxt_write_redundant(nxt_writes_t *w, const unsigned char *request, const unsigned int length);
+void nxt_write_done(nxt_writes_t *w, const unsigned char *request, const unsigned int length, const int acked);
+void nxt_channel_init(nxt_channel_t *c);
+void nxt_channel_destroy(nxt_channel_t *c);
+void nxt_channel_acquire(nxt_channel_t *c, const libnxtusb_priority_t prio);
+void nxt_channel_release(nxt_channel_t *c);
+void nxt_waits_init(nxt_waits_t *w);
+void nxt_waits_destroy(nxt_waits_t *w);
+void nxt_manifest_touched(const libnxtusb_device_handle *handle, const uint8_t opcode);
+uint8_t *nxt_read_file(const char *path, uint32_t *size);
+int nxt_file_upload_linear(
+        const libnxtusb_device_handle *handle, const char *name,
+        const void *data, const uint32_t size
+        );
+int nxt_file_find(const libnxtusb_device_handle *handle, const char *name, uint32_t *size);
+
+//internal. send packet. Returns bytes sent or libusb error code
+int nxt_send(
+             const libnxtusb_device_handle *handle, const unsigned char *request,
+             const unsigned int length
+             );
+
+//internal. account send finished with res (bytes or libusb error code), started at start
+int nxt_send_done(
+                  const libnxtusb_device_handle *handle, const unsigned char *request,
+                  const int res, const uint64_t start
+                  );
+
+//internal. async send on usb handle, see nxt_broadcast.c. Return libusb error codes,
+//LIBUSB_ERROR_NOT_SUPPORTED if handle isn't usb
+int nxt_usb_send_async(
+                       const libnxtusb_device_handle *handle, const unsigned char *request,
+                       const unsigned int length, const unsigned int timeout, int *done
+                       );
+int nxt_usb_send_poll(const libnxtusb_device_handle *handle, int *done, const unsigned int wait_us);
+int nxt_usb_send_finish(const libnxtusb_device_handle *handle, int *done);
+
+//internal. receive packet into NXT_PACKET_SIZE buffer. Returns bytes received or libusb error code
+int nxt_recv(
+             const libnxtusb_device_handle *handle,
+             unsigned char *result
+             );
+
+//internal. same with explicit timeout in ms, negative = fail at once
+int nxt_recv_timeout(
+                     const libnxtusb_device_handle *handle,
+                     unsigned char *result, const int timeout
+                     );
+
+//internal. send request, receive and check reply of exactly reply_len bytes.
+//Brick status goes to libnxtusb_error. Returns 0 on success, -1 on failure
+int nxt_transact(
+                 const libnxtusb_device_handle *handle, const void *request,
+                 const unsigned int length, void *reply, const unsigned int reply_len
+                 );
+
+//internal. nxt_transact which also copies receive timestamp of the
+//exchange while channel is still held. ts may be NULL
+int nxt_transact_ts(
+                    const libnxtusb_device_handle *handle, const void *request,
+                    const unsigned int length, void *reply, const unsigned int reply_len,
+                    libnxtusb_timestamp_t *ts
+                    );
+
+//internal. receive reply of request sent at start, caller holds channel
+int nxt_reply_locked(
+                     const libnxtusb_device_handle *handle, const uint8_t opcode,
+                     void *reply, const unsigned int reply_len, const uint64_t start
+                     );
+
+//internal. nxt_raw_command which leaves file manifest alone
+int nxt_raw_exchange(
+                     const libnxtusb_device_handle *handle, const uint8_t *request,
+                     const unsigned int length, uint8_t *reply, const unsigned int reply_size
+                     );
+
+//internal. single attempt of nxt_transact, caller holds channel
+int nxt_transact_locked(
+                        const libnxtusb_device_handle *handle, const void *request,
+                        const unsigned int length, void *reply, const unsigned int reply_len
+                        );
+
+#endif
@@ -0,0 +1,257 @@
+/**
+ * @file nxt_reconnect.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Automatic reconnect with configuration restore.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include "nxt_private.h"
+
+//internal. remember configuration carried by sent packet
+
+void nxt_shadow_update(nxt_shadow_t *s, const unsigned char *request, const unsigned int length) {
+  if (length < 3) {
+    return;
+  }
+  switch (request[1]) {
+    case NXT_OPCODE_SET_INPUTMODE:
+      if (length >= sizeof (cmd_setinput_t) && request[2] < 4) {
+        memcpy(&s->input[request[2]], request, sizeof (cmd_setinput_t));
+        s->input_set |= 1 << request[2];
+      }
+      break;
+    case NXT_OPCODE_SET_OUTPUTSTATE:
+      if (length < sizeof (cmd_setoutput_t)) {
+        break;
+      }
+      int port;
+      for (port = 0; port < 3; port++) {
+        if (request[2] == port || request[2] == NXT_OUT_ALL) {
+          memcpy(&s->output[port], request, sizeof (cmd_setoutput_t));
+          s->output[port].port = port;
+          s->output_set |= 1 << port;
+        }
+      }
+      break;
+    case NXT_OPCODE_LS_WRITE:
+    {
+      const cmd_lswrite_t *cmd = (const cmd_lswrite_t*) request;
+      // only writes expecting no data are setup, everything else is a read
+      if (length < 6 || cmd->port >= 4 || cmd->rx_size != 0 || cmd->tx_size < 2) {
+        break;
+      }
+      unsigned int n = s->ls_count[cmd->port];
+      unsigned int k;
+      for (k = 0; k < n; k++) {
+        // same device address and register
+        if (s->ls[cmd->port][k].data[0] == cmd->data[0] &&
+            s->ls[cmd->port][k].data[1] == cmd->data[1]) {
+          break;
+        }
+      }
+      if (k == NXT_SHADOW_LS_WRITES) {
+        memmove(&s->ls[cmd->port][0], &s->ls[cmd->port][1],
+                (NXT_SHADOW_LS_WRITES - 1) * sizeof (cmd_lswrite_t));
+        k--;
+      } else if (k == n) {
+        s->ls_count[cmd->port]++;
+      }
+      memset(&s->ls[cmd->port][k], 0, sizeof (cmd_lswrite_t));
+      memcpy(&s->ls[cmd->port][k], request,
+             length < sizeof (cmd_lswrite_t) ? length : sizeof (cmd_lswrite_t));
+      break;
+    }
+  }
+}
+
+//internal. is transport error a sign of vanished device
+
+int nxt_device_lost(const int io_error) {
+  return io_error == LIBUSB_ERROR_NO_DEVICE || io_error == LIBUSB_ERROR_IO;
+}
+
+// replay one shadow packet, caller holds channel. Only transport failures count
+static int shadow_send(const libnxtusb_device_handle *handle, const void *cmd, const unsigned int length) {
+  unsigned char req[NXT_PACKET_SIZE];
+  ret_status_t st;
+
+  memcpy(req, cmd, length);
+  req[0] = NXT_DIRECT_COMMAND_DOREPLY;
+  handle->priv->timeouts.last_io_error = 0;
+  int ret = nxt_transact_locked(handle, req, length, &st, sizeof (st));
+  nxt_write_done(&handle->priv->writes, req, length, ret == 0);
+  if (ret != 0 && handle->priv->timeouts.last_io_error != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// sensors first: lowspeed setup needs port in lowspeed mode.
+// Outputs stay stopped if an emergency stop came since estop_gen
+static int shadow_restore(
+                          const libnxtusb_device_handle *handle, const unsigned int restore,
+                          const unsigned int estop_gen
+                          ) {
+  nxt_shadow_t s = handle->priv->shadow;
+  int i;
+  unsigned int k;
+
+  for (i = 0; i < 4; i++) {
+    if ((restore & NXT_RESTORE_INPUTS) && (s.input_set & (1 << i)) &&
+        shadow_send(handle, &s.input[i], sizeof (cmd_setinput_t)) != 0) {
+      return -1;
+    }
+  }
+  for (i = 0; i < 4; i++) {
+    for (k = 0; (restore & NXT_RESTORE_LOWSPEED) && k < s.ls_count[i]; k++) {
+      if (shadow_send(handle, &s.ls[i][k], sizeof (cmd_lswrite_t)) != 0) {
+        return -1;
+      }
+    }
+  }
+  if (atomic_load(&handle->priv->channel.estop_gen) != estop_gen) {
+    return 0;
+  }
+  for (i = 0; i < 3; i++) {
+    if ((restore & NXT_RESTORE_OUTPUTS) && (s.output_set & (1 << i)) &&
+        shadow_send(handle, &s.output[i], sizeof (cmd_setoutput_t)) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+//internal. brick vanished at down_ns, bring it back. Returns 0 on success.
+//Caller must not hold channel. Threads failing during a reconnect wait for
+//it and share its success
+
+int nxt_reconnect_io(const libnxtusb_device_handle *handle, const uint64_t down_ns) {
+  nxt_reconnect_t *r = &handle->priv->reconnect;
+  nxt_timeouts_t *to = &handle->priv->timeouts;
+  nxt_channel_t *c = &handle->priv->channel;
+
+  if (handle->priv->transport->reopen == NULL) {
+    return -1;
+  }
+  pthread_mutex_lock(&c->lock);
+  while (r->active) {
+    pthread_cond_wait(&c->cond, &c->lock);
+  }
+  if (r->up_ns > down_ns) {
+    // brick came back after this failure began
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+  }
+  r->active = 1;
+  pthread_mutex_unlock(&c->lock);
+  unsigned int estop_gen = atomic_load(&c->estop_gen);
+  uint64_t give_up = down_ns + (uint64_t) r->timeout_ms * 1000000ULL;
+  uint64_t deadline_ns = nxt_deadline_get(to);
+  if (deadline_ns != 0 && deadline_ns < give_up) {
+    give_up = deadline_ns;
+  }
+  int ret = -1;
+  for (;;) {
+    // held until configuration is back, nobody talks to a half-restored brick
+    nxt_channel_acquire(c, NXT_PRIO_RT);
+    int reopened = handle->priv->transport->reopen((libnxtusb_device_handle*) handle);
+    if (reopened == 0) {
+      // nothing sent before outage is going to be answered,
+      // and brick may have been reset meanwhile
+      handle->priv->owed.count = 0;
+      nxt_write_cache_invalidate(handle);
+      // files may have changed over other connection
+      nxt_manifest_invalidate(handle);
+      ret = shadow_restore(handle, r->restore, estop_gen);
+    }
+    nxt_channel_release(c);
+    if (ret == 0) {
+      break;
+    }
+    uint64_t now = nxt_time_ns();
+    if (now + NXT_RECONNECT_POLL_MS * 1000000ULL >= give_up) {
+      break;
+    }
+    struct timespec ts = {0, NXT_RECONNECT_POLL_MS * 1000000L};
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+  }
+  uint64_t now = nxt_time_ns();
+  pthread_mutex_lock(&c->lock);
+  if (ret == 0) {
+    r->up_ns = now;
+  }
+  r->active = 0;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+
+  uint64_t outage = now - down_ns;
+  if (ret == 0) {
+    r->stats.reconnects++;
+    r->stats.last_outage_ns = outage;
+    r->stats.total_outage_ns += outage;
+    if (outage > r->stats.max_outage_ns) {
+      r->stats.max_outage_ns = outage;
+    }
+  } else {
+    r->stats.failures++;
+  }
+  if (r->cb != NULL) {
+    r->cb(handle, ret, outage, r->arg);
+  }
+  return ret;
+}
+
+int nxt_set_reconnect(
+                      const libnxtusb_device_handle *handle, const unsigned int timeout_ms,
+                      const unsigned int restore, libnxtusb_reconnect_cb cb, void *arg
+                      ) {
+  nxt_reconnect_t *r = &handle->priv->reconnect;
+
+  if (timeout_ms != 0 && handle->priv->transport->reopen == NULL) {
+    return -1;
+  }
+  r->timeout_ms = timeout_ms;
+  r->restore = restore;
+  r->cb = cb;
+  r->arg = arg;
+  return 0;
+}
+
+int nxt_reconnect(const libnxtusb_device_handle *handle) {
+  return nxt_reconnect_io(handle, nxt_time_ns());
+}
+
+void nxt_reconnect_stats(const libnxtusb_device_handle *handle, libnxtusb_reconnect_stats_t *stats) {
+  *stats = handle->priv->reconnect.stats;
+}
+
+void nxt_shadow_clear(const libnxtusb_device_handle *handle) {
+  memset(&handle->priv->shadow, 0, sizeof (nxt_shadow_t));
+}
+
+const char *nxt_serial(const libnxtusb_device_handle *handle) {
+  return handle->priv->serial;
+}
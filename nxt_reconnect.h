@@ -0,0 +1,136 @@
+/**
+ * @file nxt_reconnect.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Automatic reconnect with configuration restore. Public header
+ *
+ * Handle keeps shadow copy of last commanded configuration: input modes,
+ * output states and lowspeed setup writes (writes expecting no reply
+ * bytes, last NXT_SHADOW_LS_WRITES per port, one per device register).
+ * When device disappears during a command, handle reopens the brick with
+ * the same usb serial, replays the shadow configuration and then repeats
+ * the failed command if it never reached the brick or is idempotent.
+ */
+
+#ifndef NXT_RECONNECT_H
+#define NXT_RECONNECT_H
+#include "libnxtusb.h"
+
+/** \ingroup reconnect
+ * Lowspeed setup writes remembered per port
+ */
+#define NXT_SHADOW_LS_WRITES 4
+
+/** \ingroup reconnect
+ * Pause between reopen attempts, ms
+ */
+#define NXT_RECONNECT_POLL_MS 100
+
+/** \ingroup reconnect
+ * What is restored after reconnect
+ */
+typedef enum {
+  /** Sensor types and modes */
+  NXT_RESTORE_INPUTS = 0x01,
+  /** Motor states. Note that tacho-limited moves start over */
+  NXT_RESTORE_OUTPUTS = 0x02,
+  /** Lowspeed device setup */
+  NXT_RESTORE_LOWSPEED = 0x04,
+  NXT_RESTORE_ALL = 0x07
+} libnxtusb_restore_t;
+
+/** \ingroup reconnect
+ * Reconnect statistics
+ */
+typedef struct {
+  /** Successful reconnects */
+  uint64_t reconnects;
+  /** Outages which outlasted reconnect timeout */
+  uint64_t failures;
+  /** Duration of last outage, ns */
+  uint64_t last_outage_ns;
+  /** Longest outage, ns */
+  uint64_t max_outage_ns;
+  /** Sum of all outages, ns */
+  uint64_t total_outage_ns;
+} libnxtusb_reconnect_stats_t;
+
+/** \ingroup reconnect
+ * Called after every outage
+ * @param handle nxt brick handle
+ * @param result 0 if brick is back, -1 if reconnect gave up
+ * @param outage_ns outage duration, ns
+ * @param arg user argument
+ */
+typedef void (*libnxtusb_reconnect_cb)(
+        const libnxtusb_device_handle *handle, const int result,
+        const uint64_t outage_ns, void *arg
+        );
+
+/**
+ * \defgroup reconnect Reconnect.
+ * Reconnect is disabled by default, shadow configuration is kept anyway.
+ */
+
+/** \ingroup reconnect
+ *  Enable or disable automatic reconnect
+ * @param handle nxt brick handle
+ * @param timeout_ms how long to wait for brick to come back, 0 = disable
+ * @param restore libnxtusb_restore_t mask of restored configuration
+ * @param cb outage callback (may be NULL)
+ * @param arg callback argument
+ * @return 0 on success, -1 if transport can't reconnect
+ */
+int nxt_set_reconnect(
+        const libnxtusb_device_handle *handle, const unsigned int timeout_ms,
+        const unsigned int restore, libnxtusb_reconnect_cb cb, void *arg
+        );
+
+/** \ingroup reconnect
+ *  Reopen brick and restore configuration now.
+ *  Waits up to reconnect timeout (at least one attempt is made).
+ * @param handle nxt brick handle
+ * @return 0 on success, -1 on failure
+ */
+int nxt_reconnect(const libnxtusb_device_handle *handle);
+
+/** \ingroup reconnect
+ *  Get reconnect statistics
+ * @param handle nxt brick handle
+ * @param stats libnxtusb_reconnect_stats_t* statistics (preallocated)
+ */
+void nxt_reconnect_stats(const libnxtusb_device_handle *handle, libnxtusb_reconnect_stats_t *stats);
+
+/** \ingroup reconnect
+ *  Forget shadow configuration, e.g. after brick was reset on purpose
+ * @param handle nxt brick handle
+ */
+void nxt_shadow_clear(const libnxtusb_device_handle *handle);
+
+/** \ingroup reconnect
+ *  Get usb serial of opened brick
+ * @param handle nxt brick handle
+ * @return serial, empty string if unknown
+ */
+const char *nxt_serial(const libnxtusb_device_handle *handle);
+
+#endif
@@ -0,0 +1,633 @@
+/**
+ * @file nxt_recorder.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Columnar recording of input values and output states.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "nxt_private.h"
+#include "nxt_recorder.h"
+
+static const char rec_magic[8] = {'N', 'X', 'T', 'R', 'E', 'C', 1, 0};
+
+#define REC_BLOCK_MAGIC 0x424b4c42
+#define REC_MAX_COLS (NXT_REC_MAX_ROW + 1)
+#define REC_INITIAL_SIZE (1 << 20)
+#define REC_MAX_GROW (256 << 20)
+
+// stream kinds
+enum {
+  REC_KIND_INPUT = 0,
+  REC_KIND_OUTPUT = 1,
+  REC_KIND_ROW = 2
+};
+
+#define REC_STREAM(brick, kind, port) (((uint32_t) (brick) << 8) | ((kind) << 4) | (port))
+
+// columns after timestamp
+#define REC_INPUT_COLS 8
+#define REC_OUTPUT_COLS 9
+
+#pragma pack(push,1)
+
+typedef struct {
+  char magic[8];
+  // end of last complete block
+  uint64_t data_end;
+  // 0 if writer didn't close file
+  uint64_t index_offset;
+  uint64_t index_count;
+} rec_file_header_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t stream;
+  uint16_t count;
+  // including timestamp column
+  uint8_t ncols;
+  uint8_t reserved;
+  uint32_t size;
+  uint64_t t_first;
+  uint64_t t_last;
+} rec_block_header_t;
+
+typedef struct {
+  uint32_t stream;
+  uint32_t count;
+  uint64_t t_first;
+  uint64_t t_last;
+  uint64_t offset;
+} rec_index_t;
+
+#pragma pack(pop)
+
+typedef struct {
+  uint32_t stream;
+  uint8_t ncols;
+  uint16_t count;
+  // column-major, ncols * NXT_REC_BLOCK_SAMPLES
+  int64_t *cols;
+} rec_stream_t;
+
+struct libnxtusb_recorder {
+  int fd;
+  unsigned char *map;
+  size_t map_size;
+  size_t pos;
+  rec_stream_t *streams;
+  size_t nstreams;
+  size_t last;
+  rec_index_t *index;
+  size_t nindex;
+  size_t index_cap;
+};
+
+struct libnxtusb_rec_reader {
+  int fd;
+  const unsigned char *map;
+  size_t map_size;
+  // sorted by stream, then time
+  rec_index_t *index;
+  size_t nindex;
+  int64_t *scratch;
+};
+
+/*
+ *  WRITER
+ */
+
+static int rec_reserve(libnxtusb_recorder_t *rec, const size_t need) {
+  if (rec->pos + need <= rec->map_size) {
+    return 0;
+  }
+  size_t grow = rec->map_size < REC_MAX_GROW ? rec->map_size : REC_MAX_GROW;
+  size_t size = rec->map_size + grow;
+  if (size < rec->pos + need) {
+    size = rec->pos + need;
+  }
+  if (ftruncate(rec->fd, size) != 0) {
+    return -1;
+  }
+  // old mapping stays until new one exists, so failure leaves recording
+  // as it was: appends keep failing here and close still finishes the file
+  unsigned char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, rec->fd, 0);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  munmap(rec->map, rec->map_size);
+  rec->map = map;
+  rec->map_size = size;
+  return 0;
+}
+
+static unsigned char *put_varint(unsigned char *p, const int64_t v) {
+  uint64_t z = ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+  while (z >= 0x80) {
+    *p++ = (z & 0x7f) | 0x80;
+    z >>= 7;
+  }
+  *p++ = z;
+  return p;
+}
+
+static int rec_flush_stream(libnxtusb_recorder_t *rec, rec_stream_t *s) {
+  int c, i;
+
+  if (s->count == 0) {
+    return 0;
+  }
+  // varint of 64-bit value takes at most 10 bytes
+  if (rec_reserve(rec, sizeof (rec_block_header_t) + (size_t) s->ncols * s->count * 10) != 0) {
+    return -1;
+  }
+  if (rec->nindex == rec->index_cap) {
+    size_t cap = rec->index_cap ? rec->index_cap * 2 : 1024;
+    rec_index_t *index = realloc(rec->index, cap * sizeof (rec_index_t));
+    if (index == NULL) {
+      return -1;
+    }
+    rec->index = index;
+    rec->index_cap = cap;
+  }
+
+  rec_block_header_t hdr = {
+    REC_BLOCK_MAGIC, s->stream, s->count, s->ncols, 0, 0,
+    s->cols[0], s->cols[s->count - 1]
+  };
+  unsigned char *start = rec->map + rec->pos + sizeof (hdr);
+  unsigned char *p = start;
+  for (c = 0; c < s->ncols; c++) {
+    const int64_t *col = s->cols + (size_t) c * NXT_REC_BLOCK_SAMPLES;
+    int64_t prev = 0;
+    for (i = 0; i < s->count; i++) {
+      p = put_varint(p, col[i] - prev);
+      prev = col[i];
+    }
+  }
+  hdr.size = p - start;
+  memcpy(rec->map + rec->pos, &hdr, sizeof (hdr));
+
+  rec_index_t *ix = &rec->index[rec->nindex++];
+  ix->stream = s->stream;
+  ix->count = s->count;
+  ix->t_first = hdr.t_first;
+  ix->t_last = hdr.t_last;
+  ix->offset = rec->pos;
+
+  rec->pos += sizeof (hdr) + hdr.size;
+  ((rec_file_header_t*) rec->map)->data_end = rec->pos;
+  s->count = 0;
+  return 0;
+}
+
+static rec_stream_t *rec_stream(libnxtusb_recorder_t *rec, const uint32_t stream, const uint8_t ncols) {
+  size_t i;
+
+  if (rec->last < rec->nstreams && rec->streams[rec->last].stream == stream) {
+    return &rec->streams[rec->last];
+  }
+  for (i = 0; i < rec->nstreams; i++) {
+    if (rec->streams[i].stream == stream) {
+      rec->last = i;
+      return &rec->streams[i];
+    }
+  }
+  // first sample of this stream
+  rec_stream_t *streams = realloc(rec->streams, (rec->nstreams + 1) * sizeof (rec_stream_t));
+  if (streams == NULL) {
+    return NULL;
+  }
+  rec->streams = streams;
+  rec_stream_t *s = &rec->streams[rec->nstreams];
+  s->cols = malloc(sizeof (int64_t) * ncols * NXT_REC_BLOCK_SAMPLES);
+  if (s->cols == NULL) {
+    return NULL;
+  }
+  s->stream = stream;
+  s->ncols = ncols;
+  s->count = 0;
+  rec->last = rec->nstreams++;
+  return s;
+}
+
+static int rec_append(libnxtusb_recorder_t *rec, const uint32_t stream, const uint64_t ts_ns,
+                      const int64_t *vals, const uint8_t nvals) {
+  int c;
+  rec_stream_t *s = rec_stream(rec, stream, nvals + 1);
+
+  if (s == NULL) {
+    return -1;
+  }
+  s->cols[s->count] = ts_ns ? ts_ns : nxt_time_ns();
+  for (c = 0; c < nvals; c++) {
+    s->cols[(size_t) (c + 1) * NXT_REC_BLOCK_SAMPLES + s->count] = vals[c];
+  }
+  s->count++;
+  if (s->count == NXT_REC_BLOCK_SAMPLES) {
+    return rec_flush_stream(rec, s);
+  }
+  return 0;
+}
+
+libnxtusb_recorder_t *nxt_recorder_open(const char *path) {
+  libnxtusb_recorder_t *rec = calloc(1, sizeof (libnxtusb_recorder_t));
+
+  if (rec == NULL) {
+    return NULL;
+  }
+  rec->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (rec->fd < 0) {
+    free(rec);
+    return NULL;
+  }
+  if (ftruncate(rec->fd, REC_INITIAL_SIZE) != 0 ||
+      (rec->map = mmap(NULL, REC_INITIAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, rec->fd, 0)) == MAP_FAILED) {
+    close(rec->fd);
+    free(rec);
+    return NULL;
+  }
+  rec->map_size = REC_INITIAL_SIZE;
+  rec->pos = sizeof (rec_file_header_t);
+
+  rec_file_header_t *hdr = (rec_file_header_t*) rec->map;
+  memcpy(hdr->magic, rec_magic, sizeof (rec_magic));
+  hdr->data_end = rec->pos;
+  hdr->index_offset = 0;
+  hdr->index_count = 0;
+  return rec;
+}
+
+int nxt_recorder_add_input(
+                           libnxtusb_recorder_t *rec, const unsigned int brick,
+                           const uint64_t ts_ns, const libnxtusb_inputstate_t *in
+                           ) {
+  int64_t v[REC_INPUT_COLS] = {
+    in->valid, in->calibrated, in->sensor_type, in->sensor_mode,
+    in->raw_value, in->normalized_value, in->scaled_value, in->calibrated_value
+  };
+  return rec_append(rec, REC_STREAM(brick, REC_KIND_INPUT, in->port & 0x0f), ts_ns, v, REC_INPUT_COLS);
+}
+
+int nxt_recorder_add_output(
+                            libnxtusb_recorder_t *rec, const unsigned int brick,
+                            const uint64_t ts_ns, const libnxtusb_outputstate_t *out
+                            ) {
+  int64_t v[REC_OUTPUT_COLS] = {
+    out->power, out->mode, out->regulation, out->turn_ratio, out->run_state,
+    out->tacho_limit, out->tacho_count, out->block_tacho_count, out->rotation_count
+  };
+  return rec_append(rec, REC_STREAM(brick, REC_KIND_OUTPUT, out->port & 0x0f), ts_ns, v, REC_OUTPUT_COLS);
+}
+
+int nxt_recorder_add_row(
+                         libnxtusb_recorder_t *rec, const unsigned int brick, const unsigned int channel,
+                         const uint64_t ts_ns, const int64_t *values, const unsigned int n
+                         ) {
+  if (channel > 0x0f || n == 0 || n > NXT_REC_MAX_ROW) {
+    return -1;
+  }
+  rec_stream_t *s = rec_stream(rec, REC_STREAM(brick, REC_KIND_ROW, channel), n + 1);
+  // block holds one row width
+  if (s == NULL || s->ncols != n + 1) {
+    return -1;
+  }
+  return rec_append(rec, REC_STREAM(brick, REC_KIND_ROW, channel), ts_ns, values, n);
+}
+
+int nxt_recorder_close(libnxtusb_recorder_t *rec) {
+  int ret = 0;
+  size_t i;
+
+  for (i = 0; i < rec->nstreams; i++) {
+    if (rec_flush_stream(rec, &rec->streams[i]) != 0) {
+      ret = -1;
+    }
+    free(rec->streams[i].cols);
+  }
+  if (ret == 0 && rec_reserve(rec, rec->nindex * sizeof (rec_index_t)) == 0) {
+    rec_file_header_t *hdr = (rec_file_header_t*) rec->map;
+    memcpy(rec->map + rec->pos, rec->index, rec->nindex * sizeof (rec_index_t));
+    hdr->index_offset = rec->pos;
+    hdr->index_count = rec->nindex;
+    rec->pos += rec->nindex * sizeof (rec_index_t);
+  } else {
+    ret = -1;
+  }
+  if (rec->map != NULL) {
+    msync(rec->map, rec->pos, MS_SYNC);
+    munmap(rec->map, rec->map_size);
+  }
+  if (ftruncate(rec->fd, rec->pos) != 0 || close(rec->fd) != 0) {
+    ret = -1;
+  }
+  free(rec->streams);
+  free(rec->index);
+  free(rec);
+  return ret;
+}
+
+/*
+ *  READER
+ */
+
+static int index_cmp(const void *a, const void *b) {
+  const rec_index_t *x = a, *y = b;
+  if (x->stream != y->stream) {
+    return x->stream < y->stream ? -1 : 1;
+  }
+  if (x->t_first != y->t_first) {
+    return x->t_first < y->t_first ? -1 : 1;
+  }
+  return x->offset < y->offset ? -1 : (x->offset > y->offset);
+}
+
+// block header at offset, checked to lie with its data before data_end
+static int rec_block_at(const libnxtusb_rec_reader_t *r, const uint64_t data_end, const uint64_t offset,
+                        rec_block_header_t *bh) {
+  rec_block_header_t h;
+
+  if (offset < sizeof (rec_file_header_t) || offset > data_end ||
+      data_end - offset < sizeof (h)) {
+    return -1;
+  }
+  memcpy(&h, r->map + offset, sizeof (h));
+  if (h.magic != REC_BLOCK_MAGIC || h.size > data_end - offset - sizeof (h)) {
+    return -1;
+  }
+  if (bh != NULL) {
+    *bh = h;
+  }
+  return 0;
+}
+
+libnxtusb_rec_reader_t *nxt_rec_reader_open(const char *path) {
+  struct stat st;
+  libnxtusb_rec_reader_t *r = calloc(1, sizeof (libnxtusb_rec_reader_t));
+
+  if (r == NULL) {
+    return NULL;
+  }
+  r->fd = open(path, O_RDONLY);
+  if (r->fd < 0) {
+    free(r);
+    return NULL;
+  }
+  if (fstat(r->fd, &st) != 0 || (size_t) st.st_size < sizeof (rec_file_header_t) ||
+      (r->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, r->fd, 0)) == MAP_FAILED) {
+    close(r->fd);
+    free(r);
+    return NULL;
+  }
+  r->map_size = st.st_size;
+
+  const rec_file_header_t *hdr = (const rec_file_header_t*) r->map;
+  if (memcmp(hdr->magic, rec_magic, sizeof (rec_magic)) != 0 || hdr->data_end > r->map_size) {
+    goto fail;
+  }
+  if (hdr->index_offset != 0 && hdr->index_offset <= r->map_size &&
+      hdr->index_count <= (r->map_size - hdr->index_offset) / sizeof (rec_index_t)) {
+    size_t i;
+    r->nindex = hdr->index_count;
+    r->index = malloc((r->nindex ? r->nindex : 1) * sizeof (rec_index_t));
+    if (r->index == NULL) {
+      goto fail;
+    }
+    memcpy(r->index, r->map + hdr->index_offset, r->nindex * sizeof (rec_index_t));
+    for (i = 0; i < r->nindex; i++) {
+      if (rec_block_at(r, hdr->data_end, r->index[i].offset, NULL) != 0) {
+        break;
+      }
+    }
+    // corrupt index, blocks may still be fine
+    if (i < r->nindex) {
+      free(r->index);
+      r->index = NULL;
+      r->nindex = 0;
+    }
+  }
+  if (r->index == NULL) {
+    // unfinished file, walk block headers
+    size_t pos = sizeof (rec_file_header_t), cap = 0;
+    rec_block_header_t bh;
+    while (rec_block_at(r, hdr->data_end, pos, &bh) == 0) {
+      if (r->nindex == cap) {
+        cap = cap ? cap * 2 : 1024;
+        rec_index_t *index = realloc(r->index, cap * sizeof (rec_index_t));
+        if (index == NULL) {
+          goto fail;
+        }
+        r->index = index;
+      }
+      rec_index_t *ix = &r->index[r->nindex++];
+      ix->stream = bh.stream;
+      ix->count = bh.count;
+      ix->t_first = bh.t_first;
+      ix->t_last = bh.t_last;
+      ix->offset = pos;
+      pos += sizeof (bh) + bh.size;
+    }
+  }
+  qsort(r->index, r->nindex, sizeof (rec_index_t), index_cmp);
+
+  r->scratch = malloc(sizeof (int64_t) * REC_MAX_COLS * NXT_REC_BLOCK_SAMPLES);
+  if (r->scratch == NULL) {
+    goto fail;
+  }
+  return r;
+
+fail:
+  nxt_rec_reader_close(r);
+  return NULL;
+}
+
+void nxt_rec_reader_close(libnxtusb_rec_reader_t *r) {
+  munmap((void*) r->map, r->map_size);
+  close(r->fd);
+  free(r->index);
+  free(r->scratch);
+  free(r);
+}
+
+int nxt_rec_reader_range(const libnxtusb_rec_reader_t *r, uint64_t *first, uint64_t *last) {
+  size_t i;
+
+  if (r->nindex == 0) {
+    return -1;
+  }
+  *first = r->index[0].t_first;
+  *last = r->index[0].t_last;
+  for (i = 1; i < r->nindex; i++) {
+    if (r->index[i].t_first < *first) *first = r->index[i].t_first;
+    if (r->index[i].t_last > *last) *last = r->index[i].t_last;
+  }
+  return 0;
+}
+
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, int64_t *v) {
+  uint64_t z = 0;
+  int shift = 0;
+  while (p < end && shift < 64) {
+    z |= (uint64_t) (*p & 0x7f) << shift;
+    if (!(*p++ & 0x80)) {
+      *v = (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+      return p;
+    }
+    shift += 7;
+  }
+  return NULL;
+}
+
+// decode block into scratch (column-major), returns sample count or -1.
+// ncols 0 takes any width up to REC_MAX_COLS, width goes to ncols
+
+static int rec_decode(const libnxtusb_rec_reader_t *r, const rec_index_t *ix, int *ncols) {
+  rec_block_header_t bh;
+  int c, i;
+
+  memcpy(&bh, r->map + ix->offset, sizeof (bh));
+  if ((*ncols != 0 && bh.ncols != *ncols) || bh.ncols == 0 || bh.ncols > REC_MAX_COLS ||
+      bh.count > NXT_REC_BLOCK_SAMPLES) {
+    return -1;
+  }
+  *ncols = bh.ncols;
+  const unsigned char *p = r->map + ix->offset + sizeof (bh);
+  const unsigned char *end = p + bh.size;
+  for (c = 0; c < *ncols; c++) {
+    int64_t *col = r->scratch + (size_t) c * NXT_REC_BLOCK_SAMPLES;
+    int64_t prev = 0, d;
+    for (i = 0; i < bh.count; i++) {
+      if ((p = get_varint(p, end, &d)) == NULL) {
+        return -1;
+      }
+      prev += d;
+      col[i] = prev;
+    }
+  }
+  return bh.count;
+}
+
+// iterate decoded blocks of stream overlapping [t0, t1]
+
+typedef int (*rec_sample_fn)(const libnxtusb_rec_reader_t *r, const int i, const int ncols,
+                             const uint8_t port, void *cb, void *user);
+
+static long rec_query(const libnxtusb_rec_reader_t *r, const uint32_t stream, const int ncols,
+                      const uint64_t t0, const uint64_t t1, rec_sample_fn fn, void *cb, void *user) {
+  size_t lo = 0, hi = r->nindex;
+  long total = 0;
+  int i, n;
+
+  // first block of stream ending at or after t0
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    const rec_index_t *ix = &r->index[mid];
+    if (ix->stream < stream || (ix->stream == stream && ix->t_last < t0)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  for (; lo < r->nindex && r->index[lo].stream == stream && r->index[lo].t_first <= t1; lo++) {
+    int width = ncols;
+    if ((n = rec_decode(r, &r->index[lo], &width)) < 0) {
+      return -1;
+    }
+    for (i = 0; i < n; i++) {
+      uint64_t ts = r->scratch[i];
+      if (ts < t0 || ts > t1) {
+        continue;
+      }
+      total++;
+      if (fn(r, i, width, stream & 0x0f, cb, user) != 0) {
+        return total;
+      }
+    }
+  }
+  return total;
+}
+
+#define COL(r, c, i) ((r)->scratch[(size_t) (c) * NXT_REC_BLOCK_SAMPLES + (i)])
+
+static int rec_input_sample(const libnxtusb_rec_reader_t *r, const int i, const int ncols,
+                            const uint8_t port, void *cb, void *user) {
+  (void) ncols;
+  libnxtusb_inputstate_t in = {
+    NXT_COMMAND_REPLY, NXT_OPCODE_GET_INPUTVALUES, NXT_STATUS_OK, port,
+    COL(r, 1, i), COL(r, 2, i), COL(r, 3, i), COL(r, 4, i),
+    COL(r, 5, i), COL(r, 6, i), COL(r, 7, i), COL(r, 8, i)
+  };
+  return ((libnxtusb_rec_input_cb) cb)(user, COL(r, 0, i), &in);
+}
+
+static int rec_output_sample(const libnxtusb_rec_reader_t *r, const int i, const int ncols,
+                             const uint8_t port, void *cb, void *user) {
+  (void) ncols;
+  libnxtusb_outputstate_t out = {
+    NXT_COMMAND_REPLY, NXT_OPCODE_GET_OUTPUTSTATE, NXT_STATUS_OK, port,
+    COL(r, 1, i), COL(r, 2, i), COL(r, 3, i), COL(r, 4, i), COL(r, 5, i),
+    COL(r, 6, i), COL(r, 7, i), COL(r, 8, i), COL(r, 9, i)
+  };
+  return ((libnxtusb_rec_output_cb) cb)(user, COL(r, 0, i), &out);
+}
+
+long nxt_rec_reader_inputs(
+                           const libnxtusb_rec_reader_t *r, const unsigned int brick, const libnxtusb_in_t port,
+                           const uint64_t t0, const uint64_t t1, libnxtusb_rec_input_cb cb, void *user
+                           ) {
+  return rec_query(r, REC_STREAM(brick, REC_KIND_INPUT, port), REC_INPUT_COLS + 1, t0, t1,
+                   rec_input_sample, (void*) cb, user);
+}
+
+long nxt_rec_reader_outputs(
+                            const libnxtusb_rec_reader_t *r, const unsigned int brick, const libnxtusb_out_t port,
+                            const uint64_t t0, const uint64_t t1, libnxtusb_rec_output_cb cb, void *user
+                            ) {
+  return rec_query(r, REC_STREAM(brick, REC_KIND_OUTPUT, port), REC_OUTPUT_COLS + 1, t0, t1,
+                   rec_output_sample, (void*) cb, user);
+}
+
+static int rec_row_sample(const libnxtusb_rec_reader_t *r, const int i, const int ncols,
+                          const uint8_t channel, void *cb, void *user) {
+  int64_t v[NXT_REC_MAX_ROW];
+  int c;
+
+  (void) channel;
+  for (c = 1; c < ncols; c++) {
+    v[c - 1] = COL(r, c, i);
+  }
+  return ((libnxtusb_rec_row_cb) cb)(user, COL(r, 0, i), v, ncols - 1);
+}
+
+long nxt_rec_reader_rows(
+                         const libnxtusb_rec_reader_t *r, const unsigned int brick, const unsigned int channel,
+                         const uint64_t t0, const uint64_t t1, libnxtusb_rec_row_cb cb, void *user
+                         ) {
+  return rec_query(r, REC_STREAM(brick, REC_KIND_ROW, channel & 0x0f), 0, t0, t1,
+                   rec_row_sample, (void*) cb, user);
+}
@@ -0,0 +1,204 @@
+/**
+ * @file nxt_recorder.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Columnar recording of input values and output states. Public header
+ *
+ * Samples are grouped per stream (one stream per brick and port, or
+ * brick and channel for generic rows of integers) into
+ * blocks of up to NXT_REC_BLOCK_SAMPLES samples. Inside a block every
+ * field is stored as its own column of zigzag varint deltas, timestamp
+ * column first. Block index (stream, time range, offset) is appended on
+ * close, so reader can seek by time without decoding the file.
+ * Files from a writer which didn't close are still readable, reader
+ * then rebuilds index by walking block headers.
+ */
+
+#ifndef NXT_RECORDER_H
+#define NXT_RECORDER_H
+#include "libnxtusb.h"
+
+/** \ingroup recorder
+ * Samples per block
+ */
+#define NXT_REC_BLOCK_SAMPLES 256
+
+/** \ingroup recorder
+ * Most values in generic row
+ */
+#define NXT_REC_MAX_ROW 31
+
+/** \ingroup recorder
+ * Recording writer (opaque)
+ */
+typedef struct libnxtusb_recorder libnxtusb_recorder_t;
+
+/** \ingroup recorder
+ * Recording reader (opaque)
+ */
+typedef struct libnxtusb_rec_reader libnxtusb_rec_reader_t;
+
+/** \ingroup recorder
+ * Input sample callback. Return non-zero to stop reading.
+ */
+typedef int (*libnxtusb_rec_input_cb)(void *user, const uint64_t ts_ns, const libnxtusb_inputstate_t *in);
+
+/** \ingroup recorder
+ * Output sample callback. Return non-zero to stop reading.
+ */
+typedef int (*libnxtusb_rec_output_cb)(void *user, const uint64_t ts_ns, const libnxtusb_outputstate_t *out);
+
+/** \ingroup recorder
+ * Generic row callback. Return non-zero to stop reading.
+ */
+typedef int (*libnxtusb_rec_row_cb)(void *user, const uint64_t ts_ns, const int64_t *values, const unsigned int n);
+
+/**
+ * \defgroup recorder Columnar recording.
+ */
+
+/** \ingroup recorder
+ *  Create recording file (truncates existing)
+ * @param path file name
+ * @return recorder or NULL on failure
+ */
+libnxtusb_recorder_t *nxt_recorder_open(const char *path);
+
+/** \ingroup recorder
+ *  Append input values sample
+ * @param rec recorder
+ * @param brick brick number (0 to 16777215), chosen by caller
+ * @param ts_ns sample time in ns (0 = now, see nxt_time_ns)
+ * @param in libnxtusb_inputstate_t* sample
+ * @return 0 on success, -1 on failure
+ */
+int nxt_recorder_add_input(
+        libnxtusb_recorder_t *rec, const unsigned int brick,
+        const uint64_t ts_ns, const libnxtusb_inputstate_t *in
+        );
+
+/** \ingroup recorder
+ *  Append output state sample
+ * @param rec recorder
+ * @param brick brick number (0 to 16777215), chosen by caller
+ * @param ts_ns sample time in ns (0 = now, see nxt_time_ns)
+ * @param out libnxtusb_outputstate_t* sample
+ * @return 0 on success, -1 on failure
+ */
+int nxt_recorder_add_output(
+        libnxtusb_recorder_t *rec, const unsigned int brick,
+        const uint64_t ts_ns, const libnxtusb_outputstate_t *out
+        );
+
+/** \ingroup recorder
+ *  Append generic row. All rows of one channel have same number of values
+ * @param rec recorder
+ * @param brick brick number (0 to 16777215), chosen by caller
+ * @param channel row channel (0 to 15), chosen by caller
+ * @param ts_ns row time in ns (0 = now, see nxt_time_ns)
+ * @param values row values
+ * @param n number of values (1 to NXT_REC_MAX_ROW)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_recorder_add_row(
+        libnxtusb_recorder_t *rec, const unsigned int brick, const unsigned int channel,
+        const uint64_t ts_ns, const int64_t *values, const unsigned int n
+        );
+
+/** \ingroup recorder
+ *  Flush pending samples, write index and close file
+ * @param rec recorder
+ * @return 0 on success, -1 on failure
+ */
+int nxt_recorder_close(libnxtusb_recorder_t *rec);
+
+/** \ingroup recorder
+ *  Map recording for reading
+ * @param path file name
+ * @return reader or NULL on failure
+ */
+libnxtusb_rec_reader_t *nxt_rec_reader_open(const char *path);
+
+/** \ingroup recorder
+ *  Get time range covered by recording
+ * @param r reader
+ * @param first first sample time, ns
+ * @param last last sample time, ns
+ * @return 0 on success, -1 if recording is empty
+ */
+int nxt_rec_reader_range(const libnxtusb_rec_reader_t *r, uint64_t *first, uint64_t *last);
+
+/** \ingroup recorder
+ *  Read input samples of one port with time in [t0, t1]
+ * @param r reader
+ * @param brick brick number
+ * @param port libnxtusb_in_t port
+ * @param t0 range start, ns
+ * @param t1 range end, ns
+ * @param cb callback, called in time order
+ * @param user callback argument
+ * @return number of samples passed to callback, -1 on failure
+ */
+long nxt_rec_reader_inputs(
+        const libnxtusb_rec_reader_t *r, const unsigned int brick, const libnxtusb_in_t port,
+        const uint64_t t0, const uint64_t t1, libnxtusb_rec_input_cb cb, void *user
+        );
+
+/** \ingroup recorder
+ *  Read output samples of one port with time in [t0, t1]
+ * @param r reader
+ * @param brick brick number
+ * @param port libnxtusb_out_t port
+ * @param t0 range start, ns
+ * @param t1 range end, ns
+ * @param cb callback, called in time order
+ * @param user callback argument
+ * @return number of samples passed to callback, -1 on failure
+ */
+long nxt_rec_reader_outputs(
+        const libnxtusb_rec_reader_t *r, const unsigned int brick, const libnxtusb_out_t port,
+        const uint64_t t0, const uint64_t t1, libnxtusb_rec_output_cb cb, void *user
+        );
+
+/** \ingroup recorder
+ *  Read generic rows of one channel with time in [t0, t1]
+ * @param r reader
+ * @param brick brick number
+ * @param channel row channel
+ * @param t0 range start, ns
+ * @param t1 range end, ns
+ * @param cb callback, called in time order
+ * @param user callback argument
+ * @return number of rows passed to callback, -1 on failure
+ */
+long nxt_rec_reader_rows(
+        const libnxtusb_rec_reader_t *r, const unsigned int brick, const unsigned int channel,
+        const uint64_t t0, const uint64_t t1, libnxtusb_rec_row_cb cb, void *user
+        );
+
+/** \ingroup recorder
+ *  Unmap recording
+ * @param r reader
+ */
+void nxt_rec_reader_close(libnxtusb_rec_reader_t *r);
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * @file nxt_resync.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Reply stream resynchronisation.
+ */
+
+#include "nxt_private.h"
+
+static void owed_drop_oldest(nxt_owed_t *o, const unsigned int n) {
+  o->head = (o->head + n) % NXT_RESYNC_MAX_OUTSTANDING;
+  o->count -= n;
+}
+
+static void owed_expire(nxt_owed_t *o, const uint64_t now) {
+  while (o->count > 0 &&
+         now - o->since_ns[o->head] > (uint64_t) NXT_RESYNC_MAX_AGE_MS * 1000000ULL) {
+    owed_drop_oldest(o, 1);
+  }
+}
+
+//internal. reply to opcode timed out, it may still come
+
+void nxt_owed_push(nxt_owed_t *o, const uint8_t opcode) {
+  uint64_t now = nxt_time_ns();
+
+  owed_expire(o, now);
+  if (o->count == NXT_RESYNC_MAX_OUTSTANDING) {
+    owed_drop_oldest(o, 1);
+  }
+  unsigned int i = (o->head + o->count) % NXT_RESYNC_MAX_OUTSTANDING;
+  o->opcode[i] = opcode;
+  o->since_ns[i] = now;
+  o->count++;
+}
+
+//internal. is reply with opcode a late one. Outstanding requests
+//older than matched one got no reply, so they are forgotten too
+
+int nxt_owed_late(nxt_owed_t *o, const uint8_t opcode) {
+  unsigned int k;
+
+  owed_expire(o, nxt_time_ns());
+  for (k = 0; k < o->count; k++) {
+    if (o->opcode[(o->head + k) % NXT_RESYNC_MAX_OUTSTANDING] == opcode) {
+      owed_drop_oldest(o, k + 1);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int nxt_outstanding(const libnxtusb_device_handle *handle) {
+  nxt_owed_t *o = &handle->priv->owed;
+
+  owed_expire(o, nxt_time_ns());
+  return o->count;
+}
+
+int nxt_resync(const libnxtusb_device_handle *handle, const unsigned int quiet_ms) {
+  unsigned char buf[NXT_PACKET_SIZE];
+  int discarded = 0;
+  int ret;
+
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_NORMAL);
+  while ((ret = nxt_recv_timeout(handle, buf, quiet_ms ? quiet_ms : 1)) >= 0) {
+    if (ret >= 2) {
+      atomic_fetch_add_explicit(&handle->priv->metrics.op[buf[1]].late_replies, 1, memory_order_relaxed);
+    }
+    discarded++;
+  }
+  handle->priv->owed.count = 0;
+  nxt_channel_release(&handle->priv->channel);
+  return ret == LIBUSB_ERROR_TIMEOUT ? discarded : -1;
+}
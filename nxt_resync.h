@@ -0,0 +1,68 @@
+/**
+ * @file nxt_resync.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Reply stream resynchronisation. Public header
+ *
+ * Every request whose reply timed out is remembered as outstanding.
+ * Brick answers in order, so a reply arriving while requests are
+ * outstanding belongs to the oldest outstanding request with the same
+ * opcode; such replies are discarded instead of being taken as reply to
+ * the current command. Outstanding requests older than
+ * NXT_RESYNC_MAX_AGE_MS are assumed lost.
+ */
+
+#ifndef NXT_RESYNC_H
+#define NXT_RESYNC_H
+#include "libnxtusb.h"
+
+/** \ingroup resync
+ * Outstanding requests remembered per handle
+ */
+#define NXT_RESYNC_MAX_OUTSTANDING 8
+
+/** \ingroup resync
+ * Age after which outstanding request is assumed lost, ms
+ */
+#define NXT_RESYNC_MAX_AGE_MS 2000
+
+/**
+ * \defgroup resync Reply resynchronisation.
+ */
+
+/** \ingroup resync
+ *  Get number of requests still waiting for late reply
+ * @param handle nxt brick handle
+ * @return number of outstanding requests
+ */
+int nxt_outstanding(const libnxtusb_device_handle *handle);
+
+/** \ingroup resync
+ *  Drain pending replies until bus is quiet, then forget outstanding requests.
+ *  Cheap replacement for reopening the device after timeouts.
+ * @param handle nxt brick handle
+ * @param quiet_ms how long bus must stay quiet, ms
+ * @return number of discarded replies, -1 on failure
+ */
+int nxt_resync(const libnxtusb_device_handle *handle, const unsigned int quiet_ms);
+
+#endif
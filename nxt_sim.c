@@ -0,0 +1,557 @@
+/**
+ * @file nxt_sim.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Simulated brick.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "nxt_private.h"
+
+#define SIM_STEP_NS 1000000ULL
+#define SIM_STEP_S 0.001
+#define SIM_REPLIES 16
+#define SIM_NOMINAL_MV 9000.0
+// brakes stop motor this much faster than it accelerates
+#define SIM_BRAKE_FACTOR 0.5
+// ramps start from this share of power, motor would never move from 0
+#define SIM_RAMP_MIN 0.1
+
+typedef struct {
+  cmd_setoutput_t set;
+  double speed;
+  // sub-degree positions behind reported counters
+  double tacho;
+  double block;
+  double rotation;
+  double total;
+  // ramp start, tacho units
+  double ramp_from;
+} sim_motor_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t mode;
+  libnxtusb_sim_keyframe_t keys[NXT_SIM_MAX_KEYFRAMES];
+  unsigned int nkeys;
+  libnxtusb_sim_sensor_cb cb;
+  void *arg;
+  int last_bool;
+  int16_t count;
+  uint16_t raw;
+} sim_sensor_t;
+
+typedef struct {
+  libnxtusb_sim_config_t cfg;
+  uint64_t now_ns;
+  uint64_t real_start_ns;
+  uint64_t real_synced_ns;
+  sim_motor_t motor[3];
+  sim_sensor_t sensor[4];
+  unsigned char reply[SIM_REPLIES][NXT_PACKET_SIZE];
+  unsigned int reply_len[SIM_REPLIES];
+  unsigned int head;
+  unsigned int count;
+} sim_t;
+
+static const nxt_transport_t sim_transport;
+
+static sim_t *sim_of(const libnxtusb_device_handle *handle) {
+  return handle->priv->transport == &sim_transport ? handle->priv->transport_ctx : NULL;
+}
+
+static double sim_abs(const double v) {
+  return v < 0 ? -v : v;
+}
+
+static uint16_t sim_raw(const sim_t *sim, const int port) {
+  const sim_sensor_t *s = &sim->sensor[port];
+  unsigned int i;
+
+  if (s->cb != NULL) {
+    uint16_t v = s->cb(port, sim->now_ns, s->arg);
+    return v > 1023 ? 1023 : v;
+  }
+  if (s->nkeys == 0) {
+    return 1023;
+  }
+  if (sim->now_ns <= s->keys[0].t_ns) {
+    return s->keys[0].raw;
+  }
+  for (i = 1; i < s->nkeys; i++) {
+    if (sim->now_ns < s->keys[i].t_ns) {
+      const libnxtusb_sim_keyframe_t *a = &s->keys[i - 1], *b = &s->keys[i];
+      int64_t span = b->t_ns - a->t_ns;
+      int64_t into = sim->now_ns - a->t_ns;
+      return a->raw + ((int64_t) b->raw - a->raw) * into / span;
+    }
+  }
+  return s->keys[s->nkeys - 1].raw;
+}
+
+// touch switch pulls input low, light and sound read inverted
+static uint16_t sim_normalized(const sim_sensor_t *s) {
+  switch (s->type) {
+    case NXT_SENSOR_SWITCH:
+      return s->raw < 512 ? 1023 : 0;
+    case NXT_SENSOR_REFLECTION:
+    case NXT_SENSOR_LIGHT_ACTIVE:
+    case NXT_SENSOR_LIGHT_INACTIVE:
+    case NXT_SENSOR_SOUND_DB:
+    case NXT_SENSOR_SOUND_DBA:
+      return 1023 - s->raw;
+    default:
+      return s->raw;
+  }
+}
+
+// counters follow boolean value every model step, as brick samples inputs
+static void sim_sensor_step(sim_t *sim, const int port) {
+  sim_sensor_t *s = &sim->sensor[port];
+
+  s->raw = sim_raw(sim, port);
+  int b = sim_normalized(s) > 511;
+  if (b != s->last_bool) {
+    switch (s->mode & NXT_SENSOR_MASK_MODE) {
+      case NXT_SENSOR_MODE_TRANSITION_CNT:
+        s->count++;
+        break;
+      case NXT_SENSOR_MODE_PERIOD_CNT:
+        if (!b) {
+          s->count++;
+        }
+        break;
+    }
+    s->last_bool = b;
+  }
+}
+
+static int16_t sim_scaled(const sim_sensor_t *s) {
+  uint16_t norm = sim_normalized(s);
+
+  switch (s->mode & NXT_SENSOR_MASK_MODE) {
+    case NXT_SENSOR_MODE_BOOLEAN:
+      return norm > 511;
+    case NXT_SENSOR_MODE_TRANSITION_CNT:
+    case NXT_SENSOR_MODE_PERIOD_CNT:
+      return s->count;
+    case NXT_SENSOR_MODE_PCT_FULLSCALE:
+      return norm * 100 / 1023;
+    default:
+      return norm;
+  }
+}
+
+// share of power applied: ramps, sync turn ratio
+static double sim_power(const sim_t *sim, const int port) {
+  const sim_motor_t *m = &sim->motor[port];
+  double p = m->set.power / 100.0;
+  int p2;
+
+  if (!(m->set.mode & NXT_MOTOR_MODE_ON) || m->set.run_state == NXT_MOTOR_RUNSTATE_IDLE) {
+    return 0;
+  }
+  if (m->set.tacho_limit != 0 && (m->set.run_state == NXT_MOTOR_RUNSTATE_RAMPUP ||
+                                  m->set.run_state == NXT_MOTOR_RUNSTATE_RAMPDOWN)) {
+    double done = (sim_abs(m->tacho) - m->ramp_from) / (m->set.tacho_limit - m->ramp_from);
+    done = done < 0 ? 0 : (done > 1 ? 1 : done);
+    double share = m->set.run_state == NXT_MOTOR_RUNSTATE_RAMPUP ? done : 1 - done;
+    p *= SIM_RAMP_MIN + (1 - SIM_RAMP_MIN) * share;
+  }
+  if (m->set.regulation == NXT_MOTOR_REGULATION_SYNC) {
+    // first synced motor of pair is left, other one right
+    int first = 1;
+    for (p2 = 0; p2 < port; p2++) {
+      if (sim->motor[p2].set.regulation == NXT_MOTOR_REGULATION_SYNC) {
+        first = 0;
+      }
+    }
+    int t = m->set.turn_ratio;
+    if (first && t < 0) {
+      p *= 1 + t / 50.0;
+    } else if (!first && t > 0) {
+      p *= 1 - t / 50.0;
+    }
+  }
+  return p;
+}
+
+static void sim_motor_step(sim_t *sim, const int port) {
+  sim_motor_t *m = &sim->motor[port];
+  const double battery = sim->cfg.battery_mv / SIM_NOMINAL_MV;
+  double target = 0;
+  double tau = sim->cfg.coast_tau_s;
+
+  if ((m->set.mode & NXT_MOTOR_MODE_ON) && m->set.run_state != NXT_MOTOR_RUNSTATE_IDLE) {
+    double p = sim_power(sim, port);
+    target = sim->cfg.max_speed * p;
+    // regulation holds speed against sag as long as there is headroom
+    if (m->set.regulation == NXT_MOTOR_REGULATION_IDLE) {
+      target *= battery;
+    } else if (sim_abs(target) > sim->cfg.max_speed * battery) {
+      target = target < 0 ? -sim->cfg.max_speed * battery : sim->cfg.max_speed * battery;
+    }
+    tau = sim->cfg.tau_s;
+  } else if (m->set.mode & NXT_MOTOR_MODE_BRAKE) {
+    tau = sim->cfg.tau_s * SIM_BRAKE_FACTOR;
+  }
+  m->speed += (target - m->speed) * (SIM_STEP_S / (tau + SIM_STEP_S));
+  double d = m->speed * SIM_STEP_S;
+  m->tacho += d;
+  m->block += d;
+  m->rotation += d;
+  m->total += d;
+
+  if (m->set.tacho_limit != 0 && m->set.run_state != NXT_MOTOR_RUNSTATE_IDLE &&
+      sim_abs(m->tacho) >= m->set.tacho_limit) {
+    if (m->set.run_state == NXT_MOTOR_RUNSTATE_RAMPUP) {
+      m->set.run_state = NXT_MOTOR_RUNSTATE_RUNNING;
+      m->set.tacho_limit = 0;
+    } else {
+      // motor stops, brakes if asked, overshoot comes from inertia
+      m->set.run_state = NXT_MOTOR_RUNSTATE_IDLE;
+      m->set.mode &= ~NXT_MOTOR_MODE_ON;
+      m->set.power = 0;
+    }
+  }
+}
+
+static void sim_run(sim_t *sim, const uint64_t ns) {
+  uint64_t end = sim->now_ns + ns;
+  int i;
+
+  while (sim->now_ns + SIM_STEP_NS <= end) {
+    sim->now_ns += SIM_STEP_NS;
+    for (i = 0; i < 3; i++) {
+      sim_motor_step(sim, i);
+    }
+    for (i = 0; i < 4; i++) {
+      sim_sensor_step(sim, i);
+    }
+  }
+  // remainder is kept in clock, steps stay aligned to 1 ms
+  sim->now_ns = end;
+}
+
+// real-time mode: catch up with scaled wall clock
+static void sim_sync(sim_t *sim) {
+  if (sim->cfg.speed <= 0) {
+    return;
+  }
+  uint64_t real = nxt_time_ns();
+  uint64_t target = (uint64_t) ((real - sim->real_start_ns) * sim->cfg.speed);
+  if (target > sim->now_ns) {
+    sim_run(sim, target - sim->now_ns);
+  }
+  sim->real_synced_ns = real;
+}
+
+static void sim_set_output(sim_t *sim, const cmd_setoutput_t *cmd) {
+  int p;
+
+  for (p = 0; p < 3; p++) {
+    if (cmd->port != p && cmd->port != NXT_OUT_ALL) {
+      continue;
+    }
+    sim_motor_t *m = &sim->motor[p];
+    m->set = *cmd;
+    m->set.port = p;
+    if (cmd->tacho_limit != 0) {
+      m->tacho = 0;
+    }
+    m->ramp_from = sim_abs(m->tacho);
+  }
+}
+
+// handle one packet, returns reply length (0 = none)
+static unsigned int sim_command(sim_t *sim, const unsigned char *req, const unsigned int len, unsigned char *rep) {
+  unsigned int n = 3;
+  int p;
+
+  rep[0] = NXT_COMMAND_REPLY;
+  rep[1] = req[1];
+  rep[2] = NXT_STATUS_OK;
+  switch (req[1]) {
+    case NXT_OPCODE_SET_OUTPUTSTATE:
+      if (len < sizeof (cmd_setoutput_t) || (req[2] > 2 && req[2] != NXT_OUT_ALL)) {
+        rep[2] = NXT_STATUS_DATA_OUT_OF_RANGE;
+        break;
+      }
+      sim_set_output(sim, (const cmd_setoutput_t*) req);
+      break;
+    case NXT_OPCODE_GET_OUTPUTSTATE:
+    {
+      if (len < 3 || req[2] > 2) {
+        rep[2] = NXT_STATUS_DATA_OUT_OF_RANGE;
+        break;
+      }
+      sim_motor_t *m = &sim->motor[req[2]];
+      libnxtusb_outputstate_t st = {
+        NXT_COMMAND_REPLY, req[1], NXT_STATUS_OK, req[2], m->set.power, m->set.mode,
+        m->set.regulation, m->set.turn_ratio, m->set.run_state, m->set.tacho_limit,
+        (int32_t) m->tacho, (int32_t) m->block, (int32_t) m->rotation
+      };
+      memcpy(rep, &st, sizeof (st));
+      n = sizeof (st);
+      break;
+    }
+    case NXT_OPCODE_SET_INPUTMODE:
+    {
+      if (len < sizeof (cmd_setinput_t) || req[2] > 3) {
+        rep[2] = NXT_STATUS_DATA_OUT_OF_RANGE;
+        break;
+      }
+      sim_sensor_t *s = &sim->sensor[req[2]];
+      s->type = req[3];
+      s->mode = req[4];
+      s->count = 0;
+      // new type reads differently, that is no transition
+      s->raw = sim_raw(sim, req[2]);
+      s->last_bool = sim_normalized(s) > 511;
+      break;
+    }
+    case NXT_OPCODE_GET_INPUTVALUES:
+    {
+      if (len < 3 || req[2] > 3) {
+        rep[2] = NXT_STATUS_DATA_OUT_OF_RANGE;
+        break;
+      }
+      sim_sensor_t *s = &sim->sensor[req[2]];
+      s->raw = sim_raw(sim, req[2]);
+      libnxtusb_inputstate_t st = {
+        NXT_COMMAND_REPLY, req[1], NXT_STATUS_OK, req[2], s->type != NXT_SENSOR_NONE, 0,
+        s->type, s->mode, s->raw, sim_normalized(s), sim_scaled(s), 0
+      };
+      memcpy(rep, &st, sizeof (st));
+      n = sizeof (st);
+      break;
+    }
+    case NXT_OPCODE_RESET_INPUT_SCALEDVALUES:
+      if (len < 3 || req[2] > 3) {
+        rep[2] = NXT_STATUS_DATA_OUT_OF_RANGE;
+        break;
+      }
+      sim->sensor[req[2]].count = 0;
+      break;
+    case NXT_OPCODE_RESET_MOTOR_POSITION:
+      if (len < 4 || req[2] > 2) {
+        rep[2] = NXT_STATUS_DATA_OUT_OF_RANGE;
+        break;
+      }
+      if (req[3]) {
+        sim->motor[req[2]].block = 0;
+      } else {
+        sim->motor[req[2]].rotation = 0;
+      }
+      break;
+    case NXT_OPCODE_BATTERYLEVEL:
+      rep[3] = sim->cfg.battery_mv & 0xff;
+      rep[4] = sim->cfg.battery_mv >> 8;
+      n = sizeof (ret_battery_t);
+      break;
+    case NXT_OPCODE_KEEPALIVE:
+      memset(rep + 3, 0, 4);
+      n = sizeof (ret_keepalive_t);
+      break;
+    case NXT_OPCODE_PLAYTONE:
+    case NXT_OPCODE_PLAYSOUND:
+    case NXT_OPCODE_STOP_SOUND:
+      break;
+    case NXT_OPCODE_STOPPROGRAM:
+      // no program running, but motors stop as they would
+      for (p = 0; p < 3; p++) {
+        sim->motor[p].set.mode = 0;
+        sim->motor[p].set.run_state = NXT_MOTOR_RUNSTATE_IDLE;
+      }
+      rep[2] = NXT_STATUS_NO_ACTIVE_PROGRAM;
+      break;
+    case NXT_OPCODE_GET_CURRENTPROGRAM_NAME:
+      // no active program
+      rep[2] = NXT_STATUS_NO_ACTIVE_PROGRAM;
+      break;
+    default:
+      rep[2] = NXT_STATUS_UNKNOWN_OPCODE;
+      break;
+  }
+  return n;
+}
+
+static int sim_send(
+                    const libnxtusb_device_handle *handle, const unsigned char *request,
+                    const unsigned int length, const unsigned int timeout
+                    ) {
+  sim_t *sim = handle->priv->transport_ctx;
+  unsigned char rep[NXT_PACKET_SIZE];
+
+  (void) timeout;
+  sim_sync(sim);
+  sim_run(sim, sim->cfg.latency_us * 1000ULL);
+  unsigned int n = sim_command(sim, request, length, rep);
+  if (!(request[0] & 0x80) && sim->count < SIM_REPLIES) {
+    unsigned int tail = (sim->head + sim->count) % SIM_REPLIES;
+    memcpy(sim->reply[tail], rep, n);
+    sim->reply_len[tail] = n;
+    sim->count++;
+  }
+  return length;
+}
+
+static int sim_recv(
+                    const libnxtusb_device_handle *handle, unsigned char *result,
+                    const unsigned int timeout
+                    ) {
+  sim_t *sim = handle->priv->transport_ctx;
+
+  (void) timeout;
+  // nothing will ever come, no point in waiting
+  if (sim->count == 0) {
+    return LIBUSB_ERROR_TIMEOUT;
+  }
+  unsigned int n = sim->reply_len[sim->head];
+  memcpy(result, sim->reply[sim->head], n);
+  sim->head = (sim->head + 1) % SIM_REPLIES;
+  sim->count--;
+  return n;
+}
+
+static void sim_close(libnxtusb_device_handle *handle) {
+  free(handle->priv->transport_ctx);
+}
+
+// model keeps running, state survives
+static int sim_reopen(libnxtusb_device_handle *handle) {
+  sim_t *sim = handle->priv->transport_ctx;
+
+  sim->count = 0;
+  return 0;
+}
+
+static const nxt_transport_t sim_transport = {
+  sim_send, sim_recv, sim_close, sim_reopen
+};
+
+libnxtusb_device_handle *libnxtusb_open_sim(const libnxtusb_sim_config_t *cfg) {
+  sim_t *sim = calloc(1, sizeof (sim_t));
+  if (sim == NULL) {
+    return NULL;
+  }
+  if (cfg != NULL) {
+    sim->cfg = *cfg;
+  }
+  if (sim->cfg.battery_mv == 0) {
+    sim->cfg.battery_mv = 8000;
+  }
+  if (sim->cfg.max_speed <= 0) {
+    sim->cfg.max_speed = 1000;
+  }
+  if (sim->cfg.tau_s <= 0) {
+    sim->cfg.tau_s = 0.06f;
+  }
+  if (sim->cfg.coast_tau_s <= 0) {
+    sim->cfg.coast_tau_s = 0.3f;
+  }
+  sim->real_start_ns = nxt_time_ns();
+  libnxtusb_device_handle *nxtdev = nxt_handle_new(&sim_transport, sim);
+  if (nxtdev == NULL) {
+    free(sim);
+    return NULL;
+  }
+  strcpy(nxtdev->priv->serial, "SIMULATED");
+  return nxtdev;
+}
+
+int nxt_sim_advance(const libnxtusb_device_handle *handle, const uint64_t ns) {
+  sim_t *sim = sim_of(handle);
+
+  if (sim == NULL) {
+    return -1;
+  }
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_RT);
+  sim_run(sim, ns);
+  nxt_channel_release(&handle->priv->channel);
+  return 0;
+}
+
+uint64_t nxt_sim_time(const libnxtusb_device_handle *handle) {
+  sim_t *sim = sim_of(handle);
+
+  if (sim == NULL) {
+    return 0;
+  }
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_RT);
+  sim_sync(sim);
+  uint64_t now = sim->now_ns;
+  nxt_channel_release(&handle->priv->channel);
+  return now;
+}
+
+int nxt_sim_set_sensor(
+                       const libnxtusb_device_handle *handle, const libnxtusb_in_t port,
+                       const libnxtusb_sim_keyframe_t *keys, const unsigned int n
+                       ) {
+  sim_t *sim = sim_of(handle);
+
+  if (sim == NULL || port > 3 || n > NXT_SIM_MAX_KEYFRAMES) {
+    return -1;
+  }
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_BULK);
+  memcpy(sim->sensor[port].keys, keys, n * sizeof (libnxtusb_sim_keyframe_t));
+  sim->sensor[port].nkeys = n;
+  sim->sensor[port].cb = NULL;
+  nxt_channel_release(&handle->priv->channel);
+  return 0;
+}
+
+int nxt_sim_set_sensor_cb(
+                          const libnxtusb_device_handle *handle, const libnxtusb_in_t port,
+                          libnxtusb_sim_sensor_cb cb, void *arg
+                          ) {
+  sim_t *sim = sim_of(handle);
+
+  if (sim == NULL || port > 3) {
+    return -1;
+  }
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_BULK);
+  sim->sensor[port].cb = cb;
+  sim->sensor[port].arg = arg;
+  nxt_channel_release(&handle->priv->channel);
+  return 0;
+}
+
+int nxt_sim_motor(const libnxtusb_device_handle *handle, const libnxtusb_out_t port, double *degrees, double *speed) {
+  sim_t *sim = sim_of(handle);
+
+  if (sim == NULL || port > 2) {
+    return -1;
+  }
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_RT);
+  if (degrees != NULL) {
+    *degrees = sim->motor[port].total;
+  }
+  if (speed != NULL) {
+    *speed = sim->motor[port].speed;
+  }
+  nxt_channel_release(&handle->priv->channel);
+  return 0;
+}
@@ -0,0 +1,153 @@
+/**
+ * @file nxt_sim.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Simulated brick. Public header
+ *
+ * Handle from libnxtusb_open_sim talks to a brick model inside the
+ * process, so controllers can be tested without hardware. Model keeps
+ * its own virtual clock and steps physics in fixed 1 ms steps, so runs
+ * are deterministic. Clock moves only by nxt_sim_advance and by
+ * configured latency of every exchange, or follows real time scaled by
+ * speed factor.
+ *
+ * Motors: first order response of speed to power, speed regulation
+ * ignores battery sag, sync regulation applies turn ratio to synced
+ * pair, ramp up/down scale power along tacho_limit, motor stops (brakes
+ * or coasts, as mode says) on reaching tacho_limit with some overshoot.
+ * A SET_OUTPUTSTATE with tacho_limit starts new movement and clears
+ * tacho_count. Reset of motor position clears block_tacho_count
+ * (relative) or rotation_count.
+ *
+ * Sensors: raw A/D value of every input follows script (keyframes,
+ * linearly interpolated, or callback). Normalized and scaled values are
+ * derived by sensor type and mode: touch is pressed below half scale,
+ * light and sound are inverted raw, boolean, transition and period
+ * counters and percent of full scale work as on brick.
+ */
+
+#ifndef NXT_SIM_H
+#define NXT_SIM_H
+#include "libnxtusb.h"
+
+/** \ingroup sim
+ * Keyframes per sensor script
+ */
+#define NXT_SIM_MAX_KEYFRAMES 64
+
+/** \ingroup sim
+ * Model parameters, zero fields take defaults
+ */
+typedef struct {
+  /** Battery voltage, mV (8000) */
+  uint32_t battery_mv;
+  /** Speed at power 100 and 9 V, deg/s (1000) */
+  float max_speed;
+  /** Motor time constant, s (0.06) */
+  float tau_s;
+  /** Coasting time constant, s (0.3) */
+  float coast_tau_s;
+  /** Virtual time taken by every exchange, us (0) */
+  uint32_t latency_us;
+  /** Virtual seconds per real second, 0 = clock moves only explicitly */
+  double speed;
+} libnxtusb_sim_config_t;
+
+/** \ingroup sim
+ * Sensor script point: raw value at time
+ */
+typedef struct {
+  /** Virtual time, ns */
+  uint64_t t_ns;
+  /** Raw A/D value, 0-1023 */
+  uint16_t raw;
+} libnxtusb_sim_keyframe_t;
+
+/** \ingroup sim
+ * Sensor callback, returns raw A/D value of port at virtual time
+ */
+typedef uint16_t(*libnxtusb_sim_sensor_cb)(const libnxtusb_in_t port, const uint64_t t_ns, void *arg);
+
+/**
+ * \defgroup sim Simulated brick.
+ */
+
+/** \ingroup sim
+ *  Open simulated brick
+ * @param cfg libnxtusb_sim_config_t* model parameters (NULL = defaults)
+ * @return libnxtusb_device_handle handle, NULL on failure
+ */
+libnxtusb_device_handle *libnxtusb_open_sim(const libnxtusb_sim_config_t *cfg);
+
+/** \ingroup sim
+ *  Run model for given virtual time
+ * @param handle simulated brick handle
+ * @param ns virtual time, ns
+ * @return 0 on success, -1 if handle is not simulated
+ */
+int nxt_sim_advance(const libnxtusb_device_handle *handle, const uint64_t ns);
+
+/** \ingroup sim
+ *  Get virtual time
+ * @param handle simulated brick handle
+ * @return virtual time since open, ns (0 if handle is not simulated)
+ */
+uint64_t nxt_sim_time(const libnxtusb_device_handle *handle);
+
+/** \ingroup sim
+ *  Script sensor raw value with keyframes. Value before first keyframe is
+ *  that of first one, after last that of last one
+ * @param handle simulated brick handle
+ * @param port libnxtusb_in_t port
+ * @param keys keyframes, ascending time
+ * @param n number of keyframes (0 = constant 1023, nothing attached)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_sim_set_sensor(
+        const libnxtusb_device_handle *handle, const libnxtusb_in_t port,
+        const libnxtusb_sim_keyframe_t *keys, const unsigned int n
+        );
+
+/** \ingroup sim
+ *  Script sensor raw value with callback
+ * @param handle simulated brick handle
+ * @param port libnxtusb_in_t port
+ * @param cb callback, called from model with channel held
+ * @param arg callback argument
+ * @return 0 on success, -1 on failure
+ */
+int nxt_sim_set_sensor_cb(
+        const libnxtusb_device_handle *handle, const libnxtusb_in_t port,
+        libnxtusb_sim_sensor_cb cb, void *arg
+        );
+
+/** \ingroup sim
+ *  Get exact motor position of model, for checking controllers
+ * @param handle simulated brick handle
+ * @param port libnxtusb_out_t port
+ * @param degrees rotation since open, degrees
+ * @param speed current speed, deg/s
+ * @return 0 on success, -1 on failure
+ */
+int nxt_sim_motor(const libnxtusb_device_handle *handle, const libnxtusb_out_t port, double *degrees, double *speed);
+
+#endif
@@ -0,0 +1,364 @@
+/**
+ * @file nxt_sound.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * WAV to RSO conversion and upload.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nxt_private.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SOUND_PHASES 256
+// filter zero crossings on each side, in output samples
+#define SOUND_ZERO_CROSSINGS 8
+// cutoff below output Nyquist, leaves room for transition band
+#define SOUND_CUTOFF 0.9
+#define RSO_HEADER 8
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_FLOAT 0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+typedef struct {
+  // mono input, taps zeros on both sides
+  float *x;
+  uint32_t frames;
+  uint32_t in_rate;
+  uint32_t out_rate;
+  // taps per phase, multiple of 8
+  unsigned int taps;
+  float *bank;
+  uint32_t samples;
+  float gain;
+  int dither;
+  uint32_t seed;
+  // bytes of RSO produced
+  uint32_t pos;
+} rso_conv_t;
+
+static uint16_t le16(const uint8_t *p) {
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// one sample of any supported encoding to -1..1
+static float wav_sample(const uint8_t *p, const unsigned int bits, const int is_float) {
+  union {
+    uint32_t u;
+    float f;
+  } v;
+
+  if (is_float) {
+    v.u = le32(p);
+    return v.f;
+  }
+  switch (bits) {
+    case 8:
+      return (p[0] - 128) / 128.0f;
+    case 16:
+      return (int16_t) le16(p) / 32768.0f;
+    case 24:
+      return (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) / 2147483648.0f;
+    default:
+      return (int32_t) le32(p) / 2147483648.0f;
+  }
+}
+
+typedef struct {
+  const uint8_t *data;
+  uint32_t frames;
+  uint32_t rate;
+  unsigned int channels;
+  unsigned int bits;
+  unsigned int align;
+  int is_float;
+} wav_info_t;
+
+// find format and samples of RIFF WAVE file
+static int wav_parse(const uint8_t *wav, const size_t size, wav_info_t *info) {
+  const uint8_t *fmt = NULL;
+  uint32_t fmt_len = 0, data_len = 0;
+  size_t off = 12;
+
+  if (size < 12 || memcmp(wav, "RIFF", 4) != 0 || memcmp(wav + 8, "WAVE", 4) != 0) {
+    return -1;
+  }
+  info->data = NULL;
+  while (off + 8 <= size) {
+    uint32_t len = le32(wav + off + 4);
+    // writers which stream may leave length unknown
+    if (len > size - off - 8) {
+      len = size - off - 8;
+    }
+    if (memcmp(wav + off, "fmt ", 4) == 0) {
+      fmt = wav + off + 8;
+      fmt_len = len;
+    } else if (memcmp(wav + off, "data", 4) == 0) {
+      info->data = wav + off + 8;
+      data_len = len;
+    }
+    off += 8 + (size_t) len + (len & 1);
+  }
+  if (fmt == NULL || info->data == NULL || fmt_len < 16) {
+    return -1;
+  }
+  unsigned int format = le16(fmt);
+  info->channels = le16(fmt + 2);
+  info->rate = le32(fmt + 4);
+  info->align = le16(fmt + 12);
+  info->bits = le16(fmt + 14);
+  if (format == WAV_FORMAT_EXTENSIBLE && fmt_len >= 26) {
+    // first two bytes of subformat GUID are format tag
+    format = le16(fmt + 24);
+  }
+  info->is_float = format == WAV_FORMAT_FLOAT;
+  if ((format != WAV_FORMAT_PCM && !info->is_float) || (info->is_float && info->bits != 32) ||
+      (info->bits != 8 && info->bits != 16 && info->bits != 24 && info->bits != 32) ||
+      info->channels == 0 || info->rate == 0 || info->align < info->channels * (info->bits / 8)) {
+    return -1;
+  }
+  info->frames = data_len / info->align;
+  return 0;
+}
+
+// samples into conv->x, channels mixed down
+static int wav_decode(rso_conv_t *conv, const wav_info_t *info, const unsigned int pad, float *peak) {
+  const unsigned int width = info->bits / 8;
+  uint32_t i;
+  unsigned int ch;
+
+  conv->frames = info->frames;
+  conv->x = calloc((size_t) conv->frames + 2 * pad, sizeof (float));
+  if (conv->x == NULL) {
+    return -1;
+  }
+  *peak = 0;
+  for (i = 0; i < conv->frames; i++) {
+    const uint8_t *frame = info->data + (size_t) i * info->align;
+    float sum = 0;
+    for (ch = 0; ch < info->channels; ch++) {
+      sum += wav_sample(frame + ch * width, info->bits, info->is_float);
+    }
+    sum /= info->channels;
+    conv->x[pad + i] = sum;
+    if (fabsf(sum) > *peak) {
+      *peak = fabsf(sum);
+    }
+  }
+  return 0;
+}
+
+// phase p is for output position p/SOUND_PHASES of input sample past tap taps/2-1
+static int bank_design(rso_conv_t *conv, const double fc) {
+  const unsigned int taps = conv->taps;
+  const double half = taps / 2.0;
+  unsigned int p, j;
+
+  conv->bank = malloc((size_t) SOUND_PHASES * taps * sizeof (float));
+  if (conv->bank == NULL) {
+    return -1;
+  }
+  for (p = 0; p < SOUND_PHASES; p++) {
+    float *h = conv->bank + (size_t) p * taps;
+    double sum = 0;
+    for (j = 0; j < taps; j++) {
+      double t = (double) j - (half - 1) - (double) p / SOUND_PHASES;
+      double x = t / half;
+      double sinc = t == 0 ? 1 : sin(M_PI * fc * t) / (M_PI * fc * t);
+      // Blackman window
+      double w = fabs(x) >= 1 ? 0 : 0.42 + 0.5 * cos(M_PI * x) + 0.08 * cos(2 * M_PI * x);
+      h[j] = fc * sinc * w;
+      sum += h[j];
+    }
+    // unity gain at DC in every phase
+    for (j = 0; j < taps; j++) {
+      h[j] /= sum;
+    }
+  }
+  return 0;
+}
+
+static int conv_init(
+                     rso_conv_t *conv, const uint8_t *wav, const size_t size,
+                     const unsigned int rate, const unsigned int flags
+                     ) {
+  wav_info_t info;
+  float peak;
+
+  memset(conv, 0, sizeof (*conv));
+  conv->out_rate = rate ? rate : NXT_RSO_RATE;
+  if (conv->out_rate < NXT_RSO_RATE_MIN || conv->out_rate > NXT_RSO_RATE_MAX) {
+    return -1;
+  }
+  if (wav_parse(wav, size, &info) != 0) {
+    return -1;
+  }
+  conv->in_rate = info.rate;
+  double fc = SOUND_CUTOFF;
+  if (conv->in_rate > conv->out_rate) {
+    fc *= (double) conv->out_rate / conv->in_rate;
+  }
+  conv->taps = ((unsigned int) ceil(2 * SOUND_ZERO_CROSSINGS / fc) + 7) & ~7u;
+  if (wav_decode(conv, &info, conv->taps, &peak) != 0 || bank_design(conv, fc) != 0) {
+    return -1;
+  }
+  uint64_t samples = ((uint64_t) conv->frames * conv->out_rate + conv->in_rate - 1) / conv->in_rate;
+  if (samples > NXT_RSO_MAX_SAMPLES) {
+    return -1;
+  }
+  conv->samples = samples;
+  conv->gain = (flags & NXT_RSO_NORMALIZE) && peak > 0 ? 1 / peak : 1;
+  conv->dither = flags & NXT_RSO_DITHER;
+  conv->seed = 1;
+  return 0;
+}
+
+static void conv_free(rso_conv_t *conv) {
+  free(conv->x);
+  free(conv->bank);
+}
+
+static float sound_dot(const float *h, const float *x, const unsigned int n) {
+  unsigned int i = 0;
+  float sum = 0;
+
+#if defined(__SSE2__)
+  __m128 a = _mm_setzero_ps();
+  __m128 b = _mm_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(h + i), _mm_loadu_ps(x + i)));
+    b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(h + i + 4), _mm_loadu_ps(x + i + 4)));
+  }
+  float t[4];
+  _mm_storeu_ps(t, _mm_add_ps(a, b));
+  sum = t[0] + t[1] + t[2] + t[3];
+#elif defined(__ARM_NEON)
+  float32x4_t a = vdupq_n_f32(0);
+  float32x4_t b = vdupq_n_f32(0);
+  for (; i + 8 <= n; i += 8) {
+    a = vmlaq_f32(a, vld1q_f32(h + i), vld1q_f32(x + i));
+    b = vmlaq_f32(b, vld1q_f32(h + i + 4), vld1q_f32(x + i + 4));
+  }
+  float32x4_t s = vaddq_f32(a, b);
+  sum = vgetq_lane_f32(s, 0) + vgetq_lane_f32(s, 1) + vgetq_lane_f32(s, 2) + vgetq_lane_f32(s, 3);
+#endif
+  for (; i < n; i++) {
+    sum += h[i] * x[i];
+  }
+  return sum;
+}
+
+// uniform 0..1, deterministic so conversions are reproducible
+static float sound_rand(uint32_t *seed) {
+  *seed = *seed * 1664525u + 1013904223u;
+  return (*seed >> 8) / 16777216.0f;
+}
+
+static uint8_t conv_sample(rso_conv_t *conv, const uint32_t k) {
+  // exact rational position, no drift over long files
+  uint64_t num = (uint64_t) k * conv->in_rate;
+  uint64_t i = num / conv->out_rate;
+  uint64_t phase = ((num % conv->out_rate) * SOUND_PHASES + conv->out_rate / 2) / conv->out_rate;
+  if (phase == SOUND_PHASES) {
+    i++;
+    phase = 0;
+  }
+  const float *x = conv->x + conv->taps + i - (conv->taps / 2 - 1);
+  float y = sound_dot(conv->bank + phase * conv->taps, x, conv->taps) * conv->gain * 127.0f + 128.0f;
+  if (conv->dither) {
+    y += sound_rand(&conv->seed) + sound_rand(&conv->seed) - 1.0f;
+  }
+  y = floorf(y + 0.5f);
+  return y < 0 ? 0 : (y > 255 ? 255 : (uint8_t) y);
+}
+
+// next n bytes of RSO file
+static int conv_read(uint8_t *buf, const unsigned int n, void *arg) {
+  rso_conv_t *conv = arg;
+  unsigned int i;
+
+  for (i = 0; i < n; i++, conv->pos++) {
+    if (conv->pos < RSO_HEADER) {
+      // format 0x0100, sample count, rate, play mode 0
+      const uint16_t header[4] = {0x0100, conv->samples, conv->out_rate, 0};
+      buf[i] = conv->pos & 1 ? header[conv->pos / 2] & 0xff : header[conv->pos / 2] >> 8;
+    } else {
+      buf[i] = conv_sample(conv, conv->pos - RSO_HEADER);
+    }
+  }
+  return 0;
+}
+
+int nxt_wav_to_rso(
+                   const void *wav, const size_t size, const unsigned int rate, const unsigned int flags,
+                   uint8_t **rso, uint32_t *rso_size
+                   ) {
+  rso_conv_t conv;
+
+  if (conv_init(&conv, wav, size, rate, flags) != 0) {
+    conv_free(&conv);
+    return -1;
+  }
+  *rso_size = RSO_HEADER + conv.samples;
+  *rso = malloc(*rso_size);
+  if (*rso == NULL) {
+    conv_free(&conv);
+    return -1;
+  }
+  conv_read(*rso, *rso_size, &conv);
+  conv_free(&conv);
+  return 0;
+}
+
+int nxt_upload_wav(
+                   const libnxtusb_device_handle *handle, const char *name, const char *path,
+                   const unsigned int rate, const unsigned int flags
+                   ) {
+  rso_conv_t conv;
+  uint32_t size;
+
+  uint8_t *wav = nxt_read_file(path, &size);
+  if (wav == NULL) {
+    return -1;
+  }
+  int ret = conv_init(&conv, wav, size, rate, flags);
+  free(wav);
+  if (ret == 0) {
+    ret = nxt_file_upload_from(handle, name, RSO_HEADER + conv.samples, conv_read, &conv);
+  }
+  conv_free(&conv);
+  return ret;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file nxt_sound.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * WAV to RSO conversion and upload. Public header
+ *
+ * RSO is sound file format of NXT firmware: 8 byte header (format,
+ * sample count, sample rate, play mode, all big endian 16 bit) followed
+ * by 8 bit unsigned mono samples. Converter reads PCM WAV (8, 16, 24, 32
+ * bit integer or 32 bit float, any number of channels, mixed down to
+ * mono) and resamples it with windowed sinc polyphase filter bank of 256
+ * phases. Filter is as wide as ratio needs to suppress aliasing when
+ * rate is reduced, inner products use SSE or NEON when available.
+ * Result is requantized to 8 bit, optionally with peak normalization and
+ * triangular dither.
+ *
+ * nxt_upload_wav converts straight into upload pipeline: samples are
+ * produced as write packets are filled, no RSO file or buffer is made.
+ */
+
+#ifndef NXT_SOUND_H
+#define NXT_SOUND_H
+#include <stddef.h>
+#include "libnxtusb.h"
+
+/** \ingroup sound
+ * Default sample rate, Hz
+ */
+#define NXT_RSO_RATE 8000
+
+/** \ingroup sound
+ * Lowest and highest sample rates firmware plays, Hz
+ */
+#define NXT_RSO_RATE_MIN 2000
+#define NXT_RSO_RATE_MAX 16000
+
+/** \ingroup sound
+ * Most samples one RSO file holds
+ */
+#define NXT_RSO_MAX_SAMPLES 65535
+
+/** \ingroup sound
+ * Conversion flags
+ */
+enum {
+  /** Scale so that peak reaches full scale */
+  NXT_RSO_NORMALIZE = 0x01,
+  /** Triangular dither before requantization */
+  NXT_RSO_DITHER = 0x02
+};
+
+/**
+ * \defgroup sound WAV to RSO conversion.
+ */
+
+/** \ingroup sound
+ *  Convert WAV in memory to RSO
+ * @param wav WAV file contents
+ * @param size WAV size
+ * @param rate output sample rate, Hz (0 = NXT_RSO_RATE)
+ * @param flags NXT_RSO_* flags
+ * @param rso RSO file contents, free with free()
+ * @param rso_size RSO size
+ * @return 0 on success, -1 on failure (not PCM WAV, too long for RSO)
+ */
+int nxt_wav_to_rso(
+        const void *wav, const size_t size, const unsigned int rate, const unsigned int flags,
+        uint8_t **rso, uint32_t *rso_size
+        );
+
+/** \ingroup sound
+ *  Convert WAV file and upload it as RSO, replacing brick file of same name
+ * @param handle nxt brick handle
+ * @param name brick file name (.rso)
+ * @param path WAV file
+ * @param rate output sample rate, Hz (0 = NXT_RSO_RATE)
+ * @param flags NXT_RSO_* flags
+ * @return 0 on success, -1 on failure
+ */
+int nxt_upload_wav(
+        const libnxtusb_device_handle *handle, const char *name, const char *path,
+        const unsigned int rate, const unsigned int flags
+        );
+
+#endif
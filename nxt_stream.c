@@ -0,0 +1,194 @@
+/**
+ * @file nxt_stream.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Length-prefixed packet stream over file descriptor, shared by TCP and
+ * Bluetooth transports.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "nxt_private.h"
+
+//internal. start framing on fd, buffers are emptied
+
+void nxt_stream_attach(nxt_stream_t *s, const int fd) {
+  struct stat st;
+
+  s->fd = fd;
+  s->is_socket = fd >= 0 && fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+  s->out_len = 0;
+  s->in_start = 0;
+  s->in_end = 0;
+}
+
+// stream is useless after framing error or hangup
+static int stream_broken(nxt_stream_t *s) {
+  if (s->fd >= 0) {
+    close(s->fd);
+    s->fd = -1;
+  }
+  return LIBUSB_ERROR_NO_DEVICE;
+}
+
+static int stream_wait(const nxt_stream_t *s, const short events, const int timeout) {
+  struct pollfd p = {s->fd, events, 0};
+  int ret;
+
+  do {
+    ret = poll(&p, 1, timeout);
+  } while (ret < 0 && errno == EINTR);
+  if (ret == 0) {
+    return LIBUSB_ERROR_TIMEOUT;
+  }
+  return ret < 0 ? LIBUSB_ERROR_IO : 0;
+}
+
+//internal. write out buffered frames. Returns 0 or libusb error code
+
+int nxt_stream_flush(nxt_stream_t *s, const int timeout) {
+  unsigned int done = 0;
+
+  if (s->fd < 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  while (done < s->out_len) {
+    int ret = stream_wait(s, POLLOUT, timeout);
+    if (ret < 0) {
+      // partial frame can't be taken back
+      return done > 0 ? stream_broken(s) : ret;
+    }
+    // ttys have no send(), sockets must not raise SIGPIPE
+    ssize_t n = s->is_socket ?
+      send(s->fd, s->out + done, s->out_len - done, MSG_NOSIGNAL) :
+      write(s->fd, s->out + done, s->out_len - done);
+    if (n < 0 && errno != EINTR && errno != EAGAIN) {
+      return stream_broken(s);
+    }
+    if (n > 0) {
+      done += n;
+      s->stats.writes++;
+    }
+  }
+  s->out_len = 0;
+  return 0;
+}
+
+//internal. frame packet. Reply packets wait for nxt_stream_recv, no-reply
+//ones too if batching. Returns length or libusb error code
+
+int nxt_stream_send(
+                    nxt_stream_t *s, const unsigned char *request,
+                    const unsigned int length, const unsigned int timeout
+                    ) {
+  int ret;
+
+  if (s->fd < 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  if (s->out_len + 2 + length > NXT_TCP_BUFFER && (ret = nxt_stream_flush(s, timeout)) < 0) {
+    return ret;
+  }
+  s->out[s->out_len] = length & 0xff;
+  s->out[s->out_len + 1] = length >> 8;
+  memcpy(s->out + s->out_len + 2, request, length);
+  s->out_len += 2 + length;
+  s->stats.packets_out++;
+  if ((request[0] & 0x80) && !s->batching && (ret = nxt_stream_flush(s, timeout)) < 0) {
+    return ret;
+  }
+  return length;
+}
+
+//internal. next packet, several may come with one read. Returns length or
+//libusb error code
+
+int nxt_stream_recv(nxt_stream_t *s, unsigned char *result, const unsigned int timeout) {
+  int ret;
+
+  if (s->out_len > 0 && (ret = nxt_stream_flush(s, timeout)) < 0) {
+    return ret;
+  }
+  if (s->fd < 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  for (;;) {
+    unsigned int avail = s->in_end - s->in_start;
+    if (avail >= 2) {
+      unsigned int length = s->in[s->in_start] | s->in[s->in_start + 1] << 8;
+      if (length == 0 || length > NXT_PACKET_SIZE) {
+        return stream_broken(s);
+      }
+      if (avail >= 2 + length) {
+        memcpy(result, s->in + s->in_start + 2, length);
+        s->in_start += 2 + length;
+        s->stats.packets_in++;
+        return length;
+      }
+    }
+    if (s->in_start > 0) {
+      memmove(s->in, s->in + s->in_start, avail);
+      s->in_start = 0;
+      s->in_end = avail;
+    }
+    if ((ret = stream_wait(s, POLLIN, timeout)) < 0) {
+      return ret;
+    }
+    ssize_t n = read(s->fd, s->in + s->in_end, NXT_TCP_BUFFER - s->in_end);
+    if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+      return stream_broken(s);
+    }
+    if (n > 0) {
+      s->in_end += n;
+      s->stats.reads++;
+    }
+  }
+}
+
+//internal. push out what is left and close fd
+
+void nxt_stream_close(nxt_stream_t *s) {
+  if (s->fd >= 0 && s->out_len > 0) {
+    nxt_stream_flush(s, 100);
+  }
+  if (s->fd >= 0) {
+    close(s->fd);
+    s->fd = -1;
+  }
+}
+
+//internal. stream of framed transport handle, NULL for other transports
+
+nxt_stream_t *nxt_stream_of(const libnxtusb_device_handle *handle) {
+  if (handle->priv->transport == &nxt_tcp_transport ||
+      handle->priv->transport == &nxt_fd_transport ||
+      handle->priv->transport == &nxt_plain_fd_transport) {
+    // stream is first member of their context
+    return handle->priv->transport_ctx;
+  }
+  return NULL;
+}
@@ -0,0 +1,176 @@
+/**
+ * @file nxt_tcp.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * TCP transport.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "nxt_private.h"
+
+typedef struct {
+  nxt_stream_t stream;
+  char host[256];
+  unsigned short port;
+  int nodelay;
+} tcp_t;
+
+static int tcp_connect(tcp_t *t) {
+  struct addrinfo hints, *res, *ai;
+  char port[8];
+  int fd = -1;
+
+  memset(&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port, sizeof (port), "%u", t->port);
+  if (getaddrinfo(t->host, port, &hints, &res) != 0) {
+    return LIBUSB_ERROR_NOT_FOUND;
+  }
+  for (ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  if (fd < 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &t->nodelay, sizeof (t->nodelay));
+  nxt_stream_attach(&t->stream, fd);
+  return 0;
+}
+
+static int tcp_send(
+                    const libnxtusb_device_handle *handle, const unsigned char *request,
+                    const unsigned int length, const unsigned int timeout
+                    ) {
+  tcp_t *t = handle->priv->transport_ctx;
+  return nxt_stream_send(&t->stream, request, length, timeout);
+}
+
+static int tcp_recv(
+                    const libnxtusb_device_handle *handle, unsigned char *result,
+                    const unsigned int timeout
+                    ) {
+  tcp_t *t = handle->priv->transport_ctx;
+  return nxt_stream_recv(&t->stream, result, timeout);
+}
+
+static void tcp_close(libnxtusb_device_handle *handle) {
+  tcp_t *t = handle->priv->transport_ctx;
+
+  nxt_stream_close(&t->stream);
+  free(t);
+}
+
+static int tcp_reopen(libnxtusb_device_handle *handle) {
+  tcp_t *t = handle->priv->transport_ctx;
+
+  nxt_stream_close(&t->stream);
+  return tcp_connect(t);
+}
+
+const nxt_transport_t nxt_tcp_transport = {
+  tcp_send, tcp_recv, tcp_close, tcp_reopen
+};
+
+libnxtusb_device_handle *libnxtusb_open_tcp(const char *host, const unsigned short port) {
+  if (strlen(host) >= sizeof (((tcp_t*) 0)->host)) {
+    return NULL;
+  }
+  tcp_t *t = calloc(1, sizeof (tcp_t));
+  if (t == NULL) {
+    return NULL;
+  }
+  strcpy(t->host, host);
+  t->port = port ? port : NXT_TCP_PORT;
+  t->nodelay = 1;
+  if (tcp_connect(t) != 0) {
+    free(t);
+    return NULL;
+  }
+  libnxtusb_device_handle *nxtdev = nxt_handle_new(&nxt_tcp_transport, t);
+  if (nxtdev == NULL) {
+    nxt_stream_close(&t->stream);
+    free(t);
+  }
+  return nxtdev;
+}
+
+int nxt_tcp_set_batching(const libnxtusb_device_handle *handle, const int enable) {
+  nxt_stream_t *s = nxt_stream_of(handle);
+
+  if (s == NULL) {
+    return -1;
+  }
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_BULK);
+  s->batching = enable;
+  int ret = enable || s->out_len == 0 ? 0 : nxt_stream_flush(s, handle->priv->timeouts.policy[NXT_CLASS_ACTUATOR].send_ms);
+  nxt_channel_release(&handle->priv->channel);
+  return ret < 0 ? -1 : 0;
+}
+
+int nxt_tcp_set_nodelay(const libnxtusb_device_handle *handle, const int enable) {
+  if (handle->priv->transport != &nxt_tcp_transport) {
+    return -1;
+  }
+  tcp_t *t = handle->priv->transport_ctx;
+  t->nodelay = enable ? 1 : 0;
+  if (t->stream.fd >= 0 &&
+      setsockopt(t->stream.fd, IPPROTO_TCP, TCP_NODELAY, &t->nodelay, sizeof (t->nodelay)) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int nxt_tcp_flush(const libnxtusb_device_handle *handle) {
+  nxt_stream_t *s = nxt_stream_of(handle);
+
+  if (s == NULL) {
+    return -1;
+  }
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_RT);
+  int ret = s->out_len == 0 ? 0 : nxt_stream_flush(s, handle->priv->timeouts.policy[NXT_CLASS_ACTUATOR].send_ms);
+  nxt_channel_release(&handle->priv->channel);
+  return ret < 0 ? -1 : 0;
+}
+
+int nxt_tcp_stats(const libnxtusb_device_handle *handle, libnxtusb_tcp_stats_t *stats) {
+  nxt_stream_t *s = nxt_stream_of(handle);
+
+  if (s == NULL) {
+    return -1;
+  }
+  *stats = s->stats;
+  return 0;
+}
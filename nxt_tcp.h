@@ -0,0 +1,106 @@
+/**
+ * @file nxt_tcp.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * TCP transport for bricks behind nxtproxy. Public header
+ *
+ * Every packet travels as 2 bytes of length (little-endian) followed by
+ * packet data, the same framing bricks use over Bluetooth. Packets
+ * expecting a reply are held until the reply is awaited, so a pipeline
+ * (see nxt_pipeline) goes out in one write and its replies come back in
+ * one write of the proxy. With batching on, no-reply packets wait for the
+ * next write too, or for nxt_tcp_flush. Batching, flushing and statistics
+ * apply to Bluetooth handles (nxt_bluetooth.h) as well.
+ */
+
+#ifndef NXT_TCP_H
+#define NXT_TCP_H
+#include "libnxtusb.h"
+
+/** \ingroup tcp
+ * Default nxtproxy port
+ */
+#define NXT_TCP_PORT 5931
+
+/** \ingroup tcp
+ * Framed bytes buffered per direction
+ */
+#define NXT_TCP_BUFFER 4096
+
+/** \ingroup tcp
+ * TCP and Bluetooth transport statistics
+ */
+typedef struct {
+  /** Packets sent */
+  uint64_t packets_out;
+  /** write() calls carrying them */
+  uint64_t writes;
+  /** Packets received */
+  uint64_t packets_in;
+  /** read() calls carrying them */
+  uint64_t reads;
+} libnxtusb_tcp_stats_t;
+
+/**
+ * \defgroup tcp TCP transport.
+ */
+
+/** \ingroup tcp
+ *  Connect to brick served by nxtproxy
+ * @param host host name or address
+ * @param port TCP port, 0 = NXT_TCP_PORT
+ * @return libnxtusb_device_handle handle, NULL on failure
+ */
+libnxtusb_device_handle *libnxtusb_open_tcp(const char *host, const unsigned short port);
+
+/** \ingroup tcp
+ *  Hold no-reply packets until next reply is awaited or nxt_tcp_flush
+ * @param handle nxt brick handle (TCP or Bluetooth)
+ * @param enable 1 = on, 0 = off (default)
+ * @return 0 on success, -1 if handle is not TCP or Bluetooth, or flush failed
+ */
+int nxt_tcp_set_batching(const libnxtusb_device_handle *handle, const int enable);
+
+/** \ingroup tcp
+ *  Set TCP_NODELAY of connection, on by default
+ * @param handle nxt brick handle (TCP)
+ * @param enable 1 = send immediately, 0 = let kernel coalesce (Nagle)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_tcp_set_nodelay(const libnxtusb_device_handle *handle, const int enable);
+
+/** \ingroup tcp
+ *  Send buffered packets
+ * @param handle nxt brick handle (TCP or Bluetooth)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_tcp_flush(const libnxtusb_device_handle *handle);
+
+/** \ingroup tcp
+ *  Get transport statistics
+ * @param handle nxt brick handle (TCP or Bluetooth)
+ * @param stats libnxtusb_tcp_stats_t* statistics (preallocated)
+ * @return 0 on success, -1 if handle is not TCP or Bluetooth
+ */
+int nxt_tcp_stats(const libnxtusb_device_handle *handle, libnxtusb_tcp_stats_t *stats);
+
+#endif
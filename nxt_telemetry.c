@@ -0,0 +1,304 @@
+/**
+ * @file nxt_telemetry.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Shared-memory telemetry.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nxt_private.h"
+
+#define TELEMETRY_MAGIC 0x5454584eU
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_NAME_SIZE 64
+// sample data as words, so seqlock readers never race on plain memory
+#define TELEMETRY_WORDS 8
+// seqlock read attempts before slot is given up, and pause between them
+#define TELEMETRY_READ_TRIES 100
+#define TELEMETRY_RETRY_NS 1000
+
+// one seqlock protected sample. seq is odd while written
+typedef struct {
+  atomic_uint seq;
+  atomic_uint_least64_t index;
+  atomic_uint_least64_t at_ns;
+  atomic_uint kind_port;
+  atomic_uint data[TELEMETRY_WORDS];
+} slot_t;
+
+// segment layout
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  char serial[NXT_SERIAL_SIZE];
+  // samples written
+  atomic_uint_least64_t head;
+  slot_t input[4];
+  slot_t output[3];
+  slot_t ring[NXT_TELEMETRY_HISTORY];
+} segment_t;
+
+struct nxt_telemetry {
+  segment_t *seg;
+  char name[TELEMETRY_NAME_SIZE];
+};
+
+struct libnxtusb_telemetry {
+  const segment_t *seg;
+};
+
+static void slot_write(
+                       slot_t *s, const uint64_t index, const uint64_t at_ns,
+                       const unsigned int kind_port, const uint32_t *data
+                       ) {
+  unsigned int seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+  int i;
+
+  atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&s->index, index, memory_order_relaxed);
+  atomic_store_explicit(&s->at_ns, at_ns, memory_order_relaxed);
+  atomic_store_explicit(&s->kind_port, kind_port, memory_order_relaxed);
+  for (i = 0; i < TELEMETRY_WORDS; i++) {
+    atomic_store_explicit(&s->data[i], data[i], memory_order_relaxed);
+  }
+  atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+// consistent copy of slot. Returns sample index, 0 if slot is empty
+static uint64_t slot_read(const slot_t *cs, libnxtusb_telemetry_sample_t *sample) {
+  slot_t *s = (slot_t*) cs;
+  uint32_t data[TELEMETRY_WORDS];
+  unsigned int seq, kind_port;
+  uint64_t index, at_ns;
+  unsigned int tries = 0;
+  int i;
+
+  for (;; tries++) {
+    // writer which died or was stopped mid-write leaves slot odd forever
+    if (tries == TELEMETRY_READ_TRIES) {
+      return 0;
+    }
+    if (tries > 0) {
+      struct timespec ts = {0, TELEMETRY_RETRY_NS};
+      nanosleep(&ts, NULL);
+    }
+    seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    if (seq & 1) {
+      continue;
+    }
+    index = atomic_load_explicit(&s->index, memory_order_relaxed);
+    at_ns = atomic_load_explicit(&s->at_ns, memory_order_relaxed);
+    kind_port = atomic_load_explicit(&s->kind_port, memory_order_relaxed);
+    for (i = 0; i < TELEMETRY_WORDS; i++) {
+      data[i] = atomic_load_explicit(&s->data[i], memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq) {
+      break;
+    }
+  }
+  if (index == 0) {
+    return 0;
+  }
+  sample->index = index;
+  sample->at_ns = at_ns;
+  sample->kind = kind_port >> 8;
+  sample->port = kind_port & 0xff;
+  memcpy(&sample->state, data, sizeof (sample->state));
+  return index;
+}
+
+//internal. publish input values or output state reply
+
+void nxt_telemetry_record(nxt_telemetry_t *tel, const uint64_t ts_ns, const unsigned char *reply, const unsigned int length) {
+  segment_t *seg = tel->seg;
+  uint32_t data[TELEMETRY_WORDS] = {0};
+  slot_t *latest;
+  unsigned int kind;
+
+  if (reply[1] == NXT_OPCODE_GET_INPUTVALUES && length == sizeof (libnxtusb_inputstate_t) && reply[3] < 4) {
+    kind = NXT_TELEMETRY_INPUT;
+    latest = &seg->input[reply[3]];
+  } else if (reply[1] == NXT_OPCODE_GET_OUTPUTSTATE && length == sizeof (libnxtusb_outputstate_t) && reply[3] < 3) {
+    kind = NXT_TELEMETRY_OUTPUT;
+    latest = &seg->output[reply[3]];
+  } else {
+    return;
+  }
+  memcpy(data, reply, length);
+  // single writer: reply path holds channel
+  uint64_t index = atomic_load_explicit(&seg->head, memory_order_relaxed) + 1;
+  slot_write(latest, index, ts_ns, kind << 8 | reply[3], data);
+  slot_write(&seg->ring[(index - 1) % NXT_TELEMETRY_HISTORY], index, ts_ns, kind << 8 | reply[3], data);
+  atomic_store_explicit(&seg->head, index, memory_order_release);
+}
+
+int nxt_telemetry_publish(const libnxtusb_device_handle *handle, const char *name) {
+  char def[TELEMETRY_NAME_SIZE];
+
+  if (handle->priv->telemetry != NULL) {
+    return -1;
+  }
+  if (name == NULL) {
+    snprintf(def, sizeof (def), "/nxt-%s", handle->priv->serial);
+    name = def;
+  }
+  if (strlen(name) >= TELEMETRY_NAME_SIZE) {
+    return -1;
+  }
+  nxt_telemetry_t *tel = calloc(1, sizeof (nxt_telemetry_t));
+  if (tel == NULL) {
+    return -1;
+  }
+  strcpy(tel->name, name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    free(tel);
+    return -1;
+  }
+  if (ftruncate(fd, sizeof (segment_t)) != 0) {
+    close(fd);
+    shm_unlink(name);
+    free(tel);
+    return -1;
+  }
+  tel->seg = mmap(NULL, sizeof (segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (tel->seg == MAP_FAILED) {
+    shm_unlink(name);
+    free(tel);
+    return -1;
+  }
+  // fresh pages are zero, all slots empty
+  memcpy(tel->seg->serial, handle->priv->serial, NXT_SERIAL_SIZE);
+  tel->seg->version = TELEMETRY_VERSION;
+  atomic_thread_fence(memory_order_release);
+  tel->seg->magic = TELEMETRY_MAGIC;
+
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_BULK);
+  handle->priv->telemetry = tel;
+  nxt_channel_release(&handle->priv->channel);
+  return 0;
+}
+
+void nxt_telemetry_unpublish(const libnxtusb_device_handle *handle) {
+  nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_BULK);
+  nxt_telemetry_t *tel = handle->priv->telemetry;
+  handle->priv->telemetry = NULL;
+  nxt_channel_release(&handle->priv->channel);
+  if (tel == NULL) {
+    return;
+  }
+  munmap(tel->seg, sizeof (segment_t));
+  shm_unlink(tel->name);
+  free(tel);
+}
+
+libnxtusb_telemetry_t *libnxtusb_telemetry_open(const char *name) {
+  struct stat st;
+
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof (segment_t)) {
+    close(fd);
+    return NULL;
+  }
+  const segment_t *seg = mmap(NULL, sizeof (segment_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (seg == MAP_FAILED) {
+    return NULL;
+  }
+  if (seg->magic != TELEMETRY_MAGIC || seg->version != TELEMETRY_VERSION) {
+    munmap((void*) seg, sizeof (segment_t));
+    return NULL;
+  }
+  libnxtusb_telemetry_t *t = malloc(sizeof (libnxtusb_telemetry_t));
+  if (t == NULL) {
+    munmap((void*) seg, sizeof (segment_t));
+    return NULL;
+  }
+  t->seg = seg;
+  return t;
+}
+
+void libnxtusb_telemetry_close(libnxtusb_telemetry_t *t) {
+  munmap((void*) t->seg, sizeof (segment_t));
+  free(t);
+}
+
+const char *libnxtusb_telemetry_serial(const libnxtusb_telemetry_t *t) {
+  return t->seg->serial;
+}
+
+int libnxtusb_telemetry_input(const libnxtusb_telemetry_t *t, const libnxtusb_in_t port, libnxtusb_telemetry_sample_t *sample) {
+  if (port >= 4 || slot_read(&t->seg->input[port], sample) == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int libnxtusb_telemetry_output(const libnxtusb_telemetry_t *t, const libnxtusb_out_t port, libnxtusb_telemetry_sample_t *sample) {
+  if (port >= 3 || slot_read(&t->seg->output[port], sample) == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+unsigned int libnxtusb_telemetry_history(
+                                         const libnxtusb_telemetry_t *t, uint64_t *cursor,
+                                         libnxtusb_telemetry_sample_t *samples, const unsigned int max
+                                         ) {
+  segment_t *seg = (segment_t*) t->seg;
+  uint64_t head = atomic_load_explicit(&seg->head, memory_order_acquire);
+  uint64_t next = *cursor + 1;
+  unsigned int n = 0;
+
+  if (head >= NXT_TELEMETRY_HISTORY && next <= head - NXT_TELEMETRY_HISTORY) {
+    next = head - NXT_TELEMETRY_HISTORY + 1;
+  }
+  while (next <= head && n < max) {
+    uint64_t index = slot_read(&seg->ring[(next - 1) % NXT_TELEMETRY_HISTORY], &samples[n]);
+    if (index == next) {
+      *cursor = next;
+      n++;
+      next++;
+    } else if (index > next) {
+      // lapped by writer while reading, skip to oldest sample still in ring
+      head = atomic_load_explicit(&seg->head, memory_order_acquire);
+      next = head - NXT_TELEMETRY_HISTORY + 1;
+    } else {
+      break;
+    }
+  }
+  return n;
+}
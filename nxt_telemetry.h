@@ -0,0 +1,145 @@
+/**
+ * @file nxt_telemetry.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Shared-memory telemetry. Public header
+ *
+ * Publishing handle copies every input values and output state reply into
+ * a POSIX shared memory segment: latest state of each port, guarded by a
+ * seqlock, and a ring of the last NXT_TELEMETRY_HISTORY samples. Readers
+ * in any process map the segment read-only and take snapshots without
+ * syscalls and without touching the brick. Reader retries while a sample
+ * is being written, so snapshot is never torn. One publisher per segment.
+ */
+
+#ifndef NXT_TELEMETRY_H
+#define NXT_TELEMETRY_H
+#include "libnxtusb.h"
+
+/** \ingroup telemetry
+ * Samples kept in history ring
+ */
+#define NXT_TELEMETRY_HISTORY 256
+
+/** \ingroup telemetry
+ * Sample kind
+ */
+typedef enum {
+  NXT_TELEMETRY_INPUT = 0,
+  NXT_TELEMETRY_OUTPUT
+} libnxtusb_telemetry_kind_t;
+
+/** \ingroup telemetry
+ * Telemetry sample
+ */
+typedef struct {
+  /** Sample number, counts from 1 over all ports */
+  uint64_t index;
+  /** Time of reply, nxt_time_ns clock */
+  uint64_t at_ns;
+  /** libnxtusb_telemetry_kind_t kind */
+  uint8_t kind;
+  /** Port */
+  uint8_t port;
+
+  union {
+    libnxtusb_inputstate_t input;
+    libnxtusb_outputstate_t output;
+  } state;
+} libnxtusb_telemetry_sample_t;
+
+/** \ingroup telemetry
+ * Telemetry reader
+ */
+typedef struct libnxtusb_telemetry libnxtusb_telemetry_t;
+
+/**
+ * \defgroup telemetry Shared-memory telemetry.
+ */
+
+/** \ingroup telemetry
+ *  Publish port state of brick to shared memory
+ * @param handle nxt brick handle
+ * @param name shm object name ("/name"), NULL = "/nxt-<serial>"
+ * @return 0 on success, -1 on failure
+ */
+int nxt_telemetry_publish(const libnxtusb_device_handle *handle, const char *name);
+
+/** \ingroup telemetry
+ *  Stop publishing and remove segment. Mapped readers keep last state
+ * @param handle nxt brick handle
+ */
+void nxt_telemetry_unpublish(const libnxtusb_device_handle *handle);
+
+/** \ingroup telemetry
+ *  Map published segment read-only
+ * @param name shm object name, as given to nxt_telemetry_publish
+ * @return libnxtusb_telemetry_t* reader, NULL on failure
+ */
+libnxtusb_telemetry_t *libnxtusb_telemetry_open(const char *name);
+
+/** \ingroup telemetry
+ *  Unmap segment
+ * @param t reader
+ */
+void libnxtusb_telemetry_close(libnxtusb_telemetry_t *t);
+
+/** \ingroup telemetry
+ *  Serial of publishing brick
+ * @param t reader
+ * @return serial, empty if unknown
+ */
+const char *libnxtusb_telemetry_serial(const libnxtusb_telemetry_t *t);
+
+/** \ingroup telemetry
+ *  Get latest input values
+ * @param t reader
+ * @param port libnxtusb_in_t port
+ * @param sample libnxtusb_telemetry_sample_t* sample (preallocated)
+ * @return 0 on success, -1 if port was never published or publisher stopped mid-write
+ */
+int libnxtusb_telemetry_input(const libnxtusb_telemetry_t *t, const libnxtusb_in_t port, libnxtusb_telemetry_sample_t *sample);
+
+/** \ingroup telemetry
+ *  Get latest output state
+ * @param t reader
+ * @param port libnxtusb_out_t port
+ * @param sample libnxtusb_telemetry_sample_t* sample (preallocated)
+ * @return 0 on success, -1 if port was never published or publisher stopped mid-write
+ */
+int libnxtusb_telemetry_output(const libnxtusb_telemetry_t *t, const libnxtusb_out_t port, libnxtusb_telemetry_sample_t *sample);
+
+/** \ingroup telemetry
+ *  Read history since cursor. Samples overwritten before they were read
+ *  are skipped, gaps show in sample index.
+ * @param t reader
+ * @param cursor index of last sample seen, 0 at start. Updated
+ * @param samples libnxtusb_telemetry_sample_t* samples (preallocated)
+ * @param max size of samples
+ * @return number of samples read
+ */
+unsigned int libnxtusb_telemetry_history(
+        const libnxtusb_telemetry_t *t, uint64_t *cursor,
+        libnxtusb_telemetry_sample_t *samples, const unsigned int max
+        );
+
+#endif
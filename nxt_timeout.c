@@ -0,0 +1,211 @@
+/**
+ * @file nxt_timeout.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Timeouts, deadlines and retries.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "nxt_private.h"
+
+// same as old hard-coded usb timeout
+#define NXT_DEFAULT_TIMEOUT_MS 1000
+// handles a thread can hold deadlines on at once
+#define NXT_DEADLINE_SLOTS 8
+
+// deadlines are per thread, so a deadline set by one thread doesn't starve
+// others sharing the handle (wait poller, watchdog, ...)
+typedef struct {
+  uint64_t id;
+  uint64_t deadline_ns;
+} nxt_deadline_slot_t;
+
+static _Thread_local nxt_deadline_slot_t deadlines[NXT_DEADLINE_SLOTS];
+static _Thread_local unsigned int jitter_seed;
+// ids aren't reused, so a new handle at the address of a closed one
+// doesn't inherit its deadlines
+static atomic_uint_fast64_t next_id = 1;
+
+//internal. defaults for new handle
+
+void nxt_timeouts_init(nxt_timeouts_t *t) {
+  int i;
+
+  for (i = 0; i < NXT_CLASS_COUNT; i++) {
+    t->policy[i].send_ms = NXT_DEFAULT_TIMEOUT_MS;
+    t->policy[i].recv_ms = NXT_DEFAULT_TIMEOUT_MS;
+    t->policy[i].retries = 0;
+    t->policy[i].backoff_ms = 0;
+    t->policy[i].jitter_ms = 0;
+  }
+  t->id = atomic_fetch_add(&next_id, 1);
+  t->recv_class = NXT_CLASS_ACTUATOR;
+}
+
+libnxtusb_cmd_class_t nxt_opcode_class(const uint8_t opcode) {
+  if (opcode >= NXT_OPCODE_SYS_OPENREAD) {
+    return NXT_CLASS_SYSTEM;
+  }
+  switch (opcode) {
+    case NXT_OPCODE_GET_OUTPUTSTATE:
+    case NXT_OPCODE_GET_INPUTVALUES:
+    case NXT_OPCODE_MESSAGE_READ:
+    case NXT_OPCODE_BATTERYLEVEL:
+    case NXT_OPCODE_KEEPALIVE:
+    case NXT_OPCODE_LS_GET_STATUS:
+    case NXT_OPCODE_LS_READ:
+    case NXT_OPCODE_GET_CURRENTPROGRAM_NAME:
+      return NXT_CLASS_READ;
+    default:
+      return NXT_CLASS_ACTUATOR;
+  }
+}
+
+int nxt_opcode_idempotent(const uint8_t opcode) {
+  switch (opcode) {
+    case NXT_OPCODE_GET_OUTPUTSTATE:
+    case NXT_OPCODE_GET_INPUTVALUES:
+    case NXT_OPCODE_BATTERYLEVEL:
+    case NXT_OPCODE_KEEPALIVE:
+    case NXT_OPCODE_LS_GET_STATUS:
+    case NXT_OPCODE_GET_CURRENTPROGRAM_NAME:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+//internal. deadline of calling thread on handle, 0 = none
+
+uint64_t nxt_deadline_get(const nxt_timeouts_t *t) {
+  int i;
+
+  for (i = 0; i < NXT_DEADLINE_SLOTS; i++) {
+    if (deadlines[i].id == t->id) {
+      return deadlines[i].deadline_ns;
+    }
+  }
+  return 0;
+}
+
+//internal. set deadline of calling thread on handle, 0 = none
+
+void nxt_deadline_set(const nxt_timeouts_t *t, const uint64_t deadline_ns) {
+  nxt_deadline_slot_t *slot = NULL;
+  int i;
+
+  for (i = 0; i < NXT_DEADLINE_SLOTS; i++) {
+    if (deadlines[i].id == t->id) {
+      slot = &deadlines[i];
+      break;
+    }
+    if (slot == NULL && deadlines[i].deadline_ns == 0) {
+      slot = &deadlines[i];
+    }
+  }
+  if (slot == NULL) {
+    // table full, drop the earliest deadline, likely long passed
+    slot = &deadlines[0];
+    for (i = 1; i < NXT_DEADLINE_SLOTS; i++) {
+      if (deadlines[i].deadline_ns < slot->deadline_ns) {
+        slot = &deadlines[i];
+      }
+    }
+  }
+  slot->id = deadline_ns != 0 ? t->id : 0;
+  slot->deadline_ns = deadline_ns;
+}
+
+//internal. phase timeout cut to deadline. Returns -1 if deadline passed
+
+int nxt_io_timeout(const nxt_timeouts_t *t, const unsigned int phase_ms) {
+  uint64_t deadline_ns = nxt_deadline_get(t);
+
+  if (deadline_ns == 0) {
+    return phase_ms;
+  }
+  uint64_t now = nxt_time_ns();
+  if (now >= deadline_ns) {
+    return -1;
+  }
+  uint64_t left_ms = (deadline_ns - now + 999999) / 1000000;
+  return left_ms < phase_ms ? (int) left_ms : (int) phase_ms;
+}
+
+//internal. sleep before retry. Returns -1 if retry wouldn't fit before deadline
+
+int nxt_retry_pause(const nxt_timeouts_t *t, const libnxtusb_timeout_policy_t *policy) {
+  uint64_t pause_ns = (uint64_t) policy->backoff_ms * 1000000ULL;
+  uint64_t deadline_ns = nxt_deadline_get(t);
+
+  if (policy->jitter_ms > 0) {
+    if (jitter_seed == 0) {
+      jitter_seed = (unsigned int) nxt_time_ns() ^ (unsigned int) (uintptr_t) &jitter_seed;
+    }
+    pause_ns += (uint64_t) (rand_r(&jitter_seed) % (policy->jitter_ms * 1000 + 1)) * 1000ULL;
+  }
+  if (deadline_ns != 0 && nxt_time_ns() + pause_ns >= deadline_ns) {
+    return -1;
+  }
+  struct timespec ts = {pause_ns / 1000000000ULL, pause_ns % 1000000000ULL};
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+  return 0;
+}
+
+int nxt_set_timeout_policy(
+                           const libnxtusb_device_handle *handle, const libnxtusb_cmd_class_t cls,
+                           const libnxtusb_timeout_policy_t *policy
+                           ) {
+  // libusb treats 0 as infinite
+  if (cls >= NXT_CLASS_COUNT || policy->send_ms == 0 || policy->recv_ms == 0) {
+    return -1;
+  }
+  handle->priv->timeouts.policy[cls] = *policy;
+  return 0;
+}
+
+int nxt_get_timeout_policy(
+                           const libnxtusb_device_handle *handle, const libnxtusb_cmd_class_t cls,
+                           libnxtusb_timeout_policy_t *policy
+                           ) {
+  if (cls >= NXT_CLASS_COUNT) {
+    return -1;
+  }
+  *policy = handle->priv->timeouts.policy[cls];
+  return 0;
+}
+
+void nxt_set_deadline(const libnxtusb_device_handle *handle, const uint64_t deadline_ns) {
+  nxt_deadline_set(&handle->priv->timeouts, deadline_ns);
+}
+
+void nxt_set_deadline_in(const libnxtusb_device_handle *handle, const unsigned int ms) {
+  nxt_deadline_set(&handle->priv->timeouts, nxt_time_ns() + (uint64_t) ms * 1000000ULL);
+}
+
+int nxt_last_io_error(const libnxtusb_device_handle *handle) {
+  return handle->priv->timeouts.last_io_error;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file nxt_timeout.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Timeouts, deadlines and retries. Public header
+ */
+
+#ifndef NXT_TIMEOUT_H
+#define NXT_TIMEOUT_H
+#include "libnxtusb.h"
+
+/** \ingroup timeout
+ * Command classes
+ */
+typedef enum {
+  /** Commands changing brick state (motors, sensors, sound, programs) */
+  NXT_CLASS_ACTUATOR = 0,
+  /** Commands only reading brick state */
+  NXT_CLASS_READ,
+  /** System commands (files, firmware, brick info) */
+  NXT_CLASS_SYSTEM,
+
+  NXT_CLASS_COUNT
+} libnxtusb_cmd_class_t;
+
+/** \ingroup timeout
+ * Timeout policy of command class
+ */
+typedef struct {
+  /** Send phase timeout, ms */
+  unsigned int send_ms;
+  /** Receive phase timeout, ms */
+  unsigned int recv_ms;
+  /** Extra attempts after timeout or garbled reply.
+   *  Only used for idempotent reads (input values, output state,
+   *  battery level, keepalive, lowspeed status, current program name) */
+  unsigned int retries;
+  /** Pause before retry, ms */
+  unsigned int backoff_ms;
+  /** Random extra pause before retry, 0 to jitter_ms */
+  unsigned int jitter_ms;
+} libnxtusb_timeout_policy_t;
+
+/**
+ * \defgroup timeout Timeouts and deadlines.
+ * By default every class uses 1000 ms for each phase and no retries.
+ */
+
+/** \ingroup timeout
+ *  Set timeout policy for command class
+ * @param handle nxt brick handle
+ * @param cls libnxtusb_cmd_class_t command class
+ * @param policy libnxtusb_timeout_policy_t* policy
+ * @return 0 on success, -1 on failure
+ */
+int nxt_set_timeout_policy(
+        const libnxtusb_device_handle *handle, const libnxtusb_cmd_class_t cls,
+        const libnxtusb_timeout_policy_t *policy
+        );
+
+/** \ingroup timeout
+ *  Get timeout policy of command class
+ * @param handle nxt brick handle
+ * @param cls libnxtusb_cmd_class_t command class
+ * @param policy libnxtusb_timeout_policy_t* policy (preallocated)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_get_timeout_policy(
+        const libnxtusb_device_handle *handle, const libnxtusb_cmd_class_t cls,
+        libnxtusb_timeout_policy_t *policy
+        );
+
+/** \ingroup timeout
+ *  Set absolute deadline for following commands of calling thread on handle.
+ *  Phase timeouts are cut to time left, and commands fail without
+ *  touching the bus once deadline has passed. Other threads using the
+ *  same handle keep their own deadlines.
+ * @param handle nxt brick handle
+ * @param deadline_ns deadline on nxt_time_ns clock, 0 = no deadline
+ */
+void nxt_set_deadline(const libnxtusb_device_handle *handle, const uint64_t deadline_ns);
+
+/** \ingroup timeout
+ *  Set deadline of calling thread relative to now
+ * @param handle nxt brick handle
+ * @param ms time budget in ms
+ */
+void nxt_set_deadline_in(const libnxtusb_device_handle *handle, const unsigned int ms);
+
+/** \ingroup timeout
+ *  Get transport error of last failed command
+ * @param handle nxt brick handle
+ * @return 0 if last failure wasn't a transport error, otherwise libusb error code
+ *         (LIBUSB_ERROR_TIMEOUT for timeouts and missed deadlines)
+ */
+int nxt_last_io_error(const libnxtusb_device_handle *handle);
+
+/** \ingroup timeout
+ *  Get class of command opcode
+ * @param opcode command opcode
+ * @return libnxtusb_cmd_class_t class
+ */
+libnxtusb_cmd_class_t nxt_opcode_class(const uint8_t opcode);
+
+/** \ingroup timeout
+ *  Check if command may be repeated without side effects.
+ *  Message and lowspeed reads consume data on brick, so they are not.
+ * @param opcode command opcode
+ * @return 1 if idempotent, 0 otherwise
+ */
+int nxt_opcode_idempotent(const uint8_t opcode);
+
+#endif
@@ -0,0 +1,133 @@
+/**
+ * @file nxt_timing.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Round-trip measurement and sample timestamps.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "nxt_private.h"
+
+uint64_t nxt_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//internal. request which expects reply went out
+
+void nxt_timing_sent(nxt_timing_t *t, const uint64_t start_ns, const uint64_t done_ns) {
+  t->send_start_ns = start_ns;
+  t->send_done_ns = done_ns;
+}
+
+//internal. reply arrived. Update rtt estimate (same gains as tcp rto) and stamp reply
+
+void nxt_timing_received(nxt_timing_t *t, const uint64_t done_ns) {
+  if (t->send_done_ns == 0) {
+    return;
+  }
+  int64_t rtt = done_ns - t->send_start_ns;
+
+  if (t->samples == 0) {
+    t->srtt_ns = rtt;
+    t->rttvar_ns = rtt / 2;
+    t->rtt_min_ns = rtt;
+  } else {
+    int64_t err = rtt - t->srtt_ns;
+    t->srtt_ns += err / 8;
+    t->rttvar_ns += ((err < 0 ? -err : err) - t->rttvar_ns) / 4;
+    if (rtt < t->rtt_min_ns) {
+      t->rtt_min_ns = rtt;
+    }
+  }
+  t->rtt_last_ns = rtt;
+  t->samples++;
+
+  // brick sampled somewhere between end of request and start of reply.
+  // Reply leg is assumed to take half of smoothed round trip.
+  uint64_t lo = t->send_done_ns, hi = done_ns;
+  uint64_t acq = done_ns - t->srtt_ns / 2;
+  if (acq < lo) acq = lo;
+  if (acq > hi) acq = hi;
+  t->last.acquired_ns = acq;
+  t->last.error_ns = (acq - lo > hi - acq) ? acq - lo : hi - acq;
+
+  t->send_start_ns = 0;
+  t->send_done_ns = 0;
+}
+
+int nxt_timing_get(const libnxtusb_device_handle *handle, libnxtusb_timing_stats_t *stats) {
+  const nxt_timing_t *t = &handle->priv->timing;
+
+  stats->samples = t->samples;
+  stats->rtt_last_ns = t->rtt_last_ns;
+  stats->rtt_min_ns = t->rtt_min_ns;
+  stats->rtt_avg_ns = t->srtt_ns;
+  stats->rtt_dev_ns = t->rttvar_ns;
+  stats->latency_ns = t->srtt_ns / 2;
+  stats->latency_var_ns2 = (uint64_t) (t->rttvar_ns / 2) * (uint64_t) (t->rttvar_ns / 2);
+  return 0;
+}
+
+int nxt_timing_probe(const libnxtusb_device_handle *handle, const unsigned int count) {
+  unsigned int i;
+  unsigned int msec;
+
+  for (i = 0; i < count; i++) {
+    if (nxt_keepalive(handle, &msec) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int nxt_last_timestamp(const libnxtusb_device_handle *handle, libnxtusb_timestamp_t *ts) {
+  if (handle->priv->timing.samples == 0) {
+    return -1;
+  }
+  *ts = handle->priv->timing.last;
+  return 0;
+}
+
+int nxt_get_input_values_ts(
+                            const libnxtusb_device_handle *handle, const libnxtusb_in_t port,
+                            libnxtusb_inputstate_t *out, libnxtusb_timestamp_t *ts
+                            ) {
+  cmd_port_t cmd = {
+    NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_INPUTVALUES, port
+  };
+
+  return nxt_transact_ts(handle, &cmd, sizeof (cmd), out, sizeof (libnxtusb_inputstate_t), ts);
+}
+
+int nxt_get_output_state_ts(
+                            const libnxtusb_device_handle *handle, const libnxtusb_out_t port,
+                            libnxtusb_outputstate_t *out, libnxtusb_timestamp_t *ts
+                            ) {
+  cmd_port_t cmd = {
+    NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_OUTPUTSTATE, port
+  };
+
+  return nxt_transact_ts(handle, &cmd, sizeof (cmd), out, sizeof (libnxtusb_outputstate_t), ts);
+}
@@ -0,0 +1,126 @@
+/**
+ * @file nxt_timing.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Round-trip measurement and sample timestamps. Public header
+ */
+
+#ifndef NXT_TIMING_H
+#define NXT_TIMING_H
+#include "libnxtusb.h"
+
+/** \ingroup timing
+ * Sample acquisition time.
+ * Brick replies carry no brick-side time, so acquisition time is
+ * estimated on host monotonic clock (see nxt_time_ns) from the request
+ * and reply times. Real acquisition time is guaranteed to lie within
+ * acquired_ns +- error_ns.
+ */
+typedef struct {
+  /** Estimated acquisition time, ns of host monotonic clock */
+  uint64_t acquired_ns;
+  /** Error bound, ns */
+  uint32_t error_ns;
+} libnxtusb_timestamp_t;
+
+/** \ingroup timing
+ * Round-trip statistics
+ */
+typedef struct {
+  /** Number of round trips measured */
+  uint64_t samples;
+  /** Last round trip, ns */
+  uint32_t rtt_last_ns;
+  /** Smallest round trip seen, ns */
+  uint32_t rtt_min_ns;
+  /** Smoothed round trip, ns */
+  uint32_t rtt_avg_ns;
+  /** Smoothed round trip mean deviation, ns */
+  uint32_t rtt_dev_ns;
+  /** Estimated one-way (reply) latency, ns */
+  uint32_t latency_ns;
+  /** Estimated one-way latency variance, ns^2 */
+  uint64_t latency_var_ns2;
+} libnxtusb_timing_stats_t;
+
+/**
+ * \defgroup timing Timing and timestamps.
+ */
+
+/** \ingroup timing
+ *  Current host monotonic time, used for all timestamps
+ * @return time in ns
+ */
+uint64_t nxt_time_ns(void);
+
+/** \ingroup timing
+ *  Get round-trip statistics
+ * @param handle nxt brick handle
+ * @param stats libnxtusb_timing_stats_t* statistics (preallocated)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_timing_get(const libnxtusb_device_handle *handle, libnxtusb_timing_stats_t *stats);
+
+/** \ingroup timing
+ *  Measure round trips with keepalive commands, to prime or refresh
+ *  latency estimate when there is no other traffic
+ * @param handle nxt brick handle
+ * @param count number of round trips
+ * @return 0 on success, -1 on failure
+ */
+int nxt_timing_probe(const libnxtusb_device_handle *handle, const unsigned int count);
+
+/** \ingroup timing
+ *  Get timestamp of last reply received on handle
+ * @param handle nxt brick handle
+ * @param ts libnxtusb_timestamp_t* timestamp (preallocated)
+ * @return 0 on success, -1 if nothing was received yet
+ */
+int nxt_last_timestamp(const libnxtusb_device_handle *handle, libnxtusb_timestamp_t *ts);
+
+/** \ingroup timing
+ *  Get input values with acquisition timestamp
+ * @param handle nxt brick handle
+ * @param port libnxtusb_in_t Port
+ * @param out libnxtusb_inputstate_t* Input values (preallocated)
+ * @param ts libnxtusb_timestamp_t* timestamp (preallocated)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_get_input_values_ts(
+        const libnxtusb_device_handle *handle, const libnxtusb_in_t port,
+        libnxtusb_inputstate_t *out, libnxtusb_timestamp_t *ts
+        );
+
+/** \ingroup timing
+ *  Get output port state with acquisition timestamp
+ * @param handle nxt brick handle
+ * @param port libnxtusb_out_t Port
+ * @param out libnxtusb_outputstate_t* Output state (preallocated)
+ * @param ts libnxtusb_timestamp_t* timestamp (preallocated)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_get_output_state_ts(
+        const libnxtusb_device_handle *handle, const libnxtusb_out_t port,
+        libnxtusb_outputstate_t *out, libnxtusb_timestamp_t *ts
+        );
+
+#endif
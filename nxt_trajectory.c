@@ -0,0 +1,210 @@
+/**
+ * @file nxt_trajectory.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Multi-motor trajectory streaming.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nxt_private.h"
+#include "nxt_trajectory.h"
+
+struct libnxtusb_trajectory {
+  unsigned int axes;
+  unsigned int ticks;
+  unsigned int tick_ms;
+  // ticks * axes packets, tick-major
+  cmd_setoutput_t *cmds;
+  // per tick bitmask of axes whose packet differs from previous tick
+  uint8_t *changed;
+};
+
+static int8_t lerp8(const int8_t a, const int8_t b, const uint32_t num, const uint32_t den) {
+  int32_t d = ((int32_t) b - a) * (int32_t) num;
+  int32_t v = a + (d >= 0 ? d + (int32_t) den / 2 : d - (int32_t) den / 2) / (int32_t) den;
+  if (v > 100) v = 100;
+  if (v < -100) v = -100;
+  return (int8_t) v;
+}
+
+libnxtusb_trajectory_t *nxt_trajectory_compile(
+                                               const libnxtusb_out_t *ports, const unsigned int axes,
+                                               const libnxtusb_motor_regulation_t regulation, const unsigned int tick_ms,
+                                               const libnxtusb_traj_keyframe_t *kf, const unsigned int nkf
+                                               ) {
+  unsigned int i, a, k;
+
+  if (axes == 0 || axes > NXT_TRAJ_MAX_AXES || tick_ms == 0 || nkf == 0) {
+    return NULL;
+  }
+  for (a = 0; a < axes; a++) {
+    if (ports[a] > NXT_OUT_C) {
+      return NULL;
+    }
+  }
+  for (k = 1; k < nkf; k++) {
+    if (kf[k].t_ms <= kf[k - 1].t_ms) {
+      return NULL;
+    }
+  }
+
+  libnxtusb_trajectory_t *traj = malloc(sizeof (libnxtusb_trajectory_t));
+  if (traj == NULL) {
+    return NULL;
+  }
+  traj->axes = axes;
+  traj->tick_ms = tick_ms;
+  // last keyframe off the tick grid is sent on the tick after it
+  traj->ticks = (kf[nkf - 1].t_ms + tick_ms - 1) / tick_ms + 1;
+  traj->cmds = malloc(sizeof (cmd_setoutput_t) * traj->ticks * axes);
+  traj->changed = malloc(traj->ticks);
+  if (traj->cmds == NULL || traj->changed == NULL) {
+    nxt_trajectory_free(traj);
+    return NULL;
+  }
+
+  uint8_t mode = NXT_MOTOR_MODE_ON | NXT_MOTOR_MODE_BRAKE;
+  if (regulation != NXT_MOTOR_REGULATION_IDLE) {
+    mode |= NXT_MOTOR_MODE_REGULATED;
+  }
+
+  k = 0;
+  for (i = 0; i < traj->ticks; i++) {
+    uint32_t t = i * tick_ms;
+    // final tick plays last keyframe exactly
+    if (t > kf[nkf - 1].t_ms) {
+      t = kf[nkf - 1].t_ms;
+    }
+    while (k + 1 < nkf && kf[k + 1].t_ms <= t) {
+      k++;
+    }
+    const libnxtusb_traj_keyframe_t *from = &kf[k];
+    const libnxtusb_traj_keyframe_t *to = (k + 1 < nkf) ? &kf[k + 1] : &kf[k];
+    uint32_t num = 0, den = 1;
+    if (to != from && t > from->t_ms) {
+      num = t - from->t_ms;
+      den = to->t_ms - from->t_ms;
+    }
+
+    traj->changed[i] = 0;
+    for (a = 0; a < axes; a++) {
+      cmd_setoutput_t *cmd = &traj->cmds[i * axes + a];
+      cmd->type = NXT_DIRECT_COMMAND_NOREPLY;
+      cmd->opcode = NXT_OPCODE_SET_OUTPUTSTATE;
+      cmd->port = ports[a];
+      cmd->power = lerp8(from->power[a], to->power[a], num, den);
+      cmd->mode = mode;
+      cmd->regulation = regulation;
+      cmd->turn_ratio = lerp8(from->turn_ratio, to->turn_ratio, num, den);
+      cmd->run_state = NXT_MOTOR_RUNSTATE_RUNNING;
+      cmd->tacho_limit = from->tacho_limit[a];
+      if (i == 0 || memcmp(cmd, cmd - axes, sizeof (cmd_setoutput_t)) != 0) {
+        traj->changed[i] |= 1 << a;
+      }
+    }
+  }
+  return traj;
+}
+
+void nxt_trajectory_free(libnxtusb_trajectory_t *traj) {
+  if (traj == NULL) {
+    return;
+  }
+  free(traj->cmds);
+  free(traj->changed);
+  free(traj);
+}
+
+static uint64_t ts_ns(const struct timespec *ts) {
+  return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+int nxt_trajectory_run(
+                       const libnxtusb_device_handle *handle, const libnxtusb_trajectory_t *traj,
+                       libnxtusb_traj_stats_t *stats
+                       ) {
+  libnxtusb_traj_stats_t st = {traj->ticks, 0, 0, 0};
+  struct timespec now, deadline;
+  uint64_t start, tick_ns = (uint64_t) traj->tick_ms * 1000000ULL;
+  unsigned int i = 0, a;
+  uint8_t pending = 0;
+  unsigned int estop_gen = atomic_load_explicit(&handle->priv->channel.estop_gen, memory_order_relaxed);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  start = ts_ns(&now);
+
+  while (i < traj->ticks) {
+    uint64_t due = start + i * tick_ns;
+    deadline.tv_sec = due / 1000000000ULL;
+    deadline.tv_nsec = due % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // we are late: jump to newest due tick, but keep changes we skipped over
+    unsigned int latest = (ts_ns(&now) - start) / tick_ns;
+    if (latest >= traj->ticks) {
+      latest = traj->ticks - 1;
+    }
+    while (i < latest) {
+      pending |= traj->changed[i];
+      st.skipped++;
+      i++;
+    }
+    due = start + i * tick_ns;
+    if (ts_ns(&now) > due && (ts_ns(&now) - due) / 1000 > st.max_late_us) {
+      st.max_late_us = (ts_ns(&now) - due) / 1000;
+    }
+
+    pending |= traj->changed[i];
+    for (a = 0; a < traj->axes; a++) {
+      if (!(pending & (1 << a))) {
+        continue;
+      }
+      const cmd_setoutput_t *cmd = &traj->cmds[i * traj->axes + a];
+      nxt_channel_acquire(&handle->priv->channel, NXT_PRIO_RT);
+      int sent = -1;
+      // emergency stop cancels playback
+      if (atomic_load_explicit(&handle->priv->channel.estop_gen, memory_order_relaxed) == estop_gen) {
+        sent = nxt_send(handle, (const unsigned char*) cmd, sizeof (cmd_setoutput_t));
+      }
+      nxt_channel_release(&handle->priv->channel);
+      if (sent != sizeof (cmd_setoutput_t)) {
+        if (stats != NULL) {
+          *stats = st;
+        }
+        return -1;
+      }
+      st.sent++;
+    }
+    pending = 0;
+    i++;
+  }
+
+  if (stats != NULL) {
+    *stats = st;
+  }
+  return 0;
+}
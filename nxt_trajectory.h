@@ -0,0 +1,109 @@
+/**
+ * @file nxt_trajectory.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Multi-motor trajectory streaming. Public header
+ */
+
+#ifndef NXT_TRAJECTORY_H
+#define NXT_TRAJECTORY_H
+#include "libnxtusb.h"
+
+/** \ingroup traj
+ * Maximum number of axes (output ports) in one trajectory
+ */
+#define NXT_TRAJ_MAX_AXES 3
+
+/** \ingroup traj
+ * Trajectory keyframe. Power and turn ratio are linearly interpolated
+ * between keyframes, tacho limit is held until next keyframe.
+ */
+typedef struct {
+  /** Time from trajectory start, ms */
+  uint32_t t_ms;
+  /** Power per axis (-100 to 100) */
+  int8_t power[NXT_TRAJ_MAX_AXES];
+  /** Turn ratio (-100 to 100), used with NXT_MOTOR_REGULATION_SYNC */
+  int8_t turn_ratio;
+  /** Tacho limit per axis (0 = run forever) */
+  uint32_t tacho_limit[NXT_TRAJ_MAX_AXES];
+} libnxtusb_traj_keyframe_t;
+
+/** \ingroup traj
+ * Playback statistics
+ */
+typedef struct {
+  /** Ticks in trajectory */
+  unsigned int ticks;
+  /** Ticks skipped because host was late */
+  unsigned int skipped;
+  /** Command packets sent */
+  unsigned int sent;
+  /** Worst lateness against tick deadline, us */
+  unsigned int max_late_us;
+} libnxtusb_traj_stats_t;
+
+/** \ingroup traj
+ * Precompiled trajectory (opaque)
+ */
+typedef struct libnxtusb_trajectory libnxtusb_trajectory_t;
+
+/**
+ * \defgroup traj Trajectory streaming.
+ */
+
+/** \ingroup traj
+ *  Compile keyframes into per-tick command buffer
+ * @param ports output ports, one per axis (no NXT_OUT_ALL)
+ * @param axes number of axes (1 to NXT_TRAJ_MAX_AXES)
+ * @param regulation libnxtusb_motor_regulation_t regulation for all axes
+ * @param tick_ms command period in ms
+ * @param kf keyframes, sorted by t_ms
+ * @param nkf number of keyframes
+ * @return compiled trajectory or NULL on error
+ */
+libnxtusb_trajectory_t *nxt_trajectory_compile(
+        const libnxtusb_out_t *ports, const unsigned int axes,
+        const libnxtusb_motor_regulation_t regulation, const unsigned int tick_ms,
+        const libnxtusb_traj_keyframe_t *kf, const unsigned int nkf
+        );
+
+/** \ingroup traj
+ *  Free compiled trajectory
+ * @param traj compiled trajectory
+ */
+void nxt_trajectory_free(libnxtusb_trajectory_t *traj);
+
+/** \ingroup traj
+ *  Stream trajectory to brick. Blocks until last tick is sent.
+ *  Doesn't allocate memory. Stops early on nxt_emergency_stop.
+ * @param handle nxt brick handle
+ * @param traj compiled trajectory
+ * @param stats libnxtusb_traj_stats_t* playback statistics (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int nxt_trajectory_run(
+        const libnxtusb_device_handle *handle, const libnxtusb_trajectory_t *traj,
+        libnxtusb_traj_stats_t *stats
+        );
+
+#endif
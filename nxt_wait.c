@@ -0,0 +1,306 @@
+/**
+ * @file nxt_wait.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Waiting for sensor and motor conditions.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include "nxt_private.h"
+
+// ports are numbered inputs 0-3, outputs 4-6
+#define WAIT_SLOTS 7
+
+struct nxt_waiter {
+  libnxtusb_wait_cond_t cond;
+  int32_t first;
+  int32_t last;
+  int samples;
+  // 1 = holds, -1 = brick failed
+  int result;
+  int32_t value;
+  nxt_waiter_t *next;
+};
+
+static int wait_slot(const libnxtusb_wait_cond_t *cond) {
+  switch (cond->field) {
+    case NXT_WAIT_SCALED:
+    case NXT_WAIT_RAW:
+    case NXT_WAIT_NORMALIZED:
+      return cond->port < 4 ? cond->port : -1;
+    case NXT_WAIT_TACHO:
+    case NXT_WAIT_ROTATION:
+      return cond->port < 3 ? 4 + cond->port : -1;
+    default:
+      return -1;
+  }
+}
+
+static struct timespec wait_abs(const uint64_t ns) {
+  struct timespec ts = {ns / 1000000000ULL, ns % 1000000000ULL};
+  return ts;
+}
+
+//internal. init wait state of new handle
+
+void nxt_waits_init(nxt_waits_t *w) {
+  pthread_condattr_t attr;
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&w->cond, &attr);
+  pthread_cond_init(&w->wake, &attr);
+  pthread_condattr_destroy(&attr);
+  w->min_ms = NXT_WAIT_MIN_POLL_MS;
+  w->max_ms = NXT_WAIT_MAX_POLL_MS;
+}
+
+//internal. waiters are gone by now, collect poller
+
+void nxt_waits_destroy(nxt_waits_t *w) {
+  if (w->started) {
+    pthread_join(w->thread, NULL);
+  }
+  pthread_cond_destroy(&w->wake);
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->lock);
+}
+
+static int wait_holds(nxt_waiter_t *wt, const int32_t v) {
+  const int32_t t = wt->cond.threshold;
+  int holds = 0;
+
+  if (wt->samples == 0) {
+    wt->first = v;
+  }
+  switch (wt->cond.op) {
+    case NXT_WAIT_ABOVE:
+      holds = v > t;
+      break;
+    case NXT_WAIT_BELOW:
+      holds = v < t;
+      break;
+    case NXT_WAIT_EQUAL:
+      holds = v == t;
+      break;
+    case NXT_WAIT_NOT_EQUAL:
+      holds = v != t;
+      break;
+    case NXT_WAIT_RISING:
+      holds = wt->samples > 0 && wt->last <= t && v > t;
+      break;
+    case NXT_WAIT_FALLING:
+      holds = wt->samples > 0 && wt->last >= t && v < t;
+      break;
+    case NXT_WAIT_CHANGE:
+      holds = (int64_t) v - wt->first > t || (int64_t) wt->first - v > t;
+      break;
+  }
+  wt->last = v;
+  wt->samples++;
+  return holds;
+}
+
+// read port, channel is taken per read so waiters don't block commands
+static int wait_read(const libnxtusb_device_handle *handle, const int slot, int32_t v[5], int *valid) {
+  if (slot < 4) {
+    libnxtusb_inputstate_t in;
+    if (nxt_get_input_values(handle, slot, &in) != 0) {
+      return -1;
+    }
+    *valid = in.valid;
+    v[NXT_WAIT_SCALED] = in.scaled_value;
+    v[NXT_WAIT_RAW] = in.raw_value;
+    v[NXT_WAIT_NORMALIZED] = in.normalized_value;
+  } else {
+    libnxtusb_outputstate_t out;
+    if (nxt_get_output_state(handle, slot - 4, &out) != 0) {
+      return -1;
+    }
+    *valid = 1;
+    v[NXT_WAIT_TACHO] = out.tacho_count;
+    v[NXT_WAIT_ROTATION] = out.rotation_count;
+  }
+  return 0;
+}
+
+static void *wait_poller(void *arg) {
+  const libnxtusb_device_handle *handle = arg;
+  nxt_waits_t *w = &handle->priv->waits;
+  int32_t prev[WAIT_SLOTS][5];
+  int seen[WAIT_SLOTS] = {0};
+  unsigned int interval_ms = w->min_ms;
+
+  pthread_mutex_lock(&w->lock);
+  while (w->waiters != NULL) {
+    unsigned int wanted = 0;
+    nxt_waiter_t *wt;
+    int slot, changed = 0;
+
+    for (wt = w->waiters; wt != NULL; wt = wt->next) {
+      if (wt->result == 0) {
+        wanted |= 1 << wait_slot(&wt->cond);
+      }
+    }
+    for (slot = 0; slot < WAIT_SLOTS; slot++) {
+      int32_t v[5] = {0};
+      int valid;
+      if (!(wanted & (1 << slot))) {
+        continue;
+      }
+      pthread_mutex_unlock(&w->lock);
+      int ret = wait_read(handle, slot, v, &valid);
+      pthread_mutex_lock(&w->lock);
+      w->stats.polls++;
+      if (ret == 0 && seen[slot] && memcmp(prev[slot], v, sizeof (v)) != 0) {
+        changed = 1;
+      }
+      if (ret == 0) {
+        memcpy(prev[slot], v, sizeof (v));
+        seen[slot] = 1;
+      }
+      // waiters which came meanwhile are evaluated too, it's a fresh sample
+      for (wt = w->waiters; wt != NULL; wt = wt->next) {
+        if (wt->result != 0 || wait_slot(&wt->cond) != slot) {
+          continue;
+        }
+        if (ret != 0) {
+          wt->result = -1;
+        } else if (valid && wait_holds(wt, v[wt->cond.field])) {
+          wt->result = 1;
+          wt->value = v[wt->cond.field];
+        }
+      }
+    }
+    pthread_cond_broadcast(&w->cond);
+
+    interval_ms = changed ? w->min_ms : interval_ms * 2;
+    if (interval_ms > w->max_ms) {
+      interval_ms = w->max_ms;
+    }
+    if (interval_ms < w->min_ms) {
+      interval_ms = w->min_ms;
+    }
+    // new waiter cuts sleep short, it wants first sample now
+    w->kick = 0;
+    struct timespec until = wait_abs(nxt_time_ns() + interval_ms * 1000000ULL);
+    while (w->waiters != NULL && !w->kick) {
+      if (pthread_cond_timedwait(&w->wake, &w->lock, &until) != 0) {
+        break;
+      }
+    }
+  }
+  w->running = 0;
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+int nxt_wait_for(
+                 const libnxtusb_device_handle *handle, const libnxtusb_wait_cond_t *cond,
+                 const unsigned int timeout_ms, int32_t *value
+                 ) {
+  nxt_waits_t *w = &handle->priv->waits;
+  nxt_waiter_t me = {*cond, 0, 0, 0, 0, 0, NULL};
+  int ret = 0;
+
+  if (wait_slot(cond) < 0 || cond->op > NXT_WAIT_CHANGE) {
+    return -1;
+  }
+  uint64_t deadline = timeout_ms ? nxt_time_ns() + timeout_ms * 1000000ULL : 0;
+  struct timespec until = wait_abs(deadline);
+
+  pthread_mutex_lock(&w->lock);
+  me.next = w->waiters;
+  w->waiters = &me;
+  while (!w->running && w->started) {
+    // previous poller ran out of waiters, collect it first. Taken over
+    // under lock so exactly one caller joins it
+    pthread_t dead = w->thread;
+    w->started = 0;
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(dead, NULL);
+    pthread_mutex_lock(&w->lock);
+  }
+  // another caller may have started a poller while we joined
+  if (!w->running) {
+    if (pthread_create(&w->thread, NULL, wait_poller, (void*) handle) != 0) {
+      w->waiters = me.next;
+      pthread_mutex_unlock(&w->lock);
+      return -1;
+    }
+    w->started = 1;
+    w->running = 1;
+  } else {
+    w->kick = 1;
+    pthread_cond_signal(&w->wake);
+  }
+  while (me.result == 0 && ret == 0) {
+    if (deadline == 0) {
+      pthread_cond_wait(&w->cond, &w->lock);
+    } else {
+      ret = pthread_cond_timedwait(&w->cond, &w->lock, &until);
+    }
+  }
+  nxt_waiter_t **p;
+  for (p = &w->waiters; *p != &me; p = &(*p)->next) {
+  }
+  *p = me.next;
+  if (me.result == 1) {
+    w->stats.satisfied++;
+    if (value != NULL) {
+      *value = me.value;
+    }
+    ret = 0;
+  } else if (me.result == -1) {
+    w->stats.failures++;
+    ret = -1;
+  } else {
+    w->stats.timeouts++;
+    ret = 1;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return ret;
+}
+
+int nxt_wait_set_poll(const libnxtusb_device_handle *handle, const unsigned int min_ms, const unsigned int max_ms) {
+  nxt_waits_t *w = &handle->priv->waits;
+
+  if (min_ms == 0 || max_ms < min_ms) {
+    return -1;
+  }
+  pthread_mutex_lock(&w->lock);
+  w->min_ms = min_ms;
+  w->max_ms = max_ms;
+  pthread_mutex_unlock(&w->lock);
+  return 0;
+}
+
+void nxt_wait_stats(const libnxtusb_device_handle *handle, libnxtusb_wait_stats_t *stats) {
+  nxt_waits_t *w = &handle->priv->waits;
+
+  pthread_mutex_lock(&w->lock);
+  *stats = w->stats;
+  pthread_mutex_unlock(&w->lock);
+}
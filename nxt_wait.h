@@ -0,0 +1,146 @@
+/**
+ * @file nxt_wait.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Waiting for sensor and motor conditions. Public header
+ *
+ * Instead of spinning on nxt_get_input_values, caller describes what it
+ * waits for and sleeps. One poller thread per handle reads every port
+ * some waiter is interested in, once per tick no matter how many waiters
+ * share it, and wakes waiters whose condition holds. Poll interval starts
+ * at minimum, doubles while values stay the same and drops back to
+ * minimum on any change. Poller exits when last waiter is gone.
+ */
+
+#ifndef NXT_WAIT_H
+#define NXT_WAIT_H
+#include "libnxtusb.h"
+
+/** \ingroup wait
+ * Default minimum poll interval, ms
+ */
+#define NXT_WAIT_MIN_POLL_MS 5
+
+/** \ingroup wait
+ * Default maximum poll interval, ms
+ */
+#define NXT_WAIT_MAX_POLL_MS 50
+
+/** \ingroup wait
+ * Value to watch
+ */
+typedef enum {
+  /** Input scaled value */
+  NXT_WAIT_SCALED = 0,
+  /** Input raw A/D value */
+  NXT_WAIT_RAW,
+  /** Input normalized value */
+  NXT_WAIT_NORMALIZED,
+  /** Output tacho count */
+  NXT_WAIT_TACHO,
+  /** Output rotation count */
+  NXT_WAIT_ROTATION
+} libnxtusb_wait_field_t;
+
+/** \ingroup wait
+ * Condition on watched value
+ */
+typedef enum {
+  /** value > threshold */
+  NXT_WAIT_ABOVE = 0,
+  /** value < threshold */
+  NXT_WAIT_BELOW,
+  /** value == threshold */
+  NXT_WAIT_EQUAL,
+  /** value != threshold */
+  NXT_WAIT_NOT_EQUAL,
+  /** value goes from <= threshold to > threshold */
+  NXT_WAIT_RISING,
+  /** value goes from >= threshold to < threshold */
+  NXT_WAIT_FALLING,
+  /** value differs from first sample by more than threshold */
+  NXT_WAIT_CHANGE
+} libnxtusb_wait_op_t;
+
+/** \ingroup wait
+ * Wait condition
+ */
+typedef struct {
+  /** libnxtusb_wait_field_t value */
+  uint8_t field;
+  /** libnxtusb_in_t or libnxtusb_out_t port, as field says */
+  uint8_t port;
+  /** libnxtusb_wait_op_t condition */
+  uint8_t op;
+  /** Threshold, delta for NXT_WAIT_CHANGE */
+  int32_t threshold;
+} libnxtusb_wait_cond_t;
+
+/** \ingroup wait
+ * Poller statistics
+ */
+typedef struct {
+  /** Port reads done by poller */
+  uint64_t polls;
+  /** Waits satisfied */
+  uint64_t satisfied;
+  /** Waits timed out */
+  uint64_t timeouts;
+  /** Waits failed on brick error */
+  uint64_t failures;
+} libnxtusb_wait_stats_t;
+
+/**
+ * \defgroup wait Waiting for conditions.
+ */
+
+/** \ingroup wait
+ *  Sleep until condition holds.
+ *  Invalid input readings (sensor still settling) are skipped.
+ * @param handle nxt brick handle
+ * @param cond libnxtusb_wait_cond_t* condition
+ * @param timeout_ms give up after, 0 = wait forever
+ * @param value value which satisfied condition (may be NULL)
+ * @return 0 if condition holds, 1 on timeout, -1 on failure
+ */
+int nxt_wait_for(
+        const libnxtusb_device_handle *handle, const libnxtusb_wait_cond_t *cond,
+        const unsigned int timeout_ms, int32_t *value
+        );
+
+/** \ingroup wait
+ *  Set poll interval range
+ * @param handle nxt brick handle
+ * @param min_ms interval while values change
+ * @param max_ms interval values back off to while steady
+ * @return 0 on success, -1 on bad range
+ */
+int nxt_wait_set_poll(const libnxtusb_device_handle *handle, const unsigned int min_ms, const unsigned int max_ms);
+
+/** \ingroup wait
+ *  Get poller statistics
+ * @param handle nxt brick handle
+ * @param stats libnxtusb_wait_stats_t* statistics (preallocated)
+ */
+void nxt_wait_stats(const libnxtusb_device_handle *handle, libnxtusb_wait_stats_t *stats);
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * @file nxt_writes.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Write elision and coalescing of actuator commands.
+ */
+
+#include <string.h>
+#include "nxt_private.h"
+
+// packets are compared without type byte, reply and no-reply writes are the same
+#define SAME(a, b, type) (memcmp((const uint8_t*) (a) + 1, (const uint8_t*) (b) + 1, sizeof (type) - 1) == 0)
+
+//internal. is write a no-op for brick. Counts elided writes
+
+int nxt_write_redundant(nxt_writes_t *w, const unsigned char *request, const unsigned int length) {
+  int redundant = 0;
+
+  if (!w->elide) {
+    return 0;
+  }
+  switch (request[1]) {
+    case NXT_OPCODE_SET_INPUTMODE:
+      redundant = length == sizeof (cmd_setinput_t) && request[2] < 4 &&
+        (w->input_acked & (1 << request[2])) && SAME(request, &w->input[request[2]], cmd_setinput_t);
+      break;
+    case NXT_OPCODE_SET_OUTPUTSTATE:
+    {
+      const cmd_setoutput_t *cmd = (const cmd_setoutput_t*) request;
+      if (length != sizeof (cmd_setoutput_t) || cmd->tacho_limit != 0) {
+        break;
+      }
+      cmd_setoutput_t one = *cmd;
+      int port;
+      redundant = 1;
+      for (port = 0; port < 3; port++) {
+        if (cmd->port != port && cmd->port != NXT_OUT_ALL) {
+          continue;
+        }
+        one.port = port;
+        if (!(w->output_acked & (1 << port)) || !SAME(&one, &w->output[port], cmd_setoutput_t)) {
+          redundant = 0;
+        }
+      }
+      // unknown port, let brick complain
+      if (cmd->port >= 3 && cmd->port != NXT_OUT_ALL) {
+        redundant = 0;
+      }
+      break;
+    }
+  }
+  if (redundant) {
+    w->stats.elided++;
+  }
+  return redundant;
+}
+
+//internal. write finished. Acked writes update cache, anything else makes port state unknown
+
+void nxt_write_done(nxt_writes_t *w, const unsigned char *request, const unsigned int length, const int acked) {
+  switch (request[1]) {
+    case NXT_OPCODE_SET_INPUTMODE:
+      if (length != sizeof (cmd_setinput_t) || request[2] >= 4) {
+        break;
+      }
+      if (acked) {
+        memcpy(&w->input[request[2]], request, sizeof (cmd_setinput_t));
+        w->input_acked |= 1 << request[2];
+      } else {
+        w->input_acked &= ~(1 << request[2]);
+      }
+      break;
+    case NXT_OPCODE_SET_OUTPUTSTATE:
+    {
+      const cmd_setoutput_t *cmd = (const cmd_setoutput_t*) request;
+      if (length != sizeof (cmd_setoutput_t)) {
+        break;
+      }
+      int port;
+      for (port = 0; port < 3; port++) {
+        if (cmd->port != port && cmd->port != NXT_OUT_ALL) {
+          continue;
+        }
+        if (acked && cmd->tacho_limit == 0) {
+          w->output[port] = *cmd;
+          w->output[port].port = port;
+          w->output_acked |= 1 << port;
+        } else {
+          w->output_acked &= ~(1 << port);
+        }
+      }
+      break;
+    }
+    case NXT_OPCODE_STARTPROGRAM:
+    case NXT_OPCODE_STOPPROGRAM:
+      // program may have touched any port
+      w->input_acked = 0;
+      w->output_acked = 0;
+      break;
+  }
+}
+
+void nxt_set_write_elision(const libnxtusb_device_handle *handle, const int enable) {
+  handle->priv->writes.elide = enable;
+}
+
+void nxt_write_cache_invalidate(const libnxtusb_device_handle *handle) {
+  handle->priv->writes.input_acked = 0;
+  handle->priv->writes.output_acked = 0;
+}
+
+int nxt_queue_input_mode(
+                         const libnxtusb_device_handle *handle, const libnxtusb_in_t port,
+                         const libnxtusb_sensor_type_t stype, const libnxtusb_sensor_mode_t smode
+                         ) {
+  nxt_writes_t *w = &handle->priv->writes;
+
+  if (port >= 4) {
+    return -1;
+  }
+  cmd_setinput_t cmd = {
+    NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_SET_INPUTMODE, port, stype, smode
+  };
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  if (w->queued_inputs & (1 << port)) {
+    w->stats.coalesced++;
+  }
+  w->q_input[port] = cmd;
+  w->queued_inputs |= 1 << port;
+  w->stats.queued++;
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  return 0;
+}
+
+int nxt_queue_output_state(
+                           const libnxtusb_device_handle *handle, const libnxtusb_out_t port,
+                           const int8_t power, const libnxtusb_motor_mode_t mode, const libnxtusb_motor_regulation_t regulation,
+                           const int8_t turn_ratio, const libnxtusb_motor_runstate_t run_state, const uint32_t tacho_limit
+                           ) {
+  nxt_writes_t *w = &handle->priv->writes;
+  unsigned int p;
+
+  if (port >= 3 && port != NXT_OUT_ALL) {
+    return -1;
+  }
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  for (p = 0; p < 3; p++) {
+    if (port != p && port != NXT_OUT_ALL) {
+      continue;
+    }
+    cmd_setoutput_t cmd = {
+      NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_SET_OUTPUTSTATE, p, power,
+      mode, regulation, turn_ratio, run_state, tacho_limit
+    };
+    if (w->queued_outputs & (1 << p)) {
+      w->stats.coalesced++;
+    }
+    w->q_output[p] = cmd;
+    w->queued_outputs |= 1 << p;
+    w->stats.queued++;
+  }
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  return 0;
+}
+
+int nxt_pending_writes(const libnxtusb_device_handle *handle) {
+  nxt_writes_t *w = &handle->priv->writes;
+  int n = 0;
+  int i;
+
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  for (i = 0; i < 4; i++) {
+    n += (w->queued_inputs >> i) & 1;
+    n += (w->queued_outputs >> i) & 1;
+  }
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+  return n;
+}
+
+int nxt_flush_writes(const libnxtusb_device_handle *handle) {
+  nxt_writes_t *w = &handle->priv->writes;
+  cmd_setinput_t inputs[4];
+  cmd_setoutput_t outputs[3];
+  uint8_t queued_inputs, queued_outputs;
+  ret_status_t st;
+  int ret = 0;
+  int i;
+
+  // take queue as a whole, writes queued meanwhile wait for next flush
+  pthread_mutex_lock(&handle->priv->channel.lock);
+  memcpy(inputs, w->q_input, sizeof (inputs));
+  memcpy(outputs, w->q_output, sizeof (outputs));
+  queued_inputs = w->queued_inputs;
+  queued_outputs = w->queued_outputs;
+  w->queued_inputs = 0;
+  w->queued_outputs = 0;
+  pthread_mutex_unlock(&handle->priv->channel.lock);
+
+  for (i = 0; i < 4; i++) {
+    if (!(queued_inputs & (1 << i))) {
+      continue;
+    }
+    w->stats.flushed++;
+    if (nxt_transact(handle, &inputs[i], sizeof (cmd_setinput_t), &st, sizeof (st)) != 0) {
+      ret = -1;
+    }
+  }
+  // same state for every port goes as one packet, motors start together
+  if (queued_outputs == 0x07) {
+    cmd_setoutput_t all = outputs[0];
+    all.port = NXT_OUT_ALL;
+    for (i = 1; i < 3; i++) {
+      cmd_setoutput_t one = outputs[i];
+      one.port = NXT_OUT_ALL;
+      if (!SAME(&all, &one, cmd_setoutput_t)) {
+        break;
+      }
+    }
+    if (i == 3) {
+      queued_outputs = 0;
+      w->stats.flushed += 3;
+      if (nxt_transact(handle, &all, sizeof (cmd_setoutput_t), &st, sizeof (st)) != 0) {
+        ret = -1;
+      }
+    }
+  }
+  for (i = 0; i < 3; i++) {
+    if (!(queued_outputs & (1 << i))) {
+      continue;
+    }
+    w->stats.flushed++;
+    if (nxt_transact(handle, &outputs[i], sizeof (cmd_setoutput_t), &st, sizeof (st)) != 0) {
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+void nxt_write_stats(const libnxtusb_device_handle *handle, libnxtusb_write_stats_t *stats) {
+  *stats = handle->priv->writes.stats;
+}
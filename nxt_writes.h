@@ -0,0 +1,118 @@
+/**
+ * @file nxt_writes.h
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * Write elision and coalescing of actuator commands. Public header
+ *
+ * With elision enabled, handle remembers last acknowledged input mode and
+ * output state of every port, and nxt_set_input_mode / nxt_set_output_state
+ * with the same values return at once without touching the bus.
+ * Output states with tacho limit are never elided, since brick changes
+ * run state by itself when limit is reached.
+ * Cache is dropped after failed writes, program start/stop and reconnect.
+ *
+ * Queued writes are kept per port until nxt_flush_writes; newer write to
+ * the same port replaces older unsent one. When all three ports are queued
+ * with the same state, flush sends them as one NXT_OUT_ALL packet.
+ */
+
+#ifndef NXT_WRITES_H
+#define NXT_WRITES_H
+#include "libnxtusb.h"
+
+/** \ingroup writes
+ * Write statistics
+ */
+typedef struct {
+  /** Writes put into queue */
+  uint64_t queued;
+  /** Queued writes replaced by newer write to the same port */
+  uint64_t coalesced;
+  /** Writes dropped because brick already has these values */
+  uint64_t elided;
+  /** Queued writes sent by nxt_flush_writes (including elided) */
+  uint64_t flushed;
+} libnxtusb_write_stats_t;
+
+/**
+ * \defgroup writes Write elision and coalescing.
+ */
+
+/** \ingroup writes
+ *  Enable or disable write elision (disabled by default)
+ * @param handle nxt brick handle
+ * @param enable 1 to enable, 0 to disable
+ */
+void nxt_set_write_elision(const libnxtusb_device_handle *handle, const int enable);
+
+/** \ingroup writes
+ *  Forget acknowledged state, next writes go to the bus
+ * @param handle nxt brick handle
+ */
+void nxt_write_cache_invalidate(const libnxtusb_device_handle *handle);
+
+/** \ingroup writes
+ *  Queue input mode write, see nxt_set_input_mode
+ * @param handle nxt brick handle
+ * @param port libnxtusb_in_t port
+ * @param stype libnxtusb_sensor_type_t sensor type
+ * @param smode libnxtusb_sensor_mode_t sensor mode
+ * @return 0 on success, -1 on failure
+ */
+int nxt_queue_input_mode(
+        const libnxtusb_device_handle *handle, const libnxtusb_in_t port,
+        const libnxtusb_sensor_type_t stype, const libnxtusb_sensor_mode_t smode
+        );
+
+/** \ingroup writes
+ *  Queue output state write, see nxt_set_output_state.
+ *  NXT_OUT_ALL queues write for each port.
+ * @return 0 on success, -1 on failure
+ */
+int nxt_queue_output_state(
+        const libnxtusb_device_handle *handle, const libnxtusb_out_t port,
+        const int8_t power, const libnxtusb_motor_mode_t mode, const libnxtusb_motor_regulation_t regulation,
+        const int8_t turn_ratio, const libnxtusb_motor_runstate_t run_state, const uint32_t tacho_limit
+        );
+
+/** \ingroup writes
+ *  Get number of queued writes
+ * @param handle nxt brick handle
+ * @return number of writes waiting for flush
+ */
+int nxt_pending_writes(const libnxtusb_device_handle *handle);
+
+/** \ingroup writes
+ *  Send queued writes, inputs first. Failed writes are dropped too.
+ * @param handle nxt brick handle
+ * @return 0 on success, -1 if any write failed
+ */
+int nxt_flush_writes(const libnxtusb_device_handle *handle);
+
+/** \ingroup writes
+ *  Get write statistics
+ * @param handle nxt brick handle
+ * @param stats libnxtusb_write_stats_t* statistics (preallocated)
+ */
+void nxt_write_stats(const libnxtusb_device_handle *handle, libnxtusb_write_stats_t *stats);
+
+#endif
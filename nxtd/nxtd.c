@@ -0,0 +1,483 @@
+/**
+ * @file nxtd.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * nxtd - share bricks between processes.
+ *
+ * Usage: nxtd [-w window_ms] [-p socket_prefix] [serial ...]
+ * Without serials first brick found is served at <prefix>.sock, otherwise
+ * every brick is served at <prefix>-<serial>.sock. Clients connect with
+ * libnxtusb_open_daemon.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "nxt_private.h"
+
+#define NXTD_MAX_BRICKS 8
+#define NXTD_MAX_CLIENTS 32
+#define NXTD_CACHE_SIZE 16
+#define NXTD_WINDOW_MS 5
+#define NOBODY (-1)
+
+typedef struct {
+  int fd;
+} client_t;
+
+// reply to a read, shared by all clients asking the same
+typedef struct {
+  unsigned char request[NXT_PACKET_SIZE];
+  unsigned int length;
+  unsigned char reply[NXT_PACKET_SIZE];
+  int reply_length;
+  uint64_t at_ns;
+  unsigned long round;
+} poll_cache_t;
+
+typedef struct {
+  libnxtusb_device_handle *handle;
+  const char *serial;
+  struct sockaddr_un addr;
+  int listen_fd;
+  client_t clients[NXTD_MAX_CLIENTS];
+  // client index owning port
+  int input_owner[4];
+  int output_owner[3];
+  poll_cache_t cache[NXTD_CACHE_SIZE];
+  unsigned int cache_next;
+  uint64_t polls_requested;
+  uint64_t polls_executed;
+  uint64_t rejected;
+  uint64_t commands;
+  uint64_t estops;
+} brick_t;
+
+static volatile sig_atomic_t quit;
+static brick_t bricks[NXTD_MAX_BRICKS];
+static int nbricks;
+static uint64_t window_ns = NXTD_WINDOW_MS * 1000000ULL;
+static unsigned long round_no;
+
+static void on_signal(int sig) {
+  (void) sig;
+  quit = 1;
+}
+
+static int listen_on(brick_t *b, const char *prefix) {
+  int n;
+
+  b->addr.sun_family = AF_UNIX;
+  if (b->serial == NULL) {
+    n = snprintf(b->addr.sun_path, sizeof (b->addr.sun_path), "%s.sock", prefix);
+  } else {
+    n = snprintf(b->addr.sun_path, sizeof (b->addr.sun_path), "%s-%s.sock", prefix, b->serial);
+  }
+  if (n < 0 || (size_t) n >= sizeof (b->addr.sun_path)) {
+    fprintf(stderr, "nxtd: socket path too long\n");
+    return -1;
+  }
+  b->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (b->listen_fd < 0) {
+    perror("nxtd: socket");
+    return -1;
+  }
+  unlink(b->addr.sun_path);
+  if (bind(b->listen_fd, (struct sockaddr*) &b->addr, sizeof (b->addr)) != 0 ||
+      listen(b->listen_fd, NXTD_MAX_CLIENTS) != 0) {
+    perror(b->addr.sun_path);
+    close(b->listen_fd);
+    return -1;
+  }
+  return 0;
+}
+
+static void accept_client(brick_t *b) {
+  int fd = accept(b->listen_fd, NULL, NULL);
+  int i;
+
+  if (fd < 0) {
+    return;
+  }
+  for (i = 0; i < NXTD_MAX_CLIENTS; i++) {
+    if (b->clients[i].fd < 0) {
+      b->clients[i].fd = fd;
+      return;
+    }
+  }
+  // full, client sees EOF
+  close(fd);
+}
+
+// coast outputs of gone client and give its ports away
+static void drop_client(brick_t *b, const int id) {
+  int p;
+
+  close(b->clients[id].fd);
+  b->clients[id].fd = -1;
+  for (p = 0; p < 4; p++) {
+    if (b->input_owner[p] == id) {
+      b->input_owner[p] = NOBODY;
+    }
+  }
+  for (p = 0; p < 3; p++) {
+    if (b->output_owner[p] == id) {
+      b->output_owner[p] = NOBODY;
+      nxt_set_output_state(b->handle, p, 0, 0, NXT_MOTOR_REGULATION_IDLE, 0, NXT_MOTOR_RUNSTATE_IDLE, 0);
+    }
+  }
+}
+
+// ports written by command, inputs in low nibble, outputs in high
+static unsigned int write_ports(const unsigned char *req, const unsigned int length) {
+  if (length < 3) {
+    return 0;
+  }
+  switch (req[1]) {
+    case NXT_OPCODE_SET_OUTPUTSTATE:
+    case NXT_OPCODE_RESET_MOTOR_POSITION:
+      if (req[2] == NXT_OUT_ALL) {
+        return 0x70;
+      }
+      return req[2] < 3 ? 0x10 << req[2] : 0;
+    case NXT_OPCODE_SET_INPUTMODE:
+    case NXT_OPCODE_RESET_INPUT_SCALEDVALUES:
+    case NXT_OPCODE_LS_WRITE:
+      return req[2] < 4 ? 1 << req[2] : 0;
+    default:
+      return 0;
+  }
+}
+
+// brake packet of nxt_emergency_stop: all outputs, power 0, brake
+static int is_estop(const unsigned char *req, const unsigned int length) {
+  return length >= 5 && req[1] == NXT_OPCODE_SET_OUTPUTSTATE && req[2] == NXT_OUT_ALL &&
+          req[3] == 0 && (req[4] & NXT_MOTOR_MODE_BRAKE);
+}
+
+// first writer owns port. Returns 0 if client may write
+static int claim_ports(brick_t *b, const int id, const unsigned int ports) {
+  int p;
+
+  for (p = 0; p < 4; p++) {
+    if ((ports & (1 << p)) && b->input_owner[p] != NOBODY && b->input_owner[p] != id) {
+      return -1;
+    }
+  }
+  for (p = 0; p < 3; p++) {
+    if ((ports & (0x10 << p)) && b->output_owner[p] != NOBODY && b->output_owner[p] != id) {
+      return -1;
+    }
+  }
+  for (p = 0; p < 4; p++) {
+    if (ports & (1 << p)) {
+      b->input_owner[p] = id;
+    }
+  }
+  for (p = 0; p < 3; p++) {
+    if (ports & (0x10 << p)) {
+      b->output_owner[p] = id;
+    }
+  }
+  return 0;
+}
+
+static poll_cache_t *cache_find(brick_t *b, const unsigned char *req, const unsigned int length, const uint64_t now) {
+  int i;
+
+  for (i = 0; i < NXTD_CACHE_SIZE; i++) {
+    poll_cache_t *e = &b->cache[i];
+    if (e->length == length && memcmp(e->request, req, length) == 0 &&
+        (e->round == round_no || now - e->at_ns < window_ns)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void cache_clear(brick_t *b) {
+  int i;
+
+  for (i = 0; i < NXTD_CACHE_SIZE; i++) {
+    b->cache[i].length = 0;
+  }
+}
+
+// run command on brick, reconnecting if it vanished
+static int brick_command(brick_t *b, const unsigned char *req, const unsigned int length, unsigned char *reply) {
+  int got = nxt_raw_command(b->handle, req, length, reply, NXT_PACKET_SIZE);
+
+  if (got < 0 && nxt_device_lost(b->handle->priv->timeouts.last_io_error)) {
+    fprintf(stderr, "nxtd: brick %s lost, reconnecting\n", nxt_serial(b->handle));
+    cache_clear(b);
+    if (nxt_reconnect(b->handle) == 0) {
+      got = nxt_raw_command(b->handle, req, length, reply, NXT_PACKET_SIZE);
+    }
+  }
+  return got;
+}
+
+static void reply_status(const int fd, const uint8_t opcode, const uint8_t status) {
+  unsigned char reply[3] = {NXT_COMMAND_REPLY, opcode, status};
+
+  send(fd, reply, sizeof (reply), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+// any client may brake all motors, owned or not, without taking them.
+// Returns 0 if next packet of client was a brake and got served
+static int serve_estop(brick_t *b, const int id) {
+  unsigned char req[NXT_PACKET_SIZE];
+  int fd = b->clients[id].fd;
+  ssize_t n = recv(fd, req, sizeof (req), MSG_PEEK | MSG_DONTWAIT);
+
+  if (n <= 0 || !is_estop(req, n)) {
+    return -1;
+  }
+  recv(fd, req, sizeof (req), MSG_DONTWAIT);
+  b->commands++;
+  b->estops++;
+  cache_clear(b);
+  int ret = nxt_emergency_stop(b->handle);
+  if (!(req[0] & 0x80)) {
+    reply_status(fd, req[1], ret == 0 ? NXT_STATUS_OK : NXT_STATUS_COMMUNICATION_ERROR);
+  }
+  return 0;
+}
+
+// output write which was pending when brakes went on would undo them.
+// Returns 0 if next packet of client was such a write and got dropped
+static int drop_stale_write(brick_t *b, const int id) {
+  unsigned char req[NXT_PACKET_SIZE];
+  int fd = b->clients[id].fd;
+  ssize_t n = recv(fd, req, sizeof (req), MSG_PEEK | MSG_DONTWAIT);
+
+  if (n < 2 || !(write_ports(req, n) & 0x70)) {
+    return -1;
+  }
+  recv(fd, req, sizeof (req), MSG_DONTWAIT);
+  b->commands++;
+  b->rejected++;
+  if (!(req[0] & 0x80)) {
+    reply_status(fd, req[1], NXT_STATUS_CHANNEL_BUSY);
+  }
+  return 0;
+}
+
+static void serve(brick_t *b, const int id) {
+  unsigned char req[NXT_PACKET_SIZE];
+  unsigned char reply[NXT_PACKET_SIZE];
+  int fd = b->clients[id].fd;
+  ssize_t n = recv(fd, req, sizeof (req), MSG_DONTWAIT);
+
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    drop_client(b, id);
+    return;
+  }
+  if (n < 2) {
+    return;
+  }
+  const unsigned int length = n;
+  const int noreply = req[0] & 0x80;
+  int got;
+  b->commands++;
+
+  if (!noreply && nxt_opcode_idempotent(req[1])) {
+    uint64_t now = nxt_time_ns();
+    poll_cache_t *e = cache_find(b, req, length, now);
+    b->polls_requested++;
+    if (e == NULL) {
+      got = brick_command(b, req, length, reply);
+      b->polls_executed++;
+      if (got > 0) {
+        e = &b->cache[b->cache_next];
+        b->cache_next = (b->cache_next + 1) % NXTD_CACHE_SIZE;
+        memcpy(e->request, req, length);
+        e->length = length;
+        memcpy(e->reply, reply, got);
+        e->reply_length = got;
+        e->at_ns = now;
+        e->round = round_no;
+      }
+    } else {
+      memcpy(reply, e->reply, e->reply_length);
+      got = e->reply_length;
+    }
+  } else {
+    unsigned int ports = write_ports(req, length);
+    if (ports != 0 && claim_ports(b, id, ports) != 0) {
+      b->rejected++;
+      if (!noreply) {
+        reply_status(fd, req[1], NXT_STATUS_CHANNEL_BUSY);
+      }
+      return;
+    }
+    // anything but a read may change what reads return
+    cache_clear(b);
+    got = brick_command(b, req, length, reply);
+  }
+  if (noreply) {
+    return;
+  }
+  if (got <= 0) {
+    // don't leave client waiting for its timeout
+    reply[0] = NXT_COMMAND_REPLY;
+    reply[1] = req[1];
+    reply[2] = NXT_STATUS_COMMUNICATION_ERROR;
+    got = 3;
+  }
+  if (send(fd, reply, got, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+    drop_client(b, id);
+  }
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: nxtd [-w window_ms] [-p socket_prefix] [serial ...]\n");
+}
+
+int main(int argc, char **argv) {
+  const char *prefix = "/tmp/nxtd";
+  struct pollfd fds[NXTD_MAX_BRICKS * (NXTD_MAX_CLIENTS + 1)];
+  int opt;
+  int i, k;
+
+  while ((opt = getopt(argc, argv, "w:p:h")) != -1) {
+    switch (opt) {
+      case 'w':
+        window_ns = strtoull(optarg, NULL, 10) * 1000000ULL;
+        break;
+      case 'p':
+        prefix = optarg;
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (argc - optind > NXTD_MAX_BRICKS) {
+    fprintf(stderr, "nxtd: at most %d bricks\n", NXTD_MAX_BRICKS);
+    return 1;
+  }
+  nbricks = argc > optind ? argc - optind : 1;
+  for (i = 0; i < nbricks; i++) {
+    brick_t *b = &bricks[i];
+    b->serial = argc > optind ? argv[optind + i] : NULL;
+    b->handle = b->serial ? libnxtusb_getnxt_serial(b->serial) : libnxtusb_getnxt();
+    if (b->handle == NULL) {
+      fprintf(stderr, "nxtd: brick %s not found\n", b->serial ? b->serial : "");
+      return 1;
+    }
+    nxt_set_reconnect(b->handle, 5000, NXT_RESTORE_ALL, NULL, NULL);
+    for (k = 0; k < NXTD_MAX_CLIENTS; k++) {
+      b->clients[k].fd = -1;
+    }
+    for (k = 0; k < 4; k++) {
+      b->input_owner[k] = NOBODY;
+    }
+    for (k = 0; k < 3; k++) {
+      b->output_owner[k] = NOBODY;
+    }
+    if (listen_on(b, prefix) != 0) {
+      return 1;
+    }
+    printf("nxtd: brick %s at %s\n", nxt_serial(b->handle), b->addr.sun_path);
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof (sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!quit) {
+    int nfds = 0;
+    for (i = 0; i < nbricks; i++) {
+      fds[nfds].fd = bricks[i].listen_fd;
+      fds[nfds++].events = POLLIN;
+      for (k = 0; k < NXTD_MAX_CLIENTS; k++) {
+        fds[nfds].fd = bricks[i].clients[k].fd;
+        fds[nfds++].events = POLLIN;
+      }
+    }
+    if (poll(fds, nfds, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("nxtd: poll");
+      break;
+    }
+    // one packet per client per round, identical polls of a round share one brick poll
+    round_no++;
+    nfds = 0;
+    for (i = 0; i < nbricks; i++) {
+      brick_t *b = &bricks[i];
+      struct pollfd *cfds = &fds[nfds + 1];
+      if (fds[nfds].revents & POLLIN) {
+        accept_client(b);
+      }
+      nfds += 1 + NXTD_MAX_CLIENTS;
+      // brakes first, then drop output writes queued behind them
+      int braked = 0;
+      for (k = 0; k < NXTD_MAX_CLIENTS; k++) {
+        if (cfds[k].fd >= 0 && (cfds[k].revents & POLLIN) && serve_estop(b, k) == 0) {
+          cfds[k].revents = 0;
+          braked = 1;
+        }
+      }
+      for (k = 0; braked && k < NXTD_MAX_CLIENTS; k++) {
+        if (cfds[k].fd >= 0 && (cfds[k].revents & POLLIN) && drop_stale_write(b, k) == 0) {
+          cfds[k].revents = 0;
+        }
+      }
+      for (k = 0; k < NXTD_MAX_CLIENTS; k++) {
+        if (cfds[k].fd < 0 || !(cfds[k].revents & (POLLIN | POLLHUP | POLLERR))) {
+          continue;
+        }
+        serve(b, k);
+      }
+    }
+  }
+
+  for (i = 0; i < nbricks; i++) {
+    brick_t *b = &bricks[i];
+    for (k = 0; k < NXTD_MAX_CLIENTS; k++) {
+      if (b->clients[k].fd >= 0) {
+        drop_client(b, k);
+      }
+    }
+    printf("nxtd: %s: %llu commands, %llu polls requested, %llu executed, %llu writes rejected, %llu estops\n",
+           nxt_serial(b->handle), (unsigned long long) b->commands,
+           (unsigned long long) b->polls_requested, (unsigned long long) b->polls_executed,
+           (unsigned long long) b->rejected, (unsigned long long) b->estops);
+    close(b->listen_fd);
+    unlink(b->addr.sun_path);
+    libnxtusb_closenxt(b->handle);
+  }
+  return 0;
+}
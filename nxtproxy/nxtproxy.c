@@ -0,0 +1,314 @@
+/**
+ * @file nxtproxy.c
+ * @author Epifanov Ivan <isage.dna@gmail.com>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                        Version 2, December 2004
+ *
+ *     Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ *     Everyone is permitted to copy and distribute verbatim or modified
+ *     copies of this license document, and changing it is allowed as long
+ *     as the name is changed.
+ *
+ *                 DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *        TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *       0. You just DO WHAT THE FUCK YOU WANT TO
+ *
+ * @section DESCRIPTION
+ *
+ * nxtproxy - serve local brick over TCP.
+ *
+ * Usage: nxtproxy [-b address] [-p port] [-s serial | -S] [-N]
+ * Packets are framed as in nxt_tcp.h. All complete requests of one read
+ * are run in order and their replies go back in one write. -N turns
+ * TCP_NODELAY off, -S serves a simulated brick running in real time
+ * instead of USB one. Clients connect with libnxtusb_open_tcp.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "nxt_private.h"
+
+#define NXTPROXY_MAX_CLIENTS 16
+
+typedef struct {
+  int fd;
+  unsigned char in[NXT_TCP_BUFFER];
+  unsigned int in_len;
+  unsigned char out[NXT_TCP_BUFFER];
+  unsigned int out_len;
+} client_t;
+
+static volatile sig_atomic_t quit;
+static client_t clients[NXTPROXY_MAX_CLIENTS];
+static libnxtusb_device_handle *brick;
+static int nodelay = 1;
+static uint64_t packets, reads, writes;
+
+static void on_signal(int sig) {
+  (void) sig;
+  quit = 1;
+}
+
+static int listen_on(const char *address, const char *port) {
+  struct addrinfo hints, *res, *ai;
+  int fd = -1;
+  int one = 1;
+
+  memset(&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(address, port, &hints, &res) != 0) {
+    fprintf(stderr, "nxtproxy: can't resolve %s\n", address ? address : "");
+    return -1;
+  }
+  for (ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, NXTPROXY_MAX_CLIENTS) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  if (fd < 0) {
+    perror("nxtproxy: listen");
+  }
+  return fd;
+}
+
+static void accept_client(const int listen_fd) {
+  int fd = accept(listen_fd, NULL, NULL);
+  int i;
+
+  if (fd < 0) {
+    return;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof (nodelay));
+  for (i = 0; i < NXTPROXY_MAX_CLIENTS; i++) {
+    if (clients[i].fd < 0) {
+      clients[i].fd = fd;
+      clients[i].in_len = 0;
+      clients[i].out_len = 0;
+      return;
+    }
+  }
+  close(fd);
+}
+
+static void drop_client(client_t *c) {
+  close(c->fd);
+  c->fd = -1;
+}
+
+// run command on brick, reconnecting if it vanished
+static int brick_command(const unsigned char *req, const unsigned int length, unsigned char *reply) {
+  int got = nxt_raw_command(brick, req, length, reply, NXT_PACKET_SIZE);
+
+  if (got < 0 && nxt_device_lost(brick->priv->timeouts.last_io_error)) {
+    fprintf(stderr, "nxtproxy: brick lost, reconnecting\n");
+    if (nxt_reconnect(brick) == 0) {
+      got = nxt_raw_command(brick, req, length, reply, NXT_PACKET_SIZE);
+    }
+  }
+  return got;
+}
+
+static int flush_client(client_t *c) {
+  unsigned int done = 0;
+
+  while (done < c->out_len) {
+    ssize_t n = send(c->fd, c->out + done, c->out_len - done, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        struct pollfd p = {c->fd, POLLOUT, 0};
+        poll(&p, 1, 1000);
+        continue;
+      }
+      return -1;
+    }
+    done += n;
+    writes++;
+  }
+  c->out_len = 0;
+  return 0;
+}
+
+static void serve(client_t *c) {
+  unsigned char reply[NXT_PACKET_SIZE];
+  unsigned int pos = 0;
+
+  ssize_t n = recv(c->fd, c->in + c->in_len, sizeof (c->in) - c->in_len, 0);
+  if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+    drop_client(c);
+    return;
+  }
+  if (n < 0) {
+    return;
+  }
+  reads++;
+  c->in_len += n;
+  // every complete request of this read, replies batched
+  while (c->in_len - pos >= 2) {
+    unsigned int length = c->in[pos] | c->in[pos + 1] << 8;
+    if (length < 2 || length > NXT_PACKET_SIZE) {
+      fprintf(stderr, "nxtproxy: bad frame, dropping client\n");
+      drop_client(c);
+      return;
+    }
+    if (c->in_len - pos < 2 + length) {
+      break;
+    }
+    const unsigned char *req = c->in + pos + 2;
+    pos += 2 + length;
+    packets++;
+    int got = brick_command(req, length, reply);
+    if (req[0] & 0x80) {
+      continue;
+    }
+    if (got <= 0) {
+      // client must not wait for its timeout
+      reply[0] = NXT_COMMAND_REPLY;
+      reply[1] = req[1];
+      reply[2] = NXT_STATUS_COMMUNICATION_ERROR;
+      got = 3;
+    }
+    if (c->out_len + 2 + got > sizeof (c->out) && flush_client(c) != 0) {
+      drop_client(c);
+      return;
+    }
+    c->out[c->out_len] = got & 0xff;
+    c->out[c->out_len + 1] = got >> 8;
+    memcpy(c->out + c->out_len + 2, reply, got);
+    c->out_len += 2 + got;
+  }
+  memmove(c->in, c->in + pos, c->in_len - pos);
+  c->in_len -= pos;
+  if (c->out_len > 0 && flush_client(c) != 0) {
+    drop_client(c);
+  }
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: nxtproxy [-b address] [-p port] [-s serial | -S] [-N]\n");
+}
+
+int main(int argc, char **argv) {
+  const char *address = NULL;
+  const char *serial = NULL;
+  char port[8];
+  int sim = 0;
+  struct pollfd fds[NXTPROXY_MAX_CLIENTS + 1];
+  int opt;
+  int i;
+
+  snprintf(port, sizeof (port), "%u", NXT_TCP_PORT);
+  while ((opt = getopt(argc, argv, "b:p:s:SNh")) != -1) {
+    switch (opt) {
+      case 'b':
+        address = optarg;
+        break;
+      case 'p':
+        snprintf(port, sizeof (port), "%s", optarg);
+        break;
+      case 's':
+        serial = optarg;
+        break;
+      case 'S':
+        sim = 1;
+        break;
+      case 'N':
+        nodelay = 0;
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (sim) {
+    libnxtusb_sim_config_t cfg;
+    memset(&cfg, 0, sizeof (cfg));
+    cfg.speed = 1.0;
+    brick = libnxtusb_open_sim(&cfg);
+  } else {
+    brick = serial ? libnxtusb_getnxt_serial(serial) : libnxtusb_getnxt();
+  }
+  if (brick == NULL) {
+    fprintf(stderr, "nxtproxy: brick %s not found\n", serial ? serial : "");
+    return 1;
+  }
+  nxt_set_reconnect(brick, 5000, NXT_RESTORE_ALL, NULL, NULL);
+  int listen_fd = listen_on(address, port);
+  if (listen_fd < 0) {
+    libnxtusb_closenxt(brick);
+    return 1;
+  }
+  for (i = 0; i < NXTPROXY_MAX_CLIENTS; i++) {
+    clients[i].fd = -1;
+  }
+  printf("nxtproxy: brick %s on port %s\n", nxt_serial(brick), port);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof (sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!quit) {
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    for (i = 0; i < NXTPROXY_MAX_CLIENTS; i++) {
+      fds[i + 1].fd = clients[i].fd;
+      fds[i + 1].events = POLLIN;
+    }
+    if (poll(fds, NXTPROXY_MAX_CLIENTS + 1, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("nxtproxy: poll");
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      accept_client(listen_fd);
+    }
+    for (i = 0; i < NXTPROXY_MAX_CLIENTS; i++) {
+      if (clients[i].fd >= 0 && (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+        serve(&clients[i]);
+      }
+    }
+  }
+
+  for (i = 0; i < NXTPROXY_MAX_CLIENTS; i++) {
+    if (clients[i].fd >= 0) {
+      drop_client(&clients[i]);
+    }
+  }
+  printf("nxtproxy: %llu packets in %llu reads, replies in %llu writes\n",
+         (unsigned long long) packets, (unsigned long long) reads, (unsigned long long) writes);
+  close(listen_fd);
+  libnxtusb_closenxt(brick);
+  return 0;
+}
@@ -0,0 +1,68 @@
+// pipeline of reads with replies of different lengths, checked against
+// simulated brick defaults
+
+#include <stdio.h>
+#include <string.h>
+#include "nxt_private.h"
+
+#define PIPELINE_LENGTH 8
+
+static const uint8_t pipeline_requests[PIPELINE_LENGTH][3] = {
+  {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_BATTERYLEVEL, 0},
+  {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_KEEPALIVE, 0},
+  {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_OUTPUTSTATE, NXT_OUT_A},
+  {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_OUTPUTSTATE, NXT_OUT_B},
+  {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_OUTPUTSTATE, NXT_OUT_C},
+  {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_INPUTVALUES, NXT_IN_1},
+  {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_INPUTVALUES, NXT_IN_2},
+  {NXT_DIRECT_COMMAND_DOREPLY, NXT_OPCODE_GET_INPUTVALUES, NXT_IN_3}
+};
+
+static void pipeline_build(libnxtusb_raw_cmd_t *cmds) {
+  int i;
+
+  memset(cmds, 0, PIPELINE_LENGTH * sizeof (libnxtusb_raw_cmd_t));
+  for (i = 0; i < PIPELINE_LENGTH; i++) {
+    cmds[i].request = pipeline_requests[i];
+    cmds[i].length = pipeline_requests[i][1] == NXT_OPCODE_BATTERYLEVEL ||
+      pipeline_requests[i][1] == NXT_OPCODE_KEEPALIVE ? 2 : 3;
+  }
+}
+
+static int pipeline_check(const libnxtusb_raw_cmd_t *cmds) {
+  int i;
+
+  for (i = 0; i < PIPELINE_LENGTH; i++) {
+    const uint8_t *req = cmds[i].request;
+    const uint8_t *rep = cmds[i].reply;
+    int expect;
+    switch (req[1]) {
+      case NXT_OPCODE_BATTERYLEVEL:
+        expect = sizeof (ret_battery_t);
+        break;
+      case NXT_OPCODE_KEEPALIVE:
+        expect = sizeof (ret_keepalive_t);
+        break;
+      case NXT_OPCODE_GET_OUTPUTSTATE:
+        expect = sizeof (libnxtusb_outputstate_t);
+        break;
+      default:
+        expect = sizeof (libnxtusb_inputstate_t);
+    }
+    if (cmds[i].reply_length != expect || rep[0] != NXT_COMMAND_REPLY ||
+        rep[1] != req[1] || rep[2] != NXT_STATUS_OK) {
+      printf("reply %d: length %d (expected %d), %02x %02x %02x\n",
+             i, cmds[i].reply_length, expect, rep[0], rep[1], rep[2]);
+      return -1;
+    }
+    if (cmds[i].length == 3 && rep[3] != req[2]) {
+      printf("reply %d: port %u, expected %u\n", i, rep[3], req[2]);
+      return -1;
+    }
+    if (req[1] == NXT_OPCODE_BATTERYLEVEL && (rep[3] | rep[4] << 8) != 8000) {
+      printf("reply %d: battery %u mV\n", i, rep[3] | rep[4] << 8);
+      return -1;
+    }
+  }
+  return 0;
+}
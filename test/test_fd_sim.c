@@ -0,0 +1,98 @@
+// simulated brick served over a pty, the way a Bluetooth serial link
+// carries it: handle opens the slave tty by path (raw mode, write() path)
+// and all replies of a pipeline arrive with one read() and must be split
+// into packets by their length prefixes
+
+#define _XOPEN_SOURCE 600
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pipeline.h"
+
+// frames of every read are run on simulated brick, replies go back in one write
+static void *serve(void *arg) {
+  int fd = *(int*) arg;
+  libnxtusb_device_handle *sim = libnxtusb_open_sim(NULL);
+  unsigned char in[NXT_TCP_BUFFER], out[NXT_TCP_BUFFER];
+  unsigned int in_len = 0;
+  ssize_t n;
+
+  // read fails once slave side is closed
+  while (sim != NULL && (n = read(fd, in + in_len, sizeof (in) - in_len)) > 0) {
+    unsigned int pos = 0, out_len = 0;
+    in_len += n;
+    while (in_len - pos >= 2) {
+      unsigned int length = in[pos] | in[pos + 1] << 8;
+      if (in_len - pos < 2 + length) {
+        break;
+      }
+      int got = nxt_raw_command(sim, in + pos + 2, length, out + out_len + 2, NXT_PACKET_SIZE);
+      pos += 2 + length;
+      if (got > 0) {
+        out[out_len] = got & 0xff;
+        out[out_len + 1] = got >> 8;
+        out_len += 2 + got;
+      }
+    }
+    memmove(in, in + pos, in_len - pos);
+    in_len -= pos;
+    if (out_len > 0 && write(fd, out, out_len) != (ssize_t) out_len) {
+      break;
+    }
+  }
+  if (sim != NULL) {
+    libnxtusb_closenxt(sim);
+  }
+  return NULL;
+}
+
+int main(void) {
+  libnxtusb_raw_cmd_t cmds[PIPELINE_LENGTH];
+  libnxtusb_tcp_stats_t st;
+  pthread_t brick;
+  int ret = 1;
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 || ptsname(master) == NULL) {
+    printf("can't open pty\n");
+    return 1;
+  }
+  // slave must be open before brick reads master
+  libnxtusb_device_handle *handle = libnxtusb_open_bluetooth(ptsname(master));
+  if (handle == NULL) {
+    printf("can't open %s\n", ptsname(master));
+    return 1;
+  }
+  if (pthread_create(&brick, NULL, serve, &master) != 0) {
+    printf("can't start simulated brick\n");
+    return 1;
+  }
+  pipeline_build(cmds);
+  if (nxt_pipeline(handle, cmds, PIPELINE_LENGTH) != 0) {
+    printf("pipeline failed\n");
+  } else if (pipeline_check(cmds) == 0) {
+    nxt_tcp_stats(handle, &st);
+    printf("%llu packets in %llu writes, %llu replies in %llu reads\n",
+           (unsigned long long) st.packets_out, (unsigned long long) st.writes,
+           (unsigned long long) st.packets_in, (unsigned long long) st.reads);
+    if (st.packets_in == PIPELINE_LENGTH && st.reads == 1) {
+      ret = 0;
+    }
+  }
+  // closing slave ends the brick thread
+  libnxtusb_closenxt(handle);
+  pthread_join(brick, NULL);
+
+  // caller's fd has no path, so no reconnect
+  libnxtusb_device_handle *plain = libnxtusb_open_fd(master);
+  if (plain == NULL || nxt_set_reconnect(plain, 1000, NXT_RESTORE_ALL, NULL, NULL) == 0) {
+    printf("reconnect accepted on plain fd\n");
+    ret = 1;
+  }
+  if (plain != NULL) {
+    libnxtusb_closenxt(plain);
+  }
+  printf(ret == 0 ? "PASS\n" : "FAIL\n");
+  return ret;
+}
@@ -0,0 +1,88 @@
+// nxtproxy serving simulated brick over localhost: whole pipeline must go
+// out in one write and come back in one read
+
+#define _POSIX_C_SOURCE 200809L
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "pipeline.h"
+
+// free localhost port, bound and released again
+static unsigned short free_port(void) {
+  struct sockaddr_in sa;
+  socklen_t len = sizeof (sa);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  memset(&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || bind(fd, (struct sockaddr*) &sa, sizeof (sa)) != 0 ||
+      getsockname(fd, (struct sockaddr*) &sa, &len) != 0) {
+    return 0;
+  }
+  close(fd);
+  return ntohs(sa.sin_port);
+}
+
+int main(int argc, char **argv) {
+  libnxtusb_raw_cmd_t cmds[PIPELINE_LENGTH];
+  libnxtusb_tcp_stats_t before, after;
+  libnxtusb_device_handle *handle = NULL;
+  char port[8];
+  int i, ret = 1;
+
+  if (argc != 2) {
+    printf("usage: test_tcp_sim path/to/nxtproxy\n");
+    return 1;
+  }
+  unsigned short p = free_port();
+  snprintf(port, sizeof (port), "%u", p);
+  pid_t proxy = fork();
+  if (proxy == 0) {
+    execl(argv[1], "nxtproxy", "-S", "-b", "127.0.0.1", "-p", port, (char*) NULL);
+    _exit(127);
+  }
+  if (p == 0 || proxy < 0) {
+    printf("can't start nxtproxy\n");
+    return 1;
+  }
+  // proxy needs a moment to listen
+  for (i = 0; i < 500 && handle == NULL; i++) {
+    struct timespec ts = {0, 10000000L};
+    handle = libnxtusb_open_tcp("127.0.0.1", p);
+    if (handle == NULL) {
+      nanosleep(&ts, NULL);
+    }
+  }
+  if (handle == NULL) {
+    printf("can't connect to nxtproxy on port %s\n", port);
+  } else {
+    pipeline_build(cmds);
+    nxt_tcp_stats(handle, &before);
+    if (nxt_pipeline(handle, cmds, PIPELINE_LENGTH) != 0) {
+      printf("pipeline failed\n");
+    } else if (pipeline_check(cmds) == 0) {
+      nxt_tcp_stats(handle, &after);
+      printf("%llu packets in %llu writes, %llu replies in %llu reads\n",
+             (unsigned long long) (after.packets_out - before.packets_out),
+             (unsigned long long) (after.writes - before.writes),
+             (unsigned long long) (after.packets_in - before.packets_in),
+             (unsigned long long) (after.reads - before.reads));
+      if (after.packets_out - before.packets_out == PIPELINE_LENGTH &&
+          after.packets_in - before.packets_in == PIPELINE_LENGTH &&
+          after.writes - before.writes == 1 && after.reads - before.reads == 1) {
+        ret = 0;
+      }
+    }
+    libnxtusb_closenxt(handle);
+  }
+  kill(proxy, SIGTERM);
+  waitpid(proxy, NULL, 0);
+  printf(ret == 0 ? "PASS\n" : "FAIL\n");
+  return ret;
+}